@@ -53,6 +53,9 @@ bool icount_align_option;
 /* Do not count executed instructions */
 ICountMode use_icount = ICOUNT_DISABLED;
 
+/* One thread per vCPU, synchronized at quantum barriers */
+bool icount_parallel;
+
 static void icount_enable_precise(void)
 {
     /* Fixed conversion of insn to ns via "shift" option */
@@ -86,6 +89,11 @@ static void icount_update_locked(CPUState *cpu)
     int64_t executed = icount_get_executed(cpu);
     cpu->icount_budget -= executed;
 
+    if (icount_parallel) {
+        /* Other vCPUs must not see this before the quantum barrier */
+        cpu->icount_epoch_done += executed;
+        return;
+    }
     qatomic_set(&timers_state.qemu_icount,
                 timers_state.qemu_icount + executed);
 }
@@ -113,6 +121,15 @@ static int64_t icount_get_raw_locked(void)
             error_report("Bad icount read");
             exit(1);
         }
+        if (icount_parallel) {
+            /*
+             * A vCPU sees the count at the start of the quantum plus
+             * its own progress, never that of the other vCPUs.  This
+             * runs in readers too, so do not touch the shared count.
+             */
+            return qatomic_read(&timers_state.qemu_icount) +
+                   cpu->icount_epoch_done + icount_get_executed(cpu);
+        }
         /* Take into account what has run */
         icount_update_locked(cpu);
     }
@@ -120,6 +137,20 @@ static int64_t icount_get_raw_locked(void)
     return qatomic_read(&timers_state.qemu_icount);
 }
 
+/*
+ * Move the global count forward at the end of a quantum of parallel
+ * execution; the vCPUs' own progress is reset by the caller.
+ */
+void icount_advance(int64_t count)
+{
+    seqlock_write_lock(&timers_state.vm_clock_seqlock,
+                       &timers_state.vm_clock_lock);
+    qatomic_set(&timers_state.qemu_icount,
+                timers_state.qemu_icount + count);
+    seqlock_write_unlock(&timers_state.vm_clock_seqlock,
+                         &timers_state.vm_clock_lock);
+}
+
 static int64_t icount_get_locked(void)
 {
     int64_t icount = icount_get_raw_locked();
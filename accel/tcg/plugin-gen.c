@@ -248,6 +248,20 @@ static void gen_mem_cb(struct qemu_plugin_regular_cb *cb,
     tcg_temp_free_i32(clear_flags);
 }
 
+static void gen_mem_batch_cb(struct qemu_plugin_batch_cb *cb,
+                             qemu_plugin_meminfo_t meminfo, TCGv_i64 addr)
+{
+    TCGv_i32 cpu_index = gen_cpu_index();
+
+    tcg_gen_call5(qemu_plugin_vcpu_mem_batch_push, cb->info, NULL,
+                  tcgv_i32_temp(cpu_index),
+                  tcgv_i32_temp(tcg_constant_i32(meminfo)),
+                  tcgv_i64_temp(addr),
+                  tcgv_ptr_temp(tcg_constant_ptr(cb->queue)),
+                  tcgv_ptr_temp(tcg_constant_ptr(cb->userp)));
+    tcg_temp_free_i32(cpu_index);
+}
+
 static void inject_cb(struct qemu_plugin_dyn_cb *cb)
 
 {
@@ -279,6 +293,11 @@ static void inject_mem_cb(struct qemu_plugin_dyn_cb *cb,
             gen_mem_cb(&cb->regular, meminfo, addr);
         }
         break;
+    case PLUGIN_CB_MEM_BATCH:
+        if (rw & cb->batch.rw) {
+            gen_mem_batch_cb(&cb->batch, meminfo, addr);
+        }
+        break;
     case PLUGIN_CB_INLINE_ADD_U64:
     case PLUGIN_CB_INLINE_STORE_U64:
         if (rw & cb->inline_insn.rw) {
@@ -186,12 +186,34 @@ static int v_l2_levels;
 
 static void *l1_map[V_L1_MAX_SIZE];
 
+/*
+ * Each page is divided into 1 << PAGE_CODE_LINE_BITS equally sized lines
+ * (64 byte lines for 4KiB pages), and PageDesc.code_lines has bit N set
+ * if some TB of the page may contain code in line N. Writes that only
+ * touch lines without code do not need to lock the page and look for
+ * TBs to invalidate, which matters for guests that mix code and data
+ * within the same page.
+ */
+#define PAGE_CODE_LINE_BITS 6
+
 struct PageDesc {
     QemuSpin lock;
     /* list of TBs intersecting this ram page */
     uintptr_t first_tb;
+    /* lines of the page that may hold code; written with @lock held */
+    uint64_t code_lines;
 };
 
+static inline uint64_t page_code_lines(tb_page_addr_t start,
+                                       tb_page_addr_t last)
+{
+    int shift = TARGET_PAGE_BITS - PAGE_CODE_LINE_BITS;
+    unsigned first = (start & ~TARGET_PAGE_MASK) >> shift;
+    unsigned end = (last & ~TARGET_PAGE_MASK) >> shift;
+
+    return MAKE_64BIT_MASK(first, end - first + 1);
+}
+
 void page_table_config_init(void)
 {
     uint32_t v_l1_bits;
@@ -671,6 +693,7 @@ static void tb_remove_all_1(int level, void **lp)
         for (i = 0; i < V_L2_SIZE; ++i) {
             page_lock(&pd[i]);
             pd[i].first_tb = (uintptr_t)NULL;
+            qatomic_set(&pd[i].code_lines, 0);
             page_unlock(&pd[i]);
         }
     } else {
@@ -691,6 +714,27 @@ static void tb_remove_all(void)
     }
 }
 
+/*
+ * Return in [@pstart, @plast] the part of @tb that lies on its page @n.
+ * NOTE: this is subtle as a TB may span two physical pages.
+ */
+static void tb_page_extent(TranslationBlock *tb, unsigned int n,
+                           tb_page_addr_t *pstart, tb_page_addr_t *plast)
+{
+    tb_page_addr_t tb_start, tb_last;
+
+    tb_start = tb_page_addr0(tb);
+    tb_last = tb_start + tb->size - 1;
+    if (n == 0) {
+        tb_last = MIN(tb_last, tb_start | ~TARGET_PAGE_MASK);
+    } else {
+        tb_start = tb_page_addr1(tb);
+        tb_last = tb_start + (tb_last & ~TARGET_PAGE_MASK);
+    }
+    *pstart = tb_start;
+    *plast = tb_last;
+}
+
 /*
  * Add the tb in the target page and protect it if necessary.
  * Called with @p->lock held.
@@ -698,6 +742,7 @@ static void tb_remove_all(void)
 static void tb_page_add(PageDesc *p, TranslationBlock *tb, unsigned int n)
 {
     bool page_already_protected;
+    tb_page_addr_t tb_start, tb_last;
 
     assert_page_locked(p);
 
@@ -705,6 +750,10 @@ static void tb_page_add(PageDesc *p, TranslationBlock *tb, unsigned int n)
     page_already_protected = p->first_tb != 0;
     p->first_tb = (uintptr_t)tb | n;
 
+    tb_page_extent(tb, n, &tb_start, &tb_last);
+    qatomic_set(&p->code_lines,
+                p->code_lines | page_code_lines(tb_start, tb_last));
+
     /*
      * If some code is already present, then the pages are already
      * protected. So we handle the case where only the first TB is
@@ -740,6 +789,9 @@ static void tb_page_remove(PageDesc *pd, TranslationBlock *tb)
     PAGE_FOR_EACH_TB(unused, unused, pd, tb1, n1) {
         if (tb1 == tb) {
             *pprev = tb1->page_next[n1];
+            if (!pd->first_tb) {
+                qatomic_set(&pd->code_lines, 0);
+            }
             return;
         }
         pprev = &tb1->page_next[n1];
@@ -1119,6 +1171,7 @@ tb_invalidate_phys_page_range__locked(CPUState *cpu,
     PageForEachNext n;
     bool current_tb_modified = false;
     TranslationBlock *current_tb = NULL;
+    uint64_t code_lines = 0;
 
     /* Range may not cross a page. */
     tcg_debug_assert(((start ^ last) & TARGET_PAGE_MASK) == 0);
@@ -1134,16 +1187,11 @@ tb_invalidate_phys_page_range__locked(CPUState *cpu,
     PAGE_FOR_EACH_TB(start, last, p, tb, n) {
         tb_page_addr_t tb_start, tb_last;
 
-        /* NOTE: this is subtle as a TB may span two physical pages */
-        tb_start = tb_page_addr0(tb);
-        tb_last = tb_start + tb->size - 1;
-        if (n == 0) {
-            tb_last = MIN(tb_last, tb_start | ~TARGET_PAGE_MASK);
+        tb_page_extent(tb, n, &tb_start, &tb_last);
+        if (tb_last < start || tb_start > last) {
+            /* rebuild the line map from the surviving TBs */
+            code_lines |= page_code_lines(tb_start, tb_last);
         } else {
-            tb_start = tb_page_addr1(tb);
-            tb_last = tb_start + (tb_last & ~TARGET_PAGE_MASK);
-        }
-        if (!(tb_last < start || tb_start > last)) {
             if (unlikely(current_tb == tb) &&
                 (tb_cflags(current_tb) & CF_COUNT_MASK) != 1) {
                 /*
@@ -1159,6 +1207,7 @@ tb_invalidate_phys_page_range__locked(CPUState *cpu,
             tb_phys_invalidate__locked(tb);
         }
     }
+    qatomic_set(&p->code_lines, code_lines);
 
     /* if no code remaining, no need to continue to use slow writes */
     if (!p->first_tb) {
@@ -1215,9 +1264,15 @@ void tb_invalidate_phys_range_fast(CPUState *cpu, ram_addr_t start,
                                    unsigned len, uintptr_t ra)
 {
     PageDesc *p = page_find(start >> TARGET_PAGE_BITS);
+    ram_addr_t last = start + len - 1;
 
-    if (p) {
-        ram_addr_t last = start + len - 1;
+    /*
+     * Skip the page lock altogether if the write does not touch a line
+     * holding code. This is no less precise than taking the lock: we run
+     * before the store, so a translation racing with the write could see
+     * the old contents either way.
+     */
+    if (p && (qatomic_read(&p->code_lines) & page_code_lines(start, last))) {
         struct page_collection *pages = page_collection_lock(start, last);
 
         tb_invalidate_phys_page_range__locked(cpu, pages, p,
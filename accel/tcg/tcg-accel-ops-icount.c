@@ -29,6 +29,7 @@
 #include "qemu/main-loop.h"
 #include "qemu/guest-random.h"
 #include "hw/core/cpu.h"
+#include "system/cpus.h"
 
 #include "tcg-accel-ops.h"
 #include "tcg-accel-ops-icount.h"
@@ -158,3 +159,208 @@ void icount_handle_interrupt(CPUState *cpu, int mask)
         cpu_abort(cpu, "Raised interrupt while not in I/O function");
     }
 }
+
+/*
+ * Parallel icount
+ *
+ * With multi-threaded TCG every vCPU runs in its own thread for a
+ * quantum of instructions and then waits at a barrier until all other
+ * vCPUs have done the same.  Only the last vCPU to arrive moves
+ * QEMU_CLOCK_VIRTUAL forward, by exactly one quantum, and runs the
+ * expired timers of the main loop; interrupts that one vCPU raises for
+ * another are held back until that point as well.  Virtual time,
+ * main loop timers and cross-CPU interrupt delivery thus depend only on
+ * instruction counts, not on how the host schedules the vCPU threads.
+ * Timers of other AioContexts run in their own threads and are only
+ * notified.
+ *
+ * Halted or stopped vCPUs leave the barrier and join again at the end
+ * of the quantum in which they become runnable.  The state below is
+ * protected by the BQL; vCPUs wait for the barrier on their halt_cond.
+ */
+static struct {
+    uint32_t max_quantum;
+    int64_t quantum;
+    uint64_t generation;
+    unsigned members;
+    unsigned arrived;
+} icount_epoch;
+
+void icount_epoch_init(uint32_t quantum)
+{
+    icount_parallel = true;
+    icount_epoch.max_quantum = quantum;
+    icount_epoch.quantum = quantum;
+}
+
+static void icount_epoch_deliver_interrupts(void)
+{
+    CPUState *cpu;
+
+    /* in cpu_index order, so that the outcome does not depend on timing */
+    CPU_FOREACH(cpu) {
+        uint32_t mask = cpu->icount_deferred_irq;
+
+        if (mask) {
+            cpu->icount_deferred_irq = 0;
+            icount_handle_interrupt(cpu, mask);
+        }
+    }
+}
+
+/*
+ * Size of the next quantum.  Unlike icount_get_limit(), only the virtual
+ * timers of the main loop count: realtime timers would make quantum
+ * boundaries depend on wall clock time, and timers of other AioContexts
+ * are not run at the barrier anyway.  The expired main loop timers have
+ * just run, so the quantum is never empty.
+ */
+static int64_t icount_epoch_limit(void)
+{
+    int64_t deadline =
+        timerlist_deadline_ns(main_loop_tlg.tl[QEMU_CLOCK_VIRTUAL]);
+
+    if (deadline < 0) {
+        return icount_epoch.max_quantum;
+    }
+    return MAX(MIN(icount_round(deadline), icount_epoch.max_quantum), 1);
+}
+
+/* Called by the last vCPU to reach the barrier, with the BQL held. */
+static void icount_epoch_complete(void)
+{
+    CPUState *cpu;
+
+    icount_advance(icount_epoch.quantum);
+    CPU_FOREACH(cpu) {
+        cpu->icount_epoch_done = 0;
+    }
+
+    /*
+     * Run the expired main loop timers here, at the same instruction
+     * count on every run; the main loop cannot get to them first, as
+     * the clock only moves under the BQL that we hold.
+     */
+    qemu_clock_run_timers(QEMU_CLOCK_VIRTUAL);
+    qemu_clock_notify(QEMU_CLOCK_VIRTUAL);
+    icount_epoch_deliver_interrupts();
+
+    /* end the next quantum no later than the next timer deadline */
+    icount_epoch.quantum = icount_epoch_limit();
+    icount_epoch.arrived = 0;
+    icount_epoch.generation++;
+
+    CPU_FOREACH(cpu) {
+        if (cpu->icount_epoch_member) {
+            qemu_cond_broadcast(cpu->halt_cond);
+        }
+    }
+}
+
+static void icount_epoch_arrive(CPUState *cpu)
+{
+    cpu->icount_epoch_next = icount_epoch.generation + 1;
+    if (++icount_epoch.arrived == icount_epoch.members) {
+        icount_epoch_complete();
+    }
+}
+
+/*
+ * Called by the vCPU thread with the BQL held before processing events.
+ * A vCPU that is about to sleep or stop no longer holds up the others.
+ */
+void icount_epoch_leave_if_idle(CPUState *cpu)
+{
+    if (!cpu->icount_epoch_member ||
+        (!cpu_thread_is_idle(cpu) && cpu_can_run(cpu))) {
+        return;
+    }
+
+    cpu->icount_epoch_member = false;
+    icount_epoch.members--;
+    if (cpu->icount_epoch_next > icount_epoch.generation) {
+        icount_epoch.arrived--;
+    }
+
+    if (icount_epoch.members == 0) {
+        /* nobody left to reach a barrier */
+        icount_epoch_deliver_interrupts();
+    } else if (icount_epoch.arrived == icount_epoch.members) {
+        icount_epoch_complete();
+    }
+}
+
+/*
+ * Called by the vCPU thread with the BQL held.  Return true if the vCPU
+ * may run; otherwise wait for the barrier once and return false, so that
+ * the caller can process events before trying again.
+ */
+bool icount_epoch_wait(CPUState *cpu)
+{
+    if (!cpu->icount_epoch_member) {
+        cpu->icount_epoch_member = true;
+        cpu->icount_epoch_done = 0;
+        if (icount_epoch.members++ == 0) {
+            /* alone, start a new quantum right away */
+            icount_account_warp_timer();
+            icount_epoch.arrived = 0;
+            icount_epoch.generation++;
+            cpu->icount_epoch_next = icount_epoch.generation;
+            return true;
+        }
+        /* sit out the rest of the current quantum */
+        icount_epoch_arrive(cpu);
+    }
+
+    if (cpu->icount_epoch_next > icount_epoch.generation) {
+        qemu_cond_wait_bql(cpu->halt_cond);
+        return false;
+    }
+    return true;
+}
+
+/* Called without the BQL, before and after running the vCPU. */
+void icount_epoch_prepare_for_run(CPUState *cpu)
+{
+    int insns_left;
+
+    g_assert(cpu->neg.icount_decr.u16.low == 0);
+    g_assert(cpu->icount_extra == 0);
+
+    cpu->icount_budget = icount_epoch.quantum - cpu->icount_epoch_done;
+    insns_left = MIN(0xffff, cpu->icount_budget);
+    cpu->neg.icount_decr.u16.low = insns_left;
+    cpu->icount_extra = cpu->icount_budget - insns_left;
+}
+
+void icount_epoch_process_data(CPUState *cpu)
+{
+    icount_update(cpu);
+
+    cpu->neg.icount_decr.u16.low = 0;
+    cpu->icount_extra = 0;
+    cpu->icount_budget = 0;
+}
+
+/* Called by the vCPU thread with the BQL held, after running.  */
+void icount_epoch_account(CPUState *cpu)
+{
+    if (cpu->icount_epoch_done >= icount_epoch.quantum) {
+        icount_epoch_arrive(cpu);
+    }
+}
+
+void icount_epoch_handle_interrupt(CPUState *cpu, int mask)
+{
+    /*
+     * Hold back interrupts that a vCPU raises for another one until the
+     * barrier; the raising vCPU is guaranteed to get there.  Interrupts
+     * from devices outside the vCPU threads are delivered right away,
+     * as they are not deterministic anyway.
+     */
+    if (current_cpu && current_cpu != cpu && current_cpu->icount_epoch_member) {
+        cpu->icount_deferred_irq |= mask;
+        return;
+    }
+    icount_handle_interrupt(cpu, mask);
+}
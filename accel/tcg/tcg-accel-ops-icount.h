@@ -17,4 +17,12 @@ void icount_process_data(CPUState *cpu);
 
 void icount_handle_interrupt(CPUState *cpu, int mask);
 
+void icount_epoch_init(uint32_t quantum);
+void icount_epoch_leave_if_idle(CPUState *cpu);
+bool icount_epoch_wait(CPUState *cpu);
+void icount_epoch_prepare_for_run(CPUState *cpu);
+void icount_epoch_process_data(CPUState *cpu);
+void icount_epoch_account(CPUState *cpu);
+void icount_epoch_handle_interrupt(CPUState *cpu, int mask);
+
 #endif /* TCG_ACCEL_OPS_ICOUNT_H */
@@ -68,7 +68,6 @@ static void *mttcg_cpu_thread_fn(void *arg)
     CPUState *cpu = arg;
 
     assert(tcg_enabled());
-    g_assert(!icount_enabled());
 
     rcu_register_thread();
     force_rcu.notifier.notify = mttcg_force_rcu;
@@ -86,13 +85,29 @@ static void *mttcg_cpu_thread_fn(void *arg)
     qemu_guest_random_seed_thread_part2(cpu->random_seed);
 
     do {
+        if (icount_enabled()) {
+            icount_epoch_leave_if_idle(cpu);
+        }
         qemu_process_cpu_events(cpu);
 
         if (cpu_can_run(cpu)) {
             int r;
+
+            if (icount_enabled() && !icount_epoch_wait(cpu)) {
+                continue;
+            }
             bql_unlock();
-            r = tcg_cpu_exec(cpu);
+            if (icount_enabled()) {
+                icount_epoch_prepare_for_run(cpu);
+                r = tcg_cpu_exec(cpu);
+                icount_epoch_process_data(cpu);
+            } else {
+                r = tcg_cpu_exec(cpu);
+            }
             bql_lock();
+            if (icount_enabled()) {
+                icount_epoch_account(cpu);
+            }
             switch (r) {
             case EXCP_DEBUG:
                 cpu_handle_guest_debug(cpu);
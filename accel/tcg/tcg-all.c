@@ -40,6 +40,7 @@
 #include "hw/core/boards.h"
 #include "exec/tb-flush.h"
 #include "system/runstate.h"
+#include "tcg-accel-ops-icount.h"
 #endif
 #include "accel/accel-ops.h"
 #include "accel/accel-cpu-ops.h"
@@ -54,6 +55,7 @@ struct TCGState {
     bool one_insn_per_tb;
     int splitwx_enabled;
     unsigned long tb_size;
+    uint32_t icount_quantum;
 };
 typedef struct TCGState TCGState;
 
@@ -80,6 +82,7 @@ static void tcg_accel_instance_init(Object *obj)
 #else
     s->splitwx_enabled = 0;
 #endif
+    s->icount_quantum = 10000;
 }
 
 bool one_insn_per_tb;
@@ -144,6 +147,15 @@ static int tcg_init_machine(AccelState *as, MachineState *ms)
         g_assert_not_reached();
     }
 
+    if (s->mttcg_enabled == ON_OFF_AUTO_ON && icount_enabled()) {
+        if (replay_mode != REPLAY_MODE_NONE) {
+            error_report("record/replay is not supported with "
+                         "-accel tcg,thread=multi");
+            return -EINVAL;
+        }
+        icount_epoch_init(s->icount_quantum);
+    }
+
     qemu_add_vm_change_state_handler(tcg_vm_change_state, NULL);
 #endif
 
@@ -180,11 +192,7 @@ static void tcg_set_thread(Object *obj, const char *value, Error **errp)
     TCGState *s = TCG_STATE(obj);
 
     if (strcmp(value, "multi") == 0) {
-        if (icount_enabled()) {
-            error_setg(errp, "No MTTCG when icount is enabled");
-        } else {
-            s->mttcg_enabled = ON_OFF_AUTO_ON;
-        }
+        s->mttcg_enabled = ON_OFF_AUTO_ON;
     } else if (strcmp(value, "single") == 0) {
         s->mttcg_enabled = ON_OFF_AUTO_OFF;
     } else {
@@ -216,6 +224,34 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_icount_quantum(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->icount_quantum;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_icount_quantum(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value == 0) {
+        error_setg(errp, "icount-quantum must be greater than zero");
+        return;
+    }
+
+    s->icount_quantum = value;
+}
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -278,6 +314,13 @@ static void tcg_accel_class_init(ObjectClass *oc, const void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add(oc, "icount-quantum", "int",
+        tcg_get_icount_quantum, tcg_set_icount_quantum,
+        NULL, NULL);
+    object_class_property_set_description(oc, "icount-quantum",
+        "Instructions each vCPU runs between synchronization points "
+        "with icount and thread=multi");
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
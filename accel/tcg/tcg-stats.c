@@ -204,6 +204,11 @@ static void dump_exec_info(GString *buf)
 
     g_string_append_printf(buf, "\nStatistics:\n");
     tcg_dump_flush_info(buf);
+
+#ifdef CONFIG_TCI_PROFILE
+    g_string_append_printf(buf, "\nInterpreter profile:\n");
+    tci_dump_profile(buf);
+#endif
 }
 
 void tcg_get_stats(AccelState *accel, GString *buf)
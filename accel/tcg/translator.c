@@ -108,6 +108,17 @@ bool translator_is_same_page(const DisasContextBase *db, vaddr addr)
     return ((addr ^ db->pc_first) & TARGET_PAGE_MASK) == 0;
 }
 
+const void *translator_code_ptr(const DisasContextBase *db,
+                                vaddr addr, size_t len)
+{
+    if (tb_page_addr0(db->tb) == -1 ||
+        !translator_is_same_page(db, addr) ||
+        !translator_is_same_page(db, addr + len - 1)) {
+        return NULL;
+    }
+    return db->host_addr[0] + (addr - db->pc_first);
+}
+
 bool translator_use_goto_tb(DisasContextBase *db, vaddr dest)
 {
     /* Suppress goto_tb if requested. */
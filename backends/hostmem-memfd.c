@@ -28,6 +28,8 @@ struct HostMemoryBackendMemfd {
     bool hugetlb;
     uint64_t hugetlbsize;
     bool seal;
+    bool seal_set;
+    char *fd;
 };
 
 static bool
@@ -35,14 +37,36 @@ memfd_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
 {
     HostMemoryBackendMemfd *m = MEMORY_BACKEND_MEMFD(backend);
     g_autofree char *name = host_memory_backend_get_name(backend);
-    int fd = cpr_find_fd(name, 0);
-    uint32_t ram_flags;
+    uint32_t ram_flags = 0;
+    int fd;
 
     if (!backend->size) {
         error_setg(errp, "can't create backend with size 0");
         return false;
     }
 
+    if (m->fd) {
+        /* the memfd was created by someone else */
+        if (m->hugetlb || m->hugetlbsize || m->seal_set) {
+            error_setg(errp, "'hugetlb', 'hugetlbsize' and 'seal' cannot "
+                       "be used together with 'fd'");
+            return false;
+        }
+
+        /*
+         * Another process can map this memfd too, so with share=on it is
+         * as good as a named file: x-ignore-shared leaves it out of the
+         * migration stream.
+         */
+        fd = cpr_get_fd_param(name, m->fd, 0, errp);
+        if (fd < 0) {
+            return false;
+        }
+        ram_flags |= RAM_NAMED_FILE;
+        goto have_fd;
+    }
+
+    fd = cpr_find_fd(name, 0);
     if (fd >= 0) {
         goto have_fd;
     }
@@ -58,7 +82,7 @@ memfd_backend_memory_alloc(HostMemoryBackend *backend, Error **errp)
 
 have_fd:
     backend->aligned = true;
-    ram_flags = backend->share ? RAM_SHARED : RAM_PRIVATE;
+    ram_flags |= backend->share ? RAM_SHARED : RAM_PRIVATE;
     ram_flags |= backend->reserve ? 0 : RAM_NORESERVE;
     ram_flags |= backend->guest_memfd ? RAM_GUEST_MEMFD : 0;
     return memory_region_init_ram_from_fd(&backend->mr, OBJECT(backend), name,
@@ -120,6 +144,27 @@ static void
 memfd_backend_set_seal(Object *o, bool value, Error **errp)
 {
     MEMORY_BACKEND_MEMFD(o)->seal = value;
+    MEMORY_BACKEND_MEMFD(o)->seal_set = true;
+}
+
+static char *
+memfd_backend_get_fd(Object *o, Error **errp)
+{
+    return g_strdup(MEMORY_BACKEND_MEMFD(o)->fd);
+}
+
+static void
+memfd_backend_set_fd(Object *o, const char *str, Error **errp)
+{
+    HostMemoryBackendMemfd *m = MEMORY_BACKEND_MEMFD(o);
+
+    if (host_memory_backend_mr_inited(MEMORY_BACKEND(o))) {
+        error_setg(errp, "cannot change property 'fd' of %s",
+                   object_get_typename(o));
+        return;
+    }
+    g_free(m->fd);
+    m->fd = g_strdup(str);
 }
 
 static void
@@ -132,6 +177,12 @@ memfd_backend_instance_init(Object *obj)
     MEMORY_BACKEND(m)->share = true;
 }
 
+static void
+memfd_backend_instance_finalize(Object *obj)
+{
+    g_free(MEMORY_BACKEND_MEMFD(obj)->fd);
+}
+
 static void
 memfd_backend_class_init(ObjectClass *oc, const void *data)
 {
@@ -157,12 +208,18 @@ memfd_backend_class_init(ObjectClass *oc, const void *data)
                                    memfd_backend_set_seal);
     object_class_property_set_description(oc, "seal",
                                           "Seal growing & shrinking");
+    object_class_property_add_str(oc, "fd",
+                                  memfd_backend_get_fd,
+                                  memfd_backend_set_fd);
+    object_class_property_set_description(oc, "fd",
+                                          "Existing memfd to map");
 }
 
 static const TypeInfo memfd_backend_info = {
     .name = TYPE_MEMORY_BACKEND_MEMFD,
     .parent = TYPE_MEMORY_BACKEND,
     .instance_init = memfd_backend_instance_init,
+    .instance_finalize = memfd_backend_instance_finalize,
     .class_init = memfd_backend_class_init,
     .instance_size = sizeof(HostMemoryBackendMemfd),
 };
@@ -422,6 +422,8 @@ BlockDriverState *bdrv_new(void)
     }
     qemu_mutex_init(&bs->reqs_lock);
     qemu_mutex_init(&bs->dirty_bitmap_mutex);
+    qemu_mutex_init(&bs->merge.lock);
+    QLIST_INIT(&bs->merge.batches);
     bs->refcnt = 1;
     bs->aio_context = qemu_get_aio_context();
 
@@ -1124,6 +1126,22 @@ static BlockdevDetectZeroesOptions bdrv_parse_detect_zeroes(QemuOpts *opts,
     return detect_zeroes;
 }
 
+/* Upper bound for the merge-window option, in microseconds */
+#define BDRV_MERGE_WINDOW_MAX_US    100000
+
+static uint64_t bdrv_parse_merge_window(QemuOpts *opts, Error **errp)
+{
+    uint64_t window_us = qemu_opt_get_number_del(opts, BDRV_OPT_MERGE_WINDOW,
+                                                 0);
+
+    if (window_us > BDRV_MERGE_WINDOW_MAX_US) {
+        error_setg(errp, "merge-window must not exceed %d microseconds",
+                   BDRV_MERGE_WINDOW_MAX_US);
+        return 0;
+    }
+    return window_us * SCALE_US;
+}
+
 /**
  * Set open flags for aio engine
  *
@@ -1847,6 +1865,12 @@ QemuOptsList bdrv_runtime_opts = {
             .type = QEMU_OPT_BOOL,
             .help = "always accept other writers (default: off)",
         },
+        {
+            .name = BDRV_OPT_MERGE_WINDOW,
+            .type = QEMU_OPT_NUMBER,
+            .help = "hold requests back for up to this many microseconds "
+                    "to merge adjacent ones (default: 0)",
+        },
         { /* end of list */ }
     },
 };
@@ -1993,6 +2017,13 @@ static int bdrv_open_common(BlockDriverState *bs, BlockBackend *file,
         goto fail_opts;
     }
 
+    bs->merge.window_ns = bdrv_parse_merge_window(opts, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        ret = -EINVAL;
+        goto fail_opts;
+    }
+
     if (filename != NULL) {
         pstrcpy(bs->filename, sizeof(bs->filename), filename);
     } else {
@@ -4318,7 +4349,7 @@ static int bdrv_reset_options_allowed(BlockDriverState *bs,
      * in bdrv_reopen_prepare() so they can be left out of @new_opts */
     const char *const common_options[] = {
         "node-name", "discard", "cache.direct", "cache.no-flush",
-        "read-only", "auto-read-only", "detect-zeroes", NULL
+        "read-only", "auto-read-only", "detect-zeroes", "merge-window", NULL
     };
 
     for (e = qdict_first(bs->options); e; e = qdict_next(bs->options, e)) {
@@ -4921,6 +4952,13 @@ bdrv_reopen_prepare(BDRVReopenState *reopen_state, BlockReopenQueue *queue,
         goto error;
     }
 
+    reopen_state->merge_window_ns = bdrv_parse_merge_window(opts, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        ret = -EINVAL;
+        goto error;
+    }
+
     /* All other options (including node-name and driver) must be unchanged.
      * Put them back into the QDict, so that they are checked at the end
      * of this function. */
@@ -5124,6 +5162,7 @@ static void GRAPH_UNLOCKED bdrv_reopen_commit(BDRVReopenState *reopen_state)
     bs->options            = reopen_state->options;
     bs->open_flags         = reopen_state->flags;
     bs->detect_zeroes      = reopen_state->detect_zeroes;
+    qatomic_set(&bs->merge.window_ns, reopen_state->merge_window_ns);
 
     /* Remove child references from bs->options and bs->explicit_options.
      * Child options were already removed in bdrv_reopen_queue_child() */
@@ -5564,6 +5603,7 @@ static void bdrv_delete(BlockDriverState *bs)
     bdrv_close(bs);
 
     qemu_mutex_destroy(&bs->reqs_lock);
+    qemu_mutex_destroy(&bs->merge.lock);
 
     g_free(bs);
 }
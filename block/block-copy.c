@@ -36,6 +36,11 @@
 #define BLOCK_COPY_SLICE_TIME 100000000ULL /* ns */
 #define BLOCK_COPY_CLUSTER_SIZE_DEFAULT (1 << 16)
 
+/* Adaptive number of tasks in flight, see block_copy_tune_workers() */
+#define BLOCK_COPY_INITIAL_WORKERS 4
+#define BLOCK_COPY_TUNE_INTERVAL_NS (100 * SCALE_MS)
+#define BLOCK_COPY_TARGET_LATENCY_NS (50 * SCALE_MS)
+
 typedef enum {
     COPY_READ_WRITE_CLUSTER,
     COPY_READ_WRITE,
@@ -58,6 +63,8 @@ typedef struct BlockCopyCallState {
     void *cb_opaque;
     /* Coroutine where async block-copy is running */
     Coroutine *co;
+    /* Adapt the number of tasks in flight, up to @max_workers */
+    bool tune_workers;
 
     /* Fields whose state changes throughout the execution */
     bool finished; /* atomic */
@@ -66,6 +73,26 @@ typedef struct BlockCopyCallState {
     /* To reference all call states from BlockCopyState */
     QLIST_ENTRY(BlockCopyCallState) list;
 
+    /*
+     * Number of tasks that may be in flight and the state of the
+     * controller that adapts it.  Only accessed by the coroutine running
+     * block_copy_common().
+     */
+    int workers;
+    bool slow_start;
+    int64_t tune_start_ns;
+    uint64_t prev_bandwidth;
+    uint64_t min_latency;
+    int prev_workers;
+
+    /*
+     * Completed tasks since the last adjustment of @workers.
+     * Protected by lock in BlockCopyState.
+     */
+    uint64_t tune_tasks;
+    uint64_t tune_bytes;
+    uint64_t tune_latency_ns;
+
     /*
      * Fields that report information about return values and errors.
      * Protected by lock in BlockCopyState.
@@ -584,6 +611,7 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
     BlockCopyState *s = t->s;
     bool error_is_read = false;
     BlockCopyMethod method = t->method;
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     int ret = -1;
 
     WITH_GRAPH_RDLOCK_GUARD() {
@@ -604,6 +632,11 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
         } else if (s->progress) {
             progress_work_done(s->progress, t->req.bytes);
         }
+
+        t->call_state->tune_tasks++;
+        t->call_state->tune_bytes += t->req.bytes;
+        t->call_state->tune_latency_ns +=
+            qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns;
     }
     co_put_to_shres(s->mem, t->req.bytes);
     block_copy_task_end(t, ret);
@@ -619,22 +652,58 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
     return ret;
 }
 
+/*
+ * The last block status extent returned for a block_copy_dirty_clusters()
+ * run.  Tasks are created in increasing offset order, so asking about the
+ * whole remaining range once answers the query of many tasks.
+ *
+ * The data of an area does not change while it is dirty in copy_bitmap
+ * (writes to the source copy it out first), so a cached extent stays valid
+ * for every task that is created later in it.
+ */
+typedef struct BlockCopyStatusCache {
+    int64_t offset;
+    int64_t end;
+    bool skip_unallocated;
+    int ret;
+} BlockCopyStatusCache;
+
 static coroutine_fn GRAPH_RDLOCK
-int block_copy_block_status(BlockCopyState *s, int64_t offset, int64_t bytes,
+int block_copy_block_status(BlockCopyState *s, BlockCopyStatusCache *cache,
+                            int64_t offset, int64_t bytes, int64_t query_end,
                             int64_t *pnum)
 {
-    int64_t num;
+    int64_t num = 0;
     BlockDriverState *base;
+    bool skip_unallocated = qatomic_read(&s->skip_unallocated);
     int ret;
 
-    if (qatomic_read(&s->skip_unallocated)) {
-        base = bdrv_backing_chain_next(s->source->bs);
+    if (offset >= cache->offset && offset < cache->end &&
+        skip_unallocated == cache->skip_unallocated) {
+        ret = cache->ret;
+        num = cache->end - offset;
     } else {
-        base = NULL;
+        if (skip_unallocated) {
+            base = bdrv_backing_chain_next(s->source->bs);
+        } else {
+            base = NULL;
+        }
+
+        ret = bdrv_co_block_status_above(s->source->bs, base, offset,
+                                         MAX(query_end - offset, bytes), &num,
+                                         NULL, NULL);
+        trace_block_copy_block_status(s, offset, num, ret);
+        if (ret >= 0) {
+            *cache = (BlockCopyStatusCache) {
+                .offset = offset,
+                .end = offset + num,
+                .skip_unallocated = skip_unallocated,
+                .ret = ret,
+            };
+        }
     }
 
-    ret = bdrv_co_block_status_above(s->source->bs, base, offset, bytes, &num,
-                                     NULL, NULL);
+    num = MIN(num, bytes);
     if (ret < 0 || num < s->cluster_size) {
         /*
          * On error or if failed to obtain large enough chunk just fallback to
@@ -736,6 +805,70 @@ int64_t coroutine_fn block_copy_reset_unallocated(BlockCopyState *s,
     return ret;
 }
 
+/*
+ * Adjust the number of tasks in flight once per BLOCK_COPY_TUNE_INTERVAL_NS.
+ *
+ * More tasks in flight hide the round trips of each task, until the source
+ * or target is saturated and additional tasks only queue up.  Grow the
+ * number of workers as long as that improves the bandwidth, doubling it
+ * at first, and back off when it does not or when tasks queue up: that is
+ * when the average latency of a task goes above BLOCK_COPY_TARGET_LATENCY_NS
+ * and above twice the lowest average seen so far, so that slow links still
+ * get enough tasks in flight.
+ */
+static void coroutine_fn block_copy_tune_workers(BlockCopyCallState *call_state,
+                                                 AioTaskPool *aio)
+{
+    BlockCopyState *s = call_state->s;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t elapsed = now - call_state->tune_start_ns;
+    uint64_t bandwidth, latency;
+    int workers = call_state->workers;
+
+    if (elapsed < BLOCK_COPY_TUNE_INTERVAL_NS) {
+        return;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        if (!call_state->tune_tasks) {
+            return;
+        }
+        /* bytes per second, @elapsed is at least 100 ms */
+        bandwidth = muldiv64(call_state->tune_bytes, 1000, elapsed / SCALE_MS);
+        latency = call_state->tune_latency_ns / call_state->tune_tasks;
+        call_state->tune_tasks = 0;
+        call_state->tune_bytes = 0;
+        call_state->tune_latency_ns = 0;
+    }
+    call_state->tune_start_ns = now;
+    call_state->min_latency = MIN(call_state->min_latency, latency);
+
+    if (latency > BLOCK_COPY_TARGET_LATENCY_NS &&
+        latency > call_state->min_latency * 2) {
+        call_state->slow_start = false;
+        workers = MAX(workers * 3 / 4, 1);
+    } else if (workers > call_state->prev_workers &&
+               bandwidth < call_state->prev_bandwidth +
+                           call_state->prev_bandwidth / 16) {
+        /* The last increase did not buy anything, undo it */
+        call_state->slow_start = false;
+        workers = call_state->prev_workers;
+    } else if (call_state->slow_start) {
+        workers = MIN(workers * 2, call_state->max_workers);
+    } else {
+        workers = MIN(workers + 1, call_state->max_workers);
+    }
+
+    trace_block_copy_tune_workers(s, call_state->workers, workers, bandwidth,
+                                  latency);
+    call_state->prev_workers = call_state->workers;
+    call_state->prev_bandwidth = bandwidth;
+    call_state->workers = workers;
+    if (aio) {
+        aio_task_pool_set_max_busy_tasks(aio, workers);
+    }
+}
+
 /*
  * block_copy_dirty_clusters
  *
@@ -754,6 +887,7 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
     bool found_dirty = false;
     int64_t end = offset + bytes;
     AioTaskPool *aio = NULL;
+    BlockCopyStatusCache status_cache = { 0 };
 
     /*
      * block_copy() user is responsible for keeping source and target in same
@@ -782,8 +916,8 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
 
         found_dirty = true;
 
-        ret = block_copy_block_status(s, task->req.offset, task->req.bytes,
-                                      &status_bytes);
+        ret = block_copy_block_status(s, &status_cache, task->req.offset,
+                                      task->req.bytes, end, &status_bytes);
         assert(ret >= 0); /* never fail */
         if (status_bytes < task->req.bytes) {
             block_copy_task_shrink(task, status_bytes);
@@ -821,8 +955,11 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
         offset = task_end(task);
         bytes = end - offset;
 
+        if (call_state->tune_workers) {
+            block_copy_tune_workers(call_state, aio);
+        }
         if (!aio && bytes) {
-            aio = aio_task_pool_new(call_state->max_workers);
+            aio = aio_task_pool_new(call_state->workers);
         }
 
         ret = block_copy_task_run(aio, task);
@@ -950,6 +1087,7 @@ int coroutine_fn block_copy(BlockCopyState *s, int64_t start, int64_t bytes,
         .bytes = bytes,
         .ignore_ratelimit = ignore_ratelimit,
         .max_workers = BLOCK_COPY_MAX_WORKERS,
+        .workers = BLOCK_COPY_MAX_WORKERS,
         .cb = cb,
         .cb_opaque = cb_opaque,
     };
@@ -986,6 +1124,12 @@ BlockCopyCallState *block_copy_async(BlockCopyState *s,
         .cb = cb,
         .cb_opaque = cb_opaque,
 
+        .tune_workers = max_workers > 1,
+        .workers = MIN(max_workers, BLOCK_COPY_INITIAL_WORKERS),
+        .slow_start = true,
+        .min_latency = UINT64_MAX,
+        .tune_start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME),
+
         .co = qemu_coroutine_create(block_copy_async_co_entry, call_state),
     };
 
@@ -0,0 +1,1490 @@
+/*
+ * cache filter driver
+ *
+ * Keeps copies of the most frequently read clusters of the filtered node
+ * in host RAM or in a node on fast local storage.  A missed cluster only
+ * replaces the least recently used one if it was read more often, as
+ * estimated by a count-min sketch (TinyLFU admission), so that scans do
+ * not flush the cache.
+ *
+ * In write-back mode, writes to cached clusters only update the cache
+ * and mark the cluster dirty; dirty clusters are written to the filtered
+ * node on flush.  All other writes go to the filtered node and drop the
+ * cached copies of the clusters they touch.
+ *
+ * With a cache-file and persistent=on, the cluster index is saved on
+ * close so that the cache is warm after a restart.  The layout of the cache-file is a
+ * header, the index (one big-endian entry per slot, cluster number + 1
+ * or 0 for a free slot) at CACHE_INDEX_OFFSET and the cached clusters,
+ * one per slot, from the first cluster aligned offset after the index.
+ * The header is marked clean only after the index was written, so an
+ * index left behind by a crash is never trusted.  It also identifies the
+ * filtered node by checksums of its filename and of its first cluster, so
+ * that an index is not applied to another image.
+ *
+ * Copyright (c) 2026 the Oro Operating System Project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+
+#include "qapi/error.h"
+#include "qapi/qapi-types-block-core.h"
+#include "qapi/util.h"
+#include "qemu/bswap.h"
+#include "qemu/coroutine.h"
+#include "qemu/crc32c.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/host-utils.h"
+#include "qemu/lockable.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/queue.h"
+#include "qemu/units.h"
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "trace.h"
+
+#define CACHE_MAGIC             0x51454d5543414348ULL   /* "QEMUCACH" */
+#define CACHE_VERSION           2
+#define CACHE_HEADER_CLEAN      (1 << 0)
+#define CACHE_INDEX_OFFSET      4096
+
+#define CACHE_MIN_CLUSTER_SIZE  (4 * KiB)
+#define CACHE_MAX_CLUSTER_SIZE  (2 * MiB)
+
+/* Rows of the frequency sketch, and the value its counters saturate at */
+#define CACHE_SKETCH_DEPTH      4
+#define CACHE_SKETCH_MAX        15
+
+/* Number of LRU entries looked at to find a slot that can be evicted */
+#define CACHE_VICTIM_SCAN       8
+
+typedef struct CacheHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t flags;
+    uint64_t cluster_size;
+    uint64_t nb_slots;
+    uint64_t image_size;
+    uint32_t image_name_crc;
+    uint32_t image_data_crc;
+    uint64_t index_offset;
+    uint64_t data_offset;
+} QEMU_PACKED CacheHeader;
+
+typedef struct CacheSlot {
+    /* Cluster of the filtered node held by this slot, -1 if free */
+    int64_t cluster;
+
+    /* Requests using the slot; a referenced slot is never evicted */
+    unsigned refcnt;
+
+    /* Being read from the filtered node, not valid yet */
+    bool filling;
+
+    /* Overwritten in the filtered node, dropped once unreferenced */
+    bool stale;
+
+    /* Newer than the filtered node (write-back mode only) */
+    bool dirty;
+
+    /* Bumped on every write to a dirty slot, see cache_co_writeback() */
+    uint64_t dirty_gen;
+
+    /* In the LRU list if the slot is used, in the free list otherwise */
+    QTAILQ_ENTRY(CacheSlot) next;
+    QTAILQ_ENTRY(CacheSlot) dirty_next;
+} CacheSlot;
+
+typedef struct BDRVCacheState {
+    BdrvChild *cache_file;
+    uint8_t *ram;
+
+    uint64_t cluster_size;
+    uint64_t nb_slots;
+    uint64_t data_offset;
+    BlockdevCacheFilterMode mode;
+    bool persistent;
+
+    /* Identity of the filtered node, see cache_update_image_id() */
+    uint32_t image_name_crc;
+    uint32_t image_data_crc;
+
+    /* Writes fall back to write-through beyond this many dirty slots */
+    uint64_t max_dirty;
+
+    /* Serializes cache_co_writeback() */
+    CoMutex writeback_lock;
+
+    /*
+     * Protects everything below.  Only held for bookkeeping, never
+     * across I/O, so requests from several iothreads can share it.
+     */
+    QemuMutex lock;
+    int64_t image_size;
+    CacheSlot *slots;
+    GHashTable *index;
+    QTAILQ_HEAD(, CacheSlot) lru;
+    QTAILQ_HEAD(, CacheSlot) free;
+    QTAILQ_HEAD(, CacheSlot) dirty;
+    uint64_t nb_used;
+    uint64_t nb_dirty;
+
+    uint8_t *sketch;
+    uint64_t sketch_mask;
+    uint64_t sketch_additions;
+    uint64_t sketch_reset;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t admissions;
+    uint64_t rejections;
+    uint64_t evictions;
+} BDRVCacheState;
+
+typedef enum CacheWriteType {
+    CACHE_WRITE,
+    CACHE_WRITE_ZEROES,
+    CACHE_DISCARD,
+} CacheWriteType;
+
+#define CACHE_OPT_SIZE          "size"
+#define CACHE_OPT_CLUSTER_SIZE  "cluster-size"
+#define CACHE_OPT_MODE          "mode"
+#define CACHE_OPT_PERSISTENT    "persistent"
+static QemuOptsList runtime_opts = {
+    .name = "cache",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = CACHE_OPT_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "cache capacity, defaults to the size of cache-file",
+        },
+        {
+            .name = CACHE_OPT_CLUSTER_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "caching granularity, default 64k",
+        },
+        {
+            .name = CACHE_OPT_MODE,
+            .type = QEMU_OPT_STRING,
+            .help = "write policy (write-through, write-back)",
+        },
+        {
+            .name = CACHE_OPT_PERSISTENT,
+            .type = QEMU_OPT_BOOL,
+            .help = "save the index of cache-file on close",
+        },
+        { /* end of list */ }
+    },
+};
+
+static inline uint64_t cache_slot_index(BDRVCacheState *s, CacheSlot *slot)
+{
+    return slot - s->slots;
+}
+
+static inline uint64_t cache_slot_offset(BDRVCacheState *s, CacheSlot *slot)
+{
+    return s->data_offset + cache_slot_index(s, slot) * s->cluster_size;
+}
+
+static inline uint8_t *cache_slot_ram(BDRVCacheState *s, CacheSlot *slot)
+{
+    return s->ram + cache_slot_index(s, slot) * s->cluster_size;
+}
+
+static uint64_t cache_data_offset(uint64_t nb_slots, uint64_t cluster_size)
+{
+    return ROUND_UP(CACHE_INDEX_OFFSET + nb_slots * sizeof(uint64_t),
+                    cluster_size);
+}
+
+/* Frequency sketch */
+
+static uint64_t cache_sketch_pos(BDRVCacheState *s, int64_t cluster, int row)
+{
+    static const uint64_t seeds[CACHE_SKETCH_DEPTH] = {
+        0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL,
+        0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL,
+    };
+    uint64_t h = (cluster + 1) * seeds[row];
+
+    h ^= h >> 31;
+    return row * (s->sketch_mask + 1) + (h & s->sketch_mask);
+}
+
+static unsigned cache_sketch_estimate(BDRVCacheState *s, int64_t cluster)
+{
+    unsigned min = CACHE_SKETCH_MAX;
+    int row;
+
+    for (row = 0; row < CACHE_SKETCH_DEPTH; row++) {
+        min = MIN(min, s->sketch[cache_sketch_pos(s, cluster, row)]);
+    }
+    return min;
+}
+
+/*
+ * Count one access to @cluster.  Only the smallest counters are
+ * incremented (conservative update), and all counters are halved
+ * periodically so that clusters that were hot long ago fade out.
+ */
+static void cache_sketch_add(BDRVCacheState *s, int64_t cluster)
+{
+    unsigned min = cache_sketch_estimate(s, cluster);
+    uint64_t i;
+    int row;
+
+    if (min < CACHE_SKETCH_MAX) {
+        for (row = 0; row < CACHE_SKETCH_DEPTH; row++) {
+            uint8_t *c = &s->sketch[cache_sketch_pos(s, cluster, row)];
+
+            if (*c == min) {
+                (*c)++;
+            }
+        }
+    }
+
+    if (++s->sketch_additions >= s->sketch_reset) {
+        for (i = 0; i < CACHE_SKETCH_DEPTH * (s->sketch_mask + 1); i++) {
+            s->sketch[i] >>= 1;
+        }
+        s->sketch_additions = 0;
+    }
+}
+
+/* Slot management, all called with s->lock held */
+
+static void cache_remove_slot_locked(BDRVCacheState *s, CacheSlot *slot)
+{
+    assert(!slot->refcnt && !slot->dirty);
+
+    g_hash_table_remove(s->index, &slot->cluster);
+    QTAILQ_REMOVE(&s->lru, slot, next);
+    slot->cluster = -1;
+    slot->stale = false;
+    QTAILQ_INSERT_TAIL(&s->free, slot, next);
+    s->nb_used--;
+}
+
+static void cache_insert_slot_locked(BDRVCacheState *s, CacheSlot *slot,
+                                     int64_t cluster)
+{
+    slot->cluster = cluster;
+    g_hash_table_insert(s->index, &slot->cluster, slot);
+    QTAILQ_INSERT_TAIL(&s->lru, slot, next);
+    s->nb_used++;
+}
+
+static void cache_unref_slot_locked(BDRVCacheState *s, CacheSlot *slot)
+{
+    assert(slot->refcnt > 0);
+    if (--slot->refcnt == 0 && slot->stale && !slot->dirty) {
+        cache_remove_slot_locked(s, slot);
+    }
+}
+
+/*
+ * Drop the cached copy of @slot once it is unused.  Dirty slots are kept,
+ * their content is newer than the filtered node.
+ */
+static void cache_drop_slot_locked(BDRVCacheState *s, CacheSlot *slot)
+{
+    if (slot->dirty) {
+        return;
+    }
+    if (slot->refcnt || slot->filling) {
+        slot->stale = true;
+    } else {
+        cache_remove_slot_locked(s, slot);
+    }
+}
+
+static void cache_put_slot(BDRVCacheState *s, CacheSlot *slot, bool drop)
+{
+    QEMU_LOCK_GUARD(&s->lock);
+
+    slot->filling = false;
+    if (drop && !slot->dirty) {
+        slot->stale = true;
+    }
+    cache_unref_slot_locked(s, slot);
+}
+
+/*
+ * Find a slot for @cluster, which just missed.  Returns NULL if the
+ * cluster is not admitted to the cache.
+ */
+static CacheSlot *cache_admit_locked(BlockDriverState *bs, int64_t cluster)
+{
+    BDRVCacheState *s = bs->opaque;
+    CacheSlot *slot = QTAILQ_FIRST(&s->free);
+    int64_t victim = -1;
+    int scanned = 0;
+
+    if (slot) {
+        QTAILQ_REMOVE(&s->free, slot, next);
+    } else {
+        QTAILQ_FOREACH(slot, &s->lru, next) {
+            if (!slot->refcnt && !slot->filling && !slot->dirty) {
+                break;
+            }
+            if (++scanned == CACHE_VICTIM_SCAN) {
+                slot = NULL;
+                break;
+            }
+        }
+        if (!slot || cache_sketch_estimate(s, cluster) <=
+                     cache_sketch_estimate(s, slot->cluster)) {
+            s->rejections++;
+            return NULL;
+        }
+
+        victim = slot->cluster;
+        cache_remove_slot_locked(s, slot);
+        QTAILQ_REMOVE(&s->free, slot, next);
+        s->evictions++;
+    }
+
+    trace_cache_admit(bs, cluster, victim);
+    slot->filling = true;
+    slot->refcnt = 1;
+    cache_insert_slot_locked(s, slot, cluster);
+    s->admissions++;
+    return slot;
+}
+
+/*
+ * Returns the slot to read @cluster from, with a reference held, or NULL
+ * if the read must go to the filtered node.  Sets @fill if the slot was
+ * just allocated and must be filled by the caller.
+ */
+static CacheSlot *cache_get_read_slot(BlockDriverState *bs, int64_t cluster,
+                                      bool *fill)
+{
+    BDRVCacheState *s = bs->opaque;
+    CacheSlot *slot;
+
+    QEMU_LOCK_GUARD(&s->lock);
+
+    cache_sketch_add(s, cluster);
+    slot = g_hash_table_lookup(s->index, &cluster);
+    if (slot) {
+        if (slot->filling || slot->stale) {
+            s->misses++;
+            return NULL;
+        }
+        QTAILQ_REMOVE(&s->lru, slot, next);
+        QTAILQ_INSERT_TAIL(&s->lru, slot, next);
+        slot->refcnt++;
+        s->hits++;
+        *fill = false;
+        return slot;
+    }
+
+    s->misses++;
+    *fill = true;
+    return cache_admit_locked(bs, cluster);
+}
+
+/*
+ * Returns the slot that a write to @cluster must go to, with a reference
+ * held, or NULL if the write goes to the filtered node.  Dirty slots
+ * always take writes; clean ones only with @make_dirty in write-back
+ * mode.
+ */
+static CacheSlot *cache_get_write_slot(BDRVCacheState *s, int64_t cluster,
+                                       bool make_dirty)
+{
+    CacheSlot *slot;
+
+    QEMU_LOCK_GUARD(&s->lock);
+
+    slot = g_hash_table_lookup(s->index, &cluster);
+    if (!slot || slot->filling || slot->stale) {
+        return NULL;
+    }
+    if (!slot->dirty) {
+        if (!make_dirty || s->mode != BLOCKDEV_CACHE_FILTER_MODE_WRITE_BACK ||
+            s->nb_dirty >= s->max_dirty) {
+            return NULL;
+        }
+        slot->dirty = true;
+        QTAILQ_INSERT_TAIL(&s->dirty, slot, dirty_next);
+        s->nb_dirty++;
+    }
+    slot->refcnt++;
+    return slot;
+}
+
+static void cache_put_write_slot(BDRVCacheState *s, CacheSlot *slot)
+{
+    QEMU_LOCK_GUARD(&s->lock);
+
+    slot->dirty_gen++;
+    cache_unref_slot_locked(s, slot);
+}
+
+/* Drop the cached copies of all clusters in [@offset, @offset + @bytes) */
+static void cache_invalidate(BDRVCacheState *s, int64_t offset, int64_t bytes)
+{
+    int64_t first = offset / s->cluster_size;
+    int64_t last = (offset + bytes - 1) / s->cluster_size;
+    CacheSlot *slot, *next_slot;
+    int64_t cluster;
+
+    QEMU_LOCK_GUARD(&s->lock);
+
+    if ((uint64_t)(last - first) >= s->nb_used) {
+        QTAILQ_FOREACH_SAFE(slot, &s->lru, next, next_slot) {
+            if (slot->cluster >= first && slot->cluster <= last) {
+                cache_drop_slot_locked(s, slot);
+            }
+        }
+        return;
+    }
+
+    for (cluster = first; cluster <= last; cluster++) {
+        slot = g_hash_table_lookup(s->index, &cluster);
+        if (slot) {
+            cache_drop_slot_locked(s, slot);
+        }
+    }
+}
+
+static void cache_drop_all(BDRVCacheState *s)
+{
+    CacheSlot *slot, *next_slot;
+
+    QEMU_LOCK_GUARD(&s->lock);
+
+    QTAILQ_FOREACH_SAFE(slot, &s->lru, next, next_slot) {
+        cache_drop_slot_locked(s, slot);
+    }
+}
+
+/* Access to the cached copies */
+
+static int coroutine_fn GRAPH_RDLOCK
+cache_store_preadv(BDRVCacheState *s, CacheSlot *slot, int64_t offset,
+                   int64_t bytes, QEMUIOVector *qiov, size_t qiov_offset)
+{
+    if (!s->cache_file) {
+        qemu_iovec_from_buf(qiov, qiov_offset, cache_slot_ram(s, slot) + offset,
+                            bytes);
+        return 0;
+    }
+    return bdrv_co_preadv_part(s->cache_file,
+                               cache_slot_offset(s, slot) + offset,
+                               bytes, qiov, qiov_offset, 0);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cache_store_pwritev(BDRVCacheState *s, CacheSlot *slot, int64_t offset,
+                    int64_t bytes, QEMUIOVector *qiov, size_t qiov_offset)
+{
+    if (!s->cache_file) {
+        qemu_iovec_to_buf(qiov, qiov_offset, cache_slot_ram(s, slot) + offset,
+                          bytes);
+        return 0;
+    }
+    return bdrv_co_pwritev_part(s->cache_file,
+                                cache_slot_offset(s, slot) + offset,
+                                bytes, qiov, qiov_offset, 0);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cache_store_pwrite_zeroes(BDRVCacheState *s, CacheSlot *slot, int64_t offset,
+                          int64_t bytes)
+{
+    if (!s->cache_file) {
+        memset(cache_slot_ram(s, slot) + offset, 0, bytes);
+        return 0;
+    }
+    return bdrv_co_pwrite_zeroes(s->cache_file,
+                                 cache_slot_offset(s, slot) + offset, bytes, 0);
+}
+
+/* Read the cluster of @slot from the filtered node and copy out a part */
+static int coroutine_fn GRAPH_RDLOCK
+cache_co_fill(BlockDriverState *bs, CacheSlot *slot, int64_t offset,
+              int64_t bytes, QEMUIOVector *qiov, size_t qiov_offset)
+{
+    BDRVCacheState *s = bs->opaque;
+    int64_t cluster_offset = slot->cluster * s->cluster_size;
+    int64_t len = MIN(s->cluster_size, s->image_size - cluster_offset);
+    QEMUIOVector local_qiov;
+    bool drop = false;
+    uint8_t *buf;
+    int ret;
+
+    /* Nobody else looks at a slot that is filling */
+    buf = s->ram ? cache_slot_ram(s, slot)
+                 : qemu_try_blockalign(bs->file->bs, s->cluster_size);
+    if (!buf) {
+        cache_put_slot(s, slot, true);
+        return bdrv_co_preadv_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                   0);
+    }
+
+    ret = bdrv_co_pread(bs->file, cluster_offset, len, buf, 0);
+    if (ret < 0) {
+        trace_cache_fill_fail(bs, slot->cluster, ret);
+        drop = true;
+        goto out;
+    }
+    memset(buf + len, 0, s->cluster_size - len);
+    qemu_iovec_from_buf(qiov, qiov_offset, buf + (offset - cluster_offset),
+                        bytes);
+
+    /* The data was read, failing to cache it is no error for the request */
+    if (s->cache_file) {
+        int store_ret;
+
+        qemu_iovec_init_buf(&local_qiov, buf, s->cluster_size);
+        store_ret = cache_store_pwritev(s, slot, 0, s->cluster_size,
+                                        &local_qiov, 0);
+        if (store_ret < 0) {
+            trace_cache_fill_fail(bs, slot->cluster, store_ret);
+            drop = true;
+        }
+    }
+
+out:
+    cache_put_slot(s, slot, drop);
+    if (!s->ram) {
+        qemu_vfree(buf);
+    }
+    return ret < 0 ? ret : 0;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cache_co_read_hit(BlockDriverState *bs, CacheSlot *slot, int64_t offset,
+                  int64_t bytes, QEMUIOVector *qiov, size_t qiov_offset)
+{
+    BDRVCacheState *s = bs->opaque;
+    int64_t cluster_offset = slot->cluster * s->cluster_size;
+    bool dirty;
+    int ret;
+
+    trace_cache_hit(bs, slot->cluster);
+    ret = cache_store_preadv(s, slot, offset - cluster_offset, bytes,
+                             qiov, qiov_offset);
+    if (ret < 0) {
+        WITH_QEMU_LOCK_GUARD(&s->lock) {
+            dirty = slot->dirty;
+        }
+        /* The filtered node has the same data unless the slot is dirty */
+        if (!dirty) {
+            ret = bdrv_co_preadv_part(bs->file, offset, bytes, qiov,
+                                      qiov_offset, 0);
+        }
+    }
+    cache_put_slot(s, slot, ret < 0);
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cache_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                     QEMUIOVector *qiov, size_t qiov_offset,
+                     BdrvRequestFlags flags)
+{
+    BDRVCacheState *s = bs->opaque;
+    int64_t end = offset + bytes;
+    int64_t run = offset;   /* start of the reads from the filtered node */
+    int64_t pos = offset;
+    int ret;
+
+    while (pos < end) {
+        int64_t cluster = pos / s->cluster_size;
+        int64_t chunk_end = MIN(end, (cluster + 1) * s->cluster_size);
+        CacheSlot *slot;
+        bool fill;
+
+        slot = cache_get_read_slot(bs, cluster, &fill);
+        if (!slot) {
+            pos = chunk_end;
+            continue;
+        }
+
+        if (run < pos) {
+            ret = bdrv_co_preadv_part(bs->file, run, pos - run, qiov,
+                                      qiov_offset + (run - offset), flags);
+            if (ret < 0) {
+                cache_put_slot(s, slot, fill);
+                return ret;
+            }
+        }
+
+        if (fill) {
+            ret = cache_co_fill(bs, slot, pos, chunk_end - pos, qiov,
+                                qiov_offset + (pos - offset));
+        } else {
+            ret = cache_co_read_hit(bs, slot, pos, chunk_end - pos, qiov,
+                                    qiov_offset + (pos - offset));
+        }
+        if (ret < 0) {
+            return ret;
+        }
+        pos = run = chunk_end;
+    }
+
+    if (run < end) {
+        return bdrv_co_preadv_part(bs->file, run, end - run, qiov,
+                                   qiov_offset + (run - offset), flags);
+    }
+    return 0;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cache_co_write_through(BlockDriverState *bs, CacheWriteType type,
+                       int64_t offset, int64_t bytes, QEMUIOVector *qiov,
+                       size_t qiov_offset, BdrvRequestFlags flags)
+{
+    BDRVCacheState *s = bs->opaque;
+    int ret;
+
+    switch (type) {
+    case CACHE_WRITE:
+        ret = bdrv_co_pwritev_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                   flags);
+        break;
+    case CACHE_WRITE_ZEROES:
+        ret = bdrv_co_pwrite_zeroes(bs->file, offset, bytes, flags);
+        break;
+    case CACHE_DISCARD:
+        ret = bdrv_co_pdiscard(bs->file, offset, bytes);
+        break;
+    default:
+        abort();
+    }
+
+    /*
+     * Drop the old copies only now, so that a fill that raced with this
+     * write cannot leave them in the cache.  On failure the content of
+     * the range is undefined, so drop them as well.
+     */
+    cache_invalidate(s, offset, bytes);
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cache_co_write_back(BlockDriverState *bs, CacheWriteType type,
+                    CacheSlot *slot, int64_t offset, int64_t bytes,
+                    QEMUIOVector *qiov, size_t qiov_offset)
+{
+    BDRVCacheState *s = bs->opaque;
+    int64_t cluster_offset = slot->cluster * s->cluster_size;
+    int ret = 0;
+
+    switch (type) {
+    case CACHE_WRITE:
+        ret = cache_store_pwritev(s, slot, offset - cluster_offset, bytes,
+                                  qiov, qiov_offset);
+        break;
+    case CACHE_WRITE_ZEROES:
+        ret = cache_store_pwrite_zeroes(s, slot, offset - cluster_offset,
+                                        bytes);
+        break;
+    case CACHE_DISCARD:
+        /* Advisory only; the dirty data stays */
+        break;
+    default:
+        abort();
+    }
+
+    cache_put_write_slot(s, slot);
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cache_co_modify(BlockDriverState *bs, CacheWriteType type, int64_t offset,
+                int64_t bytes, QEMUIOVector *qiov, size_t qiov_offset,
+                BdrvRequestFlags flags)
+{
+    BDRVCacheState *s = bs->opaque;
+    int64_t end = offset + bytes;
+    int64_t run = offset;   /* start of the writes to the filtered node */
+    int64_t pos = offset;
+    int ret;
+
+    while (pos < end) {
+        int64_t cluster = pos / s->cluster_size;
+        int64_t chunk_end = MIN(end, (cluster + 1) * s->cluster_size);
+        CacheSlot *slot;
+
+        slot = cache_get_write_slot(s, cluster, type != CACHE_DISCARD);
+        if (!slot) {
+            pos = chunk_end;
+            continue;
+        }
+
+        if (run < pos) {
+            ret = cache_co_write_through(bs, type, run, pos - run, qiov,
+                                         qiov_offset + (run - offset), flags);
+            if (ret < 0) {
+                cache_put_write_slot(s, slot);
+                return ret;
+            }
+        }
+
+        ret = cache_co_write_back(bs, type, slot, pos, chunk_end - pos, qiov,
+                                  qiov_offset + (pos - offset));
+        if (ret < 0) {
+            return ret;
+        }
+        pos = run = chunk_end;
+    }
+
+    if (run < end) {
+        return cache_co_write_through(bs, type, run, end - run, qiov,
+                                      qiov_offset + (run - offset), flags);
+    }
+    return 0;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cache_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                      QEMUIOVector *qiov, size_t qiov_offset,
+                      BdrvRequestFlags flags)
+{
+    return cache_co_modify(bs, CACHE_WRITE, offset, bytes, qiov, qiov_offset,
+                           flags);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cache_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                       BdrvRequestFlags flags)
+{
+    return cache_co_modify(bs, CACHE_WRITE_ZEROES, offset, bytes, NULL, 0,
+                           flags);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cache_co_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes)
+{
+    return cache_co_modify(bs, CACHE_DISCARD, offset, bytes, NULL, 0, 0);
+}
+
+/*
+ * Write all dirty slots to the filtered node.  A slot written to while
+ * it is being written back has a different dirty_gen afterwards and
+ * stays dirty.
+ */
+static int coroutine_fn GRAPH_RDLOCK cache_co_writeback(BlockDriverState *bs)
+{
+    BDRVCacheState *s = bs->opaque;
+    uint8_t *buf = NULL;
+    uint64_t n;
+    int ret = 0;
+
+    QEMU_LOCK_GUARD(&s->writeback_lock);
+
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        n = s->nb_dirty;
+    }
+    if (n && !s->ram) {
+        buf = qemu_try_blockalign(bs->file->bs, s->cluster_size);
+        if (!buf) {
+            return -ENOMEM;
+        }
+    }
+
+    while (n--) {
+        CacheSlot *slot;
+        uint64_t gen = 0;
+        int64_t cluster_offset, len;
+
+        WITH_QEMU_LOCK_GUARD(&s->lock) {
+            slot = QTAILQ_FIRST(&s->dirty);
+            if (slot) {
+                QTAILQ_REMOVE(&s->dirty, slot, dirty_next);
+                gen = slot->dirty_gen;
+                slot->refcnt++;
+            }
+        }
+        if (!slot) {
+            break;
+        }
+
+        cluster_offset = slot->cluster * s->cluster_size;
+        len = MIN(s->cluster_size, s->image_size - cluster_offset);
+        if (s->ram) {
+            ret = bdrv_co_pwrite(bs->file, cluster_offset, len,
+                                 cache_slot_ram(s, slot), 0);
+        } else {
+            ret = bdrv_co_pread(s->cache_file, cache_slot_offset(s, slot),
+                                len, buf, 0);
+            if (ret >= 0) {
+                ret = bdrv_co_pwrite(bs->file, cluster_offset, len, buf, 0);
+            }
+        }
+        trace_cache_writeback(bs, slot->cluster, ret);
+
+        WITH_QEMU_LOCK_GUARD(&s->lock) {
+            if (ret >= 0 && gen == slot->dirty_gen) {
+                slot->dirty = false;
+                s->nb_dirty--;
+            } else {
+                QTAILQ_INSERT_TAIL(&s->dirty, slot, dirty_next);
+            }
+            cache_unref_slot_locked(s, slot);
+        }
+        if (ret < 0) {
+            break;
+        }
+    }
+
+    qemu_vfree(buf);
+    return ret < 0 ? ret : 0;
+}
+
+static int coroutine_fn GRAPH_RDLOCK cache_co_flush(BlockDriverState *bs)
+{
+    int ret;
+
+    /*
+     * The cache-file itself needs no flush: its content is either written
+     * back here or, after a crash, discarded together with the index.
+     */
+    ret = cache_co_writeback(bs);
+    if (ret < 0) {
+        return ret;
+    }
+    return bdrv_co_flush(bs->file->bs);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+cache_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
+                  PreallocMode prealloc, BdrvRequestFlags flags, Error **errp)
+{
+    BDRVCacheState *s = bs->opaque;
+    int ret;
+
+    ret = cache_co_writeback(bs);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to write back cached data");
+        return ret;
+    }
+    cache_drop_all(s);
+
+    ret = bdrv_co_truncate(bs->file, offset, exact, prealloc, flags, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        s->image_size = offset;
+    }
+    return 0;
+}
+
+static int64_t coroutine_fn GRAPH_RDLOCK
+cache_co_getlength(BlockDriverState *bs)
+{
+    return bdrv_co_getlength(bs->file->bs);
+}
+
+static bool cache_is_dirty_locked(BDRVCacheState *s, int64_t offset)
+{
+    int64_t cluster = offset / s->cluster_size;
+    CacheSlot *slot = g_hash_table_lookup(s->index, &cluster);
+
+    return slot && slot->dirty;
+}
+
+/*
+ * Dirty clusters are only in the cache, so the filtered node may still
+ * report them as zero or unallocated.  Report them as data of our own and
+ * pass everything else through.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+cache_co_block_status(BlockDriverState *bs, unsigned int mode,
+                      int64_t offset, int64_t bytes, int64_t *pnum,
+                      int64_t *map, BlockDriverState **file)
+{
+    BDRVCacheState *s = bs->opaque;
+    int64_t end = offset + bytes;
+    int64_t pos = end;
+    bool dirty = false;
+
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        if (s->nb_dirty) {
+            dirty = cache_is_dirty_locked(s, offset);
+            pos = QEMU_ALIGN_DOWN(offset, s->cluster_size) + s->cluster_size;
+            while (pos < end && cache_is_dirty_locked(s, pos) == dirty) {
+                pos += s->cluster_size;
+            }
+        }
+    }
+    *pnum = MIN(pos, end) - offset;
+
+    if (dirty) {
+        return BDRV_BLOCK_DATA;
+    }
+    *map = offset;
+    *file = bs->file->bs;
+    return BDRV_BLOCK_RAW | BDRV_BLOCK_OFFSET_VALID;
+}
+
+static void coroutine_fn GRAPH_RDLOCK
+cache_co_invalidate_cache(BlockDriverState *bs, Error **errp)
+{
+    BDRVCacheState *s = bs->opaque;
+    int64_t len;
+
+    /* Whoever had the image before us may have changed it */
+    cache_drop_all(s);
+
+    len = bdrv_co_getlength(bs->file->bs);
+    if (len < 0) {
+        error_setg_errno(errp, -len, "Failed to get file length");
+        return;
+    }
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        s->image_size = len;
+    }
+
+    /* Opened inactive, so the index was not loaded and the header is clean */
+    if (s->persistent) {
+        cache_mark_in_use(bs, errp);
+    }
+}
+
+/* Persistent index */
+
+static void cache_fill_header(BDRVCacheState *s, CacheHeader *hdr,
+                              uint32_t flags)
+{
+    *hdr = (CacheHeader) {
+        .magic          = cpu_to_be64(CACHE_MAGIC),
+        .version        = cpu_to_be32(CACHE_VERSION),
+        .flags          = cpu_to_be32(flags),
+        .cluster_size   = cpu_to_be64(s->cluster_size),
+        .nb_slots       = cpu_to_be64(s->nb_slots),
+        .image_size     = cpu_to_be64(s->image_size),
+        .image_name_crc = cpu_to_be32(s->image_name_crc),
+        .image_data_crc = cpu_to_be32(s->image_data_crc),
+        .index_offset   = cpu_to_be64(CACHE_INDEX_OFFSET),
+        .data_offset    = cpu_to_be64(s->data_offset),
+    };
+}
+
+/*
+ * Compute the checksums that identify the filtered node in the header.
+ * Its first cluster usually holds a partition table or file system
+ * superblock, which changes when the image is replaced or reformatted.
+ */
+static int GRAPH_RDLOCK cache_update_image_id(BlockDriverState *bs)
+{
+    BDRVCacheState *s = bs->opaque;
+    const char *name = bs->file->bs->filename;
+    int64_t len = MIN(s->cluster_size, s->image_size);
+    g_autofree uint8_t *buf = NULL;
+    int ret;
+
+    buf = g_try_malloc(len);
+    if (len && !buf) {
+        return -ENOMEM;
+    }
+    ret = bdrv_pread(bs->file, 0, len, buf, 0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    s->image_name_crc = crc32c(0xffffffff, (const uint8_t *)name,
+                               strlen(name));
+    s->image_data_crc = crc32c(0xffffffff, buf, len);
+    return 0;
+}
+
+/*
+ * Clear the clean flag before the cache-file is modified, so that a crash
+ * leaves an index behind that is not trusted.
+ */
+static int coroutine_mixed_fn GRAPH_RDLOCK
+cache_mark_in_use(BlockDriverState *bs, Error **errp)
+{
+    BDRVCacheState *s = bs->opaque;
+    CacheHeader hdr;
+    int ret;
+
+    cache_fill_header(s, &hdr, 0);
+    ret = bdrv_pwrite(s->cache_file, 0, sizeof(hdr), &hdr, 0);
+    if (ret >= 0) {
+        ret = bdrv_flush(s->cache_file->bs);
+    }
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not write cache-file header");
+        return ret;
+    }
+    return 0;
+}
+
+/*
+ * Load the index saved by cache_save_index() if it was written for the
+ * same geometry and filtered node, then mark the header as in use.
+ */
+static int GRAPH_RDLOCK cache_load_index(BlockDriverState *bs, Error **errp)
+{
+    BDRVCacheState *s = bs->opaque;
+    g_autofree uint64_t *index = NULL;
+    CacheHeader hdr, expected;
+    uint64_t i, nb_clusters;
+    bool valid;
+    int ret;
+
+    ret = bdrv_pread(s->cache_file, 0, sizeof(hdr), &hdr, 0);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Could not read cache-file header");
+        return ret;
+    }
+
+    valid = cache_update_image_id(bs) >= 0;
+    if (valid) {
+        cache_fill_header(s, &expected, CACHE_HEADER_CLEAN);
+        valid = !memcmp(&hdr, &expected, sizeof(hdr));
+    }
+    if (valid) {
+        index = g_try_new(uint64_t, s->nb_slots);
+        valid = index &&
+                bdrv_pread(s->cache_file, CACHE_INDEX_OFFSET,
+                           s->nb_slots * sizeof(uint64_t), index, 0) >= 0;
+    }
+
+    nb_clusters = DIV_ROUND_UP(s->image_size, s->cluster_size);
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        for (i = 0; valid && i < s->nb_slots; i++) {
+            uint64_t entry = be64_to_cpu(index[i]);
+            int64_t cluster = entry - 1;
+            CacheSlot *slot = &s->slots[i];
+
+            if (!entry || entry > nb_clusters ||
+                g_hash_table_contains(s->index, &cluster)) {
+                continue;
+            }
+            QTAILQ_REMOVE(&s->free, slot, next);
+            cache_insert_slot_locked(s, slot, cluster);
+
+            /* Give loaded clusters a head start over the first misses */
+            cache_sketch_add(s, cluster);
+        }
+    }
+    trace_cache_load_index(bs, s->nb_slots, s->nb_used, valid);
+
+    return cache_mark_in_use(bs, errp);
+}
+
+static void GRAPH_RDLOCK cache_save_index(BlockDriverState *bs)
+{
+    BDRVCacheState *s = bs->opaque;
+    g_autofree uint64_t *index = NULL;
+    CacheHeader hdr;
+    uint64_t i;
+    int ret;
+
+    if (s->nb_dirty) {
+        warn_report("cache: %" PRIu64 " dirty clusters could not be written "
+                    "back, not saving the cache index", s->nb_dirty);
+        return;
+    }
+
+    ret = cache_update_image_id(bs);
+    if (ret < 0) {
+        warn_report("cache: could not read the filtered node, not saving "
+                    "the cache index: %s", strerror(-ret));
+        return;
+    }
+
+    index = g_try_new0(uint64_t, s->nb_slots);
+    if (!index) {
+        return;
+    }
+    for (i = 0; i < s->nb_slots; i++) {
+        CacheSlot *slot = &s->slots[i];
+
+        if (slot->cluster >= 0 && !slot->stale) {
+            index[i] = cpu_to_be64(slot->cluster + 1);
+        }
+    }
+
+    /* The clusters and the index must be stable before the header says so */
+    ret = bdrv_pwrite(s->cache_file, CACHE_INDEX_OFFSET,
+                      s->nb_slots * sizeof(uint64_t), index, 0);
+    if (ret >= 0) {
+        ret = bdrv_flush(s->cache_file->bs);
+    }
+    if (ret >= 0) {
+        cache_fill_header(s, &hdr, CACHE_HEADER_CLEAN);
+        ret = bdrv_pwrite(s->cache_file, 0, sizeof(hdr), &hdr, 0);
+    }
+    if (ret >= 0) {
+        ret = bdrv_flush(s->cache_file->bs);
+    }
+    if (ret < 0) {
+        warn_report("cache: could not save the cache index: %s",
+                    strerror(-ret));
+    }
+}
+
+static void cache_free(BDRVCacheState *s)
+{
+    if (s->index) {
+        g_hash_table_destroy(s->index);
+    }
+    g_free(s->slots);
+    g_free(s->sketch);
+    qemu_vfree(s->ram);
+    qemu_mutex_destroy(&s->lock);
+}
+
+static int GRAPH_RDLOCK
+cache_init_slots(BlockDriverState *bs, uint64_t size, Error **errp)
+{
+    BDRVCacheState *s = bs->opaque;
+    uint64_t i, width;
+
+    if (s->cache_file) {
+        s->nb_slots = size > CACHE_INDEX_OFFSET ?
+            (size - CACHE_INDEX_OFFSET) / (s->cluster_size + sizeof(uint64_t)) :
+            0;
+        while (s->nb_slots &&
+               cache_data_offset(s->nb_slots, s->cluster_size) +
+               s->nb_slots * s->cluster_size > size) {
+            s->nb_slots--;
+        }
+        s->data_offset = cache_data_offset(s->nb_slots, s->cluster_size);
+    } else {
+        s->nb_slots = size / s->cluster_size;
+        s->data_offset = 0;
+    }
+
+    if (!s->nb_slots) {
+        error_setg(errp, "cache size %" PRIu64 " is too small for "
+                   "cluster-size %" PRIu64, size, s->cluster_size);
+        return -EINVAL;
+    }
+    if (s->nb_slots > INT32_MAX) {
+        error_setg(errp, "cache size %" PRIu64 " is too large for "
+                   "cluster-size %" PRIu64, size, s->cluster_size);
+        return -EINVAL;
+    }
+
+    if (!s->cache_file) {
+        s->ram = qemu_try_blockalign(bs->file->bs,
+                                     s->nb_slots * s->cluster_size);
+        if (!s->ram) {
+            error_setg(errp, "Could not allocate %" PRIu64 " bytes of cache",
+                       s->nb_slots * s->cluster_size);
+            return -ENOMEM;
+        }
+    }
+
+    s->slots = g_new0(CacheSlot, s->nb_slots);
+    s->index = g_hash_table_new(g_int64_hash, g_int64_equal);
+    QTAILQ_INIT(&s->lru);
+    QTAILQ_INIT(&s->free);
+    QTAILQ_INIT(&s->dirty);
+    for (i = 0; i < s->nb_slots; i++) {
+        s->slots[i].cluster = -1;
+        QTAILQ_INSERT_TAIL(&s->free, &s->slots[i], next);
+    }
+    s->max_dirty = MAX(s->nb_slots / 2, 1);
+
+    width = pow2ceil(MAX(s->nb_slots, 64));
+    s->sketch = g_new0(uint8_t, CACHE_SKETCH_DEPTH * width);
+    s->sketch_mask = width - 1;
+    s->sketch_reset = 10 * s->nb_slots;
+
+    return 0;
+}
+
+/*
+ * The cache-file is written even while we are read-only, e.g. as a
+ * backing node, so unless it references an existing node, do not let it
+ * inherit read-only from us.
+ */
+static void cache_force_writable_cache_file(QDict *options)
+{
+    const QDictEntry *e;
+
+    for (e = qdict_first(options); e; e = qdict_next(options, e)) {
+        if (strstart(qdict_entry_key(e), "cache-file.", NULL)) {
+            qdict_set_default_str(options, "cache-file." BDRV_OPT_READ_ONLY,
+                                  "off");
+            return;
+        }
+    }
+}
+
+static int cache_open(BlockDriverState *bs, QDict *options, int flags,
+                      Error **errp)
+{
+    ERRP_GUARD();
+    BDRVCacheState *s = bs->opaque;
+    QemuOpts *opts = NULL;
+    const char *mode;
+    uint64_t size;
+    int64_t len;
+    int ret;
+
+    GLOBAL_STATE_CODE();
+
+    ret = bdrv_open_file_child(NULL, options, "file", bs, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    cache_force_writable_cache_file(options);
+    s->cache_file = bdrv_open_child(NULL, options, "cache-file", bs,
+                                    &child_of_bds, BDRV_CHILD_DATA, true,
+                                    errp);
+    if (*errp) {
+        return -EINVAL;
+    }
+
+    GRAPH_RDLOCK_GUARD_MAINLOOP();
+
+    qemu_mutex_init(&s->lock);
+    qemu_co_mutex_init(&s->writeback_lock);
+
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    s->cluster_size = qemu_opt_get_size(opts, CACHE_OPT_CLUSTER_SIZE,
+                                        64 * KiB);
+    if (!is_power_of_2(s->cluster_size) ||
+        s->cluster_size < CACHE_MIN_CLUSTER_SIZE ||
+        s->cluster_size > CACHE_MAX_CLUSTER_SIZE) {
+        error_setg(errp, "cluster-size must be a power of two between "
+                   "%" PRId64 " and %" PRId64, CACHE_MIN_CLUSTER_SIZE,
+                   CACHE_MAX_CLUSTER_SIZE);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    mode = qemu_opt_get(opts, CACHE_OPT_MODE);
+    s->mode = qapi_enum_parse(&BlockdevCacheFilterMode_lookup, mode,
+                              BLOCKDEV_CACHE_FILTER_MODE_WRITE_THROUGH, errp);
+    if (*errp) {
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    s->persistent = qemu_opt_get_bool(opts, CACHE_OPT_PERSISTENT, false);
+    if (s->persistent && !s->cache_file) {
+        error_setg(errp, "persistent requires cache-file");
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    if (s->cache_file) {
+        if (bdrv_is_read_only(s->cache_file->bs)) {
+            error_setg(errp, "cache-file must be writable");
+            ret = -EINVAL;
+            goto fail;
+        }
+        len = bdrv_getlength(s->cache_file->bs);
+        if (len < 0) {
+            error_setg_errno(errp, -len, "Could not get cache-file length");
+            ret = len;
+            goto fail;
+        }
+        size = qemu_opt_get_size(opts, CACHE_OPT_SIZE, len);
+        if (size > len) {
+            error_setg(errp, "size %" PRIu64 " exceeds the length of "
+                       "cache-file (%" PRId64 ")", size, len);
+            ret = -EINVAL;
+            goto fail;
+        }
+    } else {
+        if (!qemu_opt_find(opts, CACHE_OPT_SIZE)) {
+            error_setg(errp, "size is required without cache-file");
+            ret = -EINVAL;
+            goto fail;
+        }
+        size = qemu_opt_get_size(opts, CACHE_OPT_SIZE, 0);
+    }
+
+    s->image_size = bdrv_getlength(bs->file->bs);
+    if (s->image_size < 0) {
+        error_setg_errno(errp, -s->image_size, "Could not get file length");
+        ret = s->image_size;
+        goto fail;
+    }
+
+    ret = cache_init_slots(bs, size, errp);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    if (s->persistent && !(flags & BDRV_O_INACTIVE)) {
+        ret = cache_load_index(bs, errp);
+        if (ret < 0) {
+            goto fail;
+        }
+    }
+
+    /*
+     * FUA is not advertised so that the generic code follows such writes
+     * with a flush, which writes dirty clusters back.
+     */
+    bs->supported_write_flags = BDRV_REQ_WRITE_UNCHANGED;
+    bs->supported_zero_flags = BDRV_REQ_WRITE_UNCHANGED |
+        ((BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK) &
+            bs->file->bs->supported_zero_flags);
+
+    qemu_opts_del(opts);
+    return 0;
+
+fail:
+    qemu_opts_del(opts);
+    cache_free(s);
+    return ret;
+}
+
+static void cache_close(BlockDriverState *bs)
+{
+    BDRVCacheState *s = bs->opaque;
+
+    GLOBAL_STATE_CODE();
+    GRAPH_RDLOCK_GUARD_MAINLOOP();
+
+    /* An inactive image may have been modified by the migration target */
+    if (s->persistent && !(bs->open_flags & BDRV_O_INACTIVE)) {
+        cache_save_index(bs);
+    }
+    cache_free(s);
+}
+
+/* Only the write policy can be changed; dirty data was flushed already. */
+static int cache_reopen_prepare(BDRVReopenState *reopen_state,
+                                BlockReopenQueue *queue, Error **errp)
+{
+    ERRP_GUARD();
+    const char *mode = qdict_get_try_str(reopen_state->options,
+                                         CACHE_OPT_MODE);
+    BlockdevCacheFilterMode *new_mode = g_new(BlockdevCacheFilterMode, 1);
+
+    *new_mode = qapi_enum_parse(&BlockdevCacheFilterMode_lookup, mode,
+                                BLOCKDEV_CACHE_FILTER_MODE_WRITE_THROUGH,
+                                errp);
+    if (*errp) {
+        g_free(new_mode);
+        return -EINVAL;
+    }
+    qdict_del(reopen_state->options, CACHE_OPT_MODE);
+
+    reopen_state->opaque = new_mode;
+    return 0;
+}
+
+static void cache_reopen_commit(BDRVReopenState *state)
+{
+    BDRVCacheState *s = state->bs->opaque;
+
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        s->mode = *(BlockdevCacheFilterMode *)state->opaque;
+    }
+
+    g_free(state->opaque);
+    state->opaque = NULL;
+}
+
+static void cache_reopen_abort(BDRVReopenState *state)
+{
+    g_free(state->opaque);
+    state->opaque = NULL;
+}
+
+static void cache_child_perm(BlockDriverState *bs, BdrvChild *c,
+                             BdrvChildRole role,
+                             BlockReopenQueue *reopen_queue,
+                             uint64_t perm, uint64_t shared,
+                             uint64_t *nperm, uint64_t *nshared)
+{
+    if (!(role & BDRV_CHILD_FILTERED)) {
+        /*
+         * cache-file
+         *
+         * Its content only makes sense together with our index, so nobody
+         * else may write to it, not even while we are read-only.
+         */
+        *nperm = BLK_PERM_CONSISTENT_READ | BLK_PERM_WRITE;
+        *nshared = BLK_PERM_CONSISTENT_READ | BLK_PERM_WRITE_UNCHANGED;
+        return;
+    }
+
+    bdrv_default_perms(bs, c, role, reopen_queue, perm, shared, nperm, nshared);
+}
+
+static BlockStatsSpecific *cache_get_specific_stats(BlockDriverState *bs)
+{
+    BDRVCacheState *s = bs->opaque;
+    BlockStatsSpecific *stats = g_new0(BlockStatsSpecific, 1);
+
+    stats->driver = BLOCKDEV_DRIVER_CACHE;
+
+    QEMU_LOCK_GUARD(&s->lock);
+    stats->u.cache = (BlockStatsSpecificCache) {
+        .hits           = s->hits,
+        .misses         = s->misses,
+        .admissions     = s->admissions,
+        .rejections     = s->rejections,
+        .evictions      = s->evictions,
+        .used_clusters  = s->nb_used,
+        .dirty_clusters = s->nb_dirty,
+    };
+
+    return stats;
+}
+
+/* In write-back mode, the filtered node alone does not hold our data */
+static const char *const cache_strong_runtime_opts[] = {
+    CACHE_OPT_MODE,
+
+    NULL
+};
+
+static BlockDriver bdrv_cache_filter = {
+    .format_name = "cache",
+    .instance_size = sizeof(BDRVCacheState),
+
+    .bdrv_co_getlength    = cache_co_getlength,
+    .bdrv_co_block_status = cache_co_block_status,
+    .bdrv_open            = cache_open,
+    .bdrv_close           = cache_close,
+
+    .bdrv_reopen_prepare  = cache_reopen_prepare,
+    .bdrv_reopen_commit   = cache_reopen_commit,
+    .bdrv_reopen_abort    = cache_reopen_abort,
+
+    .bdrv_co_preadv_part = cache_co_preadv_part,
+    .bdrv_co_pwritev_part = cache_co_pwritev_part,
+    .bdrv_co_pwrite_zeroes = cache_co_pwrite_zeroes,
+    .bdrv_co_pdiscard = cache_co_pdiscard,
+    .bdrv_co_flush = cache_co_flush,
+    .bdrv_co_truncate = cache_co_truncate,
+    .bdrv_co_invalidate_cache = cache_co_invalidate_cache,
+
+    .bdrv_child_perm = cache_child_perm,
+    .bdrv_get_specific_stats = cache_get_specific_stats,
+
+    .is_filter = true,
+    .strong_runtime_opts = cache_strong_runtime_opts,
+};
+
+static void bdrv_cache_init(void)
+{
+    bdrv_register(&bdrv_cache_filter);
+}
+
+block_init(bdrv_cache_init);
@@ -174,6 +174,9 @@ typedef struct BDRVRawState {
 
     uint64_t aio_max_batch;
 
+    /* io_uring fixed file slot of s->fd, or -1 */
+    int fixed_file;
+
     int perm_change_fd;
     int perm_change_flags;
     BDRVReopenState *reopen_state;
@@ -183,6 +186,8 @@ typedef struct BDRVRawState {
     bool use_linux_aio:1;
     bool has_laio_fdsync:1;
     bool use_linux_io_uring:1;
+    bool use_fixed_bufs:1;
+    bool use_nvme_uring:1;
     bool use_mpath:1;
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
@@ -197,6 +202,9 @@ typedef struct BDRVRawState {
     } stats;
 
     PRManager *pr_mgr;
+#ifdef CONFIG_NVME_URING
+    NvmeUringNs nvme_ns;
+#endif
 } BDRVRawState;
 
 typedef struct BDRVRawReopenState {
@@ -585,6 +593,12 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "AIO max batch size (0 = auto handled by AIO backend, default: 0)",
         },
+        {
+            .name = "aio-fixed-buffers",
+            .type = QEMU_OPT_BOOL,
+            .help = "register guest RAM as io_uring fixed buffers "
+                    "(default: off)",
+        },
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -613,6 +627,28 @@ static QemuOptsList raw_runtime_opts = {
 
 static const char *const mutable_opts[] = { "x-check-cache-dropped", NULL };
 
+/*
+ * With aio=io_uring, register the file descriptor as a fixed file so that
+ * requests skip the kernel's file table lookup.  It must be unregistered
+ * before s->fd is closed or replaced.
+ */
+static void raw_register_fixed_file(BDRVRawState *s)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring && s->fd >= 0) {
+        s->fixed_file = aio_register_fixed_file(s->fd);
+    }
+#endif
+}
+
+static void raw_unregister_fixed_file(BDRVRawState *s)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    aio_unregister_fixed_file(s->fixed_file);
+    s->fixed_file = -1;
+#endif
+}
+
 static int raw_open_common(BlockDriverState *bs, QDict *options,
                            int bdrv_flags, int open_flags,
                            bool device, Error **errp)
@@ -627,6 +663,8 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     struct stat st;
     OnOffAuto locking;
 
+    s->fixed_file = -1;
+
     opts = qemu_opts_create(&raw_runtime_opts, NULL, 0, &error_abort);
     if (!qemu_opts_absorb_qdict(opts, options, errp)) {
         ret = -EINVAL;
@@ -662,6 +700,8 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     s->use_linux_aio = (aio == BLOCKDEV_AIO_OPTIONS_NATIVE);
 #ifdef CONFIG_LINUX_IO_URING
     s->use_linux_io_uring = (aio == BLOCKDEV_AIO_OPTIONS_IO_URING);
+    s->use_fixed_bufs = s->use_linux_io_uring &&
+                        qemu_opt_get_bool(opts, "aio-fixed-buffers", false);
 #endif
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
@@ -799,6 +839,16 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
             ret = -EINVAL;
             goto fail;
         }
+#ifdef CONFIG_NVME_URING
+        /* NVMe generic character devices only support passthrough */
+        if (s->use_linux_io_uring && S_ISCHR(st.st_mode)) {
+            ret = nvme_uring_probe(s->fd, &s->nvme_ns, errp);
+            if (ret < 0) {
+                goto fail;
+            }
+            s->use_nvme_uring = ret;
+        }
+#endif
     }
 #ifdef CONFIG_BLKZONED
     /*
@@ -838,6 +888,21 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         /* When extending regular files, we get zeros from the OS */
         bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
     }
+#ifdef CONFIG_NVME_URING
+    if (s->use_nvme_uring) {
+        /* discard would need an NVMe Dataset Management command */
+        s->has_discard = false;
+        bs->supported_write_flags = BDRV_REQ_FUA;
+        bs->supported_zero_flags = 0;
+        if (s->nvme_ns.supports_write_zeroes) {
+            bs->supported_zero_flags = BDRV_REQ_FUA | BDRV_REQ_NO_FALLBACK;
+            if (s->nvme_ns.unmap_reads_zeroes) {
+                bs->supported_zero_flags |= BDRV_REQ_MAY_UNMAP;
+            }
+        }
+    }
+#endif
+    raw_register_fixed_file(s);
     ret = 0;
 fail:
     if (ret < 0 && s->fd != -1) {
@@ -1552,6 +1617,26 @@ static void raw_refresh_limits(BlockDriverState *bs, Error **errp)
     BDRVRawState *s = bs->opaque;
     struct stat st;
 
+#ifdef CONFIG_NVME_URING
+    if (s->use_nvme_uring) {
+        uint32_t lba_size = 1 << s->nvme_ns.lba_shift;
+
+        /* passthrough commands bypass the page cache, whatever O_DIRECT */
+        s->needs_alignment = false;
+        bs->bl.request_alignment = lba_size;
+        bs->bl.min_mem_alignment = sizeof(uint32_t);
+        bs->bl.opt_mem_alignment = qemu_real_host_page_size();
+        bs->bl.max_hw_transfer = s->nvme_ns.max_transfer;
+        bs->bl.max_hw_iov = s->nvme_ns.max_segments;
+        /* NLB is a 16 bit field */
+        bs->bl.max_pwrite_zeroes =
+            QEMU_ALIGN_DOWN(MIN((uint64_t)0x10000 << s->nvme_ns.lba_shift,
+                                INT_MAX), lba_size);
+        bs->bl.pwrite_zeroes_alignment = lba_size;
+        return;
+    }
+#endif
+
     s->needs_alignment = raw_needs_alignment(bs);
     raw_probe_alignment(bs, s->fd, errp);
 
@@ -2547,6 +2632,24 @@ static bool bdrv_qiov_is_aligned(BlockDriverState *bs, QEMUIOVector *qiov)
     return true;
 }
 
+#ifdef CONFIG_NVME_URING
+static int coroutine_fn raw_co_nvme_uring(BDRVRawState *s, uint64_t offset,
+                                          uint64_t bytes, QEMUIOVector *qiov,
+                                          int type, BdrvRequestFlags flags)
+{
+    Error *local_err = NULL;
+
+    /* there is no fallback, the character device only does passthrough */
+    if (unlikely(!aio_setup_nvme_uring(qemu_get_current_aio_context(),
+                                       &local_err))) {
+        error_report_err(local_err);
+        return -EIO;
+    }
+    return nvme_uring_co_submit(s->fd, &s->nvme_ns, offset, bytes, qiov,
+                                type, flags);
+}
+#endif
+
 #ifdef CONFIG_LINUX_AIO
 static inline bool raw_check_linux_aio(BDRVRawState *s)
 {
@@ -2590,6 +2693,14 @@ raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr, uint64_t bytes,
     }
 #endif
 
+#ifdef CONFIG_NVME_URING
+    if (s->use_nvme_uring) {
+        assert(qiov->size == bytes);
+        ret = raw_co_nvme_uring(s, offset, bytes, qiov, type, flags);
+        goto out;
+    }
+#endif
+
     /*
      * When using O_DIRECT, the request must be aligned to be able to use
      * either libaio or io_uring interface. If not fail back to regular thread
@@ -2695,6 +2806,11 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
         .aio_type       = QEMU_AIO_FLUSH,
     };
 
+#ifdef CONFIG_NVME_URING
+    if (s->use_nvme_uring) {
+        return raw_co_nvme_uring(s, 0, 0, NULL, QEMU_AIO_FLUSH, 0);
+    }
+#endif
 #ifdef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
         return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH, 0);
@@ -2716,11 +2832,41 @@ static void raw_close(BlockDriverState *bs)
 #if defined(CONFIG_BLKZONED)
         g_free(bs->wps);
 #endif
+        raw_unregister_fixed_file(s);
         qemu_close(s->fd);
         s->fd = -1;
     }
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+/*
+ * With aio-fixed-buffers=on, guest RAM registered through BlockRAMRegistrar
+ * becomes io_uring fixed buffers, so that reads and writes into it do not
+ * pin pages per request.  This keeps all of guest RAM pinned, which is why
+ * it is opt-in.  Failing to register is not an error, requests then use
+ * plain buffers.
+ */
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_fixed_bufs) {
+        aio_register_fixed_buf(host, size);
+    }
+    return true;
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_fixed_bufs) {
+        aio_unregister_fixed_buf(host, size);
+    }
+}
+#endif
+
 /**
  * Truncates the given regular file @fd to @offset and, when growing, fills the
  * new space according to @prealloc.
@@ -2959,6 +3105,13 @@ static int64_t raw_getlength(BlockDriverState *bs)
 
 static int64_t coroutine_fn raw_co_getlength(BlockDriverState *bs)
 {
+#ifdef CONFIG_NVME_URING
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_nvme_uring) {
+        return s->nvme_ns.nr_lbas << s->nvme_ns.lba_shift;
+    }
+#endif
     return raw_getlength(bs);
 }
 
@@ -3682,6 +3835,16 @@ raw_do_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
     RawPosixAIOData acb;
     ThreadPoolFunc *handler;
 
+#ifdef CONFIG_NVME_URING
+    if (s->use_nvme_uring) {
+        if (!s->nvme_ns.supports_write_zeroes) {
+            return -ENOTSUP;
+        }
+        return raw_co_nvme_uring(s, offset, bytes, NULL,
+                                 QEMU_AIO_WRITE_ZEROES, flags);
+    }
+#endif
+
 #ifdef CONFIG_FALLOCATE
     if (offset + bytes > bs->total_sectors * BDRV_SECTOR_SIZE) {
         BdrvTrackedRequest *req;
@@ -3908,9 +4071,11 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+        raw_unregister_fixed_file(s);
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
+        raw_register_fixed_file(s);
     }
     s->perm_change_fd = 0;
 
@@ -4005,6 +4170,10 @@ BlockDriver bdrv_file = {
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
     .bdrv_refresh_limits = raw_refresh_limits,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
@@ -4475,6 +4644,10 @@ static BlockDriver bdrv_host_device = {
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
     .bdrv_refresh_limits = raw_refresh_limits,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
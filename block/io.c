@@ -1773,14 +1773,60 @@ int coroutine_fn bdrv_co_preadv(BdrvChild *child,
     return bdrv_co_preadv_part(child, offset, bytes, qiov, 0, flags);
 }
 
+static int coroutine_fn GRAPH_RDLOCK
+bdrv_co_do_preadv_part(BdrvChild *child, int64_t offset, int64_t bytes,
+                       QEMUIOVector *qiov, size_t qiov_offset,
+                       BdrvRequestFlags flags)
+{
+    BlockDriverState *bs = child->bs;
+    BdrvTrackedRequest req;
+    BdrvRequestPadding pad;
+    int ret;
+
+    bdrv_inc_in_flight(bs);
+
+    /* Don't do copy-on-read if we read data before write operation */
+    if (qatomic_read(&bs->copy_on_read)) {
+        flags |= BDRV_REQ_COPY_ON_READ;
+    }
+
+    ret = bdrv_pad_request(bs, &qiov, &qiov_offset, &offset, &bytes, false,
+                           &pad, NULL, &flags);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_READ);
+    ret = bdrv_aligned_preadv(child, &req, offset, bytes,
+                              bs->bl.request_alignment,
+                              qiov, qiov_offset, flags);
+    tracked_request_end(&req);
+    bdrv_padding_finalize(&pad);
+
+fail:
+    bdrv_dec_in_flight(bs);
+
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+bdrv_co_merge_rw(BdrvChild *child, int64_t offset, int64_t bytes,
+                 QEMUIOVector *qiov, size_t qiov_offset,
+                 BdrvRequestFlags flags, bool is_write);
+
+static bool bdrv_merge_enabled(BlockDriverState *bs, QEMUIOVector *qiov,
+                               BdrvRequestFlags flags)
+{
+    return qatomic_read(&bs->merge.window_ns) && qiov &&
+           !(flags & ~(BDRV_REQ_REGISTERED_BUF | BDRV_REQ_FUA));
+}
+
 int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
     int64_t offset, int64_t bytes,
     QEMUIOVector *qiov, size_t qiov_offset,
     BdrvRequestFlags flags)
 {
     BlockDriverState *bs = child->bs;
-    BdrvTrackedRequest req;
-    BdrvRequestPadding pad;
     int ret;
     IO_CODE();
 
@@ -1807,30 +1853,13 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
         return 0;
     }
 
-    bdrv_inc_in_flight(bs);
-
-    /* Don't do copy-on-read if we read data before write operation */
-    if (qatomic_read(&bs->copy_on_read)) {
-        flags |= BDRV_REQ_COPY_ON_READ;
+    if (bdrv_merge_enabled(bs, qiov, flags)) {
+        return bdrv_co_merge_rw(child, offset, bytes, qiov, qiov_offset,
+                                flags, false);
     }
 
-    ret = bdrv_pad_request(bs, &qiov, &qiov_offset, &offset, &bytes, false,
-                           &pad, NULL, &flags);
-    if (ret < 0) {
-        goto fail;
-    }
-
-    tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_READ);
-    ret = bdrv_aligned_preadv(child, &req, offset, bytes,
-                              bs->bl.request_alignment,
-                              qiov, qiov_offset, flags);
-    tracked_request_end(&req);
-    bdrv_padding_finalize(&pad);
-
-fail:
-    bdrv_dec_in_flight(bs);
-
-    return ret;
+    return bdrv_co_do_preadv_part(child, offset, bytes, qiov, qiov_offset,
+                                  flags);
 }
 
 static int coroutine_fn GRAPH_RDLOCK
@@ -2233,9 +2262,10 @@ int coroutine_fn bdrv_co_pwritev(BdrvChild *child,
     return bdrv_co_pwritev_part(child, offset, bytes, qiov, 0, flags);
 }
 
-int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
-    int64_t offset, int64_t bytes, QEMUIOVector *qiov, size_t qiov_offset,
-    BdrvRequestFlags flags)
+static int coroutine_fn GRAPH_RDLOCK
+bdrv_co_do_pwritev_part(BdrvChild *child, int64_t offset, int64_t bytes,
+                        QEMUIOVector *qiov, size_t qiov_offset,
+                        BdrvRequestFlags flags)
 {
     BlockDriverState *bs = child->bs;
     BdrvTrackedRequest req;
@@ -2243,6 +2273,60 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
     BdrvRequestPadding pad;
     int ret;
     bool padded = false;
+
+    if (!(flags & BDRV_REQ_ZERO_WRITE)) {
+        /*
+         * Pad request for following read-modify-write cycle.
+         * bdrv_co_do_zero_pwritev() does aligning by itself, so, we do
+         * alignment only if there is no ZERO flag.
+         */
+        ret = bdrv_pad_request(bs, &qiov, &qiov_offset, &offset, &bytes, true,
+                               &pad, &padded, &flags);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    bdrv_inc_in_flight(bs);
+    tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_WRITE);
+
+    if (flags & BDRV_REQ_ZERO_WRITE) {
+        assert(!padded);
+        ret = bdrv_co_do_zero_pwritev(child, offset, bytes, flags, &req);
+        goto out;
+    }
+
+    if (padded) {
+        /*
+         * Request was unaligned to request_alignment and therefore
+         * padded.  We are going to do read-modify-write, and must
+         * serialize the request to prevent interactions of the
+         * widened region with other transactions.
+         */
+        assert(!(flags & BDRV_REQ_NO_WAIT));
+        bdrv_make_request_serialising(&req, align);
+        bdrv_padding_rmw_read(child, &req, &pad, false);
+    }
+
+    ret = bdrv_aligned_pwritev(child, &req, offset, bytes, align,
+                               qiov, qiov_offset, flags);
+
+    bdrv_padding_finalize(&pad);
+
+out:
+    tracked_request_end(&req);
+    bdrv_dec_in_flight(bs);
+
+    return ret;
+}
+
+int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
+    int64_t offset, int64_t bytes, QEMUIOVector *qiov, size_t qiov_offset,
+    BdrvRequestFlags flags)
+{
+    BlockDriverState *bs = child->bs;
+    uint64_t align = bs->bl.request_alignment;
+    int ret;
     IO_CODE();
 
     trace_bdrv_co_pwritev_part(child->bs, offset, bytes, flags);
@@ -2279,49 +2363,328 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
         return 0;
     }
 
-    if (!(flags & BDRV_REQ_ZERO_WRITE)) {
-        /*
-         * Pad request for following read-modify-write cycle.
-         * bdrv_co_do_zero_pwritev() does aligning by itself, so, we do
-         * alignment only if there is no ZERO flag.
-         */
-        ret = bdrv_pad_request(bs, &qiov, &qiov_offset, &offset, &bytes, true,
-                               &pad, &padded, &flags);
-        if (ret < 0) {
-            return ret;
+    if (bdrv_merge_enabled(bs, qiov, flags)) {
+        return bdrv_co_merge_rw(child, offset, bytes, qiov, qiov_offset,
+                                flags, true);
+    }
+
+    return bdrv_co_do_pwritev_part(child, offset, bytes, qiov, qiov_offset,
+                                   flags);
+}
+
+/*
+ * Request coalescing
+ *
+ * With the merge-window option set, a read or write that cannot join a
+ * batch may open one and wait for up to the current budget, so that
+ * requests adjacent to it can join before the batch is submitted as a
+ * single request.
+ *
+ * Only requests that continue a sequential stream, i.e. start where one
+ * of the last BDRV_MERGE_STREAMS requests ended, open a batch; random
+ * requests are never held back.  The budget is the time until the next
+ * request is expected: by Little's law, requests arrive at a rate of
+ * queue depth / latency, so the budget is the average latency divided by
+ * the average queue depth, capped at merge-window.  A request never
+ * waits when it is the only one in flight on the node: at queue depth
+ * one the next request only comes after this one completed.
+ */
+
+/* Maximum number of requests merged into one */
+#define BDRV_MERGE_MAX_REQS         32
+
+/* BdrvMergeState.depth is in units of 1/BDRV_MERGE_DEPTH_SCALE */
+#define BDRV_MERGE_DEPTH_SCALE      16
+
+typedef struct BdrvMergeReq {
+    int64_t offset;
+    int64_t bytes;
+    QEMUIOVector *qiov;
+    size_t qiov_offset;
+
+    /* Set by the batch leader once the merged request completed */
+    bool done;
+    int ret;
+} BdrvMergeReq;
+
+struct BdrvMergeBatch {
+    BdrvMergeState *state;
+    BdrvChild *child;
+    bool is_write;
+    BdrvRequestFlags flags;
+
+    /* Range covered by the requests so far, which are adjacent */
+    int64_t start;
+    int64_t end;
+    int niov;
+
+    int nb_reqs;
+    BdrvMergeReq *reqs[BDRV_MERGE_MAX_REQS];
+
+    /*
+     * Removed from BdrvMergeState.batches, nobody can join anymore.  Set
+     * once under the lock, by the timer or by the request that fills the
+     * batch, which then wakes the leader.
+     */
+    bool closed;
+
+    /* The leader waits in @leader until @closed, others in @waiters */
+    QEMUTimer timer;
+    CoQueue leader;
+    CoQueue waiters;
+    QLIST_ENTRY(BdrvMergeBatch) next;
+};
+
+static int bdrv_merge_req_cmp(const void *a, const void *b)
+{
+    const BdrvMergeReq *r1 = *(BdrvMergeReq **)a, *r2 = *(BdrvMergeReq **)b;
+
+    return r1->offset < r2->offset ? -1 : r1->offset > r2->offset;
+}
+
+/* Called with m->lock held; returns whether @req joined a batch. */
+static bool coroutine_fn
+bdrv_merge_join(BdrvMergeState *m, BdrvChild *child, BdrvMergeReq *req,
+                BdrvRequestFlags flags, bool is_write)
+{
+    BlockDriverState *bs = child->bs;
+    int64_t max_bytes = MIN_NON_ZERO(bs->bl.max_transfer,
+                                     BDRV_REQUEST_MAX_BYTES);
+    int max_iov = MIN_NON_ZERO(bs->bl.max_iov, IOV_MAX);
+    BdrvMergeBatch *b;
+
+    QLIST_FOREACH(b, &m->batches, next) {
+        if (b->child != child || b->is_write != is_write ||
+            b->flags != flags) {
+            continue;
+        }
+        if (req->offset != b->end && req->offset + req->bytes != b->start) {
+            continue;
+        }
+        if (b->end - b->start > max_bytes - req->bytes ||
+            b->niov > max_iov - req->qiov->niov) {
+            continue;
         }
+
+        b->reqs[b->nb_reqs++] = req;
+        b->start = MIN(b->start, req->offset);
+        b->end = MAX(b->end, req->offset + req->bytes);
+        b->niov += req->qiov->niov;
+        if (b->nb_reqs == BDRV_MERGE_MAX_REQS) {
+            QLIST_REMOVE(b, next);
+            b->closed = true;
+            qemu_co_queue_next(&b->leader);
+        }
+
+        while (!req->done) {
+            qemu_co_queue_wait(&b->waiters, &m->lock);
+        }
+        return true;
+    }
+    return false;
+}
+
+/* Runs in the leader's AioContext once the budget is over */
+static void bdrv_merge_timer_cb(void *opaque)
+{
+    BdrvMergeBatch *b = opaque;
+    BdrvMergeState *m = b->state;
+
+    qemu_mutex_lock(&m->lock);
+    if (!b->closed) {
+        QLIST_REMOVE(b, next);
+        b->closed = true;
+        qemu_co_enter_next(&b->leader, &m->lock);
+    }
+    qemu_mutex_unlock(&m->lock);
+}
+
+/* Moving average with a weight of 1/8 for @sample */
+static uint64_t bdrv_merge_avg(uint64_t avg, uint64_t sample)
+{
+    return avg ? avg - avg / 8 + sample / 8 : sample;
+}
+
+/*
+ * Called with m->lock held when a request arrives.  Returns whether it
+ * continues a sequential stream, and updates the budget for the queue
+ * depth including the new request.
+ */
+static bool bdrv_merge_arrive(BdrvMergeState *m, int64_t offset,
+                              int64_t bytes, bool is_write)
+{
+    uint64_t window = qatomic_read(&m->window_ns);
+    unsigned queued = qatomic_read(&m->queued);
+    bool sequential = false;
+    int i;
+
+    for (i = 0; i < BDRV_MERGE_STREAMS; i++) {
+        if (m->stream_end[i] && m->stream_end[i] == offset &&
+            m->stream_write[i] == is_write) {
+            sequential = true;
+            break;
+        }
+    }
+    if (i == BDRV_MERGE_STREAMS) {
+        i = m->stream_next++ % BDRV_MERGE_STREAMS;
     }
+    m->stream_end[i] = offset + bytes;
+    m->stream_write[i] = is_write;
 
+    m->depth = bdrv_merge_avg(m->depth, queued * BDRV_MERGE_DEPTH_SCALE);
+    if (m->depth > BDRV_MERGE_DEPTH_SCALE) {
+        m->budget_ns = MIN(m->latency_ns * BDRV_MERGE_DEPTH_SCALE / m->depth,
+                           window);
+    } else {
+        m->budget_ns = 0;
+    }
+
+    return sequential;
+}
+
+/* Submit a request or batch, and account for its latency */
+static int coroutine_fn GRAPH_RDLOCK
+bdrv_co_merge_do_rw(BdrvMergeState *m, BdrvChild *child, int64_t offset,
+                    int64_t bytes, QEMUIOVector *qiov, size_t qiov_offset,
+                    BdrvRequestFlags flags, bool is_write)
+{
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t latency;
+    int ret;
+
+    ret = is_write ?
+        bdrv_co_do_pwritev_part(child, offset, bytes, qiov, qiov_offset,
+                                flags) :
+        bdrv_co_do_preadv_part(child, offset, bytes, qiov, qiov_offset,
+                               flags);
+
+    latency = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+    qemu_mutex_lock(&m->lock);
+    m->latency_ns = bdrv_merge_avg(m->latency_ns, MAX(latency, 1));
+    qemu_mutex_unlock(&m->lock);
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+bdrv_co_merge_submit(BdrvMergeState *m, BdrvMergeBatch *b)
+{
+    QEMUIOVector qiov;
+    int i, ret;
+
+    qsort(b->reqs, b->nb_reqs, sizeof(b->reqs[0]), bdrv_merge_req_cmp);
+
+    qemu_iovec_init(&qiov, b->niov);
+    for (i = 0; i < b->nb_reqs; i++) {
+        qemu_iovec_concat(&qiov, b->reqs[i]->qiov, b->reqs[i]->qiov_offset,
+                          b->reqs[i]->bytes);
+    }
+
+    ret = bdrv_co_merge_do_rw(m, b->child, b->start, b->end - b->start,
+                              &qiov, 0, b->flags, b->is_write);
+
+    qemu_iovec_destroy(&qiov);
+    return ret;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+bdrv_co_merge_rw(BdrvChild *child, int64_t offset, int64_t bytes,
+                 QEMUIOVector *qiov, size_t qiov_offset,
+                 BdrvRequestFlags flags, bool is_write)
+{
+    BlockDriverState *bs = child->bs;
+    BdrvMergeState *m = &bs->merge;
+    BdrvMergeReq req = {
+        .offset = offset,
+        .bytes = bytes,
+        .qiov = qiov,
+        .qiov_offset = qiov_offset,
+    };
+    BdrvMergeBatch batch = {
+        .state = m,
+        .child = child,
+        .is_write = is_write,
+        .flags = flags,
+        .start = offset,
+        .end = offset + bytes,
+        .niov = qiov->niov,
+        .nb_reqs = 1,
+        .reqs = { &req },
+    };
+    bool sequential;
+    uint64_t budget;
+    int i, ret;
+
+    /* Requests waiting in a batch must keep drain from completing */
     bdrv_inc_in_flight(bs);
-    tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_WRITE);
+    qatomic_inc(&m->queued);
 
-    if (flags & BDRV_REQ_ZERO_WRITE) {
-        assert(!padded);
-        ret = bdrv_co_do_zero_pwritev(child, offset, bytes, flags, &req);
+    qemu_mutex_lock(&m->lock);
+    if (is_write) {
+        m->wr_requests++;
+    } else {
+        m->rd_requests++;
+    }
+
+    sequential = bdrv_merge_arrive(m, offset, bytes, is_write);
+
+    if (bdrv_merge_join(m, child, &req, flags, is_write)) {
+        qemu_mutex_unlock(&m->lock);
+        ret = req.ret;
         goto out;
     }
 
-    if (padded) {
-        /*
-         * Request was unaligned to request_alignment and therefore
-         * padded.  We are going to do read-modify-write, and must
-         * serialize the request to prevent interactions of the
-         * widened region with other transactions.
-         */
-        assert(!(flags & BDRV_REQ_NO_WAIT));
-        bdrv_make_request_serialising(&req, align);
-        bdrv_padding_rmw_read(child, &req, &pad, false);
+    budget = m->budget_ns;
+    if (!sequential || qatomic_read(&m->queued) <= 1 || !budget) {
+        qemu_mutex_unlock(&m->lock);
+        ret = bdrv_co_merge_do_rw(m, child, offset, bytes, qiov, qiov_offset,
+                                  flags, is_write);
+        goto out;
     }
 
-    ret = bdrv_aligned_pwritev(child, &req, offset, bytes, align,
-                               qiov, qiov_offset, flags);
+    /*
+     * Requests for the node may arrive in other threads, so the leader
+     * is woken through the lock rather than with qemu_co_sleep_wake(),
+     * and checks @closed before it waits so that no wakeup is lost.
+     */
+    m->held++;
+    qemu_co_queue_init(&batch.leader);
+    qemu_co_queue_init(&batch.waiters);
+    QLIST_INSERT_HEAD(&m->batches, &batch, next);
+    aio_timer_init(qemu_get_current_aio_context(), &batch.timer,
+                   QEMU_CLOCK_REALTIME, SCALE_NS, bdrv_merge_timer_cb, &batch);
+    timer_mod(&batch.timer, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + budget);
+    while (!batch.closed) {
+        qemu_co_queue_wait(&batch.leader, &m->lock);
+    }
+    timer_del(&batch.timer);
+
+    if (is_write) {
+        m->wr_merged += batch.nb_reqs - 1;
+    } else {
+        m->rd_merged += batch.nb_reqs - 1;
+    }
+    qemu_mutex_unlock(&m->lock);
 
-    bdrv_padding_finalize(&pad);
+    trace_bdrv_co_merge_rw(bs, is_write, batch.start,
+                           batch.end - batch.start, batch.nb_reqs, budget);
+    if (batch.nb_reqs == 1) {
+        ret = bdrv_co_merge_do_rw(m, child, offset, bytes, qiov, qiov_offset,
+                                  flags, is_write);
+    } else {
+        ret = bdrv_co_merge_submit(m, &batch);
+    }
+
+    qemu_mutex_lock(&m->lock);
+    for (i = 0; i < batch.nb_reqs; i++) {
+        batch.reqs[i]->ret = ret;
+        batch.reqs[i]->done = true;
+    }
+    qemu_co_queue_restart_all(&batch.waiters);
+    qemu_mutex_unlock(&m->lock);
 
 out:
-    tracked_request_end(&req);
+    qatomic_dec(&m->queued);
     bdrv_dec_in_flight(bs);
-
     return ret;
 }
 
@@ -43,6 +43,8 @@ static void luring_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
     uint64_t offset = req->offset;
     int fd = req->fd;
     BdrvRequestFlags flags = req->flags;
+    int fixed_file;
+    int buf_index;
 
     switch (req->type) {
     case QEMU_AIO_WRITE:
@@ -64,7 +66,15 @@ static void luring_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
         } else {
             /* The man page says non-vectored is faster than vectored */
             struct iovec *iov = qiov->iov;
-            io_uring_prep_write(sqe, fd, iov->iov_base, iov->iov_len, offset);
+
+            buf_index = aio_fixed_buf_index(iov->iov_base, iov->iov_len);
+            if (buf_index >= 0) {
+                io_uring_prep_write_fixed(sqe, fd, iov->iov_base, iov->iov_len,
+                                          offset, buf_index);
+            } else {
+                io_uring_prep_write(sqe, fd, iov->iov_base, iov->iov_len,
+                                    offset);
+            }
         }
         break;
     }
@@ -82,8 +92,15 @@ static void luring_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
         } else {
             /* The man page says non-vectored is faster than vectored */
             struct iovec *iov = qiov->iov;
-            io_uring_prep_read(sqe, fd, iov->iov_base, iov->iov_len,
-                               offset + req->total_read);
+
+            buf_index = aio_fixed_buf_index(iov->iov_base, iov->iov_len);
+            if (buf_index >= 0) {
+                io_uring_prep_read_fixed(sqe, fd, iov->iov_base, iov->iov_len,
+                                         offset + req->total_read, buf_index);
+            } else {
+                io_uring_prep_read(sqe, fd, iov->iov_base, iov->iov_len,
+                                   offset + req->total_read);
+            }
         }
         break;
     }
@@ -95,6 +112,13 @@ static void luring_prep_sqe(struct io_uring_sqe *sqe, void *opaque)
                         __func__, req->type);
         abort();
     }
+
+    /* Saves the kernel a file table lookup and reference per request */
+    fixed_file = aio_fixed_file_index(fd);
+    if (fixed_file >= 0) {
+        sqe->fd = fixed_file;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
 }
 
 /**
@@ -0,0 +1,445 @@
+/*
+ * NVMe passthrough through io_uring uring_cmd
+ *
+ * Every NVMe namespace has a generic character device (/dev/ngXnY) next
+ * to its block device.  io_uring can send NVM commands to it with
+ * IORING_OP_URING_CMD; they still go through the kernel NVMe driver, but
+ * skip the rest of the block layer (I/O scheduler, bio splitting and
+ * merging, page cache).  Unlike block/nvme.c this needs neither VFIO nor
+ * a dedicated PCI function.
+ *
+ * Each AioContext has a ring of its own, which the kernel maps onto the
+ * NVMe queue of the CPU that submits.  When the kernel supports it, the
+ * ring is created with IORING_SETUP_IOPOLL: completions are then polled
+ * from a BH for as long as requests are in flight rather than signalled
+ * by an interrupt and an eventfd.
+ *
+ * Copyright (c) 2026 the Oro Operating System Project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include <liburing.h>
+#include <linux/nvme_ioctl.h>
+#include "qemu/aio.h"
+#include "qemu/coroutine.h"
+#include "qemu/cutils.h"
+#include "qemu/defer-call.h"
+#include "qemu/event_notifier.h"
+#include "qapi/error.h"
+#include "block/block.h"
+#include "block/nvme.h"
+#include "block/raw-aio.h"
+#include "trace.h"
+
+#define NVME_URING_ENTRIES 128
+
+/* used when sysfs does not tell the queue limits of the namespace */
+#define NVME_URING_DEFAULT_MAX_TRANSFER (128 * KiB)
+#define NVME_URING_DEFAULT_MAX_SEGMENTS 127
+
+typedef struct {
+    Coroutine *co;
+    NvmeUringState *s;
+    int ret;
+} NvmeUringRequest;
+
+struct NvmeUringState {
+    AioContext *aio_context;
+    struct io_uring ring;
+    bool iopoll;
+
+    /* signalled by the kernel on completions unless @iopoll */
+    EventNotifier e;
+    /* polls the ring while requests are in flight if @iopoll */
+    QEMUBH *completion_bh;
+
+    /* No locking required, only accessed from AioContext home thread */
+    unsigned int in_flight;
+    CoQueue free_queue;
+};
+
+static void nvme_uring_submit(NvmeUringState *s)
+{
+    int ret;
+
+    do {
+        ret = io_uring_submit(&s->ring);
+    } while (ret == -EINTR);
+
+    if (s->iopoll && s->in_flight) {
+        qemu_bh_schedule(s->completion_bh);
+    }
+}
+
+static void nvme_uring_process_completions(NvmeUringState *s)
+{
+    struct io_uring_cqe *cqe;
+
+    defer_call_begin();
+
+    /* on an IOPOLL ring, this polls the device for completions */
+    while (io_uring_peek_cqe(&s->ring, &cqe) == 0) {
+        NvmeUringRequest *req = io_uring_cqe_get_data(cqe);
+
+        /* a positive result is an NVMe status code */
+        req->ret = cqe->res > 0 ? -EIO : cqe->res;
+        trace_nvme_uring_complete(req, cqe->res);
+        io_uring_cqe_seen(&s->ring, cqe);
+        s->in_flight--;
+
+        /*
+         * If the coroutine is already entered it must be in
+         * nvme_uring_co_submit() and will notice req->ret has been filled
+         * in when it eventually runs later.
+         */
+        if (!qemu_coroutine_entered(req->co)) {
+            aio_co_wake(req->co);
+        }
+    }
+
+    while (s->in_flight < NVME_URING_ENTRIES &&
+           qemu_co_enter_next(&s->free_queue, NULL)) {
+        /* each woken request takes a slot again */
+    }
+
+    defer_call_end();
+}
+
+static void nvme_uring_completion_bh(void *opaque)
+{
+    NvmeUringState *s = opaque;
+
+    nvme_uring_process_completions(s);
+    if (s->in_flight) {
+        qemu_bh_schedule(s->completion_bh);
+    }
+}
+
+static void nvme_uring_completion_cb(EventNotifier *e)
+{
+    NvmeUringState *s = container_of(e, NvmeUringState, e);
+
+    if (event_notifier_test_and_clear(&s->e)) {
+        nvme_uring_process_completions(s);
+    }
+}
+
+static bool nvme_uring_poll_cb(void *opaque)
+{
+    EventNotifier *e = opaque;
+    NvmeUringState *s = container_of(e, NvmeUringState, e);
+
+    return io_uring_cq_ready(&s->ring);
+}
+
+static void nvme_uring_poll_ready(EventNotifier *opaque)
+{
+    EventNotifier *e = opaque;
+    NvmeUringState *s = container_of(e, NvmeUringState, e);
+
+    nvme_uring_process_completions(s);
+}
+
+static void nvme_uring_deferred_fn(void *opaque)
+{
+    nvme_uring_submit(opaque);
+}
+
+static struct io_uring_sqe *nvme_uring_get_sqe(NvmeUringState *s)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&s->ring);
+
+    if (unlikely(!sqe)) {
+        /* in_flight is bounded by the ring size, so this frees sqes */
+        nvme_uring_submit(s);
+        sqe = io_uring_get_sqe(&s->ring);
+        assert(sqe);
+    }
+    return sqe;
+}
+
+int coroutine_fn nvme_uring_co_submit(int fd, const NvmeUringNs *ns,
+                                      uint64_t offset, uint64_t bytes,
+                                      QEMUIOVector *qiov, int type,
+                                      BdrvRequestFlags flags)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    NvmeUringRequest req = {
+        .co     = qemu_coroutine_self(),
+        .s      = aio_get_nvme_uring(ctx),
+        .ret    = -EINPROGRESS,
+    };
+    NvmeUringState *s = req.s;
+    uint64_t slba = offset >> ns->lba_shift;
+    uint32_t cdw12 = 0;
+    struct io_uring_sqe *sqe;
+    struct nvme_uring_cmd *cmd;
+
+    assert(QEMU_IS_ALIGNED(offset | bytes, 1 << ns->lba_shift));
+    if (type != QEMU_AIO_FLUSH) {
+        assert(bytes && (bytes >> ns->lba_shift) <= 0x10000);
+        cdw12 = (bytes >> ns->lba_shift) - 1;
+    }
+
+    while (s->in_flight >= NVME_URING_ENTRIES) {
+        qemu_co_queue_wait(&s->free_queue, NULL);
+    }
+
+    sqe = nvme_uring_get_sqe(s);
+    io_uring_prep_rw(IORING_OP_URING_CMD, sqe, fd, NULL, 0, 0);
+    sqe->cmd_op = NVME_URING_CMD_IO;
+    io_uring_sqe_set_data(sqe, &req);
+
+    cmd = (struct nvme_uring_cmd *)sqe->cmd;
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->nsid = ns->nsid;
+
+    switch (type) {
+    case QEMU_AIO_READ:
+    case QEMU_AIO_WRITE:
+        cmd->opcode = type == QEMU_AIO_READ ? NVME_CMD_READ : NVME_CMD_WRITE;
+        if (flags & BDRV_REQ_FUA) {
+            cdw12 |= 1 << 30;
+        }
+        if (qiov->niov == 1) {
+            cmd->addr = (uintptr_t)qiov->iov[0].iov_base;
+            cmd->data_len = qiov->iov[0].iov_len;
+        } else {
+            sqe->cmd_op = NVME_URING_CMD_IO_VEC;
+            cmd->addr = (uintptr_t)qiov->iov;
+            cmd->data_len = qiov->niov;
+        }
+        break;
+    case QEMU_AIO_WRITE_ZEROES:
+        cmd->opcode = NVME_CMD_WRITE_ZEROES;
+        if (flags & BDRV_REQ_MAY_UNMAP) {
+            cdw12 |= 1 << 25;
+        }
+        if (flags & BDRV_REQ_FUA) {
+            cdw12 |= 1 << 30;
+        }
+        break;
+    case QEMU_AIO_FLUSH:
+        cmd->opcode = NVME_CMD_FLUSH;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    cmd->cdw10 = slba;
+    cmd->cdw11 = slba >> 32;
+    cmd->cdw12 = cdw12;
+
+    trace_nvme_uring_co_submit(s, &req, fd, cmd->opcode, offset, bytes);
+    s->in_flight++;
+    defer_call(nvme_uring_deferred_fn, s);
+
+    if (req.ret == -EINPROGRESS) {
+        qemu_coroutine_yield();
+    }
+    return req.ret;
+}
+
+static int nvme_uring_identify(int fd, uint32_t nsid, uint32_t cns,
+                               void *buf)
+{
+    struct nvme_admin_cmd cmd = {
+        .opcode = NVME_ADM_CMD_IDENTIFY,
+        .nsid = nsid,
+        .addr = (uintptr_t)buf,
+        .data_len = NVME_IDENTIFY_DATA_SIZE,
+        .cdw10 = cns,
+    };
+    int ret;
+
+    ret = ioctl(fd, NVME_IOCTL_ADMIN_CMD, &cmd);
+    if (ret < 0) {
+        return -errno;
+    }
+    /* a positive result is an NVMe status code */
+    return ret ? -EIO : 0;
+}
+
+/*
+ * The generic device ngXnY shares its queue limits with the block device
+ * nvmeXnY, look them up there.
+ */
+static int64_t nvme_uring_sysfs_limit(int fd, const char *attr)
+{
+    g_autofree char *link = NULL, *path = NULL, *contents = NULL;
+    const char *name;
+    struct stat st;
+    int64_t val;
+
+    if (fstat(fd, &st) < 0) {
+        return -errno;
+    }
+    link = g_strdup_printf("/sys/dev/char/%u:%u", major(st.st_rdev),
+                           minor(st.st_rdev));
+    path = g_file_read_link(link, NULL);
+    if (!path) {
+        return -ENOENT;
+    }
+    name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    if (!g_str_has_prefix(name, "ng")) {
+        return -ENOENT;
+    }
+
+    g_free(path);
+    path = g_strdup_printf("/sys/block/nvme%s/queue/%s", name + 2, attr);
+    if (!g_file_get_contents(path, &contents, NULL, NULL) ||
+        qemu_strtoi64(contents, NULL, 10, &val) < 0) {
+        return -ENOENT;
+    }
+    return val;
+}
+
+int nvme_uring_probe(int fd, NvmeUringNs *ns, Error **errp)
+{
+    QEMU_AUTO_VFREE union {
+        NvmeIdCtrl ctrl;
+        NvmeIdNs ns;
+    } *id = NULL;
+    struct stat st;
+    NvmeLBAF *lbaf;
+    int64_t max_hw_sectors_kb, max_segments;
+    int nsid, ret;
+
+    if (fstat(fd, &st) < 0 || !S_ISCHR(st.st_mode)) {
+        return 0;
+    }
+    nsid = ioctl(fd, NVME_IOCTL_ID);
+    if (nsid <= 0) {
+        /* not an NVMe namespace */
+        return 0;
+    }
+
+    id = qemu_memalign(qemu_real_host_page_size(), sizeof(*id));
+
+    memset(id, 0, sizeof(*id));
+    ret = nvme_uring_identify(fd, 0, NVME_ID_CNS_CTRL, id);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to identify NVMe controller");
+        return ret;
+    }
+    ns->supports_write_zeroes =
+        !!(le16_to_cpu(id->ctrl.oncs) & NVME_ONCS_WRITE_ZEROES);
+
+    memset(id, 0, sizeof(*id));
+    ret = nvme_uring_identify(fd, nsid, NVME_ID_CNS_NS, id);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Failed to identify NVMe namespace");
+        return ret;
+    }
+
+    lbaf = &id->ns.lbaf[NVME_ID_NS_FLBAS_INDEX(id->ns.flbas)];
+    if (lbaf->ms) {
+        error_setg(errp, "NVMe namespaces with metadata are not supported");
+        return -ENOTSUP;
+    }
+    if (lbaf->ds < BDRV_SECTOR_BITS || lbaf->ds > 16) {
+        error_setg(errp, "NVMe namespace has unsupported block size (2^%d)",
+                   lbaf->ds);
+        return -ENOTSUP;
+    }
+
+    ns->nsid = nsid;
+    ns->lba_shift = lbaf->ds;
+    ns->nr_lbas = le64_to_cpu(id->ns.nsze);
+    ns->unmap_reads_zeroes =
+        NVME_ID_NS_DLFEAT_WRITE_ZEROES(id->ns.dlfeat) &&
+        NVME_ID_NS_DLFEAT_READ_BEHAVIOR(id->ns.dlfeat) ==
+            NVME_ID_NS_DLFEAT_READ_BEHAVIOR_ZEROES;
+
+    max_hw_sectors_kb = nvme_uring_sysfs_limit(fd, "max_hw_sectors_kb");
+    ns->max_transfer = max_hw_sectors_kb > 0 ?
+                       MIN(max_hw_sectors_kb * KiB, INT_MAX) :
+                       NVME_URING_DEFAULT_MAX_TRANSFER;
+    /* NLB is a 16 bit field */
+    ns->max_transfer = MIN(ns->max_transfer,
+                           (uint64_t)0x10000 << ns->lba_shift);
+    ns->max_transfer = QEMU_ALIGN_DOWN(ns->max_transfer, 1 << ns->lba_shift);
+
+    max_segments = nvme_uring_sysfs_limit(fd, "max_segments");
+    ns->max_segments = max_segments > 0 ? MIN(max_segments, IOV_MAX) :
+                       NVME_URING_DEFAULT_MAX_SEGMENTS;
+
+    trace_nvme_uring_probe(fd, nsid, ns->lba_shift, ns->nr_lbas,
+                           ns->max_transfer, ns->max_segments);
+    return 1;
+}
+
+void nvme_uring_detach_aio_context(NvmeUringState *s, AioContext *old_context)
+{
+    if (!s->iopoll) {
+        aio_set_event_notifier(old_context, &s->e, NULL, NULL, NULL);
+    }
+    qemu_bh_delete(s->completion_bh);
+    s->aio_context = NULL;
+}
+
+void nvme_uring_attach_aio_context(NvmeUringState *s, AioContext *new_context)
+{
+    s->aio_context = new_context;
+    s->completion_bh = aio_bh_new(new_context, nvme_uring_completion_bh, s);
+    if (!s->iopoll) {
+        aio_set_event_notifier(new_context, &s->e,
+                               nvme_uring_completion_cb,
+                               nvme_uring_poll_cb,
+                               nvme_uring_poll_ready);
+    }
+}
+
+NvmeUringState *nvme_uring_init(Error **errp)
+{
+    NvmeUringState *s = g_new0(NvmeUringState, 1);
+    unsigned flags = IORING_SETUP_SQE128 | IORING_SETUP_CQE32;
+    int rc;
+
+    qemu_co_queue_init(&s->free_queue);
+
+    rc = io_uring_queue_init(NVME_URING_ENTRIES, &s->ring,
+                             flags | IORING_SETUP_IOPOLL);
+    if (rc == 0) {
+        s->iopoll = true;
+        return s;
+    }
+
+    /* polled passthrough needs Linux 6.1, fall back to interrupts */
+    rc = io_uring_queue_init(NVME_URING_ENTRIES, &s->ring, flags);
+    if (rc < 0) {
+        error_setg_errno(errp, -rc, "failed to create NVMe io_uring");
+        goto out_free_state;
+    }
+
+    rc = event_notifier_init(&s->e, false);
+    if (rc < 0) {
+        error_setg_errno(errp, -rc, "failed to initialize event notifier");
+        goto out_exit_ring;
+    }
+    rc = io_uring_register_eventfd(&s->ring, event_notifier_get_fd(&s->e));
+    if (rc < 0) {
+        error_setg_errno(errp, -rc, "failed to register io_uring eventfd");
+        goto out_close_efd;
+    }
+    return s;
+
+out_close_efd:
+    event_notifier_cleanup(&s->e);
+out_exit_ring:
+    io_uring_queue_exit(&s->ring);
+out_free_state:
+    g_free(s);
+    return NULL;
+}
+
+void nvme_uring_cleanup(NvmeUringState *s)
+{
+    if (!s->iopoll) {
+        event_notifier_cleanup(&s->e);
+    }
+    io_uring_queue_exit(&s->ring);
+    g_free(s);
+}
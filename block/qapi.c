@@ -24,6 +24,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/lockable.h"
 #include "block/qapi.h"
 #include "block/block_int.h"
 #include "block/dirty-bitmap.h"
@@ -655,6 +656,18 @@ bdrv_query_bds_stats(BlockDriverState *bs, bool blk_level)
 
     s->driver_specific = bdrv_get_specific_stats(bs);
 
+    if (qatomic_read(&bs->merge.window_ns)) {
+        s->merge = g_new0(BlockMergeStats, 1);
+        WITH_QEMU_LOCK_GUARD(&bs->merge.lock) {
+            s->merge->rd_requests = bs->merge.rd_requests;
+            s->merge->wr_requests = bs->merge.wr_requests;
+            s->merge->rd_merged = bs->merge.rd_merged;
+            s->merge->wr_merged = bs->merge.wr_merged;
+            s->merge->budget_ns = bs->merge.budget_ns;
+            s->merge->held = bs->merge.held;
+        }
+    }
+
     parent_child = bdrv_primary_child(bs);
     if (!parent_child ||
         !(parent_child->role & (BDRV_CHILD_DATA | BDRV_CHILD_FILTERED)))
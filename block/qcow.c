@@ -1052,8 +1052,8 @@ static int GRAPH_RDLOCK qcow_make_empty(BlockDriverState *bs)
 /* XXX: put compressed sectors first, then all the cluster aligned
    tables to avoid losing bytes in alignment */
 static int coroutine_fn GRAPH_RDLOCK
-qcow_co_pwritev_compressed(BlockDriverState *bs, int64_t offset, int64_t bytes,
-                           QEMUIOVector *qiov)
+qcow_co_pwritev_compressed_cluster(BlockDriverState *bs, int64_t offset,
+                                   int64_t bytes, QEMUIOVector *qiov)
 {
     BDRVQcowState *s = bs->opaque;
     z_stream strm;
@@ -1134,6 +1134,38 @@ fail:
     return ret;
 }
 
+/* Requests spanning several clusters are compressed one cluster at a time */
+static int coroutine_fn GRAPH_RDLOCK
+qcow_co_pwritev_compressed(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                           QEMUIOVector *qiov)
+{
+    BDRVQcowState *s = bs->opaque;
+    QEMUIOVector cluster_qiov;
+    size_t qiov_offset = 0;
+    int ret;
+
+    if (bytes <= s->cluster_size) {
+        return qcow_co_pwritev_compressed_cluster(bs, offset, bytes, qiov);
+    }
+
+    while (bytes) {
+        int64_t n = MIN(bytes, s->cluster_size);
+
+        qemu_iovec_init_slice(&cluster_qiov, qiov, qiov_offset, n);
+        ret = qcow_co_pwritev_compressed_cluster(bs, offset, n, &cluster_qiov);
+        qemu_iovec_destroy(&cluster_qiov);
+        if (ret < 0) {
+            return ret;
+        }
+
+        offset += n;
+        bytes -= n;
+        qiov_offset += n;
+    }
+
+    return 0;
+}
+
 static int coroutine_fn
 qcow_co_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
 {
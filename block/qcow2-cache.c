@@ -25,16 +25,38 @@
 #include "qemu/osdep.h"
 #include "block/block-io.h"
 #include "qemu/memalign.h"
+#include "qemu/queue.h"
 #include "qcow2.h"
 #include "trace.h"
 
+/*
+ * Tables are replaced with the 2Q policy.  A table that is loaded for the
+ * first time goes to the RECENT queue, which is a FIFO limited to a
+ * quarter of the cache; the offsets of tables evicted from it are
+ * remembered for a while in a ghost ring.  A table that is loaded again
+ * while its offset is still in the ghost ring has proven to be reused and
+ * goes to the FREQUENT queue, an LRU list.  A sequential scan, e.g. from a
+ * backup job, thus only cycles through RECENT and does not push the
+ * working set out of FREQUENT.
+ */
+typedef enum Qcow2CacheQueue {
+    QCOW2_CACHE_FREE,
+    QCOW2_CACHE_RECENT,
+    QCOW2_CACHE_FREQUENT,
+    QCOW2_CACHE_QUEUE__MAX,
+} Qcow2CacheQueue;
+
 typedef struct Qcow2CachedTable {
     int64_t  offset;
     uint64_t lru_counter;
     int      ref;
     bool     dirty;
+    Qcow2CacheQueue queue;
+    QTAILQ_ENTRY(Qcow2CachedTable) next;
 } Qcow2CachedTable;
 
+typedef QTAILQ_HEAD(, Qcow2CachedTable) Qcow2CacheList;
+
 struct Qcow2Cache {
     Qcow2CachedTable       *entries;
     struct Qcow2Cache      *depends;
@@ -44,6 +66,24 @@ struct Qcow2Cache {
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+
+    /* Offset -> entry; the keys point to Qcow2CachedTable.offset */
+    GHashTable             *index;
+
+    /* Most recently used first */
+    Qcow2CacheList          queues[QCOW2_CACHE_QUEUE__MAX];
+    int                     recent_max;
+    int                     nr_recent;
+
+    /* Offsets evicted from RECENT; the keys point into @ghost */
+    uint64_t               *ghost;
+    int                     ghost_size;
+    int                     ghost_next;
+    GHashTable             *ghost_index;
+
+    uint64_t                hits;
+    uint64_t                misses;
+    uint64_t                evictions;
 };
 
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
@@ -71,6 +111,119 @@ static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
     }
 }
 
+static void qcow2_cache_queue(Qcow2Cache *c, int i, Qcow2CacheQueue queue)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+
+    QTAILQ_REMOVE(&c->queues[t->queue], t, next);
+    if (t->queue == QCOW2_CACHE_RECENT) {
+        c->nr_recent--;
+    }
+
+    t->queue = queue;
+    QTAILQ_INSERT_HEAD(&c->queues[queue], t, next);
+    if (queue == QCOW2_CACHE_RECENT) {
+        c->nr_recent++;
+    }
+}
+
+/* Make entry @i hold the table at @offset, or nothing if @offset is 0 */
+static void qcow2_cache_set_offset(Qcow2Cache *c, int i, uint64_t offset)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+
+    if (t->offset) {
+        g_hash_table_remove(c->index, &t->offset);
+    }
+    t->offset = offset;
+    if (offset) {
+        g_hash_table_add(c->index, &t->offset);
+    } else {
+        t->lru_counter = 0;
+        qcow2_cache_queue(c, i, QCOW2_CACHE_FREE);
+    }
+}
+
+static int qcow2_cache_lookup(Qcow2Cache *c, uint64_t offset)
+{
+    int64_t *key = g_hash_table_lookup(c->index, &offset);
+
+    if (!key) {
+        return -1;
+    }
+    return container_of(key, Qcow2CachedTable, offset) - c->entries;
+}
+
+static void qcow2_cache_ghost_add(Qcow2Cache *c, uint64_t offset)
+{
+    uint64_t *slot = &c->ghost[c->ghost_next];
+
+    if (*slot) {
+        g_hash_table_remove(c->ghost_index, slot);
+    }
+    *slot = offset;
+    g_hash_table_add(c->ghost_index, slot);
+    c->ghost_next = (c->ghost_next + 1) % c->ghost_size;
+}
+
+static bool qcow2_cache_ghost_take(Qcow2Cache *c, uint64_t offset)
+{
+    uint64_t *slot = g_hash_table_lookup(c->ghost_index, &offset);
+
+    if (!slot) {
+        return false;
+    }
+    g_hash_table_remove(c->ghost_index, slot);
+    *slot = 0;
+    return true;
+}
+
+static void qcow2_cache_ghost_clear(Qcow2Cache *c)
+{
+    g_hash_table_remove_all(c->ghost_index);
+    memset(c->ghost, 0, c->ghost_size * sizeof(c->ghost[0]));
+    c->ghost_next = 0;
+}
+
+/* The least recently used entry of @queue that is not in use, or -1 */
+static int qcow2_cache_find_victim(Qcow2Cache *c, Qcow2CacheQueue queue)
+{
+    Qcow2CachedTable *t;
+
+    QTAILQ_FOREACH_REVERSE(t, &c->queues[queue], next) {
+        if (t->ref == 0) {
+            return t - c->entries;
+        }
+    }
+    return -1;
+}
+
+/* Pick the entry to replace on a miss, or -1 if all of them are in use */
+static int qcow2_cache_evict(Qcow2Cache *c)
+{
+    Qcow2CacheQueue first, second;
+    int i;
+
+    i = qcow2_cache_find_victim(c, QCOW2_CACHE_FREE);
+    if (i >= 0) {
+        return i;
+    }
+
+    if (c->nr_recent > c->recent_max) {
+        first = QCOW2_CACHE_RECENT;
+        second = QCOW2_CACHE_FREQUENT;
+    } else {
+        first = QCOW2_CACHE_FREQUENT;
+        second = QCOW2_CACHE_RECENT;
+    }
+
+    i = qcow2_cache_find_victim(c, first);
+    if (i < 0) {
+        i = qcow2_cache_find_victim(c, second);
+    }
+    return i;
+}
+
 static void qcow2_cache_table_release(Qcow2Cache *c, int i, int num_tables)
 {
 /* Using MADV_DONTNEED to discard memory is a Linux-specific feature */
@@ -106,8 +259,7 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
-            c->entries[i].lru_counter = 0;
+            qcow2_cache_set_offset(c, i, 0);
             i++;
             to_clean++;
         }
@@ -125,6 +277,7 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2Cache *c;
+    int i;
 
     assert(num_tables > 0);
     assert(is_power_of_2(table_size));
@@ -142,9 +295,23 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
         qemu_vfree(c->table_array);
         g_free(c->entries);
         g_free(c);
-        c = NULL;
+        return NULL;
+    }
+
+    c->index = g_hash_table_new(g_int64_hash, g_int64_equal);
+    for (i = 0; i < QCOW2_CACHE_QUEUE__MAX; i++) {
+        QTAILQ_INIT(&c->queues[i]);
+    }
+    for (i = 0; i < num_tables; i++) {
+        c->entries[i].queue = QCOW2_CACHE_FREE;
+        QTAILQ_INSERT_TAIL(&c->queues[QCOW2_CACHE_FREE], &c->entries[i], next);
     }
 
+    c->recent_max = MAX(num_tables / 4, 1);
+    c->ghost_size = MAX(num_tables / 2, 1);
+    c->ghost = g_new0(uint64_t, c->ghost_size);
+    c->ghost_index = g_hash_table_new(g_int64_hash, g_int64_equal);
+
     return c;
 }
 
@@ -156,6 +323,9 @@ int qcow2_cache_destroy(Qcow2Cache *c)
         assert(c->entries[i].ref == 0);
     }
 
+    g_hash_table_destroy(c->ghost_index);
+    g_free(c->ghost);
+    g_hash_table_destroy(c->index);
     qemu_vfree(c->table_array);
     g_free(c->entries);
     g_free(c);
@@ -309,13 +479,13 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
 
     for (i = 0; i < c->size; i++) {
         assert(c->entries[i].ref == 0);
-        c->entries[i].offset = 0;
-        c->entries[i].lru_counter = 0;
+        qcow2_cache_set_offset(c, i, 0);
     }
 
     qcow2_cache_table_release(c, 0, c->size);
 
     c->lru_counter = 0;
+    qcow2_cache_ghost_clear(c);
 
     return 0;
 }
@@ -325,11 +495,9 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
                    void **table, bool read_from_disk)
 {
     BDRVQcow2State *s = bs->opaque;
+    Qcow2CacheQueue queue;
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     assert(offset != 0);
 
@@ -344,29 +512,24 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     }
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / c->table_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
-        }
-        if (++i == c->size) {
-            i = 0;
+    i = qcow2_cache_lookup(c, offset);
+    if (i >= 0) {
+        c->hits++;
+        if (c->entries[i].queue == QCOW2_CACHE_FREQUENT) {
+            qcow2_cache_queue(c, i, QCOW2_CACHE_FREQUENT);
         }
-    } while (i != lookup_index);
+        goto found;
+    }
 
-    if (min_lru_index == -1) {
+    c->misses++;
+    i = qcow2_cache_evict(c);
+    if (i < 0) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
     /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -375,9 +538,16 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
         return ret;
     }
 
+    if (c->entries[i].offset) {
+        c->evictions++;
+        if (c->entries[i].queue == QCOW2_CACHE_RECENT) {
+            qcow2_cache_ghost_add(c, c->entries[i].offset);
+        }
+    }
+
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    qcow2_cache_set_offset(c, i, 0);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -390,7 +560,10 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
         }
     }
 
-    c->entries[i].offset = offset;
+    queue = qcow2_cache_ghost_take(c, offset) ? QCOW2_CACHE_FREQUENT
+                                              : QCOW2_CACHE_RECENT;
+    qcow2_cache_set_offset(c, i, offset);
+    qcow2_cache_queue(c, i, queue);
 
     /* And return the right table */
 found:
@@ -438,14 +611,9 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
 
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
-    int i;
+    int i = qcow2_cache_lookup(c, offset);
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(c, i);
-        }
-    }
-    return NULL;
+    return i >= 0 ? qcow2_cache_get_table_addr(c, i) : NULL;
 }
 
 void qcow2_cache_discard(Qcow2Cache *c, void *table)
@@ -454,9 +622,18 @@ void qcow2_cache_discard(Qcow2Cache *c, void *table)
 
     assert(c->entries[i].ref == 0);
 
-    c->entries[i].offset = 0;
-    c->entries[i].lru_counter = 0;
+    qcow2_cache_set_offset(c, i, 0);
     c->entries[i].dirty = false;
 
     qcow2_cache_table_release(c, i, 1);
 }
+
+void qcow2_cache_get_stats(Qcow2Cache *c, Qcow2CacheStats *stats)
+{
+    *stats = (Qcow2CacheStats) {
+        .size = c->size,
+        .hits = c->hits,
+        .misses = c->misses,
+        .evictions = c->evictions,
+    };
+}
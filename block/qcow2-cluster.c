@@ -28,6 +28,7 @@
 #include "block/block-io.h"
 #include "qapi/error.h"
 #include "qcow2.h"
+#include "qemu/bitops.h"
 #include "qemu/bswap.h"
 #include "qemu/memalign.h"
 #include "trace.h"
@@ -260,6 +261,85 @@ int qcow2_write_l1_entry(BlockDriverState *bs, int l1_index)
     return 0;
 }
 
+/*
+ * Read @count entries of the active L1 table starting at @first.  The
+ * entries are converted in a separate buffer, so that concurrent loads of
+ * the same part never expose big endian entries.
+ */
+static int GRAPH_RDLOCK
+qcow2_read_l1_entries(BlockDriverState *bs, uint64_t first, uint64_t count)
+{
+    BDRVQcow2State *s = bs->opaque;
+    g_autofree uint64_t *buf = g_try_new(uint64_t, count);
+    uint64_t i;
+    int ret;
+
+    if (buf == NULL) {
+        return -ENOMEM;
+    }
+
+    ret = bdrv_pread(bs->file, s->l1_table_offset + first * L1E_SIZE,
+                     count * L1E_SIZE, buf, 0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    for (i = 0; i < count; i++) {
+        s->l1_table[first + i] = be64_to_cpu(buf[i]);
+    }
+    return 0;
+}
+
+/*
+ * Make sure that entry @l1_index of the active L1 table was read from the
+ * image.  Only after a lazy open there is something to do: the table is
+ * then read one cluster at a time when it is first needed.
+ */
+int qcow2_load_l1_entry(BlockDriverState *bs, uint64_t l1_index)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t per_cluster = s->cluster_size / L1E_SIZE;
+    uint64_t part = l1_index / per_cluster;
+    uint64_t first = part * per_cluster;
+    int ret;
+
+    if (!s->l1_loaded || test_bit(part, s->l1_loaded)) {
+        return 0;
+    }
+
+    assert(l1_index < s->l1_size);
+    ret = qcow2_read_l1_entries(bs, first,
+                                MIN(per_cluster, s->l1_size - first));
+    if (ret < 0) {
+        return ret;
+    }
+
+    trace_qcow2_load_l1_entry(bs, l1_index);
+    set_bit(part, s->l1_loaded);
+    return 0;
+}
+
+/* Load the parts of the active L1 table that a lazy open skipped. */
+int qcow2_load_l1_table(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    if (!s->l1_loaded) {
+        return 0;
+    }
+
+    /* Entries that are loaded already are read again unchanged */
+    ret = qcow2_read_l1_entries(bs, 0, s->l1_size);
+    if (ret < 0) {
+        return ret;
+    }
+
+    g_free(s->l1_loaded);
+    s->l1_loaded = NULL;
+    return 0;
+}
+
 /*
  * l2_allocate
  *
@@ -620,6 +700,11 @@ int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
         goto out;
     }
 
+    ret = qcow2_load_l1_entry(bs, l1_index);
+    if (ret < 0) {
+        return ret;
+    }
+
     l2_offset = s->l1_table[l1_index] & L1E_OFFSET_MASK;
     if (!l2_offset) {
         type = QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN;
@@ -773,6 +858,8 @@ get_cluster_table(BlockDriverState *bs, uint64_t offset,
     }
 
     assert(l1_index < s->l1_size);
+    /* Only read-only images are opened lazily */
+    assert(!s->l1_loaded);
     l2_offset = s->l1_table[l1_index] & L1E_OFFSET_MASK;
     if (offset_into_cluster(s, l2_offset)) {
         qcow2_signal_corruption(bs, true, -1, -1, "L2 table offset %#" PRIx64
@@ -1597,13 +1684,16 @@ out:
  * *host_offset is updated to contain the offset into the image file at which
  * the first allocated cluster starts.
  *
+ * Clusters left in @res are used before new ones are allocated.
+ *
  * Return 0 on success and -errno in error cases. -EAGAIN means that the
  * function has been waiting for another request and the allocation must be
  * restarted, but the whole request should not be failed.
  */
 static int coroutine_fn GRAPH_RDLOCK
 do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
-                        uint64_t *host_offset, uint64_t *nb_clusters)
+                        uint64_t *host_offset, uint64_t *nb_clusters,
+                        Qcow2AllocReservation *res)
 {
     BDRVQcow2State *s = bs->opaque;
 
@@ -1617,6 +1707,16 @@ do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
         return 0;
     }
 
+    /* Use the clusters that the caller took from its pool */
+    if (res && res->nb_clusters &&
+        (*host_offset == INV_OFFSET || *host_offset == res->offset)) {
+        *nb_clusters = MIN(*nb_clusters, res->nb_clusters);
+        *host_offset = res->offset;
+        res->offset += *nb_clusters << s->cluster_bits;
+        res->nb_clusters -= *nb_clusters;
+        return 0;
+    }
+
     /* Allocate new clusters */
     trace_qcow2_cluster_alloc_phys(qemu_coroutine_self());
     if (*host_offset == INV_OFFSET) {
@@ -1660,7 +1760,8 @@ do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
  */
 static int coroutine_fn GRAPH_RDLOCK
 handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
-             uint64_t *host_offset, uint64_t *bytes, QCowL2Meta **m)
+             uint64_t *host_offset, uint64_t *bytes, QCowL2Meta **m,
+             Qcow2AllocReservation *res)
 {
     BDRVQcow2State *s = bs->opaque;
     int l2_index;
@@ -1704,7 +1805,7 @@ handle_alloc(BlockDriverState *bs, uint64_t guest_offset,
     alloc_cluster_offset = *host_offset == INV_OFFSET ? INV_OFFSET :
         start_of_cluster(s, *host_offset);
     ret = do_alloc_cluster_offset(bs, guest_offset, &alloc_cluster_offset,
-                                  &nb_clusters);
+                                  &nb_clusters, res);
     if (ret < 0) {
         goto out;
     }
@@ -1775,6 +1876,9 @@ out:
  * allocated clusters (on success) or freeing them (on failure), and
  * for clearing the contents of @m afterwards in both cases.
  *
+ * If @res is not NULL, new clusters are taken from it first, and the
+ * clusters that were not needed are left in it.
+ *
  * If the request conflicts with another write request in flight, the coroutine
  * is queued and will be reentered when the dependency has completed.
  *
@@ -1783,7 +1887,8 @@ out:
 int coroutine_fn qcow2_alloc_host_offset(BlockDriverState *bs, uint64_t offset,
                                          unsigned int *bytes,
                                          uint64_t *host_offset,
-                                         QCowL2Meta **m)
+                                         QCowL2Meta **m,
+                                         Qcow2AllocReservation *res)
 {
     BDRVQcow2State *s = bs->opaque;
     uint64_t start, remaining;
@@ -1873,7 +1978,7 @@ again:
          * 3. If the request still hasn't completed, allocate new clusters,
          *    considering any cluster_offset of steps 1c or 2.
          */
-        ret = handle_alloc(bs, start, &cluster_offset, &cur_bytes, m);
+        ret = handle_alloc(bs, start, &cluster_offset, &cur_bytes, m, res);
         if (ret < 0) {
             return ret;
         } else if (ret) {
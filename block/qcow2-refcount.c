@@ -98,17 +98,32 @@ static void update_max_refcount_table_index(BDRVQcow2State *s)
     s->max_refcount_table_index = i;
 }
 
+/*
+ * If s->refcount_table_deferred is set, the refcount table is not read
+ * here but by qcow2_read_refcount_table(), when the image becomes
+ * writable or a refcount is first looked up.
+ */
 int coroutine_fn qcow2_refcount_init(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
-    unsigned int refcount_table_size2, i;
-    int ret;
 
     assert(s->refcount_order >= 0 && s->refcount_order <= 6);
 
     s->get_refcount = get_refcount_funcs[s->refcount_order];
     s->set_refcount = set_refcount_funcs[s->refcount_order];
 
+    if (s->refcount_table_deferred) {
+        return 0;
+    }
+    return qcow2_read_refcount_table(bs);
+}
+
+int qcow2_read_refcount_table(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    unsigned int refcount_table_size2, i;
+    int ret;
+
     assert(s->refcount_table_size <= INT_MAX / REFTABLE_ENTRY_SIZE);
     refcount_table_size2 = s->refcount_table_size * REFTABLE_ENTRY_SIZE;
     s->refcount_table = g_try_malloc(refcount_table_size2);
@@ -118,9 +133,9 @@ int coroutine_fn qcow2_refcount_init(BlockDriverState *bs)
             ret = -ENOMEM;
             goto fail;
         }
-        BLKDBG_CO_EVENT(bs->file, BLKDBG_REFTABLE_LOAD);
-        ret = bdrv_co_pread(bs->file, s->refcount_table_offset,
-                            refcount_table_size2, s->refcount_table, 0);
+        BLKDBG_EVENT(bs->file, BLKDBG_REFTABLE_LOAD);
+        ret = bdrv_pread(bs->file, s->refcount_table_offset,
+                         refcount_table_size2, s->refcount_table, 0);
         if (ret < 0) {
             goto fail;
         }
@@ -128,8 +143,11 @@ int coroutine_fn qcow2_refcount_init(BlockDriverState *bs)
             be64_to_cpus(&s->refcount_table[i]);
         update_max_refcount_table_index(s);
     }
+    s->refcount_table_deferred = false;
     return 0;
  fail:
+    g_free(s->refcount_table);
+    s->refcount_table = NULL;
     return ret;
 }
 
@@ -253,6 +271,13 @@ int qcow2_get_refcount(BlockDriverState *bs, int64_t cluster_index,
     int ret;
     void *refcount_block;
 
+    if (s->refcount_table_deferred) {
+        ret = qcow2_read_refcount_table(bs);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
     refcount_table_index = cluster_index >> s->refcount_block_bits;
     if (refcount_table_index >= s->refcount_table_size) {
         *refcount = 0;
@@ -1028,6 +1053,210 @@ int64_t qcow2_alloc_clusters(BlockDriverState *bs, uint64_t size)
     return offset;
 }
 
+/*
+ * Return the pool of @ctx, creating it if needed.  An empty pool adopts
+ * the clusters of a pool that no AioContext owns.  Called with
+ * s->alloc_pools_lock held; the pool must not be used after dropping it.
+ */
+static Qcow2AllocPool *qcow2_alloc_pool_get(BDRVQcow2State *s,
+                                            AioContext *ctx)
+{
+    Qcow2AllocPool *pool, *orphan;
+
+    QLIST_FOREACH(pool, &s->alloc_pools, next) {
+        if (pool->ctx == ctx) {
+            break;
+        }
+    }
+    if (!pool) {
+        pool = g_new0(Qcow2AllocPool, 1);
+        pool->ctx = ctx;
+        QLIST_INSERT_HEAD(&s->alloc_pools, pool, next);
+    }
+
+    if (pool->nb_clusters == 0) {
+        QLIST_FOREACH(orphan, &s->alloc_pools, next) {
+            if (!orphan->ctx) {
+                pool->offset = orphan->offset;
+                pool->nb_clusters = orphan->nb_clusters;
+                QLIST_REMOVE(orphan, next);
+                g_free(orphan);
+                break;
+            }
+        }
+    }
+
+    return pool;
+}
+
+/*
+ * Add @nb_clusters clusters at @offset to @pool, or keep them in a pool
+ * of their own if they are not contiguous with it.  Called with
+ * s->alloc_pools_lock held.
+ */
+static void qcow2_alloc_pool_give(BDRVQcow2State *s, Qcow2AllocPool *pool,
+                                  uint64_t offset, uint64_t nb_clusters)
+{
+    Qcow2AllocPool *orphan;
+
+    if (pool->nb_clusters == 0) {
+        pool->offset = offset;
+        pool->nb_clusters = nb_clusters;
+    } else if (offset + (nb_clusters << s->cluster_bits) == pool->offset) {
+        pool->offset = offset;
+        pool->nb_clusters += nb_clusters;
+    } else if (pool->offset + (pool->nb_clusters << s->cluster_bits) ==
+               offset) {
+        pool->nb_clusters += nb_clusters;
+    } else {
+        orphan = g_new0(Qcow2AllocPool, 1);
+        orphan->offset = offset;
+        orphan->nb_clusters = nb_clusters;
+        QLIST_INSERT_HEAD(&s->alloc_pools, orphan, next);
+    }
+}
+
+/*
+ * Take up to res->nb_clusters contiguous clusters for guest data from the
+ * pool of the current AioContext, and set @res to the clusters taken.
+ * res->nb_clusters is 0 on return if the pool could not provide any, in
+ * which case the caller allocates as usual.
+ *
+ * With alloc-pool-size set, each AioContext reserves a chunk of clusters
+ * with a single refcount update and then hands them out to its writes
+ * before they take s->lock.  Only refilling an empty pool takes s->lock,
+ * so writes submitted by different iothreads neither serialize on the
+ * refcount blocks for every allocation nor interleave their clusters in
+ * the image file.  The clusters that a write does not use are given back
+ * with qcow2_alloc_pool_put().
+ *
+ * The image is marked dirty before the first chunk is reserved, so the
+ * clusters still reserved when QEMU crashes are reclaimed by the repair
+ * that runs when the image is opened next.
+ *
+ * Must be called without s->lock.
+ */
+void coroutine_fn
+qcow2_alloc_pool_take(BlockDriverState *bs, Qcow2AllocReservation *res)
+{
+    BDRVQcow2State *s = bs->opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
+    Qcow2AllocPool *pool;
+    uint64_t nb_clusters = res->nb_clusters;
+    int64_t offset;
+    int ret;
+
+    res->nb_clusters = 0;
+    if (nb_clusters == 0 || nb_clusters > s->alloc_pool_clusters / 2) {
+        return;
+    }
+
+    qemu_mutex_lock(&s->alloc_pools_lock);
+    pool = qcow2_alloc_pool_get(s, ctx);
+    if (pool->nb_clusters == 0) {
+        qemu_mutex_unlock(&s->alloc_pools_lock);
+
+        qemu_co_mutex_lock(&s->lock);
+        ret = qcow2_mark_dirty(bs);
+        offset = ret < 0 ? ret :
+            qcow2_alloc_clusters(bs, s->alloc_pool_clusters << s->cluster_bits);
+        qemu_co_mutex_unlock(&s->lock);
+        if (offset < 0) {
+            /* The image may just not have room for a whole chunk */
+            return;
+        }
+        trace_qcow2_alloc_pool_refill(bs, ctx, offset,
+                                      s->alloc_pool_clusters);
+
+        /* Other writes from @ctx may have refilled the pool meanwhile */
+        qemu_mutex_lock(&s->alloc_pools_lock);
+        pool = qcow2_alloc_pool_get(s, ctx);
+        qcow2_alloc_pool_give(s, pool, offset, s->alloc_pool_clusters);
+    }
+
+    res->offset = pool->offset;
+    res->nb_clusters = MIN(nb_clusters, pool->nb_clusters);
+    pool->offset += res->nb_clusters << s->cluster_bits;
+    pool->nb_clusters -= res->nb_clusters;
+    qemu_mutex_unlock(&s->alloc_pools_lock);
+}
+
+/* Give the clusters left in @res back to the pool of the current context */
+void qcow2_alloc_pool_put(BlockDriverState *bs, Qcow2AllocReservation *res)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2AllocPool *pool;
+
+    if (res->nb_clusters == 0) {
+        return;
+    }
+
+    qemu_mutex_lock(&s->alloc_pools_lock);
+    pool = qcow2_alloc_pool_get(s, qemu_get_current_aio_context());
+    qcow2_alloc_pool_give(s, pool, res->offset, res->nb_clusters);
+    qemu_mutex_unlock(&s->alloc_pools_lock);
+
+    res->nb_clusters = 0;
+}
+
+/*
+ * Detach the pools from their AioContexts, which may go away.  Their
+ * clusters stay reserved until another pool adopts them or until
+ * qcow2_alloc_pool_drain(); freeing them here would need I/O, which the
+ * callers cannot do.
+ */
+void qcow2_alloc_pool_release(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2AllocPool *pool, *next_pool;
+
+    qemu_mutex_lock(&s->alloc_pools_lock);
+    QLIST_FOREACH_SAFE(pool, &s->alloc_pools, next, next_pool) {
+        pool->ctx = NULL;
+        if (pool->nb_clusters == 0) {
+            QLIST_REMOVE(pool, next);
+            g_free(pool);
+        }
+    }
+    qemu_mutex_unlock(&s->alloc_pools_lock);
+}
+
+/*
+ * Give the clusters left in the pools back.  Must be called before
+ * anything that relies on every allocated cluster being referenced, and
+ * before the image is closed or inactivated.
+ */
+void qcow2_alloc_pool_drain(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    g_autoptr(GArray) ranges = g_array_new(false, false,
+                                           sizeof(Qcow2AllocReservation));
+    Qcow2AllocPool *pool, *next_pool;
+    Qcow2AllocReservation r;
+    guint i;
+
+    /* qcow2_free_clusters() may yield, so collect the clusters first */
+    qemu_mutex_lock(&s->alloc_pools_lock);
+    QLIST_FOREACH_SAFE(pool, &s->alloc_pools, next, next_pool) {
+        if (pool->nb_clusters) {
+            trace_qcow2_alloc_pool_drain(bs, pool->ctx, pool->offset,
+                                         pool->nb_clusters);
+            r.offset = pool->offset;
+            r.nb_clusters = pool->nb_clusters;
+            g_array_append_val(ranges, r);
+        }
+        QLIST_REMOVE(pool, next);
+        g_free(pool);
+    }
+    qemu_mutex_unlock(&s->alloc_pools_lock);
+
+    for (i = 0; i < ranges->len; i++) {
+        r = g_array_index(ranges, Qcow2AllocReservation, i);
+        qcow2_free_clusters(bs, r.offset, r.nb_clusters << s->cluster_bits,
+                            QCOW2_DISCARD_NEVER);
+    }
+}
+
 int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                                              int64_t nb_clusters)
 {
@@ -55,6 +55,45 @@ void qcow2_free_snapshots(BlockDriverState *bs)
     s->nb_snapshots = 0;
 }
 
+/*
+ * The snapshot table is made of many small variable sized fields.  Read
+ * it through a buffer, so that a table with many snapshots does not take
+ * several requests per snapshot when the image is opened.
+ */
+#define SNAPSHOT_TABLE_BUF_SIZE (64 * KiB)
+
+typedef struct SnapshotTableReader {
+    uint8_t *buf;
+    int64_t start;
+    int64_t len;
+} SnapshotTableReader;
+
+static int coroutine_fn GRAPH_RDLOCK
+snapshot_table_pread(BlockDriverState *bs, SnapshotTableReader *r,
+                     int64_t offset, int64_t bytes, void *dst)
+{
+    int ret;
+
+    if (bytes > SNAPSHOT_TABLE_BUF_SIZE) {
+        return bdrv_co_pread(bs->file, offset, bytes, dst, 0);
+    }
+
+    if (offset < r->start || offset + bytes > r->start + r->len) {
+        /* Reads past the end of the file return zeroes */
+        ret = bdrv_co_pread(bs->file, offset, SNAPSHOT_TABLE_BUF_SIZE,
+                            r->buf, 0);
+        if (ret < 0) {
+            r->len = 0;
+            return ret;
+        }
+        r->start = offset;
+        r->len = SNAPSHOT_TABLE_BUF_SIZE;
+    }
+
+    memcpy(dst, r->buf + (offset - r->start), bytes);
+    return 0;
+}
+
 /*
  * If @repair is true, try to repair a broken snapshot table instead
  * of just returning an error:
@@ -84,6 +123,8 @@ int qcow2_do_read_snapshots(BlockDriverState *bs, bool repair,
                             Error **errp)
 {
     BDRVQcow2State *s = bs->opaque;
+    g_autofree uint8_t *buf = NULL;
+    SnapshotTableReader r = {};
     QCowSnapshotHeader h;
     QCowSnapshotExtraData extra;
     QCowSnapshot *sn;
@@ -100,6 +141,7 @@ int qcow2_do_read_snapshots(BlockDriverState *bs, bool repair,
 
     offset = s->snapshots_offset;
     s->snapshots = g_new0(QCowSnapshot, s->nb_snapshots);
+    r.buf = buf = g_malloc(SNAPSHOT_TABLE_BUF_SIZE);
 
     for(i = 0; i < s->nb_snapshots; i++) {
         bool truncate_unknown_extra_data = false;
@@ -109,7 +151,7 @@ int qcow2_do_read_snapshots(BlockDriverState *bs, bool repair,
 
         /* Read statically sized part of the snapshot header */
         offset = ROUND_UP(offset, 8);
-        ret = bdrv_co_pread(bs->file, offset, sizeof(h), &h, 0);
+        ret = snapshot_table_pread(bs, &r, offset, sizeof(h), &h);
         if (ret < 0) {
             error_setg_errno(errp, -ret, "Failed to read snapshot table");
             goto fail;
@@ -147,8 +189,9 @@ int qcow2_do_read_snapshots(BlockDriverState *bs, bool repair,
         }
 
         /* Read known extra data */
-        ret = bdrv_co_pread(bs->file, offset,
-                            MIN(sizeof(extra), sn->extra_data_size), &extra, 0);
+        ret = snapshot_table_pread(bs, &r, offset,
+                                   MIN(sizeof(extra), sn->extra_data_size),
+                                   &extra);
         if (ret < 0) {
             error_setg_errno(errp, -ret, "Failed to read snapshot table");
             goto fail;
@@ -185,8 +228,8 @@ int qcow2_do_read_snapshots(BlockDriverState *bs, bool repair,
             /* Store unknown extra data */
             unknown_extra_data_size = sn->extra_data_size - sizeof(extra);
             sn->unknown_extra_data = g_malloc(unknown_extra_data_size);
-            ret = bdrv_co_pread(bs->file, offset, unknown_extra_data_size,
-                                sn->unknown_extra_data, 0);
+            ret = snapshot_table_pread(bs, &r, offset, unknown_extra_data_size,
+                                       sn->unknown_extra_data);
             if (ret < 0) {
                 error_setg_errno(errp, -ret,
                                  "Failed to read snapshot table");
@@ -197,7 +240,7 @@ int qcow2_do_read_snapshots(BlockDriverState *bs, bool repair,
 
         /* Read snapshot ID */
         sn->id_str = g_malloc(id_str_size + 1);
-        ret = bdrv_co_pread(bs->file, offset, id_str_size, sn->id_str, 0);
+        ret = snapshot_table_pread(bs, &r, offset, id_str_size, sn->id_str);
         if (ret < 0) {
             error_setg_errno(errp, -ret, "Failed to read snapshot table");
             goto fail;
@@ -207,7 +250,7 @@ int qcow2_do_read_snapshots(BlockDriverState *bs, bool repair,
 
         /* Read snapshot name */
         sn->name = g_malloc(name_size + 1);
-        ret = bdrv_co_pread(bs->file, offset, name_size, sn->name, 0);
+        ret = snapshot_table_pread(bs, &r, offset, name_size, sn->name);
         if (ret < 0) {
             error_setg_errno(errp, -ret, "Failed to read snapshot table");
             goto fail;
@@ -1067,6 +1110,9 @@ int qcow2_snapshot_load_tmp(BlockDriverState *bs,
     s->l1_size = sn->l1_size;
     s->l1_table_offset = sn->l1_table_offset;
     s->l1_table = new_l1_table;
+    /* The snapshot's table is read in full */
+    g_free(s->l1_loaded);
+    s->l1_loaded = NULL;
 
     for(i = 0;i < s->l1_size; i++) {
         be64_to_cpus(&s->l1_table[i]);
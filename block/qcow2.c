@@ -39,6 +39,7 @@
 #include "qemu/cutils.h"
 #include "qemu/bswap.h"
 #include "qemu/memalign.h"
+#include "qemu/bitmap.h"
 #include "qapi/qobject-input-visitor.h"
 #include "qapi/qapi-visit-block-core.h"
 #include "crypto.h"
@@ -604,6 +605,22 @@ static void qcow2_add_check_result(BdrvCheckResult *out,
     }
 }
 
+/* Read the metadata that a lazy open skipped */
+static int GRAPH_RDLOCK qcow2_load_deferred_metadata(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    ret = qcow2_load_l1_table(bs);
+    if (ret < 0) {
+        return ret;
+    }
+    if (s->refcount_table_deferred) {
+        return qcow2_read_refcount_table(bs);
+    }
+    return 0;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_check_locked(BlockDriverState *bs, BdrvCheckResult *result,
                       BdrvCheckMode fix)
@@ -614,6 +631,15 @@ qcow2_co_check_locked(BlockDriverState *bs, BdrvCheckResult *result,
 
     memset(result, 0, sizeof(*result));
 
+    ret = qcow2_load_deferred_metadata(bs);
+    if (ret < 0) {
+        result->check_errors++;
+        return ret;
+    }
+
+    /* Reserved clusters would show up as leaks */
+    qcow2_alloc_pool_drain(bs);
+
     ret = qcow2_check_read_snapshot_table(bs, &snapshot_res, fix);
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
@@ -701,6 +727,7 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_ALLOC_POOL_SIZE,
     NULL
 };
 
@@ -817,6 +844,12 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_ALLOC_POOL_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Size of the chunk of clusters reserved for the writes "
+                    "of each iothread (0 = disabled)",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -942,6 +975,7 @@ cache_clean_timer_del_and_wait(BlockDriverState *bs)
 static void qcow2_detach_aio_context(BlockDriverState *bs)
 {
     cache_clean_timer_del_and_wait(bs);
+    qcow2_alloc_pool_release(bs);
 }
 
 static void qcow2_attach_aio_context(BlockDriverState *bs,
@@ -1051,6 +1085,7 @@ typedef struct Qcow2ReopenState {
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     bool discard_no_unref;
     uint64_t cache_clean_interval;
+    uint64_t alloc_pool_size;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -1151,6 +1186,19 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
         goto fail;
     }
 
+    r->alloc_pool_size = qemu_opt_get_size(opts, QCOW2_OPT_ALLOC_POOL_SIZE, 0);
+    if (r->alloc_pool_size > 1 * GiB) {
+        error_setg(errp, QCOW2_OPT_ALLOC_POOL_SIZE " must not exceed 1 GiB");
+        ret = -EINVAL;
+        goto fail;
+    }
+    if (r->alloc_pool_size && s->qcow_version < 3) {
+        error_setg(errp, QCOW2_OPT_ALLOC_POOL_SIZE " requires a qcow2 image "
+                   "with at least qemu 1.1 compatibility level");
+        ret = -EINVAL;
+        goto fail;
+    }
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1327,6 +1375,8 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
     s->cache_clean_interval = r->cache_clean_interval;
     cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
 
+    s->alloc_pool_clusters = r->alloc_pool_size >> s->cluster_bits;
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1410,6 +1460,9 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     uint64_t ext_end;
     uint64_t l1_vm_state_index;
     bool update_header = false;
+    bool lazy;
+
+    s->open_start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
 
     ret = bdrv_co_pread(bs->file, 0, sizeof(header), &header, 0);
     if (ret < 0) {
@@ -1677,6 +1730,18 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
         goto fail;
     }
 
+    /*
+     * A clean image that is opened read-only can be used without looking
+     * at most of its metadata, which for a large image with many snapshots
+     * is a lot of I/O before the first guest request.  The L1 table is
+     * then read a cluster at a time as it is used, and the refcount table
+     * when it is first needed.  Everything is read at the latest when the
+     * image becomes writable.
+     */
+    lazy = !(flags & (BDRV_O_RDWR | BDRV_O_CHECK)) &&
+           !(s->incompatible_features & QCOW2_INCOMPAT_DIRTY);
+    s->lazy_open = lazy;
+
     if (s->l1_size > 0) {
         s->l1_table = qemu_try_blockalign(bs->file->bs, s->l1_size * L1E_SIZE);
         if (s->l1_table == NULL) {
@@ -1684,6 +1749,11 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
             ret = -ENOMEM;
             goto fail;
         }
+    }
+    if (s->l1_size > 0 && lazy) {
+        s->l1_loaded = bitmap_new(DIV_ROUND_UP(s->l1_size * L1E_SIZE,
+                                               s->cluster_size));
+    } else if (s->l1_size > 0) {
         ret = bdrv_co_pread(bs->file, s->l1_table_offset, s->l1_size * L1E_SIZE,
                             s->l1_table, 0);
         if (ret < 0) {
@@ -1703,6 +1773,7 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
 
     s->flags = flags;
 
+    s->refcount_table_deferred = lazy;
     ret = qcow2_refcount_init(bs);
     if (ret != 0) {
         error_setg_errno(errp, -ret, "Could not initialize refcount handling");
@@ -1710,6 +1781,7 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     QLIST_INIT(&s->cluster_allocs);
+    QLIST_INIT(&s->alloc_pools);
     QTAILQ_INIT(&s->discards);
 
     /* read qcow2 extensions */
@@ -1971,6 +2043,10 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
 #endif
 
     qemu_co_queue_init(&s->thread_task_queue);
+    s->max_threads = MAX(QCOW2_MAX_THREADS, g_get_num_processors());
+
+    s->open_time_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - s->open_start_ns;
+    trace_qcow2_open_done(bs, s->open_time_ns, lazy);
 
     return ret;
 
@@ -1991,6 +2067,8 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     qemu_vfree(s->l1_table);
     /* else pre-write overlap checks in cache_destroy may crash */
     s->l1_table = NULL;
+    g_free(s->l1_loaded);
+    s->l1_loaded = NULL;
     cache_clean_timer_co_locked_del_and_wait(bs);
     if (s->l2_table_cache) {
         qcow2_cache_destroy(s->l2_table_cache);
@@ -2047,6 +2125,7 @@ static int qcow2_open(BlockDriverState *bs, QDict *options, int flags,
     /* Initialise locks */
     qemu_co_mutex_init(&s->lock);
     qemu_co_queue_init(&s->cache_clean_timer_exit);
+    qemu_mutex_init(&s->alloc_pools_lock);
 
     assert(!qemu_in_coroutine());
     assert(qemu_get_current_aio_context() == qemu_get_aio_context());
@@ -2055,6 +2134,9 @@ static int qcow2_open(BlockDriverState *bs, QDict *options, int flags,
                  qemu_coroutine_create(qcow2_open_entry, &qoc));
     AIO_WAIT_WHILE_UNLOCKED(NULL, qoc.ret == -EINPROGRESS);
 
+    if (qoc.ret < 0) {
+        qemu_mutex_destroy(&s->alloc_pools_lock);
+    }
     return qoc.ret;
 }
 
@@ -2084,6 +2166,13 @@ qcow2_reopen_prepare(BDRVReopenState *state,BlockReopenQueue *queue,
     r = g_new0(Qcow2ReopenState, 1);
     state->opaque = r;
 
+    /*
+     * The pools are refilled on the next write if they are still enabled,
+     * and must not keep clusters if they are disabled or the image becomes
+     * read-only.  This must happen before the caches are flushed.
+     */
+    qcow2_alloc_pool_drain(state->bs);
+
     ret = qcow2_update_options_prepare(state->bs, r, state->options,
                                        state->flags, errp);
     if (ret < 0) {
@@ -2106,6 +2195,12 @@ qcow2_reopen_prepare(BDRVReopenState *state,BlockReopenQueue *queue,
         if (ret < 0) {
             goto fail;
         }
+    } else {
+        ret = qcow2_load_deferred_metadata(state->bs);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Could not read qcow2 metadata");
+            goto fail;
+        }
     }
 
     /*
@@ -2469,6 +2564,23 @@ static int coroutine_fn GRAPH_RDLOCK qcow2_co_preadv_task_entry(AioTask *task)
                                 t->qiov, t->qiov_offset);
 }
 
+/* Remember when the first guest request on the image completed */
+static void qcow2_account_first_io(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t ns;
+
+    if (qatomic_read(&s->first_io_ns)) {
+        return;
+    }
+
+    /* 0 means that there was no request yet */
+    ns = MAX(qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - s->open_start_ns, 1);
+    if (qatomic_cmpxchg(&s->first_io_ns, 0, ns) == 0) {
+        trace_qcow2_first_io(bs, ns);
+    }
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
                      QEMUIOVector *qiov, size_t qiov_offset,
@@ -2529,6 +2641,9 @@ out:
         g_free(aio);
     }
 
+    if (ret == 0) {
+        qcow2_account_first_io(bs);
+    }
     return ret;
 }
 
@@ -2771,6 +2886,7 @@ qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
     uint64_t host_offset;
     QCowL2Meta *l2meta = NULL;
     AioTaskPool *aio = NULL;
+    Qcow2AllocReservation res = { 0 };
 
     trace_qcow2_writev_start_req(qemu_coroutine_self(), offset, bytes);
 
@@ -2787,10 +2903,16 @@ qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
                             - offset_in_cluster);
         }
 
+        if (s->alloc_pool_clusters && !has_data_file(bs)) {
+            res.nb_clusters = size_to_clusters(s, offset_in_cluster +
+                                                  cur_bytes);
+            qcow2_alloc_pool_take(bs, &res);
+        }
+
         qemu_co_mutex_lock(&s->lock);
 
         ret = qcow2_alloc_host_offset(bs, offset, &cur_bytes,
-                                      &host_offset, &l2meta);
+                                      &host_offset, &l2meta, &res);
         if (ret < 0) {
             goto out_locked;
         }
@@ -2802,6 +2924,7 @@ qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
         }
 
         qemu_co_mutex_unlock(&s->lock);
+        qcow2_alloc_pool_put(bs, &res);
 
         if (!aio && cur_bytes != bytes) {
             aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
@@ -2827,6 +2950,7 @@ out_locked:
     qcow2_handle_l2meta(bs, &l2meta, false);
 
     qemu_co_mutex_unlock(&s->lock);
+    qcow2_alloc_pool_put(bs, &res);
 
 fail_nometa:
     if (aio) {
@@ -2837,6 +2961,9 @@ fail_nometa:
         g_free(aio);
     }
 
+    if (ret == 0) {
+        qcow2_account_first_io(bs);
+    }
     trace_qcow2_writev_done_req(qemu_coroutine_self(), ret);
 
     return ret;
@@ -2848,6 +2975,8 @@ static int GRAPH_RDLOCK qcow2_inactivate(BlockDriverState *bs)
     int ret, result = 0;
     Error *local_err = NULL;
 
+    qcow2_alloc_pool_drain(bs);
+
     qcow2_store_persistent_dirty_bitmaps(bs, true, &local_err);
     if (local_err != NULL) {
         result = -EINVAL;
@@ -2884,6 +3013,8 @@ qcow2_do_close(BlockDriverState *bs, bool close_data_file)
     qemu_vfree(s->l1_table);
     /* else pre-write overlap checks in cache_destroy may crash */
     s->l1_table = NULL;
+    g_free(s->l1_loaded);
+    s->l1_loaded = NULL;
 
     if (!(s->flags & BDRV_O_INACTIVE)) {
         qcow2_inactivate(bs);
@@ -2920,10 +3051,13 @@ qcow2_do_close(BlockDriverState *bs, bool close_data_file)
 
 static void GRAPH_UNLOCKED qcow2_close(BlockDriverState *bs)
 {
+    BDRVQcow2State *s = bs->opaque;
+
     GLOBAL_STATE_CODE();
     GRAPH_RDLOCK_GUARD_MAINLOOP();
 
     qcow2_do_close(bs, true);
+    qemu_mutex_destroy(&s->alloc_pools_lock);
 }
 
 static void coroutine_fn GRAPH_RDLOCK
@@ -2955,11 +3089,13 @@ qcow2_co_invalidate_cache(BlockDriverState *bs, Error **errp)
     qcow2_do_close(bs, false);
 
     data_file = s->data_file;
+    qemu_mutex_destroy(&s->alloc_pools_lock);
     memset(s, 0, sizeof(BDRVQcow2State));
     s->data_file = data_file;
     /* Re-initialize objects initialized in qcow2_open() */
     qemu_co_mutex_init(&s->lock);
     qemu_co_queue_init(&s->cache_clean_timer_exit);
+    qemu_mutex_init(&s->alloc_pools_lock);
 
     options = qdict_clone_shallow(bs->options);
 
@@ -3361,7 +3497,7 @@ preallocate_co(BlockDriverState *bs, uint64_t offset, uint64_t new_length,
     while (bytes) {
         cur_bytes = MIN(bytes, QEMU_ALIGN_DOWN(INT_MAX, s->cluster_size));
         ret = qcow2_alloc_host_offset(bs, offset, &cur_bytes,
-                                      &host_offset, &meta);
+                                      &host_offset, &meta, NULL);
         if (ret < 0) {
             error_setg_errno(errp, -ret, "Allocating clusters failed");
             goto out;
@@ -4343,7 +4479,7 @@ qcow2_co_copy_range_to(BlockDriverState *bs,
          * the refcnt, without copying user data.
          * Or if src->bs == dst->bs->backing->bs, we could copy by discarding. */
         ret = qcow2_alloc_host_offset(bs, dst_offset, &cur_bytes,
-                                      &host_offset, &l2meta);
+                                      &host_offset, &l2meta, NULL);
         if (ret < 0) {
             goto fail;
         }
@@ -4410,6 +4546,8 @@ qcow2_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
 
     qemu_co_mutex_lock(&s->lock);
 
+    qcow2_alloc_pool_drain(bs);
+
     /*
      * Even though we store snapshot size for all images, it was not
      * required until v3, so it is not safe to proceed for v2.
@@ -4883,7 +5021,8 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
         uint64_t chunk_size = MIN(bytes, s->cluster_size);
 
         if (!aio && chunk_size != bytes) {
-            aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
+            /* compression is CPU bound, keep every compression thread busy */
+            aio = aio_task_pool_new(MAX(QCOW2_MAX_WORKERS, s->max_threads));
         }
 
         ret = qcow2_add_task(bs, aio, qcow2_co_pwritev_compressed_task_entry,
@@ -4983,6 +5122,8 @@ static int GRAPH_RDLOCK make_completely_empty(BlockDriverState *bs)
     BLKDBG_EVENT(bs->file, BLKDBG_L1_UPDATE);
 
     l1_clusters = DIV_ROUND_UP(s->l1_size, s->cluster_size / L1E_SIZE);
+
+    qcow2_alloc_pool_drain(bs);
     l1_size2 = (uint64_t)s->l1_size * L1E_SIZE;
 
     /* After this call, neither the in-memory nor the on-disk refcount
@@ -5416,11 +5557,35 @@ qcow2_get_specific_info(BlockDriverState *bs, Error **errp)
     return spec_info;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    BlockStatsSpecific *stats = g_new0(BlockStatsSpecific, 1);
+
+    stats->driver = BLOCKDEV_DRIVER_QCOW2;
+    stats->u.qcow2.l2_cache = g_new0(Qcow2CacheStats, 1);
+    stats->u.qcow2.refcount_cache = g_new0(Qcow2CacheStats, 1);
+    if (s->l2_table_cache) {
+        qcow2_cache_get_stats(s->l2_table_cache, stats->u.qcow2.l2_cache);
+    }
+    if (s->refcount_block_cache) {
+        qcow2_cache_get_stats(s->refcount_block_cache,
+                              stats->u.qcow2.refcount_cache);
+    }
+    stats->u.qcow2.open_time = s->open_time_ns;
+    stats->u.qcow2.lazy_open = s->lazy_open;
+    stats->u.qcow2.time_to_first_io = qatomic_read(&s->first_io_ns);
+    stats->u.qcow2.has_time_to_first_io = stats->u.qcow2.time_to_first_io != 0;
+
+    return stats;
+}
+
 static int coroutine_mixed_fn GRAPH_RDLOCK
 qcow2_has_zero_init(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
     bool preallocated;
+    int ret = 0;
 
     if (qemu_in_coroutine()) {
         qemu_co_mutex_lock(&s->lock);
@@ -5430,12 +5595,17 @@ qcow2_has_zero_init(BlockDriverState *bs)
      * tables allocated, nonpreallocated images have none.  It is
      * therefore enough to check the first one.
      */
+    if (s->l1_size > 0) {
+        ret = qcow2_load_l1_entry(bs, 0);
+    }
     preallocated = s->l1_size > 0 && s->l1_table[0] != 0;
     if (qemu_in_coroutine()) {
         qemu_co_mutex_unlock(&s->lock);
     }
 
-    if (!preallocated) {
+    if (ret < 0) {
+        return 0;
+    } else if (!preallocated) {
         return 1;
     } else if (bs->encrypted) {
         return 0;
@@ -6265,6 +6435,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure                       = qcow2_measure,
     .bdrv_co_get_info                   = qcow2_co_get_info,
     .bdrv_get_specific_info             = qcow2_get_specific_info,
+    .bdrv_get_specific_stats            = qcow2_get_specific_stats,
 
     .bdrv_co_save_vmstate               = qcow2_co_save_vmstate,
     .bdrv_co_load_vmstate               = qcow2_co_load_vmstate,
@@ -151,6 +151,7 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_ALLOC_POOL_SIZE "alloc-pool-size"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -232,6 +233,24 @@ typedef struct QCowSnapshot {
 struct Qcow2Cache;
 typedef struct Qcow2Cache Qcow2Cache;
 
+/*
+ * Clusters reserved for the data written from one AioContext, see
+ * qcow2_alloc_pool_take().  @ctx is NULL for clusters that no AioContext
+ * owns any more; the next pool that runs empty adopts them.
+ */
+typedef struct Qcow2AllocPool {
+    AioContext *ctx;
+    uint64_t offset;        /* first free cluster left in the chunk */
+    uint64_t nb_clusters;   /* number of free clusters left */
+    QLIST_ENTRY(Qcow2AllocPool) next;
+} Qcow2AllocPool;
+
+/* Clusters taken from a pool by one write request */
+typedef struct Qcow2AllocReservation {
+    uint64_t offset;
+    uint64_t nb_clusters;
+} Qcow2AllocReservation;
+
 typedef struct Qcow2CryptoHeaderExtension {
     uint64_t offset;
     uint64_t length;
@@ -323,6 +342,7 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
+/* Lower bound, the actual limit is one thread per host CPU */
 #define QCOW2_MAX_THREADS 4
 
 typedef struct BDRVQcow2State {
@@ -343,6 +363,12 @@ typedef struct BDRVQcow2State {
     uint64_t cluster_offset_mask;
     uint64_t l1_table_offset;
     uint64_t *l1_table;
+    /*
+     * After a lazy open (see qcow2_do_open()), one bit per cluster of
+     * l1_table that was read from the image.  NULL once the whole table
+     * is loaded, which is always the case for writable images.
+     */
+    unsigned long *l1_loaded;
 
     Qcow2Cache *l2_table_cache;
     Qcow2Cache *refcount_block_cache;
@@ -358,9 +384,17 @@ typedef struct BDRVQcow2State {
     uint64_t refcount_table_offset;
     uint32_t refcount_table_size;
     uint32_t max_refcount_table_index; /* Last used entry in refcount_table */
+    /* refcount_table is not read until the image becomes writable */
+    bool refcount_table_deferred;
     uint64_t free_cluster_index;
     uint64_t free_byte_offset;
 
+    /* Size of the chunks reserved per AioContext, 0 if disabled */
+    uint64_t alloc_pool_clusters;
+    /* Protects alloc_pools; taken without s->lock */
+    QemuMutex alloc_pools_lock;
+    QLIST_HEAD(, Qcow2AllocPool) alloc_pools;
+
     CoMutex lock;
 
     Qcow2CryptoHeaderExtension crypto_header; /* QCow2 header extension */
@@ -414,6 +448,7 @@ typedef struct BDRVQcow2State {
 
     CoQueue thread_task_queue;
     int nb_threads;
+    int max_threads;
 
     BdrvChild *data_file;
 
@@ -426,6 +461,13 @@ typedef struct BDRVQcow2State {
      * is to convert the image with the desired compression type set.
      */
     Qcow2CompressionType compression_type;
+
+    /* When qcow2_do_open() started, how long it took and if it was lazy */
+    int64_t open_start_ns;
+    uint64_t open_time_ns;
+    bool lazy_open;
+    /* Time from open_start_ns until the first request completed; atomic */
+    uint64_t first_io_ns;
 } BDRVQcow2State;
 
 typedef struct Qcow2COWRegion {
@@ -854,6 +896,7 @@ int qcow2_validate_table(BlockDriverState *bs, uint64_t offset,
 
 /* qcow2-refcount.c functions */
 int coroutine_fn GRAPH_RDLOCK qcow2_refcount_init(BlockDriverState *bs);
+int GRAPH_RDLOCK qcow2_read_refcount_table(BlockDriverState *bs);
 void qcow2_refcount_close(BlockDriverState *bs);
 
 int GRAPH_RDLOCK qcow2_get_refcount(BlockDriverState *bs, int64_t cluster_index,
@@ -877,6 +920,12 @@ int64_t GRAPH_RDLOCK coroutine_fn
 qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                         int64_t nb_clusters);
 
+void coroutine_fn GRAPH_RDLOCK
+qcow2_alloc_pool_take(BlockDriverState *bs, Qcow2AllocReservation *res);
+void qcow2_alloc_pool_put(BlockDriverState *bs, Qcow2AllocReservation *res);
+void qcow2_alloc_pool_release(BlockDriverState *bs);
+void GRAPH_RDLOCK qcow2_alloc_pool_drain(BlockDriverState *bs);
+
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size);
 void GRAPH_RDLOCK qcow2_free_clusters(BlockDriverState *bs,
                                       int64_t offset, int64_t size,
@@ -932,6 +981,8 @@ int coroutine_fn GRAPH_RDLOCK
 qcow2_shrink_l1_table(BlockDriverState *bs, uint64_t max_size);
 
 int GRAPH_RDLOCK qcow2_write_l1_entry(BlockDriverState *bs, int l1_index);
+int GRAPH_RDLOCK qcow2_load_l1_entry(BlockDriverState *bs, uint64_t l1_index);
+int GRAPH_RDLOCK qcow2_load_l1_table(BlockDriverState *bs);
 int qcow2_encrypt_sectors(BDRVQcow2State *s, int64_t sector_num,
                           uint8_t *buf, int nb_sectors, bool enc, Error **errp);
 
@@ -943,7 +994,7 @@ qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
 int coroutine_fn GRAPH_RDLOCK
 qcow2_alloc_host_offset(BlockDriverState *bs, uint64_t offset,
                         unsigned int *bytes, uint64_t *host_offset,
-                        QCowL2Meta **m);
+                        QCowL2Meta **m, Qcow2AllocReservation *res);
 
 int coroutine_fn GRAPH_RDLOCK
 qcow2_alloc_compressed_cluster_offset(BlockDriverState *bs, uint64_t offset,
@@ -1029,6 +1080,7 @@ qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
+void qcow2_cache_get_stats(Qcow2Cache *c, Qcow2CacheStats *stats);
 
 /* qcow2-bitmap.c functions */
 int coroutine_fn GRAPH_RDLOCK
@@ -25,6 +25,9 @@ static GRand *rng;
 static int limit;
 static bool sys;
 
+/* set when data accesses are simulated off the vCPU threads */
+static struct qemu_plugin_event_queue *evq;
+
 enum EvictionPolicy {
     LRU,
     FIFO,
@@ -385,27 +388,17 @@ static bool access_cache(Cache *cache, uint64_t addr)
     return false;
 }
 
-static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
-                            uint64_t vaddr, void *userdata)
+static void data_access(unsigned int vcpu_index, uint64_t effective_addr,
+                        InsnData *insn)
 {
-    uint64_t effective_addr;
-    struct qemu_plugin_hwaddr *hwaddr;
     int cache_idx;
-    InsnData *insn;
     bool hit_in_l1;
 
-    hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
-    if (hwaddr && qemu_plugin_hwaddr_is_io(hwaddr)) {
-        return;
-    }
-
-    effective_addr = hwaddr ? qemu_plugin_hwaddr_phys_addr(hwaddr) : vaddr;
     cache_idx = vcpu_index % cores;
 
     g_mutex_lock(&l1_dcache_locks[cache_idx]);
     hit_in_l1 = access_cache(l1_dcaches[cache_idx], effective_addr);
     if (!hit_in_l1) {
-        insn = userdata;
         __atomic_fetch_add(&insn->l1_dmisses, 1, __ATOMIC_SEQ_CST);
         l1_dcaches[cache_idx]->misses++;
     }
@@ -419,7 +412,6 @@ static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
 
     g_mutex_lock(&l2_ucache_locks[cache_idx]);
     if (!access_cache(l2_ucaches[cache_idx], effective_addr)) {
-        insn = userdata;
         __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
         l2_ucaches[cache_idx]->misses++;
     }
@@ -427,6 +419,34 @@ static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
     g_mutex_unlock(&l2_ucache_locks[cache_idx]);
 }
 
+static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
+                            uint64_t vaddr, void *userdata)
+{
+    uint64_t effective_addr;
+    struct qemu_plugin_hwaddr *hwaddr;
+
+    hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
+    if (hwaddr && qemu_plugin_hwaddr_is_io(hwaddr)) {
+        return;
+    }
+
+    effective_addr = hwaddr ? qemu_plugin_hwaddr_phys_addr(hwaddr) : vaddr;
+    data_access(vcpu_index, effective_addr, userdata);
+}
+
+static void vcpu_mem_batch(unsigned int vcpu_index,
+                           const struct qemu_plugin_mem_event *events,
+                           size_t n_events, void *userdata)
+{
+    size_t i;
+
+    for (i = 0; i < n_events; i++) {
+        if (!events[i].is_io) {
+            data_access(vcpu_index, events[i].paddr, events[i].userdata);
+        }
+    }
+}
+
 static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
 {
     uint64_t insn_addr;
@@ -490,9 +510,13 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
         }
         g_mutex_unlock(&hashtable_lock);
 
-        qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
-                                         QEMU_PLUGIN_CB_NO_REGS,
-                                         rw, data);
+        if (evq) {
+            qemu_plugin_register_vcpu_mem_batch_cb(insn, evq, rw, data);
+        } else {
+            qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_access,
+                                             QEMU_PLUGIN_CB_NO_REGS,
+                                             rw, data);
+        }
 
         qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
                                                QEMU_PLUGIN_CB_NO_REGS, data);
@@ -696,6 +720,12 @@ finish:
 
 static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
+    if (evq) {
+        /* account for the accesses still sitting in the rings */
+        qemu_plugin_event_queue_free(evq);
+        evq = NULL;
+    }
+
     log_stats();
     log_top_insns();
 
@@ -743,6 +773,7 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
     int l1_iassoc, l1_iblksize, l1_icachesize;
     int l1_dassoc, l1_dblksize, l1_dcachesize;
     int l2_assoc, l2_blksize, l2_cachesize;
+    bool async = false;
 
     limit = 32;
     sys = info->system_emulation;
@@ -797,6 +828,11 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
                 fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
                 return -1;
             }
+        } else if (g_strcmp0(tokens[0], "async") == 0) {
+            if (!qemu_plugin_bool_parse(tokens[0], tokens[1], &async)) {
+                fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
+                return -1;
+            }
         } else if (g_strcmp0(tokens[0], "evict") == 0) {
             if (g_strcmp0(tokens[1], "rand") == 0) {
                 policy = RAND;
@@ -844,6 +880,12 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
     l1_icache_locks = g_new0(GMutex, cores);
     l2_ucache_locks = use_l2 ? g_new0(GMutex, cores) : NULL;
 
+    if (async) {
+        evq = qemu_plugin_event_queue_new(1 << 16, 1 << 12,
+                                          QEMU_PLUGIN_BATCH_BLOCK, 1,
+                                          vcpu_mem_batch, NULL);
+    }
+
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
 
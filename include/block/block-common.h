@@ -257,6 +257,7 @@ typedef enum {
 #define BDRV_OPT_AUTO_READ_ONLY "auto-read-only"
 #define BDRV_OPT_DISCARD        "discard"
 #define BDRV_OPT_FORCE_SHARE    "force-share"
+#define BDRV_OPT_MERGE_WINDOW   "merge-window"
 #define BDRV_OPT_ACTIVE         "active"
 
 
@@ -350,6 +351,7 @@ typedef struct BDRVReopenState {
     BlockDriverState *bs;
     int flags;
     BlockdevDetectZeroesOptions detect_zeroes;
+    uint64_t merge_window_ns;
     bool backing_missing;
     BlockDriverState *old_backing_bs; /* keep pointer for permissions update */
     BlockDriverState *old_file_bs; /* keep pointer for permissions update */
@@ -66,6 +66,47 @@ enum BdrvTrackedRequestType {
     BDRV_TRACKED_TRUNCATE,
 };
 
+typedef struct BdrvMergeBatch BdrvMergeBatch;
+
+/* Number of recent request ends remembered to recognize sequential streams */
+#define BDRV_MERGE_STREAMS 8
+
+/*
+ * Coalescing of adjacent reads and writes, see bdrv_co_merge_rw() in
+ * block/io.c
+ */
+typedef struct BdrvMergeState {
+    /* Upper bound of the window, 0 if disabled.  Accessed with atomic ops. */
+    uint64_t window_ns;
+
+    /* Requests between arrival and completion in bdrv_co_merge_rw() */
+    unsigned queued;
+
+    /* Protects the fields below */
+    QemuMutex lock;
+
+    /* Moving averages of the queue depth (in 1/16) and of the latency */
+    uint64_t depth;
+    uint64_t latency_ns;
+
+    /* Current window, derived from the averages above */
+    uint64_t budget_ns;
+
+    /* End offsets of the latest requests, 0 if unused */
+    int64_t stream_end[BDRV_MERGE_STREAMS];
+    bool stream_write[BDRV_MERGE_STREAMS];
+    unsigned stream_next;
+
+    /* Batches that requests can still join */
+    QLIST_HEAD(, BdrvMergeBatch) batches;
+
+    uint64_t rd_requests;
+    uint64_t wr_requests;
+    uint64_t rd_merged;
+    uint64_t wr_merged;
+    uint64_t held;
+} BdrvMergeState;
+
 /*
  * That is not quite good that BdrvTrackedRequest structure is public,
  * as block/io.c is very careful about incoming offset/bytes being
@@ -1221,6 +1262,7 @@ struct BlockDriverState {
     QDict *options;
     QDict *explicit_options;
     BlockdevDetectZeroesOptions detect_zeroes;
+    BdrvMergeState merge;
 
     /* The error object in use for blocking operations on backing_hd */
     Error *backing_blocker;
@@ -87,6 +87,45 @@ static inline bool luring_has_fua(void)
 }
 #endif
 
+/* nvme-uring.c - NVMe passthrough through io_uring uring_cmd */
+#ifdef CONFIG_NVME_URING
+typedef struct NvmeUringState NvmeUringState;
+
+typedef struct NvmeUringNs {
+    uint32_t nsid;
+    uint32_t lba_shift;
+    uint64_t nr_lbas;
+    uint64_t max_transfer;
+    int max_segments;
+    bool supports_write_zeroes;
+    /* write zeroes with the deallocate bit reads back as zeroes */
+    bool unmap_reads_zeroes;
+} NvmeUringNs;
+
+NvmeUringState *nvme_uring_init(Error **errp);
+void nvme_uring_cleanup(NvmeUringState *s);
+void nvme_uring_detach_aio_context(NvmeUringState *s, AioContext *old_context);
+void nvme_uring_attach_aio_context(NvmeUringState *s, AioContext *new_context);
+
+/*
+ * nvme_uring_probe: check whether @fd is an NVMe generic character device
+ *
+ * Returns: 1 and fills in @ns if it is, 0 if it is not, -errno (with @errp
+ * set) if it is but the namespace cannot be used.
+ */
+int nvme_uring_probe(int fd, NvmeUringNs *ns, Error **errp);
+
+/*
+ * nvme_uring_co_submit: send an NVM command for a QEMU_AIO_READ, WRITE,
+ * WRITE_ZEROES or FLUSH request through the current AioContext's ring.
+ * @offset and @bytes must be multiples of the LBA size.
+ */
+int coroutine_fn nvme_uring_co_submit(int fd, const NvmeUringNs *ns,
+                                      uint64_t offset, uint64_t bytes,
+                                      QEMUIOVector *qiov, int type,
+                                      BdrvRequestFlags flags);
+#endif
+
 #ifdef _WIN32
 typedef struct QEMUWin32AIOState QEMUWin32AIOState;
 QEMUWin32AIOState *win32_aio_init(void);
@@ -43,6 +43,14 @@ extern ICountMode use_icount;
  */
 void icount_update(CPUState *cpu);
 
+/*
+ * With multi-threaded TCG, instructions are accounted per vCPU in
+ * cpu->icount_epoch_done, and only added to the global count by
+ * icount_advance() when all vCPUs meet at the end of a quantum.
+ */
+extern bool icount_parallel;
+void icount_advance(int64_t count);
+
 /* get raw icount value */
 int64_t icount_get_raw(void);
 
@@ -277,4 +277,18 @@ size_t translator_st_len(const DisasContextBase *db);
  */
 bool translator_is_same_page(const DisasContextBase *db, vaddr addr);
 
+/**
+ * translator_code_ptr
+ * @db: disassembly context
+ * @addr: virtual address within TB
+ * @len: length
+ *
+ * Return a host pointer to the @len bytes of guest code at @addr, or NULL
+ * if they are not all on the RAM-backed page where disassembly started.
+ * Unlike translator_ld*, this does not count as reading the bytes; it lets
+ * translators peek at code they are about to load, e.g. to validate a cache.
+ */
+const void *translator_code_ptr(const DisasContextBase *db,
+                                vaddr addr, size_t len);
+
 #endif /* EXEC__TRANSLATOR_H */
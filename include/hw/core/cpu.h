@@ -446,6 +446,12 @@ struct qemu_work_item;
  * @crash_occurred: Indicates the OS reported a crash (panic) for this CPU
  * @singlestep_enabled: Flags for single-stepping.
  * @icount_extra: Instructions until next timer event.
+ * @icount_epoch_done: Instructions executed in the current quantum, when
+ *   icount is used with multi-threaded TCG.
+ * @icount_epoch_next: Quantum in which this vCPU may run next.
+ * @icount_epoch_member: This vCPU takes part in the quantum barriers.
+ * @icount_deferred_irq: Interrupts raised by other vCPUs, to be delivered
+ *   at the next quantum barrier.
  * @cpu_ases: Pointer to array of CPUAddressSpaces (which define the
  *            AddressSpaces this CPU has)
  * @as: Pointer to the first AddressSpace, for the convenience of targets which
@@ -513,6 +519,10 @@ struct CPUState {
     int singlestep_enabled;
     int64_t icount_budget;
     int64_t icount_extra;
+    int64_t icount_epoch_done;
+    uint64_t icount_epoch_next;
+    bool icount_epoch_member;
+    uint32_t icount_deferred_irq;
     uint64_t random_seed;
     sigjmp_buf jmp_env;
 
@@ -37,6 +37,7 @@ OBJECT_DECLARE_TYPE(QIOChannel, QIOChannelClass,
 #define QIO_CHANNEL_READ_FLAG_MSG_PEEK 0x1
 #define QIO_CHANNEL_READ_FLAG_RELAXED_EOF 0x2
 #define QIO_CHANNEL_READ_FLAG_FD_PRESERVE_BLOCKING 0x4
+#define QIO_CHANNEL_READ_FLAG_WAITALL 0x8
 
 typedef enum QIOChannelFeature QIOChannelFeature;
 
@@ -287,6 +287,9 @@ struct AioContext {
 #ifdef CONFIG_LINUX_AIO
     struct LinuxAioState *linux_aio;
 #endif
+#ifdef CONFIG_NVME_URING
+    struct NvmeUringState *nvme_uring;
+#endif
 #ifdef CONFIG_LINUX_IO_URING
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
@@ -295,6 +298,20 @@ struct AioContext {
 
     /* Pending callback state for cqe handlers */
     CqeHandlerSimpleQ cqe_handler_ready_list;
+
+    /*
+     * Fixed buffers and files currently registered with fdmon_io_uring,
+     * NULL if the ring has no such table.  Only filled from the
+     * AioContext thread, but emptied by whichever thread unregisters a
+     * slot, see aio_register_fixed_buf().
+     */
+    uint64_t fixed_generation;
+    struct FdmonFixedBuf *fixed_bufs;
+    int *fixed_buf_sorted;          /* filled fixed_bufs slots by address */
+    int nr_fixed_buf_sorted;
+    struct FdmonFixedFile *fixed_files;
+    int nr_fixed_files;
+    QLIST_ENTRY(AioContext) fixed_next;
 #endif /* CONFIG_LINUX_IO_URING */
 
     /* TimerLists for calling timers - one per clock type.  Has its own
@@ -591,6 +608,12 @@ struct LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp);
 /* Return the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_get_linux_aio(AioContext *ctx);
 
+/* Setup the NvmeUringState bound to this AioContext */
+struct NvmeUringState *aio_setup_nvme_uring(AioContext *ctx, Error **errp);
+
+/* Return the NvmeUringState bound to this AioContext */
+struct NvmeUringState *aio_get_nvme_uring(AioContext *ctx);
+
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -847,6 +870,70 @@ static inline bool aio_has_io_uring(void)
  */
 void aio_add_sqe(void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
                  void *opaque, CqeHandler *cqe_handler);
+
+/**
+ * aio_register_fixed_buf: Register memory as io_uring fixed buffers
+ * @host: start of the memory range
+ * @size: length of the memory range
+ *
+ * Every AioContext registers the range with its io_uring before it
+ * prepares its next sqe, so that requests whose buffer lies in the range
+ * can use IORING_OP_READ_FIXED/IORING_OP_WRITE_FIXED and skip pinning
+ * the pages on each request.  The range is split into chunks of at most
+ * 1 GiB, the largest buffer the kernel accepts.
+ *
+ * This is only an optimization: if the tables are full or the kernel
+ * refuses to pin the memory (e.g. because of RLIMIT_MEMLOCK), requests
+ * simply keep using ordinary buffers.  Calls nest, the range stays
+ * registered until aio_unregister_fixed_buf() was called as many times.
+ *
+ * When aio_unregister_fixed_buf() returns, no io_uring references the
+ * memory any more and it may be unmapped.  Requests using the range must
+ * have completed before it is called.
+ */
+void aio_register_fixed_buf(void *host, size_t size);
+void aio_unregister_fixed_buf(void *host, size_t size);
+
+/**
+ * aio_register_fixed_file: Register a file descriptor as io_uring fixed file
+ * @fd: the file descriptor
+ *
+ * Like aio_register_fixed_buf(), but for IOSQE_FIXED_FILE.  Each call
+ * takes its own slot, even for an fd that is already registered.
+ *
+ * Returns: the slot to pass to aio_unregister_fixed_file(), or -1 if the
+ * table is full.
+ */
+int aio_register_fixed_file(int fd);
+
+/**
+ * aio_unregister_fixed_file: Unregister a fixed file
+ * @slot: the return value of aio_register_fixed_file(), -1 is ignored
+ *
+ * When this returns, no io_uring references the file any more, so it must
+ * be called before the fd is closed: otherwise the file and its locks stay
+ * alive, and a new file that reuses the fd number could be confused with
+ * it.
+ */
+void aio_unregister_fixed_file(int slot);
+
+/**
+ * aio_fixed_buf_index: Look up a fixed buffer
+ *
+ * Returns: the index of the fixed buffer that contains [@base, @base + @len)
+ * in the current AioContext's io_uring, or -1.  Only valid in a
+ * @prep_sqe() callback passed to aio_add_sqe().
+ */
+int aio_fixed_buf_index(const void *base, size_t len);
+
+/**
+ * aio_fixed_file_index: Look up a fixed file
+ *
+ * Returns: the fixed file index of @fd in the current AioContext's
+ * io_uring, or -1.  Only valid in a @prep_sqe() callback passed to
+ * aio_add_sqe().
+ */
+int aio_fixed_file_index(int fd);
 #endif /* CONFIG_LINUX_IO_URING */
 
 #endif
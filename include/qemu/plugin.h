@@ -71,6 +71,7 @@ enum plugin_dyn_cb_type {
     PLUGIN_CB_REGULAR,
     PLUGIN_CB_COND,
     PLUGIN_CB_MEM_REGULAR,
+    PLUGIN_CB_MEM_BATCH,
     PLUGIN_CB_INLINE_ADD_U64,
     PLUGIN_CB_INLINE_STORE_U64,
 };
@@ -82,6 +83,13 @@ struct qemu_plugin_regular_cb {
     enum qemu_plugin_mem_rw rw;
 };
 
+struct qemu_plugin_batch_cb {
+    struct qemu_plugin_event_queue *queue;
+    TCGHelperInfo *info;
+    void *userp;
+    enum qemu_plugin_mem_rw rw;
+};
+
 struct qemu_plugin_inline_cb {
     qemu_plugin_u64 entry;
     uint64_t imm;
@@ -107,6 +115,7 @@ struct qemu_plugin_dyn_cb {
     union {
         struct qemu_plugin_regular_cb regular;
         struct qemu_plugin_conditional_cb cond;
+        struct qemu_plugin_batch_cb batch;
         struct qemu_plugin_inline_cb inline_insn;
     };
 };
@@ -175,6 +184,12 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                              uint64_t value_high,
                              MemOpIdx oi, enum qemu_plugin_mem_rw rw);
 
+void qemu_plugin_vcpu_mem_batch_push(uint32_t cpu_index,
+                                     qemu_plugin_meminfo_t info,
+                                     uint64_t vaddr,
+                                     struct qemu_plugin_event_queue *queue,
+                                     void *userp);
+
 void qemu_plugin_flush_cb(void);
 
 void qemu_plugin_atexit_cb(void);
@@ -72,11 +72,17 @@ typedef uint64_t qemu_plugin_id_t;
  * - added qemu_plugin_write_memory_hwaddr
  * - added qemu_plugin_write_register
  * - added qemu_plugin_translate_vaddr
+ *
+ * version 6:
+ * - added qemu_plugin_event_queue_new
+ * - added qemu_plugin_event_queue_free
+ * - added qemu_plugin_event_queue_dropped
+ * - added qemu_plugin_register_vcpu_mem_batch_cb
  */
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 5
+#define QEMU_PLUGIN_VERSION 6
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -765,6 +771,127 @@ void qemu_plugin_register_vcpu_mem_inline_per_vcpu(
     qemu_plugin_u64 entry,
     uint64_t imm);
 
+/**
+ * enum qemu_plugin_batch_policy - what to do when an event ring is full
+ *
+ * @QEMU_PLUGIN_BATCH_BLOCK: the vCPU waits until the consumer thread has
+ *                           made room. No event is lost but a slow consumer
+ *                           slows the guest down.
+ * @QEMU_PLUGIN_BATCH_DROP: events that do not fit are discarded.
+ * @QEMU_PLUGIN_BATCH_SAMPLE: once a ring is half full only one event out of
+ *                            every sample_rate is recorded; events that do
+ *                            not fit are discarded.
+ */
+enum qemu_plugin_batch_policy {
+    QEMU_PLUGIN_BATCH_BLOCK,
+    QEMU_PLUGIN_BATCH_DROP,
+    QEMU_PLUGIN_BATCH_SAMPLE,
+};
+
+/**
+ * struct qemu_plugin_mem_event - a recorded memory access
+ *
+ * @vaddr: the virtual address of the access
+ * @paddr: the physical address of the access in system emulation,
+ *         @vaddr otherwise
+ * @userdata: the userdata given when instrumenting the instruction
+ * @info: the qemu_plugin_meminfo_t of the access. Only the
+ *        qemu_plugin_mem_* accessors may be used on it, as the event is
+ *        consumed outside of vCPU context.
+ * @is_io: true if the access targeted an IO region
+ */
+struct qemu_plugin_mem_event {
+    uint64_t vaddr;
+    uint64_t paddr;
+    void *userdata;
+    qemu_plugin_meminfo_t info;
+    bool is_io;
+};
+
+/**
+ * typedef qemu_plugin_vcpu_mem_batch_cb_t - batched memory callback
+ * @vcpu_index: the vCPU that performed the accesses
+ * @events: array of @n_events recorded accesses, in program order
+ * @n_events: number of entries in @events
+ * @userdata: the userdata given to qemu_plugin_event_queue_new()
+ *
+ * The callback runs on the consumer thread of the event queue, never
+ * on a vCPU thread. @events is only valid for the duration of the call.
+ */
+typedef void (*qemu_plugin_vcpu_mem_batch_cb_t)(
+    unsigned int vcpu_index,
+    const struct qemu_plugin_mem_event *events,
+    size_t n_events,
+    void *userdata);
+
+struct qemu_plugin_event_queue;
+
+/**
+ * qemu_plugin_event_queue_new() - create an asynchronous event queue
+ * @ring_size: number of events each per-vCPU ring can hold, rounded up
+ *             to a power of two
+ * @batch_size: number of pending events that wakes up the consumer
+ * @policy: what to do when a ring is full
+ * @sample_rate: keep one event out of @sample_rate under
+ *               QEMU_PLUGIN_BATCH_SAMPLE, ignored otherwise
+ * @cb: callback consuming batches of events
+ * @userdata: opaque pointer passed to @cb
+ *
+ * Memory accesses instrumented with qemu_plugin_register_vcpu_mem_batch_cb()
+ * are recorded by the vCPU into a lock-free per-vCPU ring and handed to @cb
+ * from a dedicated thread owned by the queue. Since all batches of a queue
+ * are delivered from the same thread, @cb does not need to lock state that
+ * it alone updates. Partial batches are delivered after a short idle period.
+ *
+ * Returns a new queue, which must be released with
+ * qemu_plugin_event_queue_free().
+ */
+QEMU_PLUGIN_API
+struct qemu_plugin_event_queue *
+qemu_plugin_event_queue_new(size_t ring_size, size_t batch_size,
+                            enum qemu_plugin_batch_policy policy,
+                            unsigned int sample_rate,
+                            qemu_plugin_vcpu_mem_batch_cb_t cb,
+                            void *userdata);
+
+/**
+ * qemu_plugin_event_queue_free() - drain and free an event queue
+ * @queue: queue to free
+ *
+ * All pending events are delivered before the consumer thread exits.
+ * The queue must not be referenced by any instrumentation anymore, so
+ * this is typically called from the plugin's atexit callback.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_event_queue_free(struct qemu_plugin_event_queue *queue);
+
+/**
+ * qemu_plugin_event_queue_dropped() - count events lost to backpressure
+ * @queue: queue to query
+ *
+ * Returns the number of events that were dropped or sampled out so far.
+ */
+QEMU_PLUGIN_API
+uint64_t qemu_plugin_event_queue_dropped(struct qemu_plugin_event_queue *queue);
+
+/**
+ * qemu_plugin_register_vcpu_mem_batch_cb() - record memory accesses
+ * @insn: handle for instruction to instrument
+ * @queue: queue receiving the events
+ * @rw: monitor reads, writes or both
+ * @userdata: opaque pointer stored in each recorded event
+ *
+ * This is the asynchronous counterpart of qemu_plugin_register_vcpu_mem_cb().
+ * Instead of calling into the plugin, every memory access generated by
+ * @insn appends a struct qemu_plugin_mem_event to the ring of the executing
+ * vCPU in @queue.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_vcpu_mem_batch_cb(struct qemu_plugin_insn *insn,
+                                            struct qemu_plugin_event_queue *queue,
+                                            enum qemu_plugin_mem_rw rw,
+                                            void *userdata);
+
 /**
  * qemu_plugin_request_time_control() - request the ability to control time
  *
@@ -260,7 +260,7 @@ typedef struct IOMMUTLBEvent {
 /* RAM that isn't accessible through normal means. */
 #define RAM_PROTECTED (1 << 8)
 
-/* RAM is an mmap-ed named file */
+/* RAM is an mmap-ed named file, or a memfd passed in by the user */
 #define RAM_NAMED_FILE (1 << 9)
 
 /* RAM is mmap-ed read-only */
@@ -45,6 +45,13 @@ struct RAMBlock {
     size_t page_size;
     /* dirty bitmap used during migration */
     unsigned long *bmap;
+    /*
+     * Heat of every target page and the dirty sync generation it was
+     * last sent in.  Only allocated on the source with the
+     * hot-page-deferral capability, protected by ram_state.bitmap_mutex.
+     */
+    uint8_t *page_heat;
+    uint8_t *page_heat_gen;
 
     /*
      * Below fields are only used by mapped-ram migration
@@ -57,6 +64,8 @@ struct RAMBlock {
      */
     off_t bitmap_offset;
     uint64_t pages_offset;
+    /* slot of each page in the page store, if one is used */
+    uint64_t *store_slots;
 
     /* Bitmap of already received pages.  Only used on destination side. */
     unsigned long *receivedmap;
@@ -80,6 +89,19 @@ struct RAMBlock {
     unsigned long *clear_bmap;
     uint8_t clear_bmap_shift;
 
+    /*
+     * Dirty rate model used to predict the downtime of migration.  Only
+     * used on the source, protected by the global ram_state.bitmap_mutex.
+     * Pages newly dirtied since the model was last updated, the weighted
+     * mean and variance of the dirty rate in pages per millisecond, and
+     * of the pages dirtied per update period (the hot set of the block).
+     */
+    uint64_t dirty_model_pages;
+    double dirty_rate_avg;
+    double dirty_rate_var;
+    double dirty_hot_avg;
+    double dirty_hot_var;
+
     /*
      * RAM block length that corresponds to the used_length on the migration
      * source (after RAM block sizes were synchronized). Especially, after
@@ -195,7 +217,8 @@ static inline long clear_bmap_size(uint64_t pages, uint8_t shift)
 
 /**
  * clear_bmap_set: set clear bitmap for the page range.  Must be with
- * bitmap_mutex held.
+ * bitmap_mutex held.  Ranges of the same block can be set concurrently
+ * by the workers of a parallel dirty bitmap sync.
  *
  * @rb: the ramblock to operate on
  * @start: the start page number
@@ -208,7 +231,8 @@ static inline void clear_bmap_set(RAMBlock *rb, uint64_t start,
 {
     uint8_t shift = rb->clear_bmap_shift;
 
-    bitmap_set(rb->clear_bmap, start >> shift, clear_bmap_size(npages, shift));
+    bitmap_set_atomic(rb->clear_bmap, start >> shift,
+                      clear_bmap_size(npages, shift));
 }
 
 /**
@@ -942,6 +942,9 @@ static inline size_t tcg_current_code_size(TCGContext *s)
 
 #ifdef CONFIG_TCG_INTERPRETER
 uintptr_t tcg_qemu_tb_exec(CPUArchState *env, const void *tb_ptr);
+#ifdef CONFIG_TCI_PROFILE
+void tci_dump_profile(GString *buf);
+#endif
 #else
 typedef uintptr_t tcg_prologue_fn(CPUArchState *env, const void *tb_ptr);
 extern tcg_prologue_fn *tcg_qemu_tb_exec;
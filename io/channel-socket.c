@@ -579,6 +579,15 @@ static ssize_t qio_channel_socket_readv(QIOChannel *ioc,
         sflags |= MSG_PEEK;
     }
 
+    /*
+     * Only a hint: blocking sockets then fill the whole iovec in one
+     * call instead of returning after every segment.  Non-blocking
+     * sockets still return what is available.
+     */
+    if (flags & QIO_CHANNEL_READ_FLAG_WAITALL) {
+        sflags |= MSG_WAITALL;
+    }
+
  retry:
     ret = recvmsg(sioc->fd, &msg, sflags);
     if (ret < 0) {
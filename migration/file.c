@@ -17,6 +17,7 @@
 #include "io/channel-socket.h"
 #include "io/channel-util.h"
 #include "options.h"
+#include "ram.h"
 #include "trace.h"
 
 #define OFFSET_OPTION ",offset="
@@ -206,6 +207,10 @@ int file_write_ramblock_iov(QIOChannel *ioc, const struct iovec *iov,
     size_t len;
     RAMBlock *block = pages->block;
 
+    if (block->store_slots) {
+        return ram_page_store_write_iov(block, iov, niov, errp);
+    }
+
     slice_idx = 0;
     slice_num = 1;
 
@@ -257,7 +262,7 @@ int multifd_file_recv_data(MultiFDRecvParams *p, Error **errp)
     MultiFDRecvData *data = p->data;
     size_t ret;
 
-    ret = qio_channel_pread(p->c, (char *) data->opaque,
+    ret = qio_channel_pread(data->ioc ?: p->c, (char *) data->opaque,
                             data->size, data->file_offset, errp);
     if (ret != data->size) {
         error_prepend(errp,
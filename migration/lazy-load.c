@@ -0,0 +1,563 @@
+/*
+ * Lazy restore of mapped-ram snapshots
+ *
+ * With the mapped-ram-lazy-load capability, loading a mapped-ram file
+ * does not read guest RAM before the VM starts.  Each eligible RAMBlock
+ * is emptied and registered with userfaultfd instead, and:
+ *
+ *  - a fault thread serves the pages that are touched first, by the
+ *    guest or by QEMU itself, reading a few pages around the fault;
+ *  - prefetch threads walk the blocks and fill everything else.
+ *
+ * Pages are placed atomically with UFFDIO_COPY, or UFFDIO_ZEROPAGE for
+ * the pages that are not in the file, so whichever thread gets to a page
+ * first wins and the others see EEXIST.  Once every page is in place the
+ * blocks are unregistered and the file is closed.
+ *
+ * Discarding RAM is disabled meanwhile: a page that the balloon discards
+ * after it was placed would fault again, but only missing pages are
+ * served.
+ *
+ * The file must stay readable until then: a failed read leaves a vCPU
+ * waiting for a page that is not there.  The error is reported and the
+ * VM stopped, and the page is read again on the next fault, e.g. after
+ * "cont".
+ *
+ * Copyright (c) 2026 the Oro Operating System Project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/bitmap.h"
+#include "qemu/error-report.h"
+#include "qemu/event_notifier.h"
+#include "qemu/lockable.h"
+#include "qemu/main-loop.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "exec/target_page.h"
+#include "io/channel-file.h"
+#include "system/ramblock.h"
+#include "system/memory.h"
+#include "system/runstate.h"
+#include "lazy-load.h"
+#include "trace.h"
+
+#ifdef CONFIG_LINUX
+#include "qemu/userfaultfd.h"
+
+#define LAZY_LOAD_PREFETCH_THREADS 4
+/* pages read around a fault, and claimed at once by a prefetch thread */
+#define LAZY_LOAD_FAULT_PAGES      16
+#define LAZY_LOAD_CHUNK_PAGES      256
+
+typedef struct LazyLoadBlock {
+    RAMBlock *rb;
+    uint64_t pages_offset;
+    unsigned long nr_pages;
+    /* pages stored in the file, the others are zero */
+    unsigned long *present;
+    /* pages in guest RAM, set atomically */
+    unsigned long *placed;
+    /* next chunk for the prefetch threads */
+    unsigned long next_chunk;
+    bool registered;
+} LazyLoadBlock;
+
+static struct {
+    int uffd;
+    QIOChannel *ioc;
+    /* fixed once the prefetch threads start, @lock protects it until then */
+    GPtrArray *blocks;
+    QemuMutex lock;
+    int64_t start_time;
+
+    EventNotifier quit_notifier;
+    bool quit;
+    QemuThread fault_thread;
+    QemuThread prefetch_threads[LAZY_LOAD_PREFETCH_THREADS];
+    bool prefetching;
+    int prefetch_running;
+    uint64_t fault_count;
+    bool discard_disabled;
+    /* set once a page could not be loaded, reported only once */
+    bool failed;
+} lazy;
+
+/* tells a completion from that of an earlier load */
+static unsigned int lazy_generation;
+
+bool lazy_load_ramblock_supported(RAMBlock *rb)
+{
+    static int uffd_available = -1;
+
+    if (uffd_available < 0) {
+        uint64_t features;
+
+        uffd_available = !uffd_query_features(&features);
+        if (!uffd_available) {
+            warn_report("userfaultfd is not available, mapped-ram files "
+                        "are loaded eagerly");
+        }
+    }
+
+    /*
+     * Once the first block was added, discarding is disabled by us; it is
+     * needed for the blocks to stay populated, see lazy_load_init().
+     */
+    return uffd_available && rb->fd < 0 && !qemu_ram_is_shared(rb) &&
+           !memory_region_is_nonvolatile(rb->mr) &&
+           rb->page_size == qemu_real_host_page_size() &&
+           TARGET_PAGE_SIZE == qemu_real_host_page_size() &&
+           (lazy.discard_disabled ||
+            (!ram_block_discard_is_disabled() &&
+             !ram_block_discard_is_required()));
+}
+
+/*
+ * Called from the fault and prefetch threads when a page cannot be
+ * loaded.  Whoever touches it waits until it is, so stop the VM rather
+ * than let it hang silently.
+ */
+static void lazy_load_fail(const char *fmt, ...) G_GNUC_PRINTF(1, 2);
+static void lazy_load_fail(const char *fmt, ...)
+{
+    g_autofree char *msg = NULL;
+    va_list ap;
+
+    if (qatomic_xchg(&lazy.failed, true)) {
+        return;
+    }
+
+    va_start(ap, fmt);
+    msg = g_strdup_vprintf(fmt, ap);
+    va_end(ap);
+    error_report("lazy load: %s", msg);
+
+    qemu_system_vmstop_request_prepare();
+    qemu_system_vmstop_request(RUN_STATE_IO_ERROR);
+}
+
+static LazyLoadBlock *lazy_load_find_block(uint64_t addr)
+{
+    int i;
+
+    for (i = 0; i < lazy.blocks->len; i++) {
+        LazyLoadBlock *lb = g_ptr_array_index(lazy.blocks, i);
+        uint64_t host = (uintptr_t)lb->rb->host;
+
+        if (addr >= host && addr < host + lb->nr_pages * TARGET_PAGE_SIZE) {
+            return lb;
+        }
+    }
+    return NULL;
+}
+
+static int lazy_load_place_one(LazyLoadBlock *lb, unsigned long page,
+                               uint8_t *buf, bool present)
+{
+    void *host = lb->rb->host + (page << TARGET_PAGE_BITS);
+    int ret;
+
+    if (present) {
+        ret = uffd_copy_page(lazy.uffd, host, buf, TARGET_PAGE_SIZE, false);
+    } else {
+        ret = uffd_zero_page(lazy.uffd, host, TARGET_PAGE_SIZE, false);
+    }
+    if (ret && ret != -EEXIST) {
+        return ret;
+    }
+    set_bit_atomic(page, lb->placed);
+    return 0;
+}
+
+/*
+ * Place pages [@page, @page + @n) of @lb, which are all present in the
+ * file or all zero.  @buf must hold @n pages.
+ */
+static int lazy_load_place(LazyLoadBlock *lb, unsigned long page,
+                           unsigned long n, uint8_t *buf)
+{
+    void *host = lb->rb->host + (page << TARGET_PAGE_BITS);
+    size_t size = n << TARGET_PAGE_BITS;
+    bool present = test_bit(page, lb->present);
+    unsigned long i;
+    int ret;
+
+    if (present) {
+        ssize_t len = qio_channel_pread(lazy.ioc, (char *)buf, size,
+                                        lb->pages_offset +
+                                        (page << TARGET_PAGE_BITS), NULL);
+        if (len != size) {
+            return -EIO;
+        }
+        ret = uffd_copy_page(lazy.uffd, host, buf, size, false);
+    } else {
+        ret = uffd_zero_page(lazy.uffd, host, size, false);
+    }
+
+    if (ret != -EEXIST || n == 1) {
+        if (!ret || ret == -EEXIST) {
+            bitmap_set_atomic(lb->placed, page, n);
+            ret = 0;
+        }
+        return ret;
+    }
+
+    /* another thread got to part of the range first */
+    for (i = 0; i < n; i++) {
+        if (!test_bit(page + i, lb->placed)) {
+            ret = lazy_load_place_one(lb, page + i,
+                                      buf + (i << TARGET_PAGE_BITS), present);
+            if (ret) {
+                return ret;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Length of the run of pages from @page, up to @max, that are not placed
+ * yet and are all present in the file or all zero.
+ */
+static unsigned long lazy_load_run(LazyLoadBlock *lb, unsigned long page,
+                                   unsigned long max)
+{
+    bool present = test_bit(page, lb->present);
+    unsigned long n = 1;
+
+    while (n < max && !test_bit(page + n, lb->placed) &&
+           test_bit(page + n, lb->present) == present) {
+        n++;
+    }
+    return n;
+}
+
+static void lazy_load_fault(uint64_t addr, uint8_t *buf)
+{
+    LazyLoadBlock *lb;
+    unsigned long page, n;
+    int ret;
+
+    WITH_QEMU_LOCK_GUARD(&lazy.lock) {
+        lb = lazy_load_find_block(addr);
+    }
+
+    if (!lb) {
+        lazy_load_fail("fault at 0x%" PRIx64 " outside of RAM", addr);
+        return;
+    }
+
+    page = (addr - (uintptr_t)lb->rb->host) >> TARGET_PAGE_BITS;
+    trace_lazy_load_fault(lb->rb->idstr, page);
+    qatomic_inc(&lazy.fault_count);
+
+    if (!test_bit(page, lb->placed)) {
+        n = lazy_load_run(lb, page, MIN(LAZY_LOAD_FAULT_PAGES,
+                                        lb->nr_pages - page));
+        ret = lazy_load_place(lb, page, n, buf);
+        if (ret) {
+            lazy_load_fail("could not load page " RAM_ADDR_FMT " of %s: %s",
+                           (ram_addr_t)page << TARGET_PAGE_BITS,
+                           lb->rb->idstr, strerror(-ret));
+            return;
+        }
+    }
+
+    /* a prefetch thread may have placed the page after the fault */
+    uffd_wakeup(lazy.uffd, lb->rb->host + (page << TARGET_PAGE_BITS),
+                TARGET_PAGE_SIZE);
+}
+
+static void *lazy_load_fault_thread(void *opaque)
+{
+    g_autofree uint8_t *buf = g_malloc(LAZY_LOAD_FAULT_PAGES *
+                                       TARGET_PAGE_SIZE);
+    struct pollfd pfd[2] = {
+        { .fd = lazy.uffd, .events = POLLIN },
+        { .fd = event_notifier_get_fd(&lazy.quit_notifier), .events = POLLIN },
+    };
+    struct uffd_msg msgs[16];
+
+    for (;;) {
+        int i, n;
+
+        if (poll(pfd, ARRAY_SIZE(pfd), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            lazy_load_fail("poll failed: %s", strerror(errno));
+            break;
+        }
+        if (pfd[1].revents) {
+            break;
+        }
+
+        n = uffd_read_events(lazy.uffd, msgs, ARRAY_SIZE(msgs));
+        if (n < 0) {
+            lazy_load_fail("could not read userfaultfd events");
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            if (msgs[i].event == UFFD_EVENT_PAGEFAULT) {
+                lazy_load_fault(msgs[i].arg.pagefault.address, buf);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void lazy_load_finish(bool complete)
+{
+    int i;
+
+    if (!lazy.blocks) {
+        return;
+    }
+
+    qatomic_set(&lazy.quit, true);
+    for (i = 0; lazy.prefetching && i < LAZY_LOAD_PREFETCH_THREADS; i++) {
+        qemu_thread_join(&lazy.prefetch_threads[i]);
+    }
+    event_notifier_set(&lazy.quit_notifier);
+    qemu_thread_join(&lazy.fault_thread);
+
+    for (i = 0; i < lazy.blocks->len; i++) {
+        LazyLoadBlock *lb = g_ptr_array_index(lazy.blocks, i);
+
+        if (lb->registered) {
+            uffd_unregister_memory(lazy.uffd, lb->rb->host,
+                                   lb->nr_pages * TARGET_PAGE_SIZE);
+        }
+        g_free(lb->present);
+        g_free(lb->placed);
+    }
+    trace_lazy_load_finish(complete, lazy.fault_count,
+                           (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                            lazy.start_time) / SCALE_MS);
+
+    g_ptr_array_free(lazy.blocks, true);
+    uffd_close_fd(lazy.uffd);
+    if (lazy.discard_disabled) {
+        ram_block_discard_disable(false);
+    }
+    qemu_mutex_destroy(&lazy.lock);
+    event_notifier_cleanup(&lazy.quit_notifier);
+    object_unref(OBJECT(lazy.ioc));
+    memset(&lazy, 0, sizeof(lazy));
+}
+
+static void lazy_load_complete_bh(void *opaque)
+{
+    if (GPOINTER_TO_UINT(opaque) == lazy_generation) {
+        lazy_load_finish(true);
+    }
+}
+
+static void *lazy_load_prefetch_thread(void *opaque)
+{
+    g_autofree uint8_t *buf = g_malloc(LAZY_LOAD_CHUNK_PAGES *
+                                       TARGET_PAGE_SIZE);
+    int i;
+
+    for (i = 0; i < lazy.blocks->len; i++) {
+        LazyLoadBlock *lb = g_ptr_array_index(lazy.blocks, i);
+
+        while (!qatomic_read(&lazy.quit)) {
+            unsigned long chunk = qatomic_fetch_inc(&lb->next_chunk);
+            unsigned long page = chunk * LAZY_LOAD_CHUNK_PAGES;
+            unsigned long end = MIN(page + LAZY_LOAD_CHUNK_PAGES,
+                                    lb->nr_pages);
+
+            if (page >= lb->nr_pages) {
+                break;
+            }
+
+            while (page < end) {
+                unsigned long n;
+                int ret;
+
+                if (test_bit(page, lb->placed)) {
+                    page++;
+                    continue;
+                }
+                n = lazy_load_run(lb, page, end - page);
+                ret = lazy_load_place(lb, page, n, buf);
+                if (ret) {
+                    /*
+                     * Leave the rest to the fault thread.  Without this
+                     * thread the load never completes, which must not
+                     * happen with pages missing: they would read as zero.
+                     */
+                    lazy_load_fail("could not load page " RAM_ADDR_FMT
+                                   " of %s: %s",
+                                   (ram_addr_t)page << TARGET_PAGE_BITS,
+                                   lb->rb->idstr, strerror(-ret));
+                    return NULL;
+                }
+                page += n;
+            }
+        }
+    }
+
+    /* the last one out tears everything down from the main loop */
+    if (qatomic_fetch_dec(&lazy.prefetch_running) == 1 &&
+        !qatomic_read(&lazy.quit)) {
+        aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                                lazy_load_complete_bh,
+                                GUINT_TO_POINTER(lazy_generation));
+    }
+    return NULL;
+}
+
+static bool lazy_load_init(QEMUFile *f, Error **errp)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    QIOChannelFile *fioc;
+
+    if (!object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_FILE)) {
+        error_setg(errp, "lazy load needs a migration file");
+        return false;
+    }
+
+    /* the migration channel goes away once the device state is loaded */
+    fioc = qio_channel_file_new_dupfd(QIO_CHANNEL_FILE(ioc)->fd, errp);
+    if (!fioc) {
+        return false;
+    }
+
+    lazy.uffd = uffd_create_fd(0, true);
+    if (lazy.uffd < 0) {
+        error_setg(errp, "lazy load: userfaultfd is not available");
+        object_unref(OBJECT(fioc));
+        return false;
+    }
+
+    /* keep the balloon and free page reporting away until we are done */
+    if (ram_block_discard_disable(true)) {
+        error_setg(errp, "lazy load: could not disable discarding RAM");
+        uffd_close_fd(lazy.uffd);
+        object_unref(OBJECT(fioc));
+        return false;
+    }
+    lazy.discard_disabled = true;
+
+    lazy_generation++;
+    lazy.ioc = QIO_CHANNEL(fioc);
+    lazy.blocks = g_ptr_array_new_with_free_func(g_free);
+    qemu_mutex_init(&lazy.lock);
+    lazy.start_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    event_notifier_init(&lazy.quit_notifier, false);
+    qemu_thread_create(&lazy.fault_thread, "lazy-load-fault",
+                       lazy_load_fault_thread, NULL, QEMU_THREAD_JOINABLE);
+    return true;
+}
+
+bool lazy_load_add_ramblock(QEMUFile *f, RAMBlock *rb, unsigned long nr_pages,
+                            unsigned long *present, uint64_t pages_offset,
+                            Error **errp)
+{
+    const uint64_t needed = BIT(_UFFDIO_COPY) | BIT(_UFFDIO_ZEROPAGE);
+    LazyLoadBlock *lb;
+    uint64_t ioctls;
+
+    assert(!lazy.prefetching);
+
+    if (!lazy.blocks && !lazy_load_init(f, errp)) {
+        g_free(present);
+        return false;
+    }
+
+    nr_pages = MIN(nr_pages, rb->used_length >> TARGET_PAGE_BITS);
+    lb = g_new0(LazyLoadBlock, 1);
+    lb->rb = rb;
+    lb->pages_offset = pages_offset;
+    lb->nr_pages = nr_pages;
+    lb->present = present;
+    lb->placed = bitmap_new(nr_pages);
+
+    /* from now on the block is ours, see lazy_load_finish() */
+    WITH_QEMU_LOCK_GUARD(&lazy.lock) {
+        g_ptr_array_add(lazy.blocks, lb);
+    }
+
+    if (ram_block_discard_range(rb, 0, nr_pages * TARGET_PAGE_SIZE) ||
+        uffd_register_memory(lazy.uffd, rb->host, nr_pages * TARGET_PAGE_SIZE,
+                             UFFDIO_REGISTER_MODE_MISSING, &ioctls)) {
+        error_setg(errp, "lazy load: could not register ramblock %s",
+                   rb->idstr);
+        return false;
+    }
+    lb->registered = true;
+
+    if ((ioctls & needed) != needed) {
+        error_setg(errp, "lazy load: ramblock %s does not support "
+                   "userfaultfd copies", rb->idstr);
+        return false;
+    }
+
+    trace_lazy_load_add_ramblock(rb->idstr, nr_pages,
+                                 bitmap_count_one(present, nr_pages));
+    return true;
+}
+
+void lazy_load_start(void)
+{
+    int i;
+
+    if (!lazy.blocks || lazy.prefetching) {
+        return;
+    }
+
+    lazy.prefetching = true;
+    lazy.prefetch_running = LAZY_LOAD_PREFETCH_THREADS;
+    for (i = 0; i < LAZY_LOAD_PREFETCH_THREADS; i++) {
+        qemu_thread_create(&lazy.prefetch_threads[i], "lazy-load-prefetch",
+                           lazy_load_prefetch_thread, NULL,
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+void lazy_load_cancel(void)
+{
+    lazy_load_finish(false);
+}
+
+void lazy_load_cleanup(void)
+{
+    if (!lazy.prefetching) {
+        lazy_load_finish(false);
+    }
+}
+
+#else /* !CONFIG_LINUX */
+
+bool lazy_load_ramblock_supported(RAMBlock *rb)
+{
+    return false;
+}
+
+bool lazy_load_add_ramblock(QEMUFile *f, RAMBlock *rb, unsigned long nr_pages,
+                            unsigned long *present, uint64_t pages_offset,
+                            Error **errp)
+{
+    g_assert_not_reached();
+}
+
+void lazy_load_start(void)
+{
+}
+
+void lazy_load_cancel(void)
+{
+}
+
+void lazy_load_cleanup(void)
+{
+}
+
+#endif
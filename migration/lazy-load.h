@@ -0,0 +1,48 @@
+/*
+ * Lazy restore of mapped-ram snapshots
+ *
+ * Copyright (c) 2026 the Oro Operating System Project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef QEMU_MIGRATION_LAZY_LOAD_H
+#define QEMU_MIGRATION_LAZY_LOAD_H
+
+#include "qemu-file.h"
+
+/*
+ * lazy_load_ramblock_supported: whether @rb can be filled on demand
+ *
+ * Only private anonymous memory backed by host sized pages can; every
+ * other block is read eagerly.
+ */
+bool lazy_load_ramblock_supported(RAMBlock *rb);
+
+/**
+ * lazy_load_add_ramblock: populate @rb on demand from @f
+ *
+ * @present has one bit per page of @rb, set for the pages stored in the
+ * file at @pages_offset; the other pages are zero.  Ownership of
+ * @present is transferred.  The content of @rb is discarded and every
+ * access to it waits until the page has been read from the file.
+ *
+ * Returns: true on success, false on error (with @errp set).
+ */
+bool lazy_load_add_ramblock(QEMUFile *f, RAMBlock *rb, unsigned long nr_pages,
+                            unsigned long *present, uint64_t pages_offset,
+                            Error **errp);
+
+/* Start filling the blocks added so far in the background. */
+void lazy_load_start(void);
+
+/*
+ * Stop serving pages, pages that were not read yet are left zero.  Only
+ * meant for a load that replaces the whole RAM content anyway.
+ */
+void lazy_load_cancel(void);
+
+/* Tear down a lazy load that failed before lazy_load_start(). */
+void lazy_load_cleanup(void);
+
+#endif
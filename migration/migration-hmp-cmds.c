@@ -174,6 +174,10 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                 monitor_printf(mon, ", down=%" PRIu64,
                                info->downtime);
             }
+            if (info->has_predicted_downtime) {
+                monitor_printf(mon, ", pred_down=%" PRIu64,
+                               info->predicted_downtime);
+            }
             monitor_printf(mon, "\n");
         }
     }
@@ -243,6 +247,14 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
             monitor_printf(mon, ", zerocopy_fallbacks=%" PRIu64,
                            info->ram->dirty_sync_missed_zero_copy);
         }
+        if (info->ram->has_resent_bytes) {
+            monitor_printf(mon, ", resent_bytes=%" PRIu64,
+                           info->ram->resent_bytes);
+        }
+        if (info->ram->has_deferred_pages) {
+            monitor_printf(mon, ", deferred_pages=%" PRIu64,
+                           info->ram->deferred_pages);
+        }
         monitor_printf(mon, "\n");
     }
 
@@ -453,6 +465,16 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
 
         assert(params->has_cpr_exec_command);
         monitor_print_cpr_exec_command(mon, params->cpr_exec_command);
+
+        assert(params->mapped_ram_page_store);
+        monitor_printf(mon, "%s: '%s'\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_MAPPED_RAM_PAGE_STORE),
+            params->mapped_ram_page_store);
+
+        assert(params->has_dirty_sync_threads);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_DIRTY_SYNC_THREADS),
+            params->dirty_sync_threads);
     }
 
     qapi_free_MigrationParameters(params);
@@ -755,6 +777,13 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_cpr_exec_command = true;
         break;
     }
+    case MIGRATION_PARAMETER_MAPPED_RAM_PAGE_STORE:
+        visit_type_str(v, param, &p->mapped_ram_page_store, &err);
+        break;
+    case MIGRATION_PARAMETER_DIRTY_SYNC_THREADS:
+        p->has_dirty_sync_threads = true;
+        visit_type_uint8(v, param, &p->dirty_sync_threads, &err);
+        break;
     default:
         g_assert_not_reached();
     }
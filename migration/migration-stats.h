@@ -93,6 +93,15 @@ typedef struct {
      * Number of bytes sent through RDMA.
      */
     uint64_t rdma_bytes;
+    /*
+     * Number of bytes of guest RAM sent again after being dirtied, only
+     * counted with hot-page-deferral.
+     */
+    uint64_t resent_bytes;
+    /*
+     * Number of times a dirty page was held back by hot-page-deferral.
+     */
+    uint64_t deferred_pages;
     /*
      * Number of pages transferred that were full of zeros.
      */
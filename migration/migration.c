@@ -253,6 +253,15 @@ static bool
 migration_capabilities_and_transport_compatible(MigrationAddress *addr,
                                                 Error **errp)
 {
+    const char *page_store =
+        migrate_get_current()->parameters.mapped_ram_page_store;
+
+    if (page_store && *page_store && !migrate_mapped_ram()) {
+        error_setg(errp, "mapped-ram-page-store requires the mapped-ram "
+                   "capability");
+        return false;
+    }
+
     if (addr->transport == MIGRATION_ADDRESS_TYPE_RDMA) {
         return migrate_rdma_caps_check(migrate_get_current()->capabilities,
                                        errp);
@@ -1043,6 +1052,11 @@ static void populate_time_info(MigrationInfo *info, MigrationState *s)
     info->has_setup_time = true;
     info->setup_time = s->setup_time;
 
+    if (s->predicted_downtime >= 0) {
+        info->has_predicted_downtime = true;
+        info->predicted_downtime = s->predicted_downtime;
+    }
+
     if (s->state == MIGRATION_STATUS_COMPLETED) {
         info->has_total_time = true;
         info->total_time = s->total_time;
@@ -1084,6 +1098,12 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     info->ram->precopy_bytes = qatomic_read(&mig_stats.precopy_bytes);
     info->ram->downtime_bytes = qatomic_read(&mig_stats.downtime_bytes);
     info->ram->postcopy_bytes = qatomic_read(&mig_stats.postcopy_bytes);
+    if (migrate_hot_page_deferral()) {
+        info->ram->has_resent_bytes = true;
+        info->ram->resent_bytes = qatomic_read(&mig_stats.resent_bytes);
+        info->ram->has_deferred_pages = true;
+        info->ram->deferred_pages = qatomic_read(&mig_stats.deferred_pages);
+    }
 
     if (migrate_xbzrle()) {
         info->xbzrle_cache = g_malloc0(sizeof(*info->xbzrle_cache));
@@ -1632,6 +1652,9 @@ int migrate_init(MigrationState *s, Error **errp)
     s->pages_per_second = 0.0;
     s->downtime = 0;
     s->expected_downtime = 0;
+    s->predicted_downtime = -1;
+    s->predicted_downtime_prev = -1;
+    s->switchover_wait_start = 0;
     s->setup_time = 0;
     s->start_postcopy = false;
     s->migration_thread_running = false;
@@ -3074,6 +3097,30 @@ static MigThrError migration_detect_error(MigrationState *s)
     }
 }
 
+/* Weight of the newest switchover in MigrationState.downtime_overhead */
+#define DOWNTIME_OVERHEAD_WEIGHT 0.5
+
+/*
+ * Fold the error of the last prediction into the overhead of a
+ * switchover, which covers what the model does not see: stopping the
+ * VM, saving and loading devices, and the round trips in between.
+ */
+static void migration_downtime_model_learn(MigrationState *s)
+{
+    double error;
+
+    if (s->predicted_downtime < 0 ||
+        s->state == MIGRATION_STATUS_POSTCOPY_ACTIVE) {
+        return;
+    }
+
+    error = s->downtime - s->predicted_downtime;
+    s->downtime_overhead = MAX(s->downtime_overhead +
+                               DOWNTIME_OVERHEAD_WEIGHT * error, 0);
+    trace_migration_downtime_model_learn(s->predicted_downtime, s->downtime,
+                                         (uint64_t)s->downtime_overhead);
+}
+
 static void migration_completion_end(MigrationState *s)
 {
     uint64_t bytes = migration_transferred_bytes();
@@ -3087,6 +3134,7 @@ static void migration_completion_end(MigrationState *s)
      */
     bql_lock();
     migration_downtime_end(s);
+    migration_downtime_model_learn(s);
     s->total_time = end_time - s->start_time;
     transfer_time = s->total_time - s->setup_time;
     if (transfer_time) {
@@ -3109,6 +3157,35 @@ static void update_iteration_initial_status(MigrationState *s)
     s->iteration_initial_pages = ram_get_total_transferred_pages();
 }
 
+/*
+ * Predict the downtime of switching over now: sending the RAM that is
+ * still dirty, the RAM the guest is predicted to dirty until it stops,
+ * the pending data of the other iterative devices and the non-iterable
+ * device state at @bw_per_ms, plus the overhead seen by earlier
+ * switchovers.
+ */
+static void migration_predict_downtime(MigrationState *s, double bw_per_ms)
+{
+    uint64_t must_precopy, can_postcopy, pending, ram_pending, ram_dirty;
+    uint64_t devices;
+
+    if (!bw_per_ms || !ram_predict_dirty_bytes(&ram_dirty)) {
+        return;
+    }
+
+    qemu_savevm_state_pending_estimate(&must_precopy, &can_postcopy);
+    pending = must_precopy + can_postcopy;
+    ram_pending = ram_bytes_remaining();
+    devices = (pending > ram_pending ? pending - ram_pending : 0) +
+              s->non_iterable_bytes;
+
+    s->predicted_downtime_prev = s->predicted_downtime;
+    s->predicted_downtime = (ram_pending + ram_dirty + devices) / bw_per_ms +
+                            s->downtime_overhead;
+    trace_migration_predict_downtime(ram_pending, ram_dirty, devices,
+                                     s->predicted_downtime);
+}
+
 static void migration_update_counters(MigrationState *s,
                                       int64_t current_time)
 {
@@ -3160,6 +3237,10 @@ static void migration_update_counters(MigrationState *s,
             qatomic_read(&mig_stats.dirty_bytes_last_sync) / expected_bw_per_ms;
     }
 
+    if (!migration_in_postcopy()) {
+        migration_predict_downtime(s, expected_bw_per_ms);
+    }
+
     migration_rate_reset();
 
     update_iteration_initial_status(s);
@@ -3184,6 +3265,39 @@ static bool migration_can_switchover(MigrationState *s)
     return s->switchover_acked;
 }
 
+/* Longest wait for a better switchover once the prediction is in limit */
+#define SWITCHOVER_MAX_WAIT_MS 1000
+
+/*
+ * Whether precopy can switch over with @pending_size bytes left.  With
+ * predictive-switchover and a prediction available, once the predicted
+ * downtime is within the limit keep iterating while the prediction
+ * drops by more than 5% per update: data sent now is data not sent with
+ * the VM stopped.  Otherwise compare the pending data to what can be
+ * sent within the limit.
+ */
+static bool migration_switchover_ready(MigrationState *s,
+                                       uint64_t pending_size)
+{
+    int64_t now;
+
+    if (!migrate_predictive_switchover() || s->predicted_downtime_prev < 0) {
+        return pending_size <= s->threshold_size;
+    }
+
+    if (s->predicted_downtime > migrate_downtime_limit()) {
+        s->switchover_wait_start = 0;
+        return false;
+    }
+
+    now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    if (!s->switchover_wait_start) {
+        s->switchover_wait_start = now;
+    }
+    return s->predicted_downtime * 100 >= s->predicted_downtime_prev * 95 ||
+           now - s->switchover_wait_start >= SWITCHOVER_MAX_WAIT_MS;
+}
+
 /* Migration thread iteration status */
 typedef enum {
     MIG_ITERATE_RESUME,         /* Resume current iteration */
@@ -3257,9 +3371,11 @@ static MigIterateState migration_iteration_run(MigrationState *s)
          *
          * (1) Switchover is acknowledged by destination
          * (2) Pending size is no more than the threshold specified
-         *     (which was calculated from expected downtime)
+         *     (which was calculated from expected downtime), or the
+         *     predicted downtime is within the limit
          */
-        complete_ready = can_switchover && (pending_size <= s->threshold_size);
+        complete_ready = can_switchover &&
+                         migration_switchover_ready(s, pending_size);
     }
 
     if (complete_ready) {
@@ -3862,6 +3978,8 @@ static void migration_instance_init(Object *obj)
     ms->state = MIGRATION_STATUS_NONE;
     ms->mbps = -1;
     ms->pages_per_second = -1;
+    ms->predicted_downtime = -1;
+    ms->predicted_downtime_prev = -1;
     qemu_event_init(&ms->pause_event, false);
     qemu_mutex_init(&ms->error_mutex);
 
@@ -360,6 +360,21 @@ struct MigrationState {
     int64_t downtime_start;
     int64_t downtime;
     int64_t expected_downtime;
+    /*
+     * Downtime (ms) predicted by migration_predict_downtime(), the
+     * prediction before that one, and when the prediction last got
+     * within downtime-limit with predictive-switchover.
+     */
+    int64_t predicted_downtime;
+    int64_t predicted_downtime_prev;
+    int64_t switchover_wait_start;
+    /*
+     * Kept across migrations to predict the downtime: size of the
+     * non-iterable device state last saved, and the weighted mean of
+     * the downtime (ms) that the data sent at switchover did not explain.
+     */
+    uint64_t non_iterable_bytes;
+    double downtime_overhead;
     bool capabilities[MIGRATION_CAPABILITY__MAX];
     int64_t setup_time;
 
@@ -161,7 +161,10 @@ static void multifd_nocomp_recv_cleanup(MultiFDRecvParams *p)
 
 static int multifd_nocomp_recv(MultiFDRecvParams *p, Error **errp)
 {
+    uint32_t page_size = multifd_ram_page_size();
     uint32_t flags;
+    int niov = 0;
+    int ret;
 
     if (migrate_mapped_ram()) {
         return multifd_file_recv_data(p, errp);
@@ -181,12 +184,37 @@ static int multifd_nocomp_recv(MultiFDRecvParams *p, Error **errp)
         return 0;
     }
 
+    /*
+     * Pages are read straight into guest memory.  The source sends them
+     * in address order, so merge contiguous pages into one iovec: this
+     * keeps the iovec short and marks each run received in one go.
+     */
     for (int i = 0; i < p->normal_num; i++) {
-        p->iov[i].iov_base = p->host + p->normal[i];
-        p->iov[i].iov_len = multifd_ram_page_size();
-        ramblock_recv_bitmap_set_offset(p->block, p->normal[i]);
+        uint8_t *host = p->host + p->normal[i];
+
+        if (niov && (uint8_t *)p->iov[niov - 1].iov_base +
+                    p->iov[niov - 1].iov_len == host) {
+            p->iov[niov - 1].iov_len += page_size;
+        } else {
+            p->iov[niov].iov_base = host;
+            p->iov[niov].iov_len = page_size;
+            niov++;
+        }
+    }
+
+    for (int i = 0; i < niov; i++) {
+        ramblock_recv_bitmap_set_range(p->block, p->iov[i].iov_base,
+                                       p->iov[i].iov_len / page_size);
+    }
+
+    ret = qio_channel_readv_full_all_eof(p->c, p->iov, niov, NULL, NULL,
+                                         QIO_CHANNEL_READ_FLAG_WAITALL, errp);
+    if (ret == 0) {
+        error_setg(errp, "multifd %u: unexpected end-of-file reading pages",
+                   p->id);
+        return -1;
     }
-    return qio_channel_readv_all(p->c, p->iov, p->normal_num, errp);
+    return ret < 0 ? -1 : 0;
 }
 
 static void multifd_pages_reset(MultiFDPages_t *pages)
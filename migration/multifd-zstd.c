@@ -11,8 +11,10 @@
  */
 
 #include "qemu/osdep.h"
+#include <math.h>
 #include <zstd.h>
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "system/ramblock.h"
 #include "exec/target_page.h"
 #include "qapi/error.h"
@@ -33,6 +35,8 @@ struct zstd_data {
     uint8_t *zbuff;
     /* size of compressed buffer */
     uint32_t zbuff_len;
+    /* adaptive mode only */
+    struct zstd_adaptive *adaptive;
 };
 
 /* Multifd zstd compression */
@@ -88,17 +92,19 @@ static void multifd_zstd_send_cleanup(MultiFDSendParams *p, Error **errp)
     p->iov = NULL;
 }
 
-static int multifd_zstd_send_prepare(MultiFDSendParams *p, Error **errp)
+/*
+ * Compress the normal pages of @p into z->zbuff.  The last page is
+ * followed by @last_op: ZSTD_e_flush keeps the stream going from one
+ * packet to the next, ZSTD_e_end makes each packet a frame of its own.
+ */
+static int multifd_zstd_compress(MultiFDSendParams *p,
+                                 ZSTD_EndDirective last_op, Error **errp)
 {
     MultiFDPages_t *pages = &p->data->u.ram;
     struct zstd_data *z = p->compress_data;
     int ret;
     uint32_t i;
 
-    if (!multifd_send_prepare_common(p)) {
-        goto out;
-    }
-
     z->out.dst = z->zbuff;
     z->out.size = z->zbuff_len;
     z->out.pos = 0;
@@ -107,7 +113,7 @@ static int multifd_zstd_send_prepare(MultiFDSendParams *p, Error **errp)
         ZSTD_EndDirective flush = ZSTD_e_continue;
 
         if (i == pages->normal_num - 1) {
-            flush = ZSTD_e_flush;
+            flush = last_op;
         }
         z->in.src = pages->block->host + pages->offset[i];
         z->in.size = multifd_ram_page_size();
@@ -118,14 +124,16 @@ static int multifd_zstd_send_prepare(MultiFDSendParams *p, Error **errp)
          *
          * We need to loop while:
          * - return is > 0
-         * - there is input available
+         * - there is input available, or output left to flush
          * - there is output space free
          */
         do {
             ret = ZSTD_compressStream2(z->zcs, &z->out, &z->in, flush);
-        } while (ret > 0 && (z->in.size > z->in.pos)
+        } while (ret > 0 && (z->in.size > z->in.pos ||
+                             flush != ZSTD_e_continue)
                          && (z->out.size > z->out.pos));
-        if (ret > 0 && (z->in.size > z->in.pos)) {
+        if (ret > 0 && (z->in.size > z->in.pos ||
+                        flush != ZSTD_e_continue)) {
             error_setg(errp, "multifd %u: compressStream buffer too small",
                        p->id);
             return -1;
@@ -136,6 +144,20 @@ static int multifd_zstd_send_prepare(MultiFDSendParams *p, Error **errp)
             return -1;
         }
     }
+    return 0;
+}
+
+static int multifd_zstd_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    struct zstd_data *z = p->compress_data;
+
+    if (!multifd_send_prepare_common(p)) {
+        goto out;
+    }
+
+    if (multifd_zstd_compress(p, ZSTD_e_flush, errp) < 0) {
+        return -1;
+    }
     p->iov[p->iovs_num].iov_base = z->zbuff;
     p->iov[p->iovs_num].iov_len = z->out.pos;
     p->iovs_num++;
@@ -193,23 +215,16 @@ static void multifd_zstd_recv_cleanup(MultiFDRecvParams *p)
     p->compress_data = NULL;
 }
 
-static int multifd_zstd_recv(MultiFDRecvParams *p, Error **errp)
+static int multifd_zstd_recv_pages(MultiFDRecvParams *p, Error **errp)
 {
     uint32_t in_size = p->next_packet_size;
     uint32_t out_size = 0;
     uint32_t page_size = multifd_ram_page_size();
     uint32_t expected_size = p->normal_num * page_size;
-    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
     struct zstd_data *z = p->compress_data;
     int ret;
     int i;
 
-    if (flags != MULTIFD_FLAG_ZSTD) {
-        error_setg(errp, "multifd %u: flags received %x flags expected %x",
-                   p->id, flags, MULTIFD_FLAG_ZSTD);
-        return -1;
-    }
-
     multifd_recv_zero_page_process(p);
 
     if (!p->normal_num) {
@@ -265,6 +280,303 @@ static int multifd_zstd_recv(MultiFDRecvParams *p, Error **errp)
     return 0;
 }
 
+static int multifd_zstd_recv(MultiFDRecvParams *p, Error **errp)
+{
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+
+    if (flags != MULTIFD_FLAG_ZSTD) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_ZSTD);
+        return -1;
+    }
+
+    return multifd_zstd_recv_pages(p, errp);
+}
+
+/*
+ * Multifd adaptive compression
+ *
+ * Each packet is either sent as is or compressed with zstd, at level 1
+ * or at a stronger level.  The sender picks the method that it expects
+ * to get the packet through fastest: compressing costs CPU time on the
+ * channel's thread, not compressing costs time on the wire.  The cost
+ * per byte and the compression ratio of each method are tracked per
+ * channel from the packets it sent, so that the choice follows the
+ * load of the host and the content of the guest memory.
+ *
+ * Compressed packets are complete zstd frames, so that the level can
+ * change from one packet to the next and the destination does not care
+ * which level was used.  The packet flags say whether the payload is
+ * compressed.
+ */
+
+/* Level used for the fast zstd method */
+#define ADAPTIVE_ZSTD_FAST_LEVEL 1
+/* Minimum level used for the strong zstd method */
+#define ADAPTIVE_ZSTD_STRONG_LEVEL 3
+/* Above this many bits per byte, data is not worth compressing */
+#define ADAPTIVE_MAX_ENTROPY 7.5
+/* Bytes sampled from each page to estimate the entropy */
+#define ADAPTIVE_SAMPLE_LEN 64
+/* Maximum number of pages sampled per packet */
+#define ADAPTIVE_SAMPLE_PAGES 64
+/* Every that many packets, try another method to refresh its figures */
+#define ADAPTIVE_PROBE_INTERVAL 32
+
+typedef enum {
+    ADAPTIVE_NOCOMP,
+    ADAPTIVE_ZSTD_FAST,
+    ADAPTIVE_ZSTD_STRONG,
+    ADAPTIVE__MAX,
+} AdaptiveMethod;
+
+static const char *const adaptive_method_str[ADAPTIVE__MAX] = {
+    [ADAPTIVE_NOCOMP] = "none",
+    [ADAPTIVE_ZSTD_FAST] = "zstd-fast",
+    [ADAPTIVE_ZSTD_STRONG] = "zstd-strong",
+};
+
+struct zstd_adaptive {
+    /* moving averages: CPU ns per input byte, output/input size */
+    double cost[ADAPTIVE__MAX];
+    double ratio[ADAPTIVE__MAX];
+    /* moving average of the ns per byte spent writing to the channel */
+    double wire_cost;
+    int level[ADAPTIVE__MAX];
+    /* level the compression stream is set to */
+    int cur_level;
+    uint64_t packets;
+};
+
+static void adaptive_update(double *avg, double sample)
+{
+    *avg = *avg * 0.75 + sample * 0.25;
+}
+
+/*
+ * Estimate the entropy in bits per byte of the normal pages of @p from
+ * a few bytes of some of them.  Zero pages are already gone, so this
+ * mostly tells apart compressed or encrypted data from the rest.
+ */
+static double multifd_adaptive_entropy(MultiFDSendParams *p)
+{
+    MultiFDPages_t *pages = &p->data->u.ram;
+    uint32_t page_size = multifd_ram_page_size();
+    uint32_t step = MAX(1, pages->normal_num / ADAPTIVE_SAMPLE_PAGES);
+    uint32_t hist[256] = { };
+    uint32_t i, j, n = 0;
+    double entropy = 0;
+
+    for (i = 0; i < pages->normal_num; i += step) {
+        /* look at a different part of each page */
+        uint32_t off = (i * 7 * ADAPTIVE_SAMPLE_LEN) % page_size;
+        const uint8_t *buf = pages->block->host + pages->offset[i] + off;
+
+        for (j = 0; j < ADAPTIVE_SAMPLE_LEN; j++) {
+            hist[buf[j]]++;
+        }
+        n += ADAPTIVE_SAMPLE_LEN;
+    }
+
+    for (i = 0; i < 256; i++) {
+        if (hist[i]) {
+            double f = (double)hist[i] / n;
+
+            entropy -= f * log2(f);
+        }
+    }
+    return entropy;
+}
+
+static AdaptiveMethod multifd_adaptive_select(MultiFDSendParams *p,
+                                              struct zstd_adaptive *a)
+{
+    AdaptiveMethod best = ADAPTIVE_NOCOMP, m;
+    double best_cost = INFINITY;
+
+    if (multifd_adaptive_entropy(p) > ADAPTIVE_MAX_ENTROPY) {
+        return ADAPTIVE_NOCOMP;
+    }
+
+    for (m = 0; m < ADAPTIVE__MAX; m++) {
+        double cost = a->cost[m] + a->ratio[m] * a->wire_cost;
+
+        if (cost < best_cost) {
+            best = m;
+            best_cost = cost;
+        }
+    }
+
+    /* the figures of the other methods get stale, refresh them */
+    if (!(a->packets % ADAPTIVE_PROBE_INTERVAL)) {
+        m = (a->packets / ADAPTIVE_PROBE_INTERVAL) % ADAPTIVE__MAX;
+        if (m != best) {
+            return m;
+        }
+    }
+    return best;
+}
+
+static int multifd_zstd_adaptive_send_setup(MultiFDSendParams *p,
+                                            Error **errp)
+{
+    struct zstd_adaptive *a;
+    struct zstd_data *z;
+
+    if (multifd_zstd_send_setup(p, errp) < 0) {
+        return -1;
+    }
+    z = p->compress_data;
+
+    /* Packet header and either the compressed data or every page */
+    g_free(p->iov);
+    p->iov = g_new0(struct iovec, multifd_ram_page_count() + 1);
+
+    a = g_new0(struct zstd_adaptive, 1);
+    a->level[ADAPTIVE_ZSTD_FAST] = ADAPTIVE_ZSTD_FAST_LEVEL;
+    a->level[ADAPTIVE_ZSTD_STRONG] = MAX(migrate_multifd_zstd_level(),
+                                         ADAPTIVE_ZSTD_STRONG_LEVEL);
+    a->cur_level = migrate_multifd_zstd_level();
+    /* start with a guess: 1 GB/s for zstd-fast and for the link */
+    a->cost[ADAPTIVE_ZSTD_FAST] = 1;
+    a->ratio[ADAPTIVE_ZSTD_FAST] = 0.5;
+    a->cost[ADAPTIVE_ZSTD_STRONG] = 3;
+    a->ratio[ADAPTIVE_ZSTD_STRONG] = 0.4;
+    a->ratio[ADAPTIVE_NOCOMP] = 1;
+    a->wire_cost = 1;
+    z->adaptive = a;
+    return 0;
+}
+
+static void multifd_zstd_adaptive_send_cleanup(MultiFDSendParams *p,
+                                               Error **errp)
+{
+    struct zstd_data *z = p->compress_data;
+
+    g_free(z->adaptive);
+    multifd_zstd_send_cleanup(p, errp);
+}
+
+static int multifd_zstd_adaptive_send_prepare(MultiFDSendParams *p,
+                                              Error **errp)
+{
+    MultiFDPages_t *pages = &p->data->u.ram;
+    struct zstd_data *z = p->compress_data;
+    struct zstd_adaptive *a = z->adaptive;
+    uint32_t page_size = multifd_ram_page_size();
+    uint32_t in_size;
+    AdaptiveMethod m;
+    int64_t start;
+    size_t ret;
+
+    /* the last write of this channel tells how fast the link is */
+    if (p->write_bytes) {
+        adaptive_update(&a->wire_cost, (double)p->write_ns / p->write_bytes);
+    }
+
+    if (!multifd_send_prepare_common(p)) {
+        p->flags |= MULTIFD_FLAG_NOCOMP;
+        goto out;
+    }
+
+    in_size = pages->normal_num * page_size;
+    m = multifd_adaptive_select(p, a);
+    a->packets++;
+    trace_multifd_zstd_adaptive_select(p->id, adaptive_method_str[m],
+                                       (unsigned)(a->cost[m] * 1000),
+                                       (unsigned)(a->ratio[m] * 100),
+                                       (unsigned)(a->wire_cost * 1000));
+
+    if (m == ADAPTIVE_NOCOMP) {
+        for (uint32_t i = 0; i < pages->normal_num; i++) {
+            p->iov[p->iovs_num].iov_base = pages->block->host +
+                                           pages->offset[i];
+            p->iov[p->iovs_num].iov_len = page_size;
+            p->iovs_num++;
+        }
+        p->next_packet_size = in_size;
+        p->flags |= MULTIFD_FLAG_NOCOMP;
+        goto out;
+    }
+
+    /* the previous packet ended its frame, the level can change */
+    if (a->cur_level != a->level[m]) {
+        ret = ZSTD_CCtx_setParameter(z->zcs, ZSTD_c_compressionLevel,
+                                     a->level[m]);
+        if (ZSTD_isError(ret)) {
+            error_setg(errp, "multifd %u: setting zstd level failed: %s",
+                       p->id, ZSTD_getErrorName(ret));
+            return -1;
+        }
+        a->cur_level = a->level[m];
+    }
+
+    start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    if (multifd_zstd_compress(p, ZSTD_e_end, errp) < 0) {
+        return -1;
+    }
+    adaptive_update(&a->cost[m],
+                    (double)(qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start) /
+                    in_size);
+    adaptive_update(&a->ratio[m], (double)z->out.pos / in_size);
+
+    p->iov[p->iovs_num].iov_base = z->zbuff;
+    p->iov[p->iovs_num].iov_len = z->out.pos;
+    p->iovs_num++;
+    p->next_packet_size = z->out.pos;
+    p->flags |= MULTIFD_FLAG_ZSTD;
+
+out:
+    multifd_send_fill_packet(p);
+    return 0;
+}
+
+static int multifd_zstd_adaptive_recv_setup(MultiFDRecvParams *p,
+                                            Error **errp)
+{
+    if (multifd_zstd_recv_setup(p, errp) < 0) {
+        return -1;
+    }
+    p->iov = g_new0(struct iovec, multifd_ram_page_count());
+    return 0;
+}
+
+static void multifd_zstd_adaptive_recv_cleanup(MultiFDRecvParams *p)
+{
+    g_free(p->iov);
+    p->iov = NULL;
+    multifd_zstd_recv_cleanup(p);
+}
+
+static int multifd_zstd_adaptive_recv(MultiFDRecvParams *p, Error **errp)
+{
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+
+    if (flags == MULTIFD_FLAG_ZSTD) {
+        return multifd_zstd_recv_pages(p, errp);
+    }
+
+    if (flags != MULTIFD_FLAG_NOCOMP) {
+        error_setg(errp, "multifd %u: flags received %x flags expected "
+                   "%x or %x", p->id, flags, MULTIFD_FLAG_NOCOMP,
+                   MULTIFD_FLAG_ZSTD);
+        return -1;
+    }
+
+    multifd_recv_zero_page_process(p);
+
+    if (!p->normal_num) {
+        return 0;
+    }
+
+    for (int i = 0; i < p->normal_num; i++) {
+        p->iov[i].iov_base = p->host + p->normal[i];
+        p->iov[i].iov_len = multifd_ram_page_size();
+        ramblock_recv_bitmap_set_offset(p->block, p->normal[i]);
+    }
+    return qio_channel_readv_all(p->c, p->iov, p->normal_num, errp);
+}
+
 static const MultiFDMethods multifd_zstd_ops = {
     .send_setup = multifd_zstd_send_setup,
     .send_cleanup = multifd_zstd_send_cleanup,
@@ -274,9 +586,20 @@ static const MultiFDMethods multifd_zstd_ops = {
     .recv = multifd_zstd_recv
 };
 
+static const MultiFDMethods multifd_zstd_adaptive_ops = {
+    .send_setup = multifd_zstd_adaptive_send_setup,
+    .send_cleanup = multifd_zstd_adaptive_send_cleanup,
+    .send_prepare = multifd_zstd_adaptive_send_prepare,
+    .recv_setup = multifd_zstd_adaptive_recv_setup,
+    .recv_cleanup = multifd_zstd_adaptive_recv_cleanup,
+    .recv = multifd_zstd_adaptive_recv
+};
+
 static void multifd_zstd_register(void)
 {
     multifd_register_ops(MULTIFD_COMPRESSION_ZSTD, &multifd_zstd_ops);
+    multifd_register_ops(MULTIFD_COMPRESSION_ADAPTIVE,
+                         &multifd_zstd_adaptive_ops);
 }
 
 migration_init(multifd_zstd_register);
@@ -14,6 +14,7 @@
 #include "qemu/cutils.h"
 #include "qemu/iov.h"
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "exec/target_page.h"
 #include "system/system.h"
 #include "system/ramblock.h"
@@ -686,6 +687,7 @@ static void *multifd_send_thread(void *opaque)
         if (qatomic_load_acquire(&p->pending_job)) {
             bool is_device_state = multifd_payload_device_state(p->data);
             size_t total_size;
+            int64_t write_start;
             int write_flags_masked = 0;
 
             p->flags = 0;
@@ -711,6 +713,7 @@ static void *multifd_send_thread(void *opaque)
              */
             total_size = iov_size(p->iov, p->iovs_num);
 
+            write_start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
             if (migrate_mapped_ram()) {
                 assert(!is_device_state);
 
@@ -727,6 +730,12 @@ static void *multifd_send_thread(void *opaque)
                 break;
             }
 
+            if (!is_device_state) {
+                p->write_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                              write_start;
+                p->write_bytes = total_size;
+            }
+
             qatomic_add(&mig_stats.multifd_bytes, total_size);
 
             p->next_packet_size = 0;
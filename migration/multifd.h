@@ -134,6 +134,8 @@ struct MultiFDRecvData {
     size_t size;
     /* for preadv */
     off_t file_offset;
+    /* read from this channel instead of the multifd one, if set */
+    QIOChannel *ioc;
 };
 
 typedef struct {
@@ -234,6 +236,9 @@ typedef struct {
     uint32_t iovs_num;
     /* used for compression methods */
     void *compress_data;
+    /* duration and size of the last write of RAM pages */
+    uint64_t write_ns;
+    size_t write_bytes;
 }  MultiFDSendParams;
 
 typedef struct {
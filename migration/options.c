@@ -53,6 +53,7 @@
 /* The delay time (in ms) between two COLO checkpoints */
 #define DEFAULT_MIGRATE_X_CHECKPOINT_DELAY (200 * 100)
 #define DEFAULT_MIGRATE_MULTIFD_CHANNELS 2
+#define DEFAULT_MIGRATE_DIRTY_SYNC_THREADS 1
 #define DEFAULT_MIGRATE_MULTIFD_COMPRESSION MULTIFD_COMPRESSION_NONE
 /* 0: means nocompress, 1: best speed, ... 9: best compress ratio */
 #define DEFAULT_MIGRATE_MULTIFD_ZLIB_LEVEL 1
@@ -183,6 +184,11 @@ const Property migration_properties[] = {
     DEFINE_PROP_ZERO_PAGE_DETECTION("zero-page-detection", MigrationState,
                        parameters.zero_page_detection,
                        ZERO_PAGE_DETECTION_MULTIFD),
+    DEFINE_PROP_STRING("mapped-ram-page-store", MigrationState,
+                       parameters.mapped_ram_page_store),
+    DEFINE_PROP_UINT8("dirty-sync-threads", MigrationState,
+                      parameters.dirty_sync_threads,
+                      DEFAULT_MIGRATE_DIRTY_SYNC_THREADS),
 
     /* Migration capabilities */
     DEFINE_PROP_MIG_CAP("x-xbzrle", MIGRATION_CAPABILITY_XBZRLE),
@@ -208,6 +214,12 @@ const Property migration_properties[] = {
                         MIGRATION_CAPABILITY_SWITCHOVER_ACK),
     DEFINE_PROP_MIG_CAP("x-dirty-limit", MIGRATION_CAPABILITY_DIRTY_LIMIT),
     DEFINE_PROP_MIG_CAP("mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
+    DEFINE_PROP_MIG_CAP("mapped-ram-lazy-load",
+                        MIGRATION_CAPABILITY_MAPPED_RAM_LAZY_LOAD),
+    DEFINE_PROP_MIG_CAP("predictive-switchover",
+                        MIGRATION_CAPABILITY_PREDICTIVE_SWITCHOVER),
+    DEFINE_PROP_MIG_CAP("hot-page-deferral",
+                        MIGRATION_CAPABILITY_HOT_PAGE_DEFERRAL),
     DEFINE_PROP_MIG_CAP("x-ignore-shared",
                         MIGRATION_CAPABILITY_X_IGNORE_SHARED),
 };
@@ -336,6 +348,20 @@ bool migrate_mapped_ram(void)
     return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
 }
 
+bool migrate_mapped_ram_lazy_load(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM_LAZY_LOAD];
+}
+
+bool migrate_hot_page_deferral(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_HOT_PAGE_DEFERRAL];
+}
+
 bool migrate_ignore_shared(void)
 {
     MigrationState *s = migrate_get_current();
@@ -385,6 +411,13 @@ bool migrate_postcopy_ram(void)
     return s->capabilities[MIGRATION_CAPABILITY_POSTCOPY_RAM];
 }
 
+bool migrate_predictive_switchover(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_PREDICTIVE_SWITCHOVER];
+}
+
 bool migrate_rdma_pin_all(void)
 {
     MigrationState *s = migrate_get_current();
@@ -510,7 +543,8 @@ INITIALIZE_MIGRATE_CAPS_SET(check_caps_background_snapshot,
     MIGRATION_CAPABILITY_XBZRLE,
     MIGRATION_CAPABILITY_X_COLO,
     MIGRATION_CAPABILITY_VALIDATE_UUID,
-    MIGRATION_CAPABILITY_ZERO_COPY_SEND);
+    MIGRATION_CAPABILITY_ZERO_COPY_SEND,
+    MIGRATION_CAPABILITY_HOT_PAGE_DEFERRAL);
 
 /* Snapshot compatibility check list */
 static const
@@ -715,6 +749,17 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
         }
     }
 
+    if (new_caps[MIGRATION_CAPABILITY_MAPPED_RAM_LAZY_LOAD]) {
+#ifndef CONFIG_LINUX
+        error_setg(errp, "Lazy load of mapped-ram is only supported on Linux");
+        return false;
+#endif
+        if (!new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+            error_setg(errp, "Lazy load requires the mapped-ram capability");
+            return false;
+        }
+    }
+
     /*
      * On destination side, check the cases that capability is being set
      * after incoming thread has started.
@@ -831,6 +876,13 @@ bool migrate_direct_io(void)
         s->capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+uint8_t migrate_dirty_sync_threads(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.dirty_sync_threads;
+}
+
 uint64_t migrate_downtime_limit(void)
 {
     MigrationState *s = migrate_get_current();
@@ -838,6 +890,18 @@ uint64_t migrate_downtime_limit(void)
     return s->parameters.downtime_limit;
 }
 
+const char *migrate_mapped_ram_page_store(void)
+{
+    MigrationState *s = migrate_get_current();
+    const char *path = s->parameters.mapped_ram_page_store;
+
+    if (!s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM] ||
+        !path || !*path) {
+        return NULL;
+    }
+    return path;
+}
+
 uint8_t migrate_max_cpu_throttle(void)
 {
     MigrationState *s = migrate_get_current();
@@ -1033,7 +1097,8 @@ static void tls_opt_to_str(StrOrNull *opt)
  */
 static void migrate_mark_all_params_present(MigrationParameters *p)
 {
-    int len, n_str_args = 3; /* tls-creds, tls-hostname, tls-authz */
+    /* tls-creds, tls-hostname, tls-authz, mapped-ram-page-store */
+    int len, n_str_args = 4;
     bool *has_fields[] = {
         &p->has_throttle_trigger_threshold, &p->has_cpu_throttle_initial,
         &p->has_cpu_throttle_increment, &p->has_cpu_throttle_tailslow,
@@ -1047,7 +1112,7 @@ static void migrate_mark_all_params_present(MigrationParameters *p)
         &p->has_announce_step, &p->has_block_bitmap_mapping,
         &p->has_x_vcpu_dirty_limit_period, &p->has_vcpu_dirty_limit,
         &p->has_mode, &p->has_zero_page_detection, &p->has_direct_io,
-        &p->has_cpr_exec_command,
+        &p->has_cpr_exec_command, &p->has_dirty_sync_threads,
     };
 
     len = ARRAY_SIZE(has_fields);
@@ -1075,6 +1140,10 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
         qapi_free_BitmapMigrationNodeAliasList(params->block_bitmap_mapping);
     }
 
+    if (!params->mapped_ram_page_store) {
+        params->mapped_ram_page_store = g_strdup("");
+    }
+
     return params;
 }
 
@@ -1164,6 +1233,12 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->dirty_sync_threads < 1) {
+        error_setg(errp, "Option dirty_sync_threads expects "
+                   "a value between 1 and 255");
+        return false;
+    }
+
     if (params->multifd_zlib_level > 9) {
         error_setg(errp, "Option multifd_zlib_level expects "
                    "a value between 0 and 9");
@@ -1386,6 +1461,14 @@ static void migrate_params_test_apply(MigrationParameters *params,
     if (params->has_cpr_exec_command) {
         dest->cpr_exec_command = params->cpr_exec_command;
     }
+
+    if (params->mapped_ram_page_store) {
+        dest->mapped_ram_page_store = params->mapped_ram_page_store;
+    }
+
+    if (params->has_dirty_sync_threads) {
+        dest->dirty_sync_threads = params->dirty_sync_threads;
+    }
 }
 
 static void migrate_params_apply(MigrationParameters *params)
@@ -1514,6 +1597,16 @@ static void migrate_params_apply(MigrationParameters *params)
         s->parameters.cpr_exec_command =
             QAPI_CLONE(strList, params->cpr_exec_command);
     }
+
+    if (params->mapped_ram_page_store) {
+        g_free(s->parameters.mapped_ram_page_store);
+        s->parameters.mapped_ram_page_store =
+            g_strdup(params->mapped_ram_page_store);
+    }
+
+    if (params->has_dirty_sync_threads) {
+        s->parameters.dirty_sync_threads = params->dirty_sync_threads;
+    }
 }
 
 void qmp_migrate_set_parameters(MigrationParameters *params, Error **errp)
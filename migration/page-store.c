@@ -0,0 +1,383 @@
+/*
+ * Content-addressed page store for mapped-ram snapshots
+ *
+ * With the mapped-ram-page-store parameter set, mapped-ram migration
+ * does not write guest pages to the migration file.  Each page is
+ * identified by the SHA-256 digest of its content and written once to
+ * a pool file that is shared by all snapshots; for every page of a
+ * RAMBlock the migration file only holds the slot of that page in the
+ * pool.
+ *
+ * The pool is append-only: a header followed by one page per slot.
+ * Next to it, <pool>.hashes holds the digest of every slot so that a
+ * later migration can find the pages that are already stored.  A slot
+ * only counts once its digest is in <pool>.hashes, and digests are only
+ * written by page_store_flush(), after the pages they describe have
+ * been synced to disk.  A crash while saving therefore at worst wastes
+ * some space.  Slots are never freed, deleting old snapshots does not
+ * shrink the pool.
+ *
+ * Only one migration at a time may add to a pool; a writable pool is
+ * locked for as long as it is open.
+ *
+ * Copyright (c) 2026 the Oro Operating System Project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/lockable.h"
+#include "qemu/thread.h"
+#include "qapi/error.h"
+#include "crypto/hash.h"
+#include "io/channel-file.h"
+#include "page-store.h"
+#include "trace.h"
+
+#define PAGE_STORE_MAGIC    0x51454d5550475354ULL    /* "QEMUPGST" */
+#define PAGE_STORE_VERSION  1
+#define PAGE_STORE_DIGEST   QCRYPTO_HASH_ALGO_SHA256
+#define PAGE_STORE_DIGEST_LEN 32
+
+typedef struct PageStoreHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t page_size;
+} QEMU_PACKED PageStoreHeader;
+
+typedef struct PageStoreEntry {
+    uint8_t digest[PAGE_STORE_DIGEST_LEN];
+    uint64_t slot;
+} PageStoreEntry;
+
+struct PageStore {
+    size_t page_size;
+    uint64_t data_offset;
+    QIOChannel *pool;
+    QIOChannel *hashes;
+
+    /* protects the fields below */
+    QemuMutex lock;
+    GHashTable *entries;
+    /* PageStoreEntry of pages written, whose digest is not yet */
+    GArray *pending;
+    uint64_t nr_slots;
+    uint64_t nr_hits;
+};
+
+static guint page_store_hash(gconstpointer key)
+{
+    const PageStoreEntry *e = key;
+
+    /* the digest is uniformly distributed already */
+    return ldl_he_p(e->digest);
+}
+
+static gboolean page_store_equal(gconstpointer a, gconstpointer b)
+{
+    const PageStoreEntry *ea = a, *eb = b;
+
+    return !memcmp(ea->digest, eb->digest, PAGE_STORE_DIGEST_LEN);
+}
+
+static bool page_store_pread(QIOChannel *ioc, void *buf, size_t len,
+                             off_t offset, Error **errp)
+{
+    ssize_t ret = qio_channel_pread(ioc, buf, len, offset, errp);
+
+    if (ret < 0) {
+        return false;
+    }
+    if (ret != len) {
+        error_setg(errp, "short read from page store at offset %" PRIx64,
+                   (uint64_t)offset);
+        return false;
+    }
+    return true;
+}
+
+static bool page_store_pwrite(QIOChannel *ioc, const void *buf, size_t len,
+                              off_t offset, Error **errp)
+{
+    ssize_t ret = qio_channel_pwrite(ioc, (void *)buf, len, offset, errp);
+
+    if (ret < 0) {
+        return false;
+    }
+    if (ret != len) {
+        error_setg(errp, "short write to page store at offset %" PRIx64,
+                   (uint64_t)offset);
+        return false;
+    }
+    return true;
+}
+
+static gint page_store_slot_cmp(gconstpointer a, gconstpointer b)
+{
+    const PageStoreEntry *ea = a, *eb = b;
+
+    return ea->slot < eb->slot ? -1 : ea->slot > eb->slot;
+}
+
+static bool page_store_load_hashes(PageStore *ps, const char *path,
+                                   uint64_t pool_slots, Error **errp)
+{
+    static const uint8_t zero[PAGE_STORE_DIGEST_LEN];
+    g_autofree char *buf = NULL;
+    g_autoptr(GError) gerr = NULL;
+    gsize len;
+    uint64_t i, n;
+
+    if (!g_file_get_contents(path, &buf, &len, &gerr)) {
+        error_setg(errp, "could not read page store digests: %s",
+                   gerr->message);
+        return false;
+    }
+
+    n = MIN(len / PAGE_STORE_DIGEST_LEN, pool_slots);
+    for (i = 0; i < n; i++) {
+        const uint8_t *digest = (uint8_t *)buf + i * PAGE_STORE_DIGEST_LEN;
+        PageStoreEntry *e;
+
+        /* the digest of this slot was never written */
+        if (!memcmp(digest, zero, PAGE_STORE_DIGEST_LEN)) {
+            continue;
+        }
+        e = g_new(PageStoreEntry, 1);
+        memcpy(e->digest, digest, PAGE_STORE_DIGEST_LEN);
+        e->slot = i;
+        g_hash_table_add(ps->entries, e);
+    }
+    ps->nr_slots = n;
+    return true;
+}
+
+PageStore *page_store_open(const char *path, size_t page_size,
+                           bool writable, Error **errp)
+{
+    PageStore *ps = g_new0(PageStore, 1);
+    QIOChannelFile *fioc;
+    PageStoreHeader hdr;
+    struct stat st;
+    uint64_t pool_slots = 0;
+
+    ps->page_size = page_size;
+    ps->data_offset = ROUND_UP(sizeof(hdr), page_size);
+    qemu_mutex_init(&ps->lock);
+    ps->entries = g_hash_table_new_full(page_store_hash, page_store_equal,
+                                        g_free, NULL);
+    ps->pending = g_array_new(false, false, sizeof(PageStoreEntry));
+
+    fioc = qio_channel_file_new_path(path, writable ? O_RDWR | O_CREAT
+                                                    : O_RDONLY,
+                                     0600, errp);
+    if (!fioc) {
+        goto fail;
+    }
+    ps->pool = QIO_CHANNEL(fioc);
+
+    if (writable && qemu_lock_fd(fioc->fd, 0, 0, true) < 0) {
+        error_setg(errp, "%s is in use by another migration", path);
+        goto fail;
+    }
+
+    if (fstat(fioc->fd, &st) < 0) {
+        error_setg_errno(errp, errno, "could not stat page store %s", path);
+        goto fail;
+    }
+
+    if (st.st_size == 0 && writable) {
+        hdr.magic = cpu_to_be64(PAGE_STORE_MAGIC);
+        hdr.version = cpu_to_be32(PAGE_STORE_VERSION);
+        hdr.page_size = cpu_to_be32(page_size);
+        if (!page_store_pwrite(ps->pool, &hdr, sizeof(hdr), 0, errp)) {
+            goto fail;
+        }
+    } else {
+        if (!page_store_pread(ps->pool, &hdr, sizeof(hdr), 0, errp)) {
+            goto fail;
+        }
+        if (be64_to_cpu(hdr.magic) != PAGE_STORE_MAGIC ||
+            be32_to_cpu(hdr.version) > PAGE_STORE_VERSION) {
+            error_setg(errp, "%s is not a supported page store", path);
+            goto fail;
+        }
+        if (be32_to_cpu(hdr.page_size) != page_size) {
+            error_setg(errp, "page store %s holds %u byte pages, "
+                       "expected %zu", path, be32_to_cpu(hdr.page_size),
+                       page_size);
+            goto fail;
+        }
+        if (st.st_size > ps->data_offset) {
+            pool_slots = (st.st_size - ps->data_offset) / page_size;
+        }
+    }
+
+    if (writable) {
+        g_autofree char *hashes_path = g_strdup_printf("%s.hashes", path);
+
+        fioc = qio_channel_file_new_path(hashes_path, O_RDWR | O_CREAT,
+                                         0600, errp);
+        if (!fioc) {
+            goto fail;
+        }
+        ps->hashes = QIO_CHANNEL(fioc);
+
+        if (!page_store_load_hashes(ps, hashes_path, pool_slots, errp)) {
+            goto fail;
+        }
+    } else {
+        ps->nr_slots = pool_slots;
+    }
+
+    trace_page_store_open(path, writable, ps->nr_slots);
+    return ps;
+
+fail:
+    error_prepend(errp, "page store: ");
+    page_store_close(ps);
+    return NULL;
+}
+
+void page_store_close(PageStore *ps)
+{
+    if (!ps) {
+        return;
+    }
+
+    trace_page_store_close(ps->nr_slots, ps->nr_hits);
+    if (ps->pool) {
+        object_unref(OBJECT(ps->pool));
+    }
+    if (ps->hashes) {
+        object_unref(OBJECT(ps->hashes));
+    }
+    /* pages whose digest is still pending are only wasted space */
+    g_array_free(ps->pending, true);
+    g_hash_table_destroy(ps->entries);
+    qemu_mutex_destroy(&ps->lock);
+    g_free(ps);
+}
+
+bool page_store_put(PageStore *ps, const void *page, uint64_t *slot,
+                    Error **errp)
+{
+    PageStoreEntry key, *e;
+    uint8_t *digest = key.digest;
+    size_t digest_len = PAGE_STORE_DIGEST_LEN;
+
+    assert(ps->hashes);
+
+    if (qcrypto_hash_bytes(PAGE_STORE_DIGEST, page, ps->page_size,
+                           &digest, &digest_len, errp) < 0) {
+        return false;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&ps->lock) {
+        e = g_hash_table_lookup(ps->entries, &key);
+        if (e) {
+            ps->nr_hits++;
+            *slot = e->slot;
+            return true;
+        }
+        key.slot = ps->nr_slots++;
+    }
+
+    /*
+     * The slot only becomes visible to other pages once the page is
+     * written, and its digest is only written to disk by
+     * page_store_flush().  Pages are not read back before then.
+     */
+    if (!page_store_pwrite(ps->pool, page, ps->page_size,
+                           page_store_slot_offset(ps, key.slot), errp)) {
+        return false;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&ps->lock) {
+        /*
+         * If another thread stored the same page meanwhile, keep its
+         * slot in the table; this one is only wasted space.
+         */
+        e = g_hash_table_lookup(ps->entries, &key);
+        if (!e) {
+            g_hash_table_add(ps->entries, g_memdup2(&key, sizeof(key)));
+        }
+        g_array_append_val(ps->pending, key);
+    }
+    *slot = key.slot;
+    return true;
+}
+
+/* Write the digests of @pending, sorted by slot, one run of slots at once */
+static bool page_store_write_digests(PageStore *ps, GArray *pending,
+                                     Error **errp)
+{
+    g_autofree uint8_t *buf = NULL;
+    guint i, j;
+
+    buf = g_malloc(MIN(pending->len, 4096) * PAGE_STORE_DIGEST_LEN);
+    g_array_sort(pending, page_store_slot_cmp);
+
+    for (i = 0; i < pending->len; i = j) {
+        PageStoreEntry *first = &g_array_index(pending, PageStoreEntry, i);
+
+        for (j = i; j < pending->len && j - i < 4096; j++) {
+            PageStoreEntry *e = &g_array_index(pending, PageStoreEntry, j);
+
+            if (e->slot != first->slot + (j - i)) {
+                break;
+            }
+            memcpy(buf + (j - i) * PAGE_STORE_DIGEST_LEN, e->digest,
+                   PAGE_STORE_DIGEST_LEN);
+        }
+        if (!page_store_pwrite(ps->hashes, buf,
+                               (j - i) * PAGE_STORE_DIGEST_LEN,
+                               first->slot * PAGE_STORE_DIGEST_LEN, errp)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool page_store_flush(PageStore *ps, Error **errp)
+{
+    g_autoptr(GArray) pending = NULL;
+
+    /*
+     * Only pages that were written before the pool is synced may have
+     * their digest written, so take them first.
+     */
+    WITH_QEMU_LOCK_GUARD(&ps->lock) {
+        pending = ps->pending;
+        ps->pending = g_array_new(false, false, sizeof(PageStoreEntry));
+    }
+
+    if (qemu_fdatasync(QIO_CHANNEL_FILE(ps->pool)->fd) < 0) {
+        error_setg_errno(errp, errno, "could not sync page store");
+        return false;
+    }
+    if (!page_store_write_digests(ps, pending, errp)) {
+        return false;
+    }
+    if (qemu_fdatasync(QIO_CHANNEL_FILE(ps->hashes)->fd) < 0) {
+        error_setg_errno(errp, errno, "could not sync page store digests");
+        return false;
+    }
+    return true;
+}
+
+QIOChannel *page_store_channel(PageStore *ps)
+{
+    return ps->pool;
+}
+
+uint64_t page_store_slot_offset(PageStore *ps, uint64_t slot)
+{
+    return ps->data_offset + slot * ps->page_size;
+}
+
+uint64_t page_store_nr_slots(PageStore *ps)
+{
+    return ps->nr_slots;
+}
@@ -0,0 +1,50 @@
+/*
+ * Content-addressed page store for mapped-ram snapshots
+ *
+ * Copyright (c) 2026 the Oro Operating System Project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef QEMU_MIGRATION_PAGE_STORE_H
+#define QEMU_MIGRATION_PAGE_STORE_H
+
+#include "io/channel.h"
+
+typedef struct PageStore PageStore;
+
+/**
+ * page_store_open: open or create the page pool at @path
+ *
+ * With @writable, the pool is created if it does not exist, locked
+ * against other writers, and the digests of the pages it already holds
+ * are loaded, so that page_store_put() can reuse them.  Otherwise the
+ * pool is only opened for reading pages back.
+ */
+PageStore *page_store_open(const char *path, size_t page_size,
+                           bool writable, Error **errp);
+void page_store_close(PageStore *ps);
+
+/**
+ * page_store_put: store one page unless its content is already present
+ *
+ * Sets @slot to the slot that holds the content of @page.  Thread-safe;
+ * hashing and writing the page are done outside of any lock.
+ *
+ * Returns: true on success, false on error (with @errp set).
+ */
+bool page_store_put(PageStore *ps, const void *page, uint64_t *slot,
+                    Error **errp);
+
+/*
+ * Make all pages stored so far durable before they are referenced, then
+ * record their digests so that later migrations can reuse them.
+ */
+bool page_store_flush(PageStore *ps, Error **errp);
+
+/* The pool channel, and the offset in it of the page held by @slot. */
+QIOChannel *page_store_channel(PageStore *ps);
+uint64_t page_store_slot_offset(PageStore *ps, uint64_t slot);
+uint64_t page_store_nr_slots(PageStore *ps);
+
+#endif
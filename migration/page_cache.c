@@ -34,6 +34,7 @@ struct CacheItem {
 struct PageCache {
     CacheItem *page_cache;
     size_t page_size;
+    unsigned page_bits;
     size_t max_num_items;
     size_t num_items;
 };
@@ -61,7 +62,9 @@ PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
         error_setg(errp, "Failed to allocate cache");
         return NULL;
     }
+    g_assert(is_power_of_2(page_size));
     cache->page_size = page_size;
+    cache->page_bits = ctz64(page_size);
     cache->num_items = 0;
     cache->max_num_items = num_pages;
 
@@ -105,7 +108,7 @@ static size_t cache_get_cache_pos(const PageCache *cache,
                                   uint64_t address)
 {
     g_assert(cache->max_num_items);
-    return (address / cache->page_size) & (cache->max_num_items - 1);
+    return (address >> cache->page_bits) & (cache->max_num_items - 1);
 }
 
 static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
@@ -125,8 +128,8 @@ uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
     return cache_get_by_addr(cache, addr)->it_data;
 }
 
-bool cache_is_cached(const PageCache *cache, uint64_t addr,
-                     uint64_t current_age)
+uint8_t *cache_lookup(const PageCache *cache, uint64_t addr,
+                      uint64_t current_age)
 {
     CacheItem *it;
 
@@ -135,9 +138,9 @@ bool cache_is_cached(const PageCache *cache, uint64_t addr,
     if (it->it_addr == addr) {
         /* update the it_age when the cache hit */
         it->it_age = current_age;
-        return true;
+        return it->it_data;
     }
-    return false;
+    return NULL;
 }
 
 int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
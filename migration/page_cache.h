@@ -36,16 +36,16 @@ PageCache *cache_init(uint64_t cache_size, size_t page_size, Error **errp);
 void cache_fini(PageCache *cache);
 
 /**
- * cache_is_cached: Checks to see if the page is cached
+ * cache_lookup: Get the data cached for an addr and mark it as used
  *
- * Returns %true if page is cached
+ * Returns pointer to the data cached or NULL if the page is not cached
  *
  * @cache pointer to the PageCache struct
  * @addr: page addr
  * @current_age: current bitmap generation
  */
-bool cache_is_cached(const PageCache *cache, uint64_t addr,
-                     uint64_t current_age);
+uint8_t *cache_lookup(const PageCache *cache, uint64_t addr,
+                      uint64_t current_age);
 
 /**
  * get_cached_data: Get the data cached for an addr
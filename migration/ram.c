@@ -27,11 +27,13 @@
  */
 
 #include "qemu/osdep.h"
+#include <math.h>
 #include "qemu/cutils.h"
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/madvise.h"
 #include "qemu/main-loop.h"
+#include "block/thread-pool.h"
 #include "xbzrle.h"
 #include "ram.h"
 #include "migration.h"
@@ -61,6 +63,8 @@
 #include "system/runstate.h"
 #include "rdma.h"
 #include "options.h"
+#include "page-store.h"
+#include "lazy-load.h"
 #include "system/dirtylimit.h"
 #include "system/kvm.h"
 
@@ -91,6 +95,12 @@
  */
 #define MAPPED_RAM_LOAD_BUF_SIZE 0x100000
 
+/*
+ * With mapped-ram-page-store, the pool that holds the pages of
+ * mapped-ram migrations, see page-store.c.
+ */
+static PageStore *ram_page_store;
+
 XBZRLECacheStats xbzrle_counters;
 
 /*
@@ -434,6 +444,21 @@ struct RAMState {
      * Protected by @bitmap_mutex.
      */
     PageLocationHint page_hint;
+    /* Workers syncing the dirty bitmap, with dirty-sync-threads > 1 */
+    ThreadPool *sync_pool;
+    /*
+     * Dirty rate model, see ram_predict_dirty_bytes().  Protected by
+     * @bitmap_mutex.
+     */
+    int64_t time_last_sync;
+    int64_t time_last_dirty_model;
+    double dirty_model_period;
+    uint64_t dirty_model_samples;
+    /*
+     * Dirty pages held back by hot-page-deferral.  Protected by
+     * @bitmap_mutex.
+     */
+    uint64_t page_heat_deferred;
 };
 typedef struct RAMState RAMState;
 
@@ -633,7 +658,8 @@ static int save_xbzrle_page(RAMState *rs, PageSearchStatus *pss,
     QEMUFile *file = pss->pss_channel;
     uint64_t generation = qatomic_read(&mig_stats.dirty_sync_count);
 
-    if (!cache_is_cached(XBZRLE.cache, current_addr, generation)) {
+    prev_cached_page = cache_lookup(XBZRLE.cache, current_addr, generation);
+    if (!prev_cached_page) {
         xbzrle_counters.cache_miss++;
         if (!rs->last_stage) {
             if (cache_insert(XBZRLE.cache, current_addr, *current_data,
@@ -660,7 +686,6 @@ static int save_xbzrle_page(RAMState *rs, PageSearchStatus *pss,
      * guest page is good for xbzrle encoding.
      */
     xbzrle_counters.pages++;
-    prev_cached_page = get_cached_data(XBZRLE.cache, current_addr);
 
     /* save current buffer into memory */
     memcpy(XBZRLE.current_buf, *current_data, TARGET_PAGE_SIZE);
@@ -826,6 +851,68 @@ unsigned long colo_bitmap_find_dirty(RAMState *rs, RAMBlock *rb,
     return first;
 }
 
+/*
+ * Page heat, with hot-page-deferral.  Every target page has a heat and
+ * the dirty sync generation it was last sent in.  Finding a page dirty
+ * again within one generation of sending it makes it hotter, finding it
+ * dirty later halves its heat.  A dirty page with heat h >= PAGE_HEAT_HOT
+ * is held back until 2^h generations after it was last sent: the hot set
+ * of the guest is then resent rarely, and precopy spends its bandwidth on
+ * the cold pages, which only need to go once.  Held back pages still go
+ * in the final round, or in postcopy.
+ */
+#define PAGE_HEAT_MASK      0x07
+#define PAGE_HEAT_HOT       2
+#define PAGE_HEAT_DEFERRED  0x20
+#define PAGE_HEAT_SENT      0x40
+#define PAGE_HEAT_SEEN      0x80
+
+/*
+ * Whether the dirty @page of @rb should be held back for now.
+ *
+ * Called with bitmap_mutex held.
+ */
+static bool ram_page_heat_defer(RAMState *rs, RAMBlock *rb, unsigned long page)
+{
+    uint8_t gen = qatomic_read(&mig_stats.dirty_sync_count);
+    uint8_t age = gen - rb->page_heat_gen[page];
+    uint8_t *heat = &rb->page_heat[page];
+    unsigned int h = *heat & PAGE_HEAT_MASK;
+
+    /* the first time the page is found dirty since it was sent */
+    if ((*heat & (PAGE_HEAT_SENT | PAGE_HEAT_SEEN)) == PAGE_HEAT_SENT) {
+        h = age <= 1 ? MIN(h + 1, PAGE_HEAT_MASK) : h / 2;
+        *heat = (*heat & ~PAGE_HEAT_MASK) | PAGE_HEAT_SEEN | h;
+    }
+
+    if (rs->last_stage || migration_in_postcopy() ||
+        h < PAGE_HEAT_HOT || age >= (1U << h)) {
+        return false;
+    }
+
+    if (!(*heat & PAGE_HEAT_DEFERRED)) {
+        *heat |= PAGE_HEAT_DEFERRED;
+        rs->page_heat_deferred++;
+        qatomic_inc(&mig_stats.deferred_pages);
+    }
+    return true;
+}
+
+/* Called with bitmap_mutex held, when @page of @rb is about to be sent */
+static void ram_page_heat_sent(RAMState *rs, RAMBlock *rb, unsigned long page)
+{
+    uint8_t *heat = &rb->page_heat[page];
+
+    if (*heat & PAGE_HEAT_SENT) {
+        qatomic_add(&mig_stats.resent_bytes, TARGET_PAGE_SIZE);
+    }
+    if ((*heat & PAGE_HEAT_DEFERRED) && rs->page_heat_deferred) {
+        rs->page_heat_deferred--;
+    }
+    *heat = (*heat & PAGE_HEAT_MASK) | PAGE_HEAT_SENT;
+    rb->page_heat_gen[page] = qatomic_read(&mig_stats.dirty_sync_count);
+}
+
 static inline bool migration_bitmap_clear_dirty(RAMState *rs,
                                                 RAMBlock *rb,
                                                 unsigned long page)
@@ -1008,6 +1095,83 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     uint64_t new_dirty_pages =
         physical_memory_sync_dirty_bitmap(rb, 0, rb->used_length);
 
+    rb->dirty_model_pages += new_dirty_pages;
+    rs->migration_dirty_pages += new_dirty_pages;
+    rs->num_dirty_pages_period += new_dirty_pages;
+}
+
+/*
+ * Target pages synced by one worker when the dirty bitmap is synced in
+ * parallel: 1GiB with 4KiB pages.  This is a multiple of BITS_PER_LONG,
+ * so that workers never share a word of the RAMBlock's dirty bitmap, and
+ * a multiple or a divisor of the clear_bmap chunk.
+ */
+#define DIRTY_SYNC_CHUNK_PAGES (1UL << 18)
+
+typedef struct DirtySyncTask {
+    RAMBlock *rb;
+    ram_addr_t start;
+    ram_addr_t length;
+    uint64_t num_dirty;
+} DirtySyncTask;
+
+static int dirty_sync_task(void *opaque)
+{
+    DirtySyncTask *task = opaque;
+
+    /* the migration thread holds the RCU read lock until we are done */
+    task->num_dirty = physical_memory_sync_dirty_bitmap(task->rb, task->start,
+                                                        task->length);
+    return 0;
+}
+
+/*
+ * Split the sync of every RAMBlock in chunks of DIRTY_SYNC_CHUNK_PAGES
+ * and run them on @rs->sync_pool.  The chunks start on a word of both
+ * the RAMBlock's bitmap and, unless the block itself is misaligned, of
+ * the global dirty bitmap; the slow path for misaligned ranges only
+ * uses atomic bit operations on the latter.
+ *
+ * Called with RCU critical section and bitmap_mutex held.
+ */
+static void ram_sync_dirty_bitmap_parallel(RAMState *rs)
+{
+    const ram_addr_t chunk = (ram_addr_t)DIRTY_SYNC_CHUNK_PAGES <<
+                             TARGET_PAGE_BITS;
+    g_autoptr(GArray) tasks = g_array_new(false, false,
+                                          sizeof(DirtySyncTask));
+    uint64_t new_dirty_pages = 0;
+    RAMBlock *block;
+    guint i;
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_addr_t start;
+
+        for (start = 0; start < block->used_length; start += chunk) {
+            DirtySyncTask task = {
+                .rb = block,
+                .start = start,
+                .length = MIN(block->used_length - start, chunk),
+            };
+
+            g_array_append_val(tasks, task);
+        }
+    }
+
+    trace_migration_bitmap_sync_parallel(tasks->len);
+    /* the array does not grow anymore, the tasks can point into it */
+    for (i = 0; i < tasks->len; i++) {
+        thread_pool_submit(rs->sync_pool, dirty_sync_task,
+                           &g_array_index(tasks, DirtySyncTask, i), NULL);
+    }
+    thread_pool_wait(rs->sync_pool);
+
+    for (i = 0; i < tasks->len; i++) {
+        DirtySyncTask *task = &g_array_index(tasks, DirtySyncTask, i);
+
+        task->rb->dirty_model_pages += task->num_dirty;
+        new_dirty_pages += task->num_dirty;
+    }
     rs->migration_dirty_pages += new_dirty_pages;
     rs->num_dirty_pages_period += new_dirty_pages;
 }
@@ -1072,6 +1236,111 @@ static void migration_update_rates(RAMState *rs, int64_t end_time)
     }
 }
 
+/*
+ * The dirty rate model predicts how much RAM the guest dirties between
+ * the last bitmap sync and the moment it is stopped for switchover.
+ * Every RAMBlock keeps a weighted mean and variance of its dirty rate,
+ * folded in at most every DIRTY_MODEL_PERIOD_MS with weight
+ * DIRTY_MODEL_WEIGHT for the newest sample.  The pages newly dirtied in
+ * one such period are the hot set of the block: however long the window,
+ * the guest does not dirty more distinct pages between two syncs.
+ * Predictions use the mean plus DIRTY_MODEL_SIGMAS standard deviations,
+ * so that a bursty guest is not mistaken for a quiet one.
+ */
+#define DIRTY_MODEL_PERIOD_MS 100
+#define DIRTY_MODEL_WEIGHT    0.25
+#define DIRTY_MODEL_SIGMAS    2
+
+static void dirty_model_fold(double *avg, double *var, double sample,
+                             bool first)
+{
+    double delta = sample - *avg;
+
+    if (first) {
+        *avg = sample;
+        *var = 0;
+        return;
+    }
+    *avg += DIRTY_MODEL_WEIGHT * delta;
+    *var = (1 - DIRTY_MODEL_WEIGHT) *
+           (*var + DIRTY_MODEL_WEIGHT * delta * delta);
+}
+
+/* Called with RCU critical section and bitmap_mutex held */
+static void ram_dirty_model_update(RAMState *rs, int64_t now)
+{
+    int64_t period = now - rs->time_last_dirty_model;
+    bool first = !rs->dirty_model_samples;
+    RAMBlock *block;
+
+    if (!rs->time_last_dirty_model) {
+        /* the first sync only tells where the period starts */
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            block->dirty_model_pages = 0;
+        }
+        rs->time_last_dirty_model = now;
+        return;
+    }
+    if (period < DIRTY_MODEL_PERIOD_MS) {
+        return;
+    }
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        double pages = block->dirty_model_pages;
+
+        dirty_model_fold(&block->dirty_rate_avg, &block->dirty_rate_var,
+                         pages / period, first);
+        dirty_model_fold(&block->dirty_hot_avg, &block->dirty_hot_var,
+                         pages, first);
+        block->dirty_model_pages = 0;
+    }
+    if (first) {
+        rs->dirty_model_period = period;
+    } else {
+        rs->dirty_model_period += DIRTY_MODEL_WEIGHT *
+                                  (period - rs->dirty_model_period);
+    }
+    rs->dirty_model_samples++;
+    rs->time_last_dirty_model = now;
+}
+
+bool ram_predict_dirty_bytes(uint64_t *bytes)
+{
+    RAMState *rs = ram_state;
+    RAMBlock *block;
+    double pages = 0;
+    int64_t window;
+
+    if (!rs) {
+        return false;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&rs->bitmap_mutex) {
+        if (!rs->dirty_model_samples) {
+            return false;
+        }
+        window = qemu_clock_get_ms(QEMU_CLOCK_REALTIME) - rs->time_last_sync;
+
+        WITH_RCU_READ_LOCK_GUARD() {
+            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+                double rate = block->dirty_rate_avg +
+                              DIRTY_MODEL_SIGMAS * sqrt(block->dirty_rate_var);
+                double limit = block->used_length >> TARGET_PAGE_BITS;
+
+                if (window <= rs->dirty_model_period) {
+                    limit = MIN(limit, block->dirty_hot_avg +
+                                DIRTY_MODEL_SIGMAS *
+                                sqrt(block->dirty_hot_var));
+                }
+                pages += MIN(rate * window, limit);
+            }
+        }
+    }
+
+    *bytes = pages * TARGET_PAGE_SIZE;
+    return true;
+}
+
 /*
  * Enable dirty-limit to throttle down the guest
  */
@@ -1133,6 +1402,7 @@ static void migration_trigger_throttle(RAMState *rs)
 
 static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 {
+    uint8_t sync_threads = migrate_dirty_sync_threads();
     RAMBlock *block;
     int64_t end_time;
 
@@ -1142,15 +1412,35 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
         rs->time_last_bitmap_sync = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
     }
 
+    /* dirty-sync-threads may have been changed since the last sync */
+    if (sync_threads > 1) {
+        if (!rs->sync_pool) {
+            rs->sync_pool = thread_pool_new();
+        }
+        thread_pool_set_max_threads(rs->sync_pool, sync_threads);
+    } else if (rs->sync_pool) {
+        thread_pool_free(rs->sync_pool);
+        rs->sync_pool = NULL;
+    }
+
     trace_migration_bitmap_sync_start();
     memory_global_dirty_log_sync(last_stage);
 
     WITH_QEMU_LOCK_GUARD(&rs->bitmap_mutex) {
         WITH_RCU_READ_LOCK_GUARD() {
-            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-                ramblock_sync_dirty_bitmap(rs, block);
+            if (rs->sync_pool) {
+                ram_sync_dirty_bitmap_parallel(rs);
+            } else {
+                RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+                    ramblock_sync_dirty_bitmap(rs, block);
+                }
             }
             qatomic_set(&mig_stats.dirty_bytes_last_sync, ram_bytes_remaining());
+
+            if (!last_stage) {
+                rs->time_last_sync = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+                ram_dirty_model_update(rs, rs->time_last_sync);
+            }
         }
     }
 
@@ -1276,8 +1566,19 @@ static int save_normal_page(PageSearchStatus *pss, RAMBlock *block,
     QEMUFile *file = pss->pss_channel;
 
     if (migrate_mapped_ram()) {
-        qemu_put_buffer_at(file, buf, TARGET_PAGE_SIZE,
-                           block->pages_offset + offset);
+        if (block->store_slots) {
+            Error *local_err = NULL;
+
+            if (!page_store_put(ram_page_store, buf,
+                                &block->store_slots[offset >> TARGET_PAGE_BITS],
+                                &local_err)) {
+                qemu_file_set_error_obj(file, -EIO, local_err);
+                return -1;
+            }
+        } else {
+            qemu_put_buffer_at(file, buf, TARGET_PAGE_SIZE,
+                               block->pages_offset + offset);
+        }
         set_bit(offset >> TARGET_PAGE_BITS, block->file_bmap);
     } else {
         ram_transferred_add(save_page_header(pss, pss->pss_channel, block,
@@ -2238,10 +2539,20 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss)
     pss_host_page_prepare(pss);
 
     do {
+        if (pss->block->page_heat && test_bit(pss->page, pss->block->bmap) &&
+            ram_page_heat_defer(rs, pss->block, pss->page)) {
+            pss->page++;
+            pss_find_next_dirty(pss);
+            continue;
+        }
+
         page_dirty = migration_bitmap_clear_dirty(rs, pss->block, pss->page);
 
         /* Check the pages is dirty and if it is send it */
         if (page_dirty) {
+            if (pss->block->page_heat) {
+                ram_page_heat_sent(rs, pss->block, pss->page);
+            }
             /*
              * Properly yield the lock only in postcopy preempt mode
              * because both migration thread and rp-return thread can
@@ -2421,6 +2732,9 @@ static void xbzrle_load_cleanup(void)
 static void ram_state_cleanup(RAMState **rsp)
 {
     if (*rsp) {
+        if ((*rsp)->sync_pool) {
+            thread_pool_free((*rsp)->sync_pool);
+        }
         migration_page_queue_free(*rsp);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
@@ -2456,6 +2770,10 @@ static void ram_bitmaps_destroy(void)
         block->bmap = NULL;
         g_free(block->file_bmap);
         block->file_bmap = NULL;
+        g_free(block->store_slots);
+        block->store_slots = NULL;
+        g_clear_pointer(&block->page_heat, g_free);
+        g_clear_pointer(&block->page_heat_gen, g_free);
     }
 }
 
@@ -2479,6 +2797,8 @@ static void ram_save_cleanup(void *opaque)
     }
 
     ram_bitmaps_destroy();
+    page_store_close(ram_page_store);
+    ram_page_store = NULL;
 
     xbzrle_cleanup();
     multifd_ram_save_cleanup();
@@ -2852,6 +3172,10 @@ static void ram_list_init_bitmaps(void)
             if (migrate_mapped_ram()) {
                 block->file_bmap = bitmap_new(pages);
             }
+            if (migrate_hot_page_deferral()) {
+                block->page_heat = g_new0(uint8_t, pages);
+                block->page_heat_gen = g_new0(uint8_t, pages);
+            }
             block->clear_bmap_shift = shift;
             block->clear_bmap = bitmap_new(clear_bmap_size(pages, shift));
         }
@@ -3002,7 +3326,7 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
     }
 }
 
-#define MAPPED_RAM_HDR_VERSION 1
+#define MAPPED_RAM_HDR_VERSION 2
 struct MappedRamHeader {
     uint32_t version;
     /*
@@ -3020,9 +3344,28 @@ struct MappedRamHeader {
      * are stored.
      */
     uint64_t pages_offset;
+    /* Below fields are only present since version 2 */
+    uint64_t flags;
 } QEMU_PACKED;
 typedef struct MappedRamHeader MappedRamHeader;
 
+/*
+ * The pages are in the page store, the pages region holds the big-endian
+ * 64-bit slot of each page instead.
+ */
+#define MAPPED_RAM_HDR_PAGE_STORE (1ULL << 0)
+
+#define MAPPED_RAM_HDR_V1_SIZE offsetof(MappedRamHeader, flags)
+
+/* Size of the pages region of @block in the migration file */
+static uint64_t mapped_ram_pages_size(RAMBlock *block, bool page_store)
+{
+    if (page_store) {
+        return (block->used_length >> TARGET_PAGE_BITS) * sizeof(uint64_t);
+    }
+    return block->used_length;
+}
+
 static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
 {
     g_autofree MappedRamHeader *header = NULL;
@@ -3030,9 +3373,16 @@ static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
     long num_pages;
 
     header = g_new0(MappedRamHeader, 1);
-    header_size = sizeof(MappedRamHeader);
 
-    header->version = cpu_to_be32(MAPPED_RAM_HDR_VERSION);
+    /* keep files without a page store readable by older QEMUs */
+    if (ram_page_store) {
+        header_size = sizeof(MappedRamHeader);
+        header->version = cpu_to_be32(MAPPED_RAM_HDR_VERSION);
+        header->flags = cpu_to_be64(MAPPED_RAM_HDR_PAGE_STORE);
+    } else {
+        header_size = MAPPED_RAM_HDR_V1_SIZE;
+        header->version = cpu_to_be32(1);
+    }
     header->page_size = cpu_to_be64(TARGET_PAGE_SIZE);
 
     if (migrate_ram_is_ignored(block)) {
@@ -3054,13 +3404,18 @@ static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
 
         header->bitmap_offset = cpu_to_be64(block->bitmap_offset);
         header->pages_offset = cpu_to_be64(block->pages_offset);
+
+        if (ram_page_store) {
+            block->store_slots = g_new0(uint64_t, num_pages);
+        }
     }
 
     qemu_put_buffer(file, (uint8_t *) header, header_size);
 
     if (!migrate_ram_is_ignored(block)) {
         /* leave space for block data */
-        qemu_set_offset(file, block->pages_offset + block->used_length,
+        qemu_set_offset(file, block->pages_offset +
+                        mapped_ram_pages_size(block, ram_page_store),
                         SEEK_SET);
     }
 }
@@ -3068,7 +3423,7 @@ static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
 static bool mapped_ram_read_header(QEMUFile *file, MappedRamHeader *header,
                                    Error **errp)
 {
-    size_t ret, header_size = sizeof(MappedRamHeader);
+    size_t ret, header_size = MAPPED_RAM_HDR_V1_SIZE;
 
     ret = qemu_get_buffer(file, (uint8_t *)header, header_size);
     if (ret != header_size) {
@@ -3091,6 +3446,23 @@ static bool mapped_ram_read_header(QEMUFile *file, MappedRamHeader *header,
     header->bitmap_offset = be64_to_cpu(header->bitmap_offset);
     header->pages_offset = be64_to_cpu(header->pages_offset);
 
+    header->flags = 0;
+    if (header->version >= 2) {
+        header_size = sizeof(header->flags);
+        ret = qemu_get_buffer(file, (uint8_t *)&header->flags, header_size);
+        if (ret != header_size) {
+            error_setg(errp, "Could not read mapped-ram header flags");
+            return false;
+        }
+        header->flags = be64_to_cpu(header->flags);
+    }
+
+    if (header->flags & ~MAPPED_RAM_HDR_PAGE_STORE) {
+        error_setg(errp, "Unknown mapped-ram header flags 0x%" PRIx64,
+                   header->flags);
+        return false;
+    }
+
     return true;
 }
 
@@ -3122,6 +3494,15 @@ static int ram_save_setup(QEMUFile *f, void *opaque, Error **errp)
             return -1;
         }
     }
+
+    if (migrate_mapped_ram_page_store()) {
+        ram_page_store = page_store_open(migrate_mapped_ram_page_store(),
+                                         TARGET_PAGE_SIZE, true, errp);
+        if (!ram_page_store) {
+            return -1;
+        }
+    }
+
     (*rsp)->pss[RAM_CHANNEL_PRECOPY].pss_channel = f;
 
     /*
@@ -3214,6 +3595,16 @@ static void ram_save_file_bmap(QEMUFile *f)
 {
     RAMBlock *block;
 
+    if (ram_page_store) {
+        Error *local_err = NULL;
+
+        /* the slots written below must not point to lost pages */
+        if (!page_store_flush(ram_page_store, &local_err)) {
+            qemu_file_set_error_obj(f, -EIO, local_err);
+            return;
+        }
+    }
+
     RAMBLOCK_FOREACH_MIGRATABLE(block) {
         if (migrate_ram_is_ignored(block)) {
             continue;
@@ -3226,6 +3617,19 @@ static void ram_save_file_bmap(QEMUFile *f)
                            block->bitmap_offset);
         ram_transferred_add(bitmap_size);
 
+        if (block->store_slots) {
+            size_t slots_size = num_pages * sizeof(uint64_t);
+
+            for (long i = 0; i < num_pages; i++) {
+                block->store_slots[i] = cpu_to_be64(block->store_slots[i]);
+            }
+            qemu_put_buffer_at(f, (uint8_t *)block->store_slots, slots_size,
+                               block->pages_offset);
+            ram_transferred_add(slots_size);
+            g_free(block->store_slots);
+            block->store_slots = NULL;
+        }
+
         /*
          * Free the bitmap here to catch any synchronization issues
          * with multifd channels. No channels should be sending pages
@@ -3236,6 +3640,30 @@ static void ram_save_file_bmap(QEMUFile *f)
     }
 }
 
+/*
+ * Called by the multifd channels instead of writing the pages to the
+ * migration file when they go to the page store.
+ */
+int ram_page_store_write_iov(RAMBlock *block, const struct iovec *iov,
+                             int niov, Error **errp)
+{
+    for (int i = 0; i < niov; i++) {
+        uint8_t *page = iov[i].iov_base;
+        uint8_t *end = page + iov[i].iov_len;
+
+        for (; page < end; page += TARGET_PAGE_SIZE) {
+            ram_addr_t offset = page - block->host;
+
+            if (!page_store_put(ram_page_store, page,
+                                &block->store_slots[offset >> TARGET_PAGE_BITS],
+                                errp)) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
 void ramblock_set_file_bmap_atomic(RAMBlock *block, ram_addr_t offset, bool set)
 {
     if (set) {
@@ -3449,7 +3877,15 @@ static void ram_state_pending_estimate(void *opaque, uint64_t *must_precopy,
     RAMState **temp = opaque;
     RAMState *rs = *temp;
 
-    uint64_t remaining_size = rs->migration_dirty_pages * TARGET_PAGE_SIZE;
+    /*
+     * Leave out the hot pages held back for now: otherwise a hot set
+     * larger than the threshold would keep the migration thread from
+     * ever syncing again.
+     */
+    uint64_t remaining_size = (rs->migration_dirty_pages -
+                               MIN(rs->page_heat_deferred,
+                                   rs->migration_dirty_pages)) *
+                              TARGET_PAGE_SIZE;
 
     if (migrate_postcopy_ram()) {
         /* We can do postcopy, and all the data is postcopiable */
@@ -3760,6 +4196,8 @@ void colo_release_ram_cache(void)
  */
 static int ram_load_setup(QEMUFile *f, void *opaque, Error **errp)
 {
+    /* RAM is about to be overwritten, stop filling it from the last load */
+    lazy_load_cancel();
     xbzrle_load_setup();
     ramblock_recv_map_init();
 
@@ -3777,6 +4215,9 @@ static int ram_load_cleanup(void *opaque)
     }
 
     xbzrle_load_cleanup();
+    page_store_close(ram_page_store);
+    ram_page_store = NULL;
+    lazy_load_cleanup();
 
     RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
         g_free(rb->receivedmap);
@@ -4024,11 +4465,12 @@ void colo_flush_ram_cache(void)
     trace_colo_flush_ram_cache_end();
 }
 
-static size_t ram_load_multifd_pages(void *host_addr, size_t size,
-                                     uint64_t offset)
+static size_t ram_load_multifd_pages(QIOChannel *ioc, void *host_addr,
+                                     size_t size, uint64_t offset)
 {
     MultiFDRecvData *data = multifd_get_recv_data();
 
+    data->ioc = ioc;
     data->opaque = host_addr;
     data->file_offset = offset;
     data->size = size;
@@ -4122,7 +4564,7 @@ static bool read_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
             size = MIN(unread, MAPPED_RAM_LOAD_BUF_SIZE);
 
             if (migrate_multifd()) {
-                read = ram_load_multifd_pages(host, size,
+                read = ram_load_multifd_pages(NULL, host, size,
                                               block->pages_offset + offset);
             } else {
                 read = qemu_get_buffer_at(f, host, size,
@@ -4152,6 +4594,81 @@ err:
     return false;
 }
 
+/*
+ * Same as read_ramblock_mapped_ram(), but the pages region holds the
+ * slot of each page in the page store.  Pages saved in one go sit in
+ * consecutive slots, so runs of them are read with a single request.
+ */
+static bool read_ramblock_page_store(QEMUFile *f, RAMBlock *block,
+                                     long num_pages, unsigned long *bitmap,
+                                     Error **errp)
+{
+    g_autofree uint64_t *slots = g_new(uint64_t, num_pages);
+    size_t slots_size = num_pages * sizeof(uint64_t);
+    QIOChannel *ioc = page_store_channel(ram_page_store);
+    uint64_t nr_slots = page_store_nr_slots(ram_page_store);
+    unsigned long page, clear_bit_idx = 0;
+    size_t max_run = MAPPED_RAM_LOAD_BUF_SIZE >> TARGET_PAGE_BITS;
+
+    if (qemu_get_buffer_at(f, (uint8_t *)slots, slots_size,
+                           block->pages_offset) != slots_size) {
+        error_setg(errp, "(%s) failed to read page store slots",
+                   block->idstr);
+        return false;
+    }
+
+    page = find_first_bit(bitmap, num_pages);
+    while (page < num_pages) {
+        uint64_t slot = be64_to_cpu(slots[page]), offset;
+        size_t run = 1, size;
+        ssize_t read;
+        void *host;
+
+        if (!handle_zero_mapped_ram(block, clear_bit_idx, page, errp)) {
+            return false;
+        }
+
+        while (page + run < num_pages && run < max_run &&
+               test_bit(page + run, bitmap) &&
+               be64_to_cpu(slots[page + run]) == slot + run) {
+            run++;
+        }
+        if (slot >= nr_slots || nr_slots - slot < run) {
+            error_setg(errp, "(%s) page " RAM_ADDR_FMT " refers to slot %"
+                       PRIu64 " beyond the end of the page store",
+                       block->idstr, (ram_addr_t)page << TARGET_PAGE_BITS,
+                       slot);
+            return false;
+        }
+
+        host = host_from_ram_block_offset(block, page << TARGET_PAGE_BITS);
+        if (!host) {
+            error_setg(errp, "page outside of ramblock %s range",
+                       block->idstr);
+            return false;
+        }
+
+        size = run << TARGET_PAGE_BITS;
+        offset = page_store_slot_offset(ram_page_store, slot);
+        if (migrate_multifd()) {
+            read = ram_load_multifd_pages(ioc, host, size, offset);
+        } else {
+            read = qio_channel_pread(ioc, host, size, offset, NULL);
+        }
+        if (read != size) {
+            error_setg(errp, "(%s) failed to read page store offset 0x%"
+                       PRIx64, block->idstr, offset);
+            return false;
+        }
+
+        clear_bit_idx = page + run;
+        page = find_next_bit(bitmap, num_pages, clear_bit_idx);
+    }
+
+    /* Handle trailing 0 pages */
+    return handle_zero_mapped_ram(block, clear_bit_idx, num_pages, errp);
+}
+
 static void parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
                                       ram_addr_t length, Error **errp)
 {
@@ -4171,6 +4688,20 @@ static void parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
 
     block->pages_offset = header.pages_offset;
 
+    if ((header.flags & MAPPED_RAM_HDR_PAGE_STORE) && !ram_page_store) {
+        const char *path = migrate_mapped_ram_page_store();
+
+        if (!path) {
+            error_setg(errp, "Ramblock %s pages are in a page store, set "
+                       "the mapped-ram-page-store parameter", block->idstr);
+            return;
+        }
+        ram_page_store = page_store_open(path, TARGET_PAGE_SIZE, false, errp);
+        if (!ram_page_store) {
+            return;
+        }
+    }
+
     /*
      * Check the alignment of the file region that contains pages. We
      * don't enforce MAPPED_RAM_FILE_OFFSET_ALIGNMENT to allow that
@@ -4194,6 +4725,29 @@ static void parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
         return;
     }
 
+    if (migrate_mapped_ram_lazy_load() &&
+        !(header.flags & MAPPED_RAM_HDR_PAGE_STORE) &&
+        lazy_load_ramblock_supported(block)) {
+        if (!lazy_load_add_ramblock(f, block, num_pages,
+                                    g_steal_pointer(&bitmap),
+                                    block->pages_offset, errp)) {
+            return;
+        }
+        /* Skip pages array */
+        qemu_set_offset(f, block->pages_offset + length, SEEK_SET);
+        return;
+    }
+
+    if (header.flags & MAPPED_RAM_HDR_PAGE_STORE) {
+        if (!read_ramblock_page_store(f, block, num_pages, bitmap, errp)) {
+            return;
+        }
+        /* Skip slots array */
+        qemu_set_offset(f, block->pages_offset + num_pages * sizeof(uint64_t),
+                        SEEK_SET);
+        return;
+    }
+
     if (!read_ramblock_mapped_ram(f, block, num_pages, bitmap, errp)) {
         return;
     }
@@ -4296,6 +4850,11 @@ static int parse_ramblocks(QEMUFile *f, ram_addr_t total_ram_bytes)
         total_ram_bytes -= length;
     }
 
+    /* RAM blocks that are loaded lazily are now filled in the background */
+    if (!ret) {
+        lazy_load_start();
+    }
+
     return ret;
 }
 
@@ -77,6 +77,11 @@ void ram_mig_init(void);
 int xbzrle_cache_resize(uint64_t new_size, Error **errp);
 uint64_t ram_bytes_remaining(void);
 uint64_t ram_bytes_total(void);
+/*
+ * Set @bytes to the RAM the guest is predicted to have dirtied since the
+ * last dirty bitmap sync.  Returns false until the model has samples.
+ */
+bool ram_predict_dirty_bytes(uint64_t *bytes);
 void mig_throttle_counter_reset(void);
 
 uint64_t ram_pagesize_summary(void);
@@ -108,6 +113,8 @@ void postcopy_preempt_shutdown_file(MigrationState *s);
 void *postcopy_preempt_thread(void *opaque);
 void ramblock_set_file_bmap_atomic(RAMBlock *block, ram_addr_t offset,
                                    bool set);
+int ram_page_store_write_iov(RAMBlock *block, const struct iovec *iov,
+                             int niov, Error **errp);
 
 /* ram cache */
 int colo_init_ram_cache(Error **errp);
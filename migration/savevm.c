@@ -1661,6 +1661,7 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
                                                     bool in_postcopy)
 {
     MigrationState *ms = migrate_get_current();
+    uint64_t start_bytes = qemu_file_transferred(f);
     int64_t start_ts_each, end_ts_each;
     JSONWriter *vmdesc = ms->vmdesc;
     int vmdesc_len;
@@ -1692,6 +1693,9 @@ int qemu_savevm_state_complete_precopy_non_iterable(QEMUFile *f,
                                     end_ts_each - start_ts_each);
     }
 
+    /* the next downtime prediction assumes a device state of this size */
+    ms->non_iterable_bytes = qemu_file_transferred(f) - start_bytes;
+
     if (!in_postcopy) {
         /* Postcopy stream will still be going */
         qemu_put_byte(f, QEMU_VM_EOF);
@@ -15,150 +15,15 @@
 #include "qemu/host-utils.h"
 #include "xbzrle.h"
 
-#if defined(CONFIG_AVX512BW_OPT)
+#if defined(CONFIG_AVX2_OPT) || defined(CONFIG_AVX512BW_OPT)
 #include <immintrin.h>
 #include "host/cpuinfo.h"
+#endif
 
-static int __attribute__((target("avx512bw")))
-xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
-                            uint8_t *dst, int dlen)
-{
-    uint32_t zrun_len = 0, nzrun_len = 0;
-    int d = 0, i = 0, num = 0;
-    uint8_t *nzrun_start = NULL;
-    /* add 1 to include residual part in main loop */
-    uint32_t count512s = (slen >> 6) + 1;
-    /* countResidual is tail of data, i.e., countResidual = slen % 64 */
-    uint32_t count_residual = slen & 0b111111;
-    bool never_same = true;
-    uint64_t mask_residual = 1;
-    mask_residual <<= count_residual;
-    mask_residual -= 1;
-    __m512i r = _mm512_set1_epi32(0);
-
-    while (count512s) {
-        int bytes_to_check = 64;
-        uint64_t mask = 0xffffffffffffffff;
-        if (count512s == 1) {
-            bytes_to_check = count_residual;
-            mask = mask_residual;
-        }
-        __m512i old_data = _mm512_mask_loadu_epi8(r,
-                                                  mask, old_buf + i);
-        __m512i new_data = _mm512_mask_loadu_epi8(r,
-                                                  mask, new_buf + i);
-        uint64_t comp = _mm512_cmpeq_epi8_mask(old_data, new_data);
-        count512s--;
-
-        bool is_same = (comp & 0x1);
-        while (bytes_to_check) {
-            if (d + 2 > dlen) {
-                return -1;
-            }
-            if (is_same) {
-                if (nzrun_len) {
-                    d += uleb128_encode_small(dst + d, nzrun_len);
-                    if (d + nzrun_len > dlen) {
-                        return -1;
-                    }
-                    nzrun_start = new_buf + i - nzrun_len;
-                    memcpy(dst + d, nzrun_start, nzrun_len);
-                    d += nzrun_len;
-                    nzrun_len = 0;
-                }
-                /* 64 data at a time for speed */
-                if (count512s && (comp == 0xffffffffffffffff)) {
-                    i += 64;
-                    zrun_len += 64;
-                    break;
-                }
-                never_same = false;
-                num = ctz64(~comp);
-                num = (num < bytes_to_check) ? num : bytes_to_check;
-                zrun_len += num;
-                bytes_to_check -= num;
-                comp >>= num;
-                i += num;
-                if (bytes_to_check) {
-                    /* still has different data after same data */
-                    d += uleb128_encode_small(dst + d, zrun_len);
-                    zrun_len = 0;
-                } else {
-                    break;
-                }
-            }
-            if (never_same || zrun_len) {
-                /*
-                 * never_same only acts if
-                 * data begins with diff in first count512s
-                 */
-                d += uleb128_encode_small(dst + d, zrun_len);
-                zrun_len = 0;
-                never_same = false;
-            }
-            /* has diff, 64 data at a time for speed */
-            if ((bytes_to_check == 64) && (comp == 0x0)) {
-                i += 64;
-                nzrun_len += 64;
-                break;
-            }
-            num = ctz64(comp);
-            num = (num < bytes_to_check) ? num : bytes_to_check;
-            nzrun_len += num;
-            bytes_to_check -= num;
-            comp >>= num;
-            i += num;
-            if (bytes_to_check) {
-                /* mask like 111000 */
-                d += uleb128_encode_small(dst + d, nzrun_len);
-                /* overflow */
-                if (d + nzrun_len > dlen) {
-                    return -1;
-                }
-                nzrun_start = new_buf + i - nzrun_len;
-                memcpy(dst + d, nzrun_start, nzrun_len);
-                d += nzrun_len;
-                nzrun_len = 0;
-                is_same = true;
-            }
-        }
-    }
-
-    if (nzrun_len != 0) {
-        d += uleb128_encode_small(dst + d, nzrun_len);
-        /* overflow */
-        if (d + nzrun_len > dlen) {
-            return -1;
-        }
-        nzrun_start = new_buf + i - nzrun_len;
-        memcpy(dst + d, nzrun_start, nzrun_len);
-        d += nzrun_len;
-    }
-    return d;
-}
-
-static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
-                                    int slen, uint8_t *dst, int dlen);
-
-static int (*accel_func)(uint8_t *, uint8_t *, int, uint8_t *, int);
-
-static void __attribute__((constructor)) init_accel(void)
-{
-    unsigned info = cpuinfo_init();
-    if (info & CPUINFO_AVX512BW) {
-        accel_func = xbzrle_encode_buffer_avx512;
-    } else {
-        accel_func = xbzrle_encode_buffer_int;
-    }
-}
-
-int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
-                         uint8_t *dst, int dlen)
-{
-    return accel_func(old_buf, new_buf, slen, dst, dlen);
-}
-
-#define xbzrle_encode_buffer xbzrle_encode_buffer_int
+/* vpaddq_u8 is only available on AArch64 */
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define XBZRLE_NEON
+#include <arm_neon.h>
 #endif
 
 /*
@@ -171,8 +36,8 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
 
   length = uleb128 encoded integer
  */
-int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
-                         uint8_t *dst, int dlen)
+static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
+                                    int slen, uint8_t *dst, int dlen)
 {
     uint32_t zrun_len = 0, nzrun_len = 0;
     int d = 0, i = 0;
@@ -273,6 +138,255 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
     return d;
 }
 
+/*
+ * Encoder for the vector implementations below.  @eq_mask returns a
+ * mask with bit n set if byte n of two 64-byte blocks is the same, so
+ * that the end of each run is found with a single count of trailing
+ * zeroes instead of a byte-by-byte scan.  It is inlined into each
+ * caller, together with @eq_mask, under the caller's target options.
+ */
+static inline __attribute__((always_inline)) int
+xbzrle_encode_masked(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                     uint8_t *dst, int dlen,
+                     uint64_t (*eq_mask)(const uint8_t *, const uint8_t *))
+{
+    int d = 0, i = 0, run_start = 0;
+    /* a page starts with a zrun, possibly empty */
+    bool zrun = true;
+
+    while (i < slen) {
+        int n = MIN(slen - i, 64);
+        uint64_t eq;
+        int pos = 0;
+
+        if (n == 64) {
+            eq = eq_mask(old_buf + i, new_buf + i);
+        } else {
+            int j;
+
+            for (eq = 0, j = 0; j < n; j++) {
+                eq |= (uint64_t)(old_buf[i + j] == new_buf[i + j]) << j;
+            }
+        }
+
+        for (;;) {
+            /* bits that end the current run */
+            uint64_t end = (zrun ? ~eq : eq) >> pos;
+            int len;
+
+            if (!end) {
+                break;
+            }
+            pos += ctz64(end);
+            if (pos >= n) {
+                break;
+            }
+
+            len = i + pos - run_start;
+            if (d + 2 > dlen) {
+                return -1;
+            }
+            d += uleb128_encode_small(dst + d, len);
+            if (!zrun) {
+                if (d + len > dlen) {
+                    return -1;
+                }
+                memcpy(dst + d, new_buf + run_start, len);
+                d += len;
+            }
+            run_start = i + pos;
+            zrun = !zrun;
+        }
+        i += n;
+    }
+
+    if (zrun) {
+        /*
+         * skip last zero run, d is 0 if the buffer is unchanged; like the
+         * other encoders, still fail if there is no room for its length
+         */
+        return d && d + 2 > dlen ? -1 : d;
+    }
+
+    /* last nzrun */
+    if (d + 2 > dlen) {
+        return -1;
+    }
+    d += uleb128_encode_small(dst + d, slen - run_start);
+    if (d + slen - run_start > dlen) {
+        return -1;
+    }
+    memcpy(dst + d, new_buf + run_start, slen - run_start);
+    return d + slen - run_start;
+}
+
+#ifdef CONFIG_AVX2_OPT
+static inline __attribute__((always_inline, target("avx2"))) uint64_t
+xbzrle_eq_mask_avx2(const uint8_t *a, const uint8_t *b)
+{
+    __m256i a0 = _mm256_loadu_si256((const __m256i *)a);
+    __m256i a1 = _mm256_loadu_si256((const __m256i *)(a + 32));
+    __m256i b0 = _mm256_loadu_si256((const __m256i *)b);
+    __m256i b1 = _mm256_loadu_si256((const __m256i *)(b + 32));
+    uint32_t lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(a0, b0));
+    uint32_t hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(a1, b1));
+
+    return lo | (uint64_t)hi << 32;
+}
+
+static int __attribute__((target("avx2")))
+xbzrle_encode_buffer_avx2(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                          uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_masked(old_buf, new_buf, slen, dst, dlen,
+                                xbzrle_eq_mask_avx2);
+}
+#endif
+
+#ifdef CONFIG_AVX512BW_OPT
+static inline __attribute__((always_inline, target("avx512bw"))) uint64_t
+xbzrle_eq_mask_avx512(const uint8_t *a, const uint8_t *b)
+{
+    return _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(a),
+                                  _mm512_loadu_si512(b));
+}
+
+static int __attribute__((target("avx512bw")))
+xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                            uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_masked(old_buf, new_buf, slen, dst, dlen,
+                                xbzrle_eq_mask_avx512);
+}
+#endif
+
+#ifdef XBZRLE_NEON
+static inline __attribute__((always_inline)) uint64_t
+xbzrle_eq_mask_neon(const uint8_t *a, const uint8_t *b)
+{
+    static const uint8_t bits[16] = {
+        1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128,
+    };
+    uint8x16_t bit = vld1q_u8(bits);
+    uint8x16_t t0 = vandq_u8(vceqq_u8(vld1q_u8(a), vld1q_u8(b)), bit);
+    uint8x16_t t1 = vandq_u8(vceqq_u8(vld1q_u8(a + 16), vld1q_u8(b + 16)),
+                             bit);
+    uint8x16_t t2 = vandq_u8(vceqq_u8(vld1q_u8(a + 32), vld1q_u8(b + 32)),
+                             bit);
+    uint8x16_t t3 = vandq_u8(vceqq_u8(vld1q_u8(a + 48), vld1q_u8(b + 48)),
+                             bit);
+
+    /* each pairwise add halves the bytes, 8 bytes make one byte of mask */
+    t0 = vpaddq_u8(t0, t1);
+    t2 = vpaddq_u8(t2, t3);
+    t0 = vpaddq_u8(t0, t2);
+    t0 = vpaddq_u8(t0, t0);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(t0), 0);
+}
+
+static int xbzrle_encode_buffer_neon(uint8_t *old_buf, uint8_t *new_buf,
+                                     int slen, uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_masked(old_buf, new_buf, slen, dst, dlen,
+                                xbzrle_eq_mask_neon);
+}
+#endif
+
+typedef int (*xbzrle_encode_fn)(uint8_t *, uint8_t *, int, uint8_t *, int);
+
+static xbzrle_encode_fn const accel_table[] = {
+    xbzrle_encode_buffer_int,
+#ifdef CONFIG_AVX2_OPT
+    xbzrle_encode_buffer_avx2,
+#endif
+#ifdef CONFIG_AVX512BW_OPT
+    xbzrle_encode_buffer_avx512,
+#endif
+#ifdef XBZRLE_NEON
+    xbzrle_encode_buffer_neon,
+#endif
+};
+
+static xbzrle_encode_fn accel_func;
+static unsigned accel_index;
+
+static unsigned best_accel(void)
+{
+#if defined(CONFIG_AVX2_OPT) || defined(CONFIG_AVX512BW_OPT)
+    unsigned info = cpuinfo_init();
+
+#ifdef CONFIG_AVX512BW_OPT
+    if (info & CPUINFO_AVX512BW) {
+        return ARRAY_SIZE(accel_table) - 1;
+    }
+#endif
+#ifdef CONFIG_AVX2_OPT
+    if (info & CPUINFO_AVX2) {
+        return 1;
+    }
+#endif
+    return 0;
+#else
+    return ARRAY_SIZE(accel_table) - 1;
+#endif
+}
+
+static void __attribute__((constructor)) init_accel(void)
+{
+    accel_index = best_accel();
+    accel_func = accel_table[accel_index];
+}
+
+bool test_xbzrle_encode_next_accel(void)
+{
+    if (accel_index != 0) {
+        accel_func = accel_table[--accel_index];
+        return true;
+    }
+    return false;
+}
+
+int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                         uint8_t *dst, int dlen)
+{
+    return accel_func(old_buf, new_buf, slen, dst, dlen);
+}
+
+/*
+ * Runs are mostly short, copy them without going through memcpy() but
+ * never beyond @len: @dst is the guest page.
+ */
+static inline void xbzrle_copy_run(uint8_t *dst, const uint8_t *src,
+                                   uint32_t len)
+{
+    if (len <= 16 && len >= 8) {
+        uint64_t a, b;
+
+        memcpy(&a, src, 8);
+        memcpy(&b, src + len - 8, 8);
+        memcpy(dst, &a, 8);
+        memcpy(dst + len - 8, &b, 8);
+    } else if (len < 8 && len >= 4) {
+        uint32_t a, b;
+
+        memcpy(&a, src, 4);
+        memcpy(&b, src + len - 4, 4);
+        memcpy(dst, &a, 4);
+        memcpy(dst + len - 4, &b, 4);
+    } else {
+        memcpy(dst, src, len);
+    }
+}
+
+static inline int xbzrle_decode_length(const uint8_t *in, uint32_t *n)
+{
+    if (likely(!(*in & 0x80))) {
+        *n = *in;
+        return 1;
+    }
+    return uleb128_decode_small(in, n);
+}
+
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
 {
     int i = 0, d = 0;
@@ -286,7 +400,7 @@ int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
             return -1;
         }
 
-        ret = uleb128_decode_small(src + i, &count);
+        ret = xbzrle_decode_length(src + i, &count);
         if (ret < 0 || (i && !count)) {
             return -1;
         }
@@ -303,7 +417,7 @@ int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
             return -1;
         }
 
-        ret = uleb128_decode_small(src + i, &count);
+        ret = xbzrle_decode_length(src + i, &count);
         if (ret < 0 || !count) {
             return -1;
         }
@@ -314,7 +428,7 @@ int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
             return -1;
         }
 
-        memcpy(dst + d, src + i, count);
+        xbzrle_copy_run(dst + d, src + i, count);
         d += count;
         i += count;
     }
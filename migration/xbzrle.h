@@ -19,4 +19,11 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
 
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen);
 
+/*
+ * Switch xbzrle_encode_buffer() to the next slower implementation
+ * available on this host, for tests.  Returns false once the plain C
+ * encoder is in use.
+ */
+bool test_xbzrle_encode_next_accel(void);
+
 #endif
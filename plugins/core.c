@@ -491,6 +491,38 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
     dyn_cb->regular = regular_cb;
 }
 
+void plugin_register_vcpu_mem_batch_cb(GArray **arr,
+                                       struct qemu_plugin_event_queue *queue,
+                                       enum qemu_plugin_mem_rw rw,
+                                       void *udata)
+{
+    static TCGHelperInfo info = {
+        /* recording an event never touches guest registers */
+        .flags = TCG_CALL_NO_RWG,
+        /*
+         * Match qemu_plugin_vcpu_mem_batch_push:
+         *   void (*)(uint32_t, qemu_plugin_meminfo_t, uint64_t,
+         *            void *, void *)
+         */
+        .typemask =
+            (dh_typemask(void, 0) |
+             dh_typemask(i32, 1) |
+             (__builtin_types_compatible_p(qemu_plugin_meminfo_t, uint32_t)
+              ? dh_typemask(i32, 2) : dh_typemask(s32, 2)) |
+             dh_typemask(i64, 3) |
+             dh_typemask(ptr, 4) |
+             dh_typemask(ptr, 5))
+    };
+
+    struct qemu_plugin_dyn_cb *dyn_cb = plugin_get_dyn_cb(arr);
+    struct qemu_plugin_batch_cb batch_cb = { .queue = queue,
+                                             .userp = udata,
+                                             .rw = rw,
+                                             .info = &info };
+    dyn_cb->type = PLUGIN_CB_MEM_BATCH;
+    dyn_cb->batch = batch_cb;
+}
+
 /*
  * Disable CFI checks.
  * The callback function has been loaded from an external library so we do not
@@ -702,6 +734,14 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                 qemu_plugin_set_cb_flags(cpu, QEMU_PLUGIN_CB_NO_REGS);
             }
             break;
+        case PLUGIN_CB_MEM_BATCH:
+            if (rw & cb->batch.rw) {
+                qemu_plugin_vcpu_mem_batch_push(cpu->cpu_index,
+                                                make_plugin_meminfo(oi, rw),
+                                                vaddr, cb->batch.queue,
+                                                cb->batch.userp);
+            }
+            break;
         case PLUGIN_CB_INLINE_ADD_U64:
         case PLUGIN_CB_INLINE_STORE_U64:
             if (rw & cb->inline_insn.rw) {
@@ -0,0 +1,359 @@
+/*
+ * QEMU Plugin asynchronous event queues
+ *
+ * Memory accesses instrumented through qemu_plugin_register_vcpu_mem_batch_cb
+ * are not reported synchronously. Instead the vCPU appends a small record to
+ * a single-producer/single-consumer ring private to that vCPU, and a thread
+ * owned by the queue hands the records to the plugin in batches. The vCPU
+ * fast path is a handful of loads and stores and never takes a lock.
+ *
+ * The table of per-vCPU rings grows on demand and is published with RCU,
+ * so that vCPUs created late (e.g. new threads in user-mode) get a ring
+ * without stopping the world.
+ *
+ * Copyright (c) 2026 the Oro Operating System Project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/host-utils.h"
+#include "qemu/lockable.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "qemu/plugin.h"
+#include "qemu/qemu-plugin.h"
+#include "plugin.h"
+
+/* how long the consumer sleeps before flushing partial batches */
+#define EVENT_QUEUE_IDLE_MS 10
+
+typedef struct PluginEventRing {
+    /* updated by the producing vCPU only */
+    uint64_t head;
+    uint64_t seen;
+    uint64_t dropped;
+    /* updated by the consumer thread only, keep it off the producer's line */
+    uint64_t tail QEMU_ALIGNED(64);
+    /* set by the consumer whenever it frees slots */
+    QemuEvent space;
+    struct qemu_plugin_mem_event events[];
+} PluginEventRing;
+
+typedef struct PluginEventRingTable {
+    struct rcu_head rcu;
+    unsigned int n;
+    PluginEventRing *rings[];
+} PluginEventRingTable;
+
+struct qemu_plugin_event_queue {
+    qemu_plugin_vcpu_mem_batch_cb_t cb;
+    void *userdata;
+    enum qemu_plugin_batch_policy policy;
+    uint64_t ring_size;
+    uint64_t batch_size;
+    unsigned int sample_rate;
+
+    /* RCU-protected, replaced under @lock */
+    PluginEventRingTable *table;
+    /* protects @table updates and the consumer's sleep */
+    QemuMutex lock;
+    QemuCond wake;
+    bool sleeping;
+    bool stopping;
+    QemuThread thread;
+};
+
+static PluginEventRing *event_queue_add_ring(struct qemu_plugin_event_queue *q,
+                                             unsigned int cpu_index)
+{
+    PluginEventRingTable *old, *new;
+    PluginEventRing *ring;
+    unsigned int n;
+
+    QEMU_LOCK_GUARD(&q->lock);
+    old = q->table;
+    if (old && cpu_index < old->n && old->rings[cpu_index]) {
+        return old->rings[cpu_index];
+    }
+
+    n = MAX(cpu_index + 1, old ? old->n : 0);
+    new = g_malloc0(sizeof(*new) + n * sizeof(new->rings[0]));
+    new->n = n;
+    if (old) {
+        memcpy(new->rings, old->rings, old->n * sizeof(old->rings[0]));
+    }
+
+    ring = g_malloc0(sizeof(*ring) + q->ring_size * sizeof(ring->events[0]));
+    qemu_event_init(&ring->space, false);
+    new->rings[cpu_index] = ring;
+
+    qatomic_rcu_set(&q->table, new);
+    if (old) {
+        g_free_rcu(old, rcu);
+    }
+    return ring;
+}
+
+static inline PluginEventRing *
+event_queue_get_ring(struct qemu_plugin_event_queue *q, unsigned int cpu_index)
+{
+    PluginEventRingTable *table = qatomic_rcu_read(&q->table);
+
+    if (likely(table && cpu_index < table->n && table->rings[cpu_index])) {
+        return table->rings[cpu_index];
+    }
+    return event_queue_add_ring(q, cpu_index);
+}
+
+static void event_queue_kick(struct qemu_plugin_event_queue *q)
+{
+    /* pairs with the barrier in event_queue_thread() */
+    smp_mb();
+    if (qatomic_read(&q->sleeping)) {
+        WITH_QEMU_LOCK_GUARD(&q->lock) {
+            qemu_cond_signal(&q->wake);
+        }
+    }
+}
+
+static void event_ring_drop(PluginEventRing *ring)
+{
+    qatomic_set(&ring->dropped, ring->dropped + 1);
+}
+
+/*
+ * Called from TCG generated code and from qemu_plugin_vcpu_mem_cb(),
+ * always on the vCPU thread that owns the ring.
+ */
+void qemu_plugin_vcpu_mem_batch_push(uint32_t cpu_index,
+                                     qemu_plugin_meminfo_t info,
+                                     uint64_t vaddr,
+                                     struct qemu_plugin_event_queue *q,
+                                     void *userp)
+{
+    PluginEventRing *ring = event_queue_get_ring(q, cpu_index);
+    struct qemu_plugin_hwaddr *hwaddr;
+    struct qemu_plugin_mem_event *ev;
+    uint64_t head = ring->head;
+    uint64_t used = head - qatomic_load_acquire(&ring->tail);
+
+    if (q->policy == QEMU_PLUGIN_BATCH_SAMPLE && used >= q->ring_size / 2) {
+        if (ring->seen++ % q->sample_rate) {
+            event_ring_drop(ring);
+            return;
+        }
+    }
+
+    while (used >= q->ring_size) {
+        if (q->policy != QEMU_PLUGIN_BATCH_BLOCK) {
+            event_ring_drop(ring);
+            event_queue_kick(q);
+            return;
+        }
+        qemu_event_reset(&ring->space);
+        event_queue_kick(q);
+        used = head - qatomic_load_acquire(&ring->tail);
+        if (used >= q->ring_size) {
+            qemu_event_wait(&ring->space);
+            used = head - qatomic_load_acquire(&ring->tail);
+        }
+    }
+
+    ev = &ring->events[head & (q->ring_size - 1)];
+    ev->vaddr = vaddr;
+    ev->userdata = userp;
+    ev->info = info;
+
+    /* we are in vCPU context, so the softmmu TLB still holds the entry */
+    hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
+    ev->paddr = hwaddr ? qemu_plugin_hwaddr_phys_addr(hwaddr) : vaddr;
+    ev->is_io = hwaddr && qemu_plugin_hwaddr_is_io(hwaddr);
+
+    qatomic_store_release(&ring->head, head + 1);
+
+    if (used + 1 == q->batch_size) {
+        event_queue_kick(q);
+    }
+}
+
+/*
+ * Deliver pending events of every ring holding at least a full batch,
+ * or of every non-empty ring if @all. Returns the number of events
+ * delivered. Must be called from the consumer thread.
+ */
+QEMU_DISABLE_CFI
+static uint64_t event_queue_drain(struct qemu_plugin_event_queue *q, bool all)
+{
+    PluginEventRingTable *table;
+    uint64_t total = 0;
+    unsigned int i;
+
+    RCU_READ_LOCK_GUARD();
+    table = qatomic_rcu_read(&q->table);
+    if (!table) {
+        return 0;
+    }
+
+    for (i = 0; i < table->n; i++) {
+        PluginEventRing *ring = table->rings[i];
+        uint64_t head, tail, start;
+
+        if (!ring) {
+            continue;
+        }
+        head = qatomic_load_acquire(&ring->head);
+        tail = start = ring->tail;
+        if (head == tail || (!all && head - tail < q->batch_size)) {
+            continue;
+        }
+
+        while (tail != head) {
+            uint64_t idx = tail & (q->ring_size - 1);
+            uint64_t n = MIN(head - tail, q->ring_size - idx);
+
+            n = MIN(n, q->batch_size);
+            q->cb(i, &ring->events[idx], n, q->userdata);
+            tail += n;
+            qatomic_store_release(&ring->tail, tail);
+            qemu_event_set(&ring->space);
+        }
+        total += tail - start;
+    }
+    return total;
+}
+
+/*
+ * Whether a ring holds a full batch, i.e. whether a producer may have
+ * tried to kick us. Must be called from the consumer thread.
+ */
+static bool event_queue_has_batch(struct qemu_plugin_event_queue *q)
+{
+    PluginEventRingTable *table;
+    unsigned int i;
+
+    RCU_READ_LOCK_GUARD();
+    table = qatomic_rcu_read(&q->table);
+    if (!table) {
+        return false;
+    }
+
+    for (i = 0; i < table->n; i++) {
+        PluginEventRing *ring = table->rings[i];
+
+        if (ring && qatomic_load_acquire(&ring->head) - ring->tail >=
+            q->batch_size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void *event_queue_thread(void *opaque)
+{
+    struct qemu_plugin_event_queue *q = opaque;
+    bool flush_partial = false;
+
+    rcu_register_thread();
+
+    for (;;) {
+        if (event_queue_drain(q, flush_partial)) {
+            flush_partial = false;
+            continue;
+        }
+
+        qemu_mutex_lock(&q->lock);
+        if (q->stopping) {
+            qemu_mutex_unlock(&q->lock);
+            break;
+        }
+        qatomic_set(&q->sleeping, true);
+        /* pairs with the barrier in event_queue_kick() */
+        smp_mb();
+        /*
+         * A producer that filled a batch before it could see sleeping
+         * did not signal us, so look at the rings once more.
+         */
+        if (event_queue_has_batch(q)) {
+            qatomic_set(&q->sleeping, false);
+            qemu_mutex_unlock(&q->lock);
+            continue;
+        }
+        flush_partial = !qemu_cond_timedwait(&q->wake, &q->lock,
+                                             EVENT_QUEUE_IDLE_MS);
+        qatomic_set(&q->sleeping, false);
+        qemu_mutex_unlock(&q->lock);
+    }
+
+    /* deliver whatever is left before going away */
+    event_queue_drain(q, true);
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+struct qemu_plugin_event_queue *
+qemu_plugin_event_queue_new(size_t ring_size, size_t batch_size,
+                            enum qemu_plugin_batch_policy policy,
+                            unsigned int sample_rate,
+                            qemu_plugin_vcpu_mem_batch_cb_t cb,
+                            void *userdata)
+{
+    struct qemu_plugin_event_queue *q;
+
+    g_assert(cb);
+    g_assert(policy <= QEMU_PLUGIN_BATCH_SAMPLE);
+
+    q = g_new0(struct qemu_plugin_event_queue, 1);
+    q->cb = cb;
+    q->userdata = userdata;
+    q->policy = policy;
+    q->ring_size = pow2ceil(MAX(ring_size, 2));
+    q->batch_size = MIN(MAX(batch_size, 1), q->ring_size);
+    q->sample_rate = MAX(sample_rate, 1);
+    qemu_mutex_init(&q->lock);
+    qemu_cond_init(&q->wake);
+    qemu_thread_create(&q->thread, "plugin-evq", event_queue_thread, q,
+                       QEMU_THREAD_JOINABLE);
+    return q;
+}
+
+uint64_t qemu_plugin_event_queue_dropped(struct qemu_plugin_event_queue *q)
+{
+    PluginEventRingTable *table;
+    uint64_t dropped = 0;
+    unsigned int i;
+
+    RCU_READ_LOCK_GUARD();
+    table = qatomic_rcu_read(&q->table);
+    for (i = 0; table && i < table->n; i++) {
+        if (table->rings[i]) {
+            dropped += qatomic_read(&table->rings[i]->dropped);
+        }
+    }
+    return dropped;
+}
+
+void qemu_plugin_event_queue_free(struct qemu_plugin_event_queue *q)
+{
+    unsigned int i;
+
+    WITH_QEMU_LOCK_GUARD(&q->lock) {
+        q->stopping = true;
+        qemu_cond_signal(&q->wake);
+    }
+    qemu_thread_join(&q->thread);
+
+    if (q->table) {
+        for (i = 0; i < q->table->n; i++) {
+            if (q->table->rings[i]) {
+                qemu_event_destroy(&q->table->rings[i]->space);
+                g_free(q->table->rings[i]);
+            }
+        }
+        g_free(q->table);
+    }
+    qemu_cond_destroy(&q->wake);
+    qemu_mutex_destroy(&q->lock);
+    g_free(q);
+}
@@ -109,6 +109,11 @@ void plugin_register_vcpu_mem_cb(GArray **arr,
                                  enum qemu_plugin_mem_rw rw,
                                  void *udata);
 
+void plugin_register_vcpu_mem_batch_cb(GArray **arr,
+                                       struct qemu_plugin_event_queue *queue,
+                                       enum qemu_plugin_mem_rw rw,
+                                       void *udata);
+
 void exec_inline_op(enum plugin_dyn_cb_type type,
                     struct qemu_plugin_inline_cb *cb,
                     int cpu_index);
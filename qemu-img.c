@@ -87,6 +87,7 @@ enum {
     OPTION_FORCE = 276,
     OPTION_SKIP_BROKEN = 277,
     OPTION_LIMITS = 278,
+    OPTION_STATS = 279,
 };
 
 typedef enum OutputFormat {
@@ -1663,6 +1664,12 @@ enum ImgConvertBlockStatus {
 #define MAX_COROUTINES 16
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
+/* Work done by one stage of the conversion, for --stats */
+typedef struct ImgConvertStage {
+    uint64_t bytes;
+    int64_t busy_us;    /* summed over all coroutines */
+} ImgConvertStage;
+
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1695,8 +1702,30 @@ typedef struct ImgConvertState {
     int64_t wait_sector_num[MAX_COROUTINES];
     CoMutex lock;
     int ret;
+    bool stats;
+    ImgConvertStage read_stage;
+    ImgConvertStage zero_stage;
+    ImgConvertStage write_stage;
 } ImgConvertState;
 
+static void convert_stage_add(ImgConvertStage *stage, int nb_sectors,
+                              int64_t start_us)
+{
+    stage->bytes += (uint64_t)nb_sectors << BDRV_SECTOR_BITS;
+    stage->busy_us += g_get_monotonic_time() - start_us;
+}
+
+static void convert_print_stage(const char *name, ImgConvertStage *stage,
+                                int64_t elapsed_us)
+{
+    g_autofree char *size = size_to_str(stage->bytes);
+    g_autofree char *rate = size_to_str(elapsed_us ?
+                                        stage->bytes * 1e6 / elapsed_us : 0);
+
+    printf("%-6s %12s %10.3f s busy %12s/s\n", name, size,
+           stage->busy_us / 1e6, rate);
+}
+
 static void convert_select_part(ImgConvertState *s, int64_t sector_num,
                                 int *src_cur, int64_t *src_cur_offset)
 {
@@ -1820,6 +1849,8 @@ static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
                                         int nb_sectors, uint8_t *buf)
 {
     uint64_t single_read_until = 0;
+    int64_t start_us = g_get_monotonic_time();
+    int total = nb_sectors;
     int n, ret;
 
     assert(nb_sectors <= s->buf_sectors);
@@ -1866,9 +1897,33 @@ static int coroutine_fn convert_co_read(ImgConvertState *s, int64_t sector_num,
         buf += n * BDRV_SECTOR_SIZE;
     }
 
+    convert_stage_add(&s->read_stage, total, start_us);
     return 0;
 }
 
+/*
+ * Compressed clusters must be written whole, but a multi-cluster buffer can
+ * mix zero and non-zero clusters.  Return the number of sectors at the start
+ * of @buf, in whole clusters, that are either all zero or all non-zero, and
+ * set @zero accordingly.
+ */
+static int convert_compressed_run(ImgConvertState *s, const uint8_t *buf,
+                                  int nb_sectors, bool *zero)
+{
+    int n = MIN(nb_sectors, s->cluster_sectors);
+
+    *zero = buffer_is_zero(buf, n * BDRV_SECTOR_SIZE);
+    while (n < nb_sectors) {
+        int m = MIN(nb_sectors - n, s->cluster_sectors);
+
+        if (buffer_is_zero(buf + n * BDRV_SECTOR_SIZE,
+                           m * BDRV_SECTOR_SIZE) != *zero) {
+            break;
+        }
+        n += m;
+    }
+    return n;
+}
 
 static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
                                          int nb_sectors, uint8_t *buf,
@@ -1879,6 +1934,8 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
     while (nb_sectors > 0) {
         int n = nb_sectors;
         BdrvRequestFlags flags = s->compressed ? BDRV_REQ_WRITE_COMPRESSED : 0;
+        int64_t start_us = g_get_monotonic_time();
+        bool zero = false;
 
         switch (status) {
         case BLK_BACKING_FILE:
@@ -1893,20 +1950,23 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
              * is real non-zero data, we must write it. Otherwise we can treat
              * it as zero sectors.
              * Compressed clusters need to be written as a whole, so in that
-             * case we can only save the write if the buffer is completely
-             * zeroed. */
+             * case we can only save the write for completely zeroed
+             * clusters. */
+            if (s->compressed && s->min_sparse) {
+                n = convert_compressed_run(s, buf, n, &zero);
+            }
             if (!s->min_sparse ||
                 (!s->compressed &&
                  is_allocated_sectors_min(buf, n, &n, s->min_sparse,
                                           sector_num, s->alignment)) ||
-                (s->compressed &&
-                 !buffer_is_zero(buf, n * BDRV_SECTOR_SIZE)))
+                (s->compressed && !zero))
             {
                 ret = blk_co_pwrite(s->target, sector_num << BDRV_SECTOR_BITS,
                                     n << BDRV_SECTOR_BITS, buf, flags);
                 if (ret < 0) {
                     return ret;
                 }
+                convert_stage_add(&s->write_stage, n, start_us);
                 break;
             }
             /* fall-through */
@@ -1914,6 +1974,7 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
         case BLK_ZERO:
             if (s->has_zero_init) {
                 assert(!s->target_has_backing);
+                convert_stage_add(&s->zero_stage, n, start_us);
                 break;
             }
             ret = blk_co_pwrite_zeroes(s->target,
@@ -1923,6 +1984,7 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
             if (ret < 0) {
                 return ret;
             }
+            convert_stage_add(&s->zero_stage, n, start_us);
             break;
         }
 
@@ -1937,6 +1999,8 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
 static int coroutine_fn convert_co_copy_range(ImgConvertState *s, int64_t sector_num,
                                               int nb_sectors)
 {
+    int64_t start_us = g_get_monotonic_time();
+    int total = nb_sectors;
     int n, ret;
 
     while (nb_sectors > 0) {
@@ -1962,6 +2026,8 @@ static int coroutine_fn convert_co_copy_range(ImgConvertState *s, int64_t sector
         sector_num += n;
         nb_sectors -= n;
     }
+
+    convert_stage_add(&s->write_stage, total, start_us);
     return 0;
 }
 
@@ -2101,14 +2167,17 @@ static int convert_do_copy(ImgConvertState *s)
         bdrv_graph_rdunlock_main_loop();
     }
 
-    /* Allocate buffer for copied data. For compressed images, only one cluster
-     * can be copied at a time. */
+    /*
+     * Allocate buffer for copied data. For compressed images, copy whole
+     * clusters; writing several of them at once lets the format driver
+     * compress them in parallel even though writes are kept in order.
+     */
     if (s->compressed) {
         if (s->cluster_sectors <= 0 || s->cluster_sectors > s->buf_sectors) {
             error_report("invalid cluster size");
             return -EINVAL;
         }
-        s->buf_sectors = s->cluster_sectors;
+        s->buf_sectors = QEMU_ALIGN_DOWN(s->buf_sectors, s->cluster_sectors);
     }
 
     while (sector_num < s->total_sectors) {
@@ -2250,6 +2319,7 @@ static int img_convert(const img_cmd_t *ccmd, int argc, char **argv)
     bool bitmaps = false;
     bool skip_broken = false;
     int64_t rate_limit = 0;
+    int64_t elapsed_us = 0;
 
     ImgConvertState s = (ImgConvertState) {
         /* Need at least 4k of zeros for sparse detection */
@@ -2293,6 +2363,7 @@ static int img_convert(const img_cmd_t *ccmd, int argc, char **argv)
             {"progress", no_argument, 0, 'p'},
             {"quiet", no_argument, 0, 'q'},
             {"object", required_argument, 0, OPTION_OBJECT},
+            {"stats", no_argument, 0, OPTION_STATS},
             {0, 0, 0, 0}
         };
         c = getopt_long(argc, argv, "hf:O:b:B:CcF:o:l:S:pt:T:nm:WUr:q",
@@ -2307,8 +2378,8 @@ static int img_convert(const img_cmd_t *ccmd, int argc, char **argv)
 "        [-O TGT_FMT | --target-image-opts] [-o TGT_FMT_OPTS] [-t TGT_CACHE]\n"
 "        [-b BACKING_FILE [-F BACKING_FMT]] [-S SPARSE_SIZE]\n"
 "        [-n] [--target-is-zero] [-c]\n"
-"        [-U] [-r RATE] [-m NUM_PARALLEL] [-W] [-C] [-p] [-q] [--object OBJDEF]\n"
-"        SRC_FILE [SRC_FILE2...] TGT_FILE\n"
+"        [-U] [-r RATE] [-m NUM_PARALLEL] [-W] [-C] [-p] [-q] [--stats]\n"
+"        [--object OBJDEF] SRC_FILE [SRC_FILE2...] TGT_FILE\n"
 ,
 "  -f, --source-format SRC_FMT\n"
 "     specify format of all SRC_FILEs explicitly (default: probing is used)\n"
@@ -2361,6 +2432,8 @@ static int img_convert(const img_cmd_t *ccmd, int argc, char **argv)
 "     display progress information\n"
 "  -q, --quiet\n"
 "     quiet mode (produce only error messages if any)\n"
+"  --stats\n"
+"     print the amount of data and time spent by each stage at the end\n"
 "  --object OBJDEF\n"
 "     defines QEMU user-creatable object\n"
 "  SRC_FILE...\n"
@@ -2485,6 +2558,9 @@ static int img_convert(const img_cmd_t *ccmd, int argc, char **argv)
         case 'q':
             s.quiet = true;
             break;
+        case OPTION_STATS:
+            s.stats = true;
+            break;
         case OPTION_OBJECT:
             user_creatable_process_cmdline(optarg);
             break;
@@ -2864,7 +2940,9 @@ static int img_convert(const img_cmd_t *ccmd, int argc, char **argv)
         set_rate_limit(s.target, rate_limit);
     }
 
+    elapsed_us = g_get_monotonic_time();
     ret = convert_do_copy(&s);
+    elapsed_us = g_get_monotonic_time() - elapsed_us;
 
     /* Now copy the bitmaps */
     if (bitmaps && ret == 0) {
@@ -2876,6 +2954,12 @@ out:
         qemu_progress_print(100, 0);
     }
     qemu_progress_end();
+    if (!ret && s.stats && !s.quiet) {
+        printf("Converted in %.3f s\n", elapsed_us / 1e6);
+        convert_print_stage("read", &s.read_stage, elapsed_us);
+        convert_print_stage("zero", &s.zero_stage, elapsed_us);
+        convert_print_stage("write", &s.write_stage, elapsed_us);
+    }
     qemu_opts_del(opts);
     qemu_opts_free(create_opts);
     qobject_unref(open_opts);
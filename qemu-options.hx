@@ -229,6 +229,7 @@ ERST
 DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "-accel [accel=]accelerator[,prop[=value][,...]]\n"
     "                select accelerator (kvm, xen, hvf, nvmm, whpx, mshv or tcg; use 'help' for a list)\n"
+    "                icount-quantum=n (instructions per vCPU between icount synchronization points with thread=multi)\n"
     "                igd-passthru=on|off (enable Xen integrated Intel graphics passthrough, default=off)\n"
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
@@ -248,6 +249,16 @@ SRST
     specified, the next one is used if the previous one fails to
     initialize.
 
+    ``icount-quantum=n``
+        With ``-icount`` and ``thread=multi``, every vCPU executes n
+        instructions and then waits for all other running vCPUs before
+        the virtual clock advances by n instructions. Smaller values
+        make timer and inter-processor interrupts more precise at the
+        cost of more frequent synchronization (default=10000). This
+        keeps virtual time in step across vCPUs, but the interleaving
+        of memory accesses between vCPUs is still up to the host, so
+        runs are not reproducible; use single-threaded TCG for that.
+
     ``igd-passthru=on|off``
         When Xen is in use, this option controls whether Intel
         integrated graphics devices can be passed through to the guest
@@ -284,7 +295,8 @@ SRST
         additional host cores. The default is to enable multi-threading
         where both the back-end and front-ends support it and no
         incompatible TCG features have been enabled (e.g.
-        icount/replay).
+        icount/replay). Multi-threading can be requested explicitly
+        together with ``-icount``, but not with record/replay.
 
     ``dirty-ring-size=n``
         When the KVM accelerator is used, it controls the size of the per-vCPU
@@ -1540,6 +1552,14 @@ SRST
             supporting platforms, and 0 on other platforms. Setting it
             to 0 disables this feature.
 
+        ``alloc-pool-size``
+            Size of the chunk of clusters that each iothread reserves
+            for the data it writes. The image is marked dirty while
+            clusters are reserved, so clusters still reserved when QEMU
+            crashes are reclaimed when the image is opened again.
+            Requires a version 3 image. The default value is 0, which
+            disables the pools.
+
         ``pass-discard-request``
             Whether discard requests to the qcow2 device should be
             forwarded to the data source (on/off; default: on if
@@ -5699,7 +5719,7 @@ SRST
         Please refer to ``memory-backend-file`` for a description of the
         options.
 
-    ``-object memory-backend-memfd,id=id,merge=on|off,dump=on|off,share=on|off,prealloc=on|off,size=size,host-nodes=host-nodes,policy=default|preferred|bind|interleave,seal=on|off,hugetlb=on|off,hugetlbsize=size``
+    ``-object memory-backend-memfd,id=id,merge=on|off,dump=on|off,share=on|off,prealloc=on|off,size=size,host-nodes=host-nodes,policy=default|preferred|bind|interleave,seal=on|off,hugetlb=on|off,hugetlbsize=size,fd=fd``
         Creates an anonymous memory file backend object, which allows
         QEMU to share the memory with an external process (e.g. when
         using vhost-user). The memory is allocated with memfd and
@@ -5719,6 +5739,14 @@ SRST
         incompatible with the ``seal`` option (requires at least Linux
         4.16).
 
+        The ``fd`` option maps an existing memfd, given as an inherited
+        file descriptor number or the name of a descriptor passed with
+        the ``getfd`` monitor command, instead of creating one. It
+        cannot be combined with the ``seal``, ``hugetlb`` and
+        ``hugetlbsize`` options. With ``share=off``, writes by the VM stay private,
+        which allows starting several VMs from the memory of a template
+        VM (see :doc:`/system/vm-templating`).
+
         Please refer to ``memory-backend-file`` for a description of the
         other options.
 
@@ -0,0 +1,30 @@
+/*
+ * NVMe passthrough through io_uring uring_cmd stubs
+ *
+ * Copyright (c) 2026 the Oro Operating System Project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "qemu/osdep.h"
+#include "qemu/aio.h"
+#include "block/raw-aio.h"
+
+void nvme_uring_detach_aio_context(NvmeUringState *s, AioContext *old_context)
+{
+    abort();
+}
+
+void nvme_uring_attach_aio_context(NvmeUringState *s, AioContext *new_context)
+{
+    abort();
+}
+
+NvmeUringState *nvme_uring_init(Error **errp)
+{
+    abort();
+}
+
+void nvme_uring_cleanup(NvmeUringState *s)
+{
+    abort();
+}
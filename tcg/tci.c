@@ -38,6 +38,45 @@
 
 __thread uintptr_t tci_tb_ptr;
 
+#ifdef CONFIG_TCI_PROFILE
+/*
+ * Executed bytecodes per opcode, summed over all vCPU threads.
+ * The counters are plain increments, so concurrent vCPUs may lose
+ * the odd update; this is good enough to find hot opcodes and keeps
+ * the dispatch path cheap.  Indexed by the raw 8-bit opcode field.
+ */
+static uint64_t tci_op_count[256];
+
+static inline void tci_profile(TCGOpcode opc)
+{
+    tci_op_count[opc]++;
+}
+
+void tci_dump_profile(GString *buf)
+{
+    uint64_t total = 0;
+    unsigned i;
+
+    for (i = 0; i < NB_OPS; i++) {
+        total += tci_op_count[i];
+    }
+    g_string_append_printf(buf, "TCI bytecodes executed %" PRIu64 "\n", total);
+    for (i = 0; i < NB_OPS; i++) {
+        uint64_t n = tci_op_count[i];
+
+        if (n) {
+            g_string_append_printf(buf, "  %-20s %14" PRIu64 " (%5.2f%%)\n",
+                                   tcg_op_defs[i].name, n,
+                                   (double)n * 100 / total);
+        }
+    }
+}
+#else
+static inline void tci_profile(TCGOpcode opc)
+{
+}
+#endif
+
 /*
  * Load sets of arguments all at once.  The naming convention is:
  *   tci_args_<arguments>
@@ -85,6 +124,22 @@ static void tci_args_rr(uint32_t insn, TCGReg *r0, TCGReg *r1)
     *r1 = extract32(insn, 12, 4);
 }
 
+static void tci_args_rrc(uint32_t insn, TCGReg *r0, TCGReg *r1, TCGCond *c2)
+{
+    *r0 = extract32(insn, 8, 4);
+    *r1 = extract32(insn, 12, 4);
+    *c2 = extract32(insn, 16, 4);
+}
+
+/*
+ * The fused compare-and-branch opcodes are followed by a full word
+ * holding the branch displacement, relative to the end of that word.
+ */
+static const uint32_t *tci_branch_target(const uint32_t *tb_ptr)
+{
+    return (const void *)(tb_ptr + 1) + (int32_t)*tb_ptr;
+}
+
 static void tci_args_ri(uint32_t insn, TCGReg *r0, tcg_target_ulong *i1)
 {
     *r0 = extract32(insn, 8, 4);
@@ -307,6 +362,23 @@ static void tci_qemu_st(CPUArchState *env, uint64_t taddr, uint64_t val,
     }
 }
 
+/*
+ * The interpreter uses threaded dispatch: rather than looping back to a
+ * single switch, every handler fetches the next bytecode itself and jumps
+ * to its handler through the dispatch table.  This gives each opcode its
+ * own indirect branch, which the host predicts far better than one shared
+ * branch, and removes the loop and bounds check from every step.
+ */
+#define TCI_CASE(name)  tci_op_##name
+
+#define TCI_NEXT()                      \
+    do {                                \
+        insn = *tb_ptr++;               \
+        opc = extract32(insn, 0, 8);    \
+        tci_profile(opc);               \
+        goto *dispatch[opc];            \
+    } while (0)
+
 /* Interpret pseudo code in tb. */
 /*
  * Disable CFI checks.
@@ -321,464 +393,553 @@ uintptr_t QEMU_DISABLE_CFI tcg_qemu_tb_exec(CPUArchState *env,
     uint64_t stack[(TCG_STATIC_CALL_ARGS_SIZE + TCG_STATIC_FRAME_SIZE)
                    / sizeof(uint64_t)];
     bool carry = false;
+    uint32_t insn;
+    TCGOpcode opc;
+    TCGReg r0, r1, r2, r3, r4;
+    tcg_target_ulong t1;
+    TCGCond condition;
+    uint8_t pos, len;
+    uint32_t tmp32;
+    uint64_t taddr;
+    MemOpIdx oi;
+    int32_t ofs;
+    void *ptr;
+
+    /* Indexed by the 8-bit opcode field, so any encoding is in bounds. */
+    static const void * const dispatch[256] = {
+        [0 ... 255] = &&TCI_CASE(illegal),
+        [INDEX_op_call] = &&TCI_CASE(call),
+        [INDEX_op_br] = &&TCI_CASE(br),
+        [INDEX_op_setcond] = &&TCI_CASE(setcond),
+        [INDEX_op_movcond] = &&TCI_CASE(movcond),
+        [INDEX_op_mov] = &&TCI_CASE(mov),
+        [INDEX_op_tci_movi] = &&TCI_CASE(tci_movi),
+        [INDEX_op_tci_movl] = &&TCI_CASE(tci_movl),
+        [INDEX_op_tci_setcarry] = &&TCI_CASE(tci_setcarry),
+        [INDEX_op_ld8u] = &&TCI_CASE(ld8u),
+        [INDEX_op_ld8s] = &&TCI_CASE(ld8s),
+        [INDEX_op_ld16u] = &&TCI_CASE(ld16u),
+        [INDEX_op_ld16s] = &&TCI_CASE(ld16s),
+        [INDEX_op_ld] = &&TCI_CASE(ld),
+        [INDEX_op_st8] = &&TCI_CASE(st8),
+        [INDEX_op_st16] = &&TCI_CASE(st16),
+        [INDEX_op_st] = &&TCI_CASE(st),
+        [INDEX_op_add] = &&TCI_CASE(add),
+        [INDEX_op_sub] = &&TCI_CASE(sub),
+        [INDEX_op_mul] = &&TCI_CASE(mul),
+        [INDEX_op_and] = &&TCI_CASE(and),
+        [INDEX_op_or] = &&TCI_CASE(or),
+        [INDEX_op_xor] = &&TCI_CASE(xor),
+        [INDEX_op_andc] = &&TCI_CASE(andc),
+        [INDEX_op_orc] = &&TCI_CASE(orc),
+        [INDEX_op_eqv] = &&TCI_CASE(eqv),
+        [INDEX_op_nand] = &&TCI_CASE(nand),
+        [INDEX_op_nor] = &&TCI_CASE(nor),
+        [INDEX_op_neg] = &&TCI_CASE(neg),
+        [INDEX_op_not] = &&TCI_CASE(not),
+        [INDEX_op_ctpop] = &&TCI_CASE(ctpop),
+        [INDEX_op_addco] = &&TCI_CASE(addco),
+        [INDEX_op_addci] = &&TCI_CASE(addci),
+        [INDEX_op_addcio] = &&TCI_CASE(addcio),
+        [INDEX_op_subbo] = &&TCI_CASE(subbo),
+        [INDEX_op_subbi] = &&TCI_CASE(subbi),
+        [INDEX_op_subbio] = &&TCI_CASE(subbio),
+        [INDEX_op_muls2] = &&TCI_CASE(muls2),
+        [INDEX_op_mulu2] = &&TCI_CASE(mulu2),
+        [INDEX_op_tci_divs32] = &&TCI_CASE(tci_divs32),
+        [INDEX_op_tci_divu32] = &&TCI_CASE(tci_divu32),
+        [INDEX_op_tci_rems32] = &&TCI_CASE(tci_rems32),
+        [INDEX_op_tci_remu32] = &&TCI_CASE(tci_remu32),
+        [INDEX_op_tci_clz32] = &&TCI_CASE(tci_clz32),
+        [INDEX_op_tci_ctz32] = &&TCI_CASE(tci_ctz32),
+        [INDEX_op_tci_setcond32] = &&TCI_CASE(tci_setcond32),
+        [INDEX_op_tci_movcond32] = &&TCI_CASE(tci_movcond32),
+        [INDEX_op_shl] = &&TCI_CASE(shl),
+        [INDEX_op_shr] = &&TCI_CASE(shr),
+        [INDEX_op_sar] = &&TCI_CASE(sar),
+        [INDEX_op_tci_rotl32] = &&TCI_CASE(tci_rotl32),
+        [INDEX_op_tci_rotr32] = &&TCI_CASE(tci_rotr32),
+        [INDEX_op_deposit] = &&TCI_CASE(deposit),
+        [INDEX_op_extract] = &&TCI_CASE(extract),
+        [INDEX_op_sextract] = &&TCI_CASE(sextract),
+        [INDEX_op_tci_brcond] = &&TCI_CASE(tci_brcond),
+        [INDEX_op_tci_brcond32] = &&TCI_CASE(tci_brcond32),
+        [INDEX_op_bswap16] = &&TCI_CASE(bswap16),
+        [INDEX_op_bswap32] = &&TCI_CASE(bswap32),
+        [INDEX_op_ld32u] = &&TCI_CASE(ld32u),
+        [INDEX_op_ld32s] = &&TCI_CASE(ld32s),
+        [INDEX_op_st32] = &&TCI_CASE(st32),
+        [INDEX_op_divs] = &&TCI_CASE(divs),
+        [INDEX_op_divu] = &&TCI_CASE(divu),
+        [INDEX_op_rems] = &&TCI_CASE(rems),
+        [INDEX_op_remu] = &&TCI_CASE(remu),
+        [INDEX_op_clz] = &&TCI_CASE(clz),
+        [INDEX_op_ctz] = &&TCI_CASE(ctz),
+        [INDEX_op_rotl] = &&TCI_CASE(rotl),
+        [INDEX_op_rotr] = &&TCI_CASE(rotr),
+        [INDEX_op_ext_i32_i64] = &&TCI_CASE(ext_i32_i64),
+        [INDEX_op_extu_i32_i64] = &&TCI_CASE(extu_i32_i64),
+        [INDEX_op_bswap64] = &&TCI_CASE(bswap64),
+        [INDEX_op_exit_tb] = &&TCI_CASE(exit_tb),
+        [INDEX_op_goto_tb] = &&TCI_CASE(goto_tb),
+        [INDEX_op_goto_ptr] = &&TCI_CASE(goto_ptr),
+        [INDEX_op_qemu_ld] = &&TCI_CASE(qemu_ld),
+        [INDEX_op_tci_qemu_ld_rrr] = &&TCI_CASE(tci_qemu_ld_rrr),
+        [INDEX_op_qemu_st] = &&TCI_CASE(qemu_st),
+        [INDEX_op_tci_qemu_st_rrr] = &&TCI_CASE(tci_qemu_st_rrr),
+        [INDEX_op_mb] = &&TCI_CASE(mb),
+    };
 
     regs[TCG_AREG0] = (tcg_target_ulong)env;
     regs[TCG_REG_CALL_STACK] = (uintptr_t)stack;
     tci_assert(tb_ptr);
 
-    for (;;) {
-        uint32_t insn;
-        TCGOpcode opc;
-        TCGReg r0, r1, r2, r3, r4;
-        tcg_target_ulong t1;
-        TCGCond condition;
-        uint8_t pos, len;
-        uint32_t tmp32;
-        uint64_t taddr;
-        MemOpIdx oi;
-        int32_t ofs;
-        void *ptr;
-
-        insn = *tb_ptr++;
-        opc = extract32(insn, 0, 8);
-
-        switch (opc) {
-        case INDEX_op_call:
-            {
-                void *call_slots[MAX_CALL_IARGS];
-                ffi_cif *cif;
-                void *func;
-                unsigned i, s, n;
-
-                tci_args_nl(insn, tb_ptr, &len, &ptr);
-                func = ((void **)ptr)[0];
-                cif = ((void **)ptr)[1];
-
-                n = cif->nargs;
-                for (i = s = 0; i < n; ++i) {
-                    ffi_type *t = cif->arg_types[i];
-                    call_slots[i] = &stack[s];
-                    s += DIV_ROUND_UP(t->size, 8);
-                }
-
-                /* Helper functions may need to access the "return address" */
-                tci_tb_ptr = (uintptr_t)tb_ptr;
-                ffi_call(cif, func, stack, call_slots);
-            }
-
-            switch (len) {
-            case 0: /* void */
-                break;
-            case 1: /* uint32_t */
-                /*
-                 * The result winds up "left-aligned" in the stack[0] slot.
-                 * Note that libffi has an odd special case in that it will
-                 * always widen an integral result to ffi_arg.
-                 */
-                if (sizeof(ffi_arg) == 8) {
-                    regs[TCG_REG_R0] = (uint32_t)stack[0];
-                } else {
-                    regs[TCG_REG_R0] = *(uint32_t *)stack;
-                }
-                break;
-            case 2: /* uint64_t */
-                memcpy(&regs[TCG_REG_R0], stack, 8);
-                break;
-            case 3: /* Int128 */
-                memcpy(&regs[TCG_REG_R0], stack, 16);
-                break;
-            default:
-                g_assert_not_reached();
-            }
-            break;
+    TCI_NEXT();
 
-        case INDEX_op_br:
-            tci_args_l(insn, tb_ptr, &ptr);
-            tb_ptr = ptr;
-            continue;
-        case INDEX_op_setcond:
-            tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
-            regs[r0] = tci_compare64(regs[r1], regs[r2], condition);
-            break;
-        case INDEX_op_movcond:
-            tci_args_rrrrrc(insn, &r0, &r1, &r2, &r3, &r4, &condition);
-            tmp32 = tci_compare64(regs[r1], regs[r2], condition);
-            regs[r0] = regs[tmp32 ? r3 : r4];
-            break;
-        case INDEX_op_mov:
-            tci_args_rr(insn, &r0, &r1);
-            regs[r0] = regs[r1];
-            break;
-        case INDEX_op_tci_movi:
-            tci_args_ri(insn, &r0, &t1);
-            regs[r0] = t1;
-            break;
-        case INDEX_op_tci_movl:
-            tci_args_rl(insn, tb_ptr, &r0, &ptr);
-            regs[r0] = *(tcg_target_ulong *)ptr;
-            break;
-        case INDEX_op_tci_setcarry:
-            carry = true;
-            break;
+    TCI_CASE(call):
+        {
+            void *call_slots[MAX_CALL_IARGS];
+            ffi_cif *cif;
+            void *func;
+            unsigned i, s, n;
 
-            /* Load/store operations (32 bit). */
+            tci_args_nl(insn, tb_ptr, &len, &ptr);
+            func = ((void **)ptr)[0];
+            cif = ((void **)ptr)[1];
 
-        case INDEX_op_ld8u:
-            tci_args_rrs(insn, &r0, &r1, &ofs);
-            ptr = (void *)(regs[r1] + ofs);
-            regs[r0] = *(uint8_t *)ptr;
-            break;
-        case INDEX_op_ld8s:
-            tci_args_rrs(insn, &r0, &r1, &ofs);
-            ptr = (void *)(regs[r1] + ofs);
-            regs[r0] = *(int8_t *)ptr;
-            break;
-        case INDEX_op_ld16u:
-            tci_args_rrs(insn, &r0, &r1, &ofs);
-            ptr = (void *)(regs[r1] + ofs);
-            regs[r0] = *(uint16_t *)ptr;
-            break;
-        case INDEX_op_ld16s:
-            tci_args_rrs(insn, &r0, &r1, &ofs);
-            ptr = (void *)(regs[r1] + ofs);
-            regs[r0] = *(int16_t *)ptr;
-            break;
-        case INDEX_op_ld:
-            tci_args_rrs(insn, &r0, &r1, &ofs);
-            ptr = (void *)(regs[r1] + ofs);
-            regs[r0] = *(tcg_target_ulong *)ptr;
-            break;
-        case INDEX_op_st8:
-            tci_args_rrs(insn, &r0, &r1, &ofs);
-            ptr = (void *)(regs[r1] + ofs);
-            *(uint8_t *)ptr = regs[r0];
-            break;
-        case INDEX_op_st16:
-            tci_args_rrs(insn, &r0, &r1, &ofs);
-            ptr = (void *)(regs[r1] + ofs);
-            *(uint16_t *)ptr = regs[r0];
-            break;
-        case INDEX_op_st:
-            tci_args_rrs(insn, &r0, &r1, &ofs);
-            ptr = (void *)(regs[r1] + ofs);
-            *(tcg_target_ulong *)ptr = regs[r0];
-            break;
+            n = cif->nargs;
+            for (i = s = 0; i < n; ++i) {
+                ffi_type *t = cif->arg_types[i];
+                call_slots[i] = &stack[s];
+                s += DIV_ROUND_UP(t->size, 8);
+            }
 
-            /* Arithmetic operations (mixed 32/64 bit). */
+            /* Helper functions may need to access the "return address" */
+            tci_tb_ptr = (uintptr_t)tb_ptr;
+            ffi_call(cif, func, stack, call_slots);
+        }
 
-        case INDEX_op_add:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = regs[r1] + regs[r2];
-            break;
-        case INDEX_op_sub:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = regs[r1] - regs[r2];
-            break;
-        case INDEX_op_mul:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = regs[r1] * regs[r2];
-            break;
-        case INDEX_op_and:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = regs[r1] & regs[r2];
-            break;
-        case INDEX_op_or:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = regs[r1] | regs[r2];
-            break;
-        case INDEX_op_xor:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = regs[r1] ^ regs[r2];
-            break;
-        case INDEX_op_andc:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = regs[r1] & ~regs[r2];
-            break;
-        case INDEX_op_orc:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = regs[r1] | ~regs[r2];
-            break;
-        case INDEX_op_eqv:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = ~(regs[r1] ^ regs[r2]);
-            break;
-        case INDEX_op_nand:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = ~(regs[r1] & regs[r2]);
-            break;
-        case INDEX_op_nor:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = ~(regs[r1] | regs[r2]);
-            break;
-        case INDEX_op_neg:
-            tci_args_rr(insn, &r0, &r1);
-            regs[r0] = -regs[r1];
+        switch (len) {
+        case 0: /* void */
+            break;
+        case 1: /* uint32_t */
+            /*
+             * The result winds up "left-aligned" in the stack[0] slot.
+             * Note that libffi has an odd special case in that it will
+             * always widen an integral result to ffi_arg.
+             */
+            if (sizeof(ffi_arg) == 8) {
+                regs[TCG_REG_R0] = (uint32_t)stack[0];
+            } else {
+                regs[TCG_REG_R0] = *(uint32_t *)stack;
+            }
             break;
-        case INDEX_op_not:
-            tci_args_rr(insn, &r0, &r1);
-            regs[r0] = ~regs[r1];
+        case 2: /* uint64_t */
+            memcpy(&regs[TCG_REG_R0], stack, 8);
             break;
-        case INDEX_op_ctpop:
-            tci_args_rr(insn, &r0, &r1);
-            regs[r0] = ctpop64(regs[r1]);
+        case 3: /* Int128 */
+            memcpy(&regs[TCG_REG_R0], stack, 16);
             break;
-        case INDEX_op_addco:
-            tci_args_rrr(insn, &r0, &r1, &r2);
+        default:
+            g_assert_not_reached();
+        }
+        TCI_NEXT();
+
+    TCI_CASE(br):
+        tci_args_l(insn, tb_ptr, &ptr);
+        tb_ptr = ptr;
+        TCI_NEXT();
+    TCI_CASE(setcond):
+        tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
+        regs[r0] = tci_compare64(regs[r1], regs[r2], condition);
+        TCI_NEXT();
+    TCI_CASE(movcond):
+        tci_args_rrrrrc(insn, &r0, &r1, &r2, &r3, &r4, &condition);
+        tmp32 = tci_compare64(regs[r1], regs[r2], condition);
+        regs[r0] = regs[tmp32 ? r3 : r4];
+        TCI_NEXT();
+    TCI_CASE(mov):
+        tci_args_rr(insn, &r0, &r1);
+        regs[r0] = regs[r1];
+        TCI_NEXT();
+    TCI_CASE(tci_movi):
+        tci_args_ri(insn, &r0, &t1);
+        regs[r0] = t1;
+        TCI_NEXT();
+    TCI_CASE(tci_movl):
+        tci_args_rl(insn, tb_ptr, &r0, &ptr);
+        regs[r0] = *(tcg_target_ulong *)ptr;
+        TCI_NEXT();
+    TCI_CASE(tci_setcarry):
+        carry = true;
+        TCI_NEXT();
+
+        /* Load/store operations (32 bit). */
+
+    TCI_CASE(ld8u):
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        ptr = (void *)(regs[r1] + ofs);
+        regs[r0] = *(uint8_t *)ptr;
+        TCI_NEXT();
+    TCI_CASE(ld8s):
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        ptr = (void *)(regs[r1] + ofs);
+        regs[r0] = *(int8_t *)ptr;
+        TCI_NEXT();
+    TCI_CASE(ld16u):
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        ptr = (void *)(regs[r1] + ofs);
+        regs[r0] = *(uint16_t *)ptr;
+        TCI_NEXT();
+    TCI_CASE(ld16s):
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        ptr = (void *)(regs[r1] + ofs);
+        regs[r0] = *(int16_t *)ptr;
+        TCI_NEXT();
+    TCI_CASE(ld):
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        ptr = (void *)(regs[r1] + ofs);
+        regs[r0] = *(tcg_target_ulong *)ptr;
+        TCI_NEXT();
+    TCI_CASE(st8):
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        ptr = (void *)(regs[r1] + ofs);
+        *(uint8_t *)ptr = regs[r0];
+        TCI_NEXT();
+    TCI_CASE(st16):
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        ptr = (void *)(regs[r1] + ofs);
+        *(uint16_t *)ptr = regs[r0];
+        TCI_NEXT();
+    TCI_CASE(st):
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        ptr = (void *)(regs[r1] + ofs);
+        *(tcg_target_ulong *)ptr = regs[r0];
+        TCI_NEXT();
+
+        /* Arithmetic operations (mixed 32/64 bit). */
+
+    TCI_CASE(add):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] + regs[r2];
+        TCI_NEXT();
+    TCI_CASE(sub):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] - regs[r2];
+        TCI_NEXT();
+    TCI_CASE(mul):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] * regs[r2];
+        TCI_NEXT();
+    TCI_CASE(and):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] & regs[r2];
+        TCI_NEXT();
+    TCI_CASE(or):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] | regs[r2];
+        TCI_NEXT();
+    TCI_CASE(xor):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] ^ regs[r2];
+        TCI_NEXT();
+    TCI_CASE(andc):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] & ~regs[r2];
+        TCI_NEXT();
+    TCI_CASE(orc):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] | ~regs[r2];
+        TCI_NEXT();
+    TCI_CASE(eqv):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = ~(regs[r1] ^ regs[r2]);
+        TCI_NEXT();
+    TCI_CASE(nand):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = ~(regs[r1] & regs[r2]);
+        TCI_NEXT();
+    TCI_CASE(nor):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = ~(regs[r1] | regs[r2]);
+        TCI_NEXT();
+    TCI_CASE(neg):
+        tci_args_rr(insn, &r0, &r1);
+        regs[r0] = -regs[r1];
+        TCI_NEXT();
+    TCI_CASE(not):
+        tci_args_rr(insn, &r0, &r1);
+        regs[r0] = ~regs[r1];
+        TCI_NEXT();
+    TCI_CASE(ctpop):
+        tci_args_rr(insn, &r0, &r1);
+        regs[r0] = ctpop64(regs[r1]);
+        TCI_NEXT();
+    TCI_CASE(addco):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        t1 = regs[r1] + regs[r2];
+        carry = t1 < regs[r1];
+        regs[r0] = t1;
+        TCI_NEXT();
+    TCI_CASE(addci):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] + regs[r2] + carry;
+        TCI_NEXT();
+    TCI_CASE(addcio):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        if (carry) {
+            t1 = regs[r1] + regs[r2] + 1;
+            carry = t1 <= regs[r1];
+        } else {
             t1 = regs[r1] + regs[r2];
             carry = t1 < regs[r1];
-            regs[r0] = t1;
-            break;
-        case INDEX_op_addci:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = regs[r1] + regs[r2] + carry;
-            break;
-        case INDEX_op_addcio:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            if (carry) {
-                t1 = regs[r1] + regs[r2] + 1;
-                carry = t1 <= regs[r1];
-            } else {
-                t1 = regs[r1] + regs[r2];
-                carry = t1 < regs[r1];
-            }
-            regs[r0] = t1;
-            break;
-        case INDEX_op_subbo:
-            tci_args_rrr(insn, &r0, &r1, &r2);
+        }
+        regs[r0] = t1;
+        TCI_NEXT();
+    TCI_CASE(subbo):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        carry = regs[r1] < regs[r2];
+        regs[r0] = regs[r1] - regs[r2];
+        TCI_NEXT();
+    TCI_CASE(subbi):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] - regs[r2] - carry;
+        TCI_NEXT();
+    TCI_CASE(subbio):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        if (carry) {
+            carry = regs[r1] <= regs[r2];
+            regs[r0] = regs[r1] - regs[r2] - 1;
+        } else {
             carry = regs[r1] < regs[r2];
             regs[r0] = regs[r1] - regs[r2];
-            break;
-        case INDEX_op_subbi:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = regs[r1] - regs[r2] - carry;
-            break;
-        case INDEX_op_subbio:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            if (carry) {
-                carry = regs[r1] <= regs[r2];
-                regs[r0] = regs[r1] - regs[r2] - 1;
-            } else {
-                carry = regs[r1] < regs[r2];
-                regs[r0] = regs[r1] - regs[r2];
-            }
-            break;
-        case INDEX_op_muls2:
-            tci_args_rrrr(insn, &r0, &r1, &r2, &r3);
-            muls64(&regs[r0], &regs[r1], regs[r2], regs[r3]);
-            break;
-        case INDEX_op_mulu2:
-            tci_args_rrrr(insn, &r0, &r1, &r2, &r3);
-            mulu64(&regs[r0], &regs[r1], regs[r2], regs[r3]);
-            break;
-
-            /* Arithmetic operations (32 bit). */
-
-        case INDEX_op_tci_divs32:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = (int32_t)regs[r1] / (int32_t)regs[r2];
-            break;
-        case INDEX_op_tci_divu32:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = (uint32_t)regs[r1] / (uint32_t)regs[r2];
-            break;
-        case INDEX_op_tci_rems32:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = (int32_t)regs[r1] % (int32_t)regs[r2];
-            break;
-        case INDEX_op_tci_remu32:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = (uint32_t)regs[r1] % (uint32_t)regs[r2];
-            break;
-        case INDEX_op_tci_clz32:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            tmp32 = regs[r1];
-            regs[r0] = tmp32 ? clz32(tmp32) : regs[r2];
-            break;
-        case INDEX_op_tci_ctz32:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            tmp32 = regs[r1];
-            regs[r0] = tmp32 ? ctz32(tmp32) : regs[r2];
-            break;
-        case INDEX_op_tci_setcond32:
-            tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
-            regs[r0] = tci_compare32(regs[r1], regs[r2], condition);
-            break;
-        case INDEX_op_tci_movcond32:
-            tci_args_rrrrrc(insn, &r0, &r1, &r2, &r3, &r4, &condition);
-            tmp32 = tci_compare32(regs[r1], regs[r2], condition);
-            regs[r0] = regs[tmp32 ? r3 : r4];
-            break;
-
-            /* Shift/rotate operations. */
-
-        case INDEX_op_shl:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = regs[r1] << (regs[r2] % TCG_TARGET_REG_BITS);
-            break;
-        case INDEX_op_shr:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = regs[r1] >> (regs[r2] % TCG_TARGET_REG_BITS);
-            break;
-        case INDEX_op_sar:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = ((tcg_target_long)regs[r1]
-                        >> (regs[r2] % TCG_TARGET_REG_BITS));
-            break;
-        case INDEX_op_tci_rotl32:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = rol32(regs[r1], regs[r2] & 31);
-            break;
-        case INDEX_op_tci_rotr32:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = ror32(regs[r1], regs[r2] & 31);
-            break;
-        case INDEX_op_deposit:
-            tci_args_rrrbb(insn, &r0, &r1, &r2, &pos, &len);
-            regs[r0] = deposit64(regs[r1], pos, len, regs[r2]);
-            break;
-        case INDEX_op_extract:
-            tci_args_rrbb(insn, &r0, &r1, &pos, &len);
-            regs[r0] = extract64(regs[r1], pos, len);
-            break;
-        case INDEX_op_sextract:
-            tci_args_rrbb(insn, &r0, &r1, &pos, &len);
-            regs[r0] = sextract64(regs[r1], pos, len);
-            break;
-        case INDEX_op_brcond:
-            tci_args_rl(insn, tb_ptr, &r0, &ptr);
-            if (regs[r0]) {
-                tb_ptr = ptr;
-            }
-            break;
-        case INDEX_op_bswap16:
-            tci_args_rr(insn, &r0, &r1);
-            regs[r0] = bswap16(regs[r1]);
-            break;
-        case INDEX_op_bswap32:
-            tci_args_rr(insn, &r0, &r1);
-            regs[r0] = bswap32(regs[r1]);
-            break;
-
-            /* Load/store operations (64 bit). */
-
-        case INDEX_op_ld32u:
-            tci_args_rrs(insn, &r0, &r1, &ofs);
-            ptr = (void *)(regs[r1] + ofs);
-            regs[r0] = *(uint32_t *)ptr;
-            break;
-        case INDEX_op_ld32s:
-            tci_args_rrs(insn, &r0, &r1, &ofs);
-            ptr = (void *)(regs[r1] + ofs);
-            regs[r0] = *(int32_t *)ptr;
-            break;
-        case INDEX_op_st32:
-            tci_args_rrs(insn, &r0, &r1, &ofs);
-            ptr = (void *)(regs[r1] + ofs);
-            *(uint32_t *)ptr = regs[r0];
-            break;
-
-            /* Arithmetic operations (64 bit). */
+        }
+        TCI_NEXT();
+    TCI_CASE(muls2):
+        tci_args_rrrr(insn, &r0, &r1, &r2, &r3);
+        muls64(&regs[r0], &regs[r1], regs[r2], regs[r3]);
+        TCI_NEXT();
+    TCI_CASE(mulu2):
+        tci_args_rrrr(insn, &r0, &r1, &r2, &r3);
+        mulu64(&regs[r0], &regs[r1], regs[r2], regs[r3]);
+        TCI_NEXT();
 
-        case INDEX_op_divs:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = (int64_t)regs[r1] / (int64_t)regs[r2];
-            break;
-        case INDEX_op_divu:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = (uint64_t)regs[r1] / (uint64_t)regs[r2];
-            break;
-        case INDEX_op_rems:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = (int64_t)regs[r1] % (int64_t)regs[r2];
-            break;
-        case INDEX_op_remu:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = (uint64_t)regs[r1] % (uint64_t)regs[r2];
-            break;
-        case INDEX_op_clz:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = regs[r1] ? clz64(regs[r1]) : regs[r2];
-            break;
-        case INDEX_op_ctz:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = regs[r1] ? ctz64(regs[r1]) : regs[r2];
-            break;
+        /* Arithmetic operations (32 bit). */
 
-            /* Shift/rotate operations (64 bit). */
+    TCI_CASE(tci_divs32):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = (int32_t)regs[r1] / (int32_t)regs[r2];
+        TCI_NEXT();
+    TCI_CASE(tci_divu32):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = (uint32_t)regs[r1] / (uint32_t)regs[r2];
+        TCI_NEXT();
+    TCI_CASE(tci_rems32):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = (int32_t)regs[r1] % (int32_t)regs[r2];
+        TCI_NEXT();
+    TCI_CASE(tci_remu32):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = (uint32_t)regs[r1] % (uint32_t)regs[r2];
+        TCI_NEXT();
+    TCI_CASE(tci_clz32):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        tmp32 = regs[r1];
+        regs[r0] = tmp32 ? clz32(tmp32) : regs[r2];
+        TCI_NEXT();
+    TCI_CASE(tci_ctz32):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        tmp32 = regs[r1];
+        regs[r0] = tmp32 ? ctz32(tmp32) : regs[r2];
+        TCI_NEXT();
+    TCI_CASE(tci_setcond32):
+        tci_args_rrrc(insn, &r0, &r1, &r2, &condition);
+        regs[r0] = tci_compare32(regs[r1], regs[r2], condition);
+        TCI_NEXT();
+    TCI_CASE(tci_movcond32):
+        tci_args_rrrrrc(insn, &r0, &r1, &r2, &r3, &r4, &condition);
+        tmp32 = tci_compare32(regs[r1], regs[r2], condition);
+        regs[r0] = regs[tmp32 ? r3 : r4];
+        TCI_NEXT();
+
+        /* Shift/rotate operations. */
+
+    TCI_CASE(shl):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] << (regs[r2] % TCG_TARGET_REG_BITS);
+        TCI_NEXT();
+    TCI_CASE(shr):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] >> (regs[r2] % TCG_TARGET_REG_BITS);
+        TCI_NEXT();
+    TCI_CASE(sar):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = ((tcg_target_long)regs[r1]
+                    >> (regs[r2] % TCG_TARGET_REG_BITS));
+        TCI_NEXT();
+    TCI_CASE(tci_rotl32):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = rol32(regs[r1], regs[r2] & 31);
+        TCI_NEXT();
+    TCI_CASE(tci_rotr32):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = ror32(regs[r1], regs[r2] & 31);
+        TCI_NEXT();
+    TCI_CASE(deposit):
+        tci_args_rrrbb(insn, &r0, &r1, &r2, &pos, &len);
+        regs[r0] = deposit64(regs[r1], pos, len, regs[r2]);
+        TCI_NEXT();
+    TCI_CASE(extract):
+        tci_args_rrbb(insn, &r0, &r1, &pos, &len);
+        regs[r0] = extract64(regs[r1], pos, len);
+        TCI_NEXT();
+    TCI_CASE(sextract):
+        tci_args_rrbb(insn, &r0, &r1, &pos, &len);
+        regs[r0] = sextract64(regs[r1], pos, len);
+        TCI_NEXT();
+    TCI_CASE(tci_brcond):
+        tci_args_rrc(insn, &r0, &r1, &condition);
+        if (tci_compare64(regs[r0], regs[r1], condition)) {
+            tb_ptr = tci_branch_target(tb_ptr);
+        } else {
+            tb_ptr++;
+        }
+        TCI_NEXT();
+    TCI_CASE(tci_brcond32):
+        tci_args_rrc(insn, &r0, &r1, &condition);
+        if (tci_compare32(regs[r0], regs[r1], condition)) {
+            tb_ptr = tci_branch_target(tb_ptr);
+        } else {
+            tb_ptr++;
+        }
+        TCI_NEXT();
+    TCI_CASE(bswap16):
+        tci_args_rr(insn, &r0, &r1);
+        regs[r0] = bswap16(regs[r1]);
+        TCI_NEXT();
+    TCI_CASE(bswap32):
+        tci_args_rr(insn, &r0, &r1);
+        regs[r0] = bswap32(regs[r1]);
+        TCI_NEXT();
+
+        /* Load/store operations (64 bit). */
+
+    TCI_CASE(ld32u):
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        ptr = (void *)(regs[r1] + ofs);
+        regs[r0] = *(uint32_t *)ptr;
+        TCI_NEXT();
+    TCI_CASE(ld32s):
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        ptr = (void *)(regs[r1] + ofs);
+        regs[r0] = *(int32_t *)ptr;
+        TCI_NEXT();
+    TCI_CASE(st32):
+        tci_args_rrs(insn, &r0, &r1, &ofs);
+        ptr = (void *)(regs[r1] + ofs);
+        *(uint32_t *)ptr = regs[r0];
+        TCI_NEXT();
+
+        /* Arithmetic operations (64 bit). */
+
+    TCI_CASE(divs):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = (int64_t)regs[r1] / (int64_t)regs[r2];
+        TCI_NEXT();
+    TCI_CASE(divu):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = (uint64_t)regs[r1] / (uint64_t)regs[r2];
+        TCI_NEXT();
+    TCI_CASE(rems):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = (int64_t)regs[r1] % (int64_t)regs[r2];
+        TCI_NEXT();
+    TCI_CASE(remu):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = (uint64_t)regs[r1] % (uint64_t)regs[r2];
+        TCI_NEXT();
+    TCI_CASE(clz):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] ? clz64(regs[r1]) : regs[r2];
+        TCI_NEXT();
+    TCI_CASE(ctz):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = regs[r1] ? ctz64(regs[r1]) : regs[r2];
+        TCI_NEXT();
 
-        case INDEX_op_rotl:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = rol64(regs[r1], regs[r2] & 63);
-            break;
-        case INDEX_op_rotr:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            regs[r0] = ror64(regs[r1], regs[r2] & 63);
-            break;
-        case INDEX_op_ext_i32_i64:
-            tci_args_rr(insn, &r0, &r1);
-            regs[r0] = (int32_t)regs[r1];
-            break;
-        case INDEX_op_extu_i32_i64:
-            tci_args_rr(insn, &r0, &r1);
-            regs[r0] = (uint32_t)regs[r1];
-            break;
-        case INDEX_op_bswap64:
-            tci_args_rr(insn, &r0, &r1);
-            regs[r0] = bswap64(regs[r1]);
-            break;
+        /* Shift/rotate operations (64 bit). */
 
-            /* QEMU specific operations. */
+    TCI_CASE(rotl):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = rol64(regs[r1], regs[r2] & 63);
+        TCI_NEXT();
+    TCI_CASE(rotr):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        regs[r0] = ror64(regs[r1], regs[r2] & 63);
+        TCI_NEXT();
+    TCI_CASE(ext_i32_i64):
+        tci_args_rr(insn, &r0, &r1);
+        regs[r0] = (int32_t)regs[r1];
+        TCI_NEXT();
+    TCI_CASE(extu_i32_i64):
+        tci_args_rr(insn, &r0, &r1);
+        regs[r0] = (uint32_t)regs[r1];
+        TCI_NEXT();
+    TCI_CASE(bswap64):
+        tci_args_rr(insn, &r0, &r1);
+        regs[r0] = bswap64(regs[r1]);
+        TCI_NEXT();
 
-        case INDEX_op_exit_tb:
-            tci_args_l(insn, tb_ptr, &ptr);
-            return (uintptr_t)ptr;
+        /* QEMU specific operations. */
 
-        case INDEX_op_goto_tb:
-            tci_args_l(insn, tb_ptr, &ptr);
-            tb_ptr = *(void **)ptr;
-            break;
+    TCI_CASE(exit_tb):
+        tci_args_l(insn, tb_ptr, &ptr);
+        return (uintptr_t)ptr;
 
-        case INDEX_op_goto_ptr:
-            tci_args_r(insn, &r0);
-            ptr = (void *)regs[r0];
-            if (!ptr) {
-                return 0;
-            }
-            tb_ptr = ptr;
-            break;
+    TCI_CASE(goto_tb):
+        tci_args_l(insn, tb_ptr, &ptr);
+        tb_ptr = *(void **)ptr;
+        TCI_NEXT();
 
-        case INDEX_op_qemu_ld:
-            tci_args_rrm(insn, &r0, &r1, &oi);
-            taddr = regs[r1];
-            regs[r0] = tci_qemu_ld(env, taddr, oi, tb_ptr);
-            break;
-        case INDEX_op_tci_qemu_ld_rrr:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            taddr = regs[r1];
-            oi = regs[r2];
-            regs[r0] = tci_qemu_ld(env, taddr, oi, tb_ptr);
-            break;
+    TCI_CASE(goto_ptr):
+        tci_args_r(insn, &r0);
+        ptr = (void *)regs[r0];
+        if (!ptr) {
+            return 0;
+        }
+        tb_ptr = ptr;
+        TCI_NEXT();
 
-        case INDEX_op_qemu_st:
-            tci_args_rrm(insn, &r0, &r1, &oi);
-            taddr = regs[r1];
-            tci_qemu_st(env, taddr, regs[r0], oi, tb_ptr);
-            break;
-        case INDEX_op_tci_qemu_st_rrr:
-            tci_args_rrr(insn, &r0, &r1, &r2);
-            taddr = regs[r1];
-            oi = regs[r2];
-            tci_qemu_st(env, taddr, regs[r0], oi, tb_ptr);
-            break;
+    TCI_CASE(qemu_ld):
+        tci_args_rrm(insn, &r0, &r1, &oi);
+        taddr = regs[r1];
+        regs[r0] = tci_qemu_ld(env, taddr, oi, tb_ptr);
+        TCI_NEXT();
+    TCI_CASE(tci_qemu_ld_rrr):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        taddr = regs[r1];
+        oi = regs[r2];
+        regs[r0] = tci_qemu_ld(env, taddr, oi, tb_ptr);
+        TCI_NEXT();
 
-        case INDEX_op_mb:
-            /* Ensure ordering for all kinds */
-            smp_mb();
-            break;
-        default:
-            g_assert_not_reached();
-        }
-    }
+    TCI_CASE(qemu_st):
+        tci_args_rrm(insn, &r0, &r1, &oi);
+        taddr = regs[r1];
+        tci_qemu_st(env, taddr, regs[r0], oi, tb_ptr);
+        TCI_NEXT();
+    TCI_CASE(tci_qemu_st_rrr):
+        tci_args_rrr(insn, &r0, &r1, &r2);
+        taddr = regs[r1];
+        oi = regs[r2];
+        tci_qemu_st(env, taddr, regs[r0], oi, tb_ptr);
+        TCI_NEXT();
+
+    TCI_CASE(mb):
+        /* Ensure ordering for all kinds */
+        smp_mb();
+        TCI_NEXT();
+    TCI_CASE(illegal):
+        g_assert_not_reached();
 }
 
 /*
@@ -866,11 +1027,14 @@ int print_insn_tci(bfd_vma addr, disassemble_info *info)
         info->fprintf_func(info->stream, "%-12s  %d, %p", op_name, len, ptr);
         break;
 
-    case INDEX_op_brcond:
-        tci_args_rl(insn, tb_ptr, &r0, &ptr);
-        info->fprintf_func(info->stream, "%-12s  %s, 0, ne, %p",
-                           op_name, str_r(r0), ptr);
-        break;
+    case INDEX_op_tci_brcond:
+    case INDEX_op_tci_brcond32:
+        tci_args_rrc(insn, &r0, &r1, &c);
+        info->fprintf_func(info->stream, "%-12s  %s, %s, %s, %p",
+                           op_name, str_r(r0), str_r(r1), str_c(c),
+                           tci_branch_target(tb_ptr));
+        /* skip the displacement word */
+        return sizeof(insn) * 2;
 
     case INDEX_op_setcond:
     case INDEX_op_tci_setcond32:
@@ -0,0 +1,111 @@
+/*
+ * XBZRLE encoder and decoder speed benchmark
+ *
+ * Copyright (c) 2026 the Oro Operating System Project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "../migration/xbzrle.h"
+
+#define PAGE_SIZE   4096
+#define NR_PAGES    256
+
+/* percentage of bytes that differ between the old and new pages */
+static const int densities[] = { 0, 1, 10, 50 };
+
+static void fill_pages(uint8_t *old, uint8_t *new, int density)
+{
+    for (size_t i = 0; i < PAGE_SIZE * NR_PAGES; i++) {
+        old[i] = new[i] = g_test_rand_int();
+        if (g_test_rand_int_range(0, 100) < density) {
+            new[i] ^= g_test_rand_int_range(1, 256);
+        }
+    }
+}
+
+static void test_encode(const void *opaque)
+{
+    uint8_t *old = g_malloc(PAGE_SIZE * NR_PAGES);
+    uint8_t *new = g_malloc(PAGE_SIZE * NR_PAGES);
+    uint8_t *dst = g_malloc(PAGE_SIZE);
+    int accel_index = 0;
+
+    do {
+        if (accel_index != 0) {
+            g_test_message("%s", "");  /* gnu_printf Werror for simple "" */
+        }
+        for (size_t d = 0; d < ARRAY_SIZE(densities); d++) {
+            double total = 0.0;
+
+            fill_pages(old, new, densities[d]);
+            g_test_timer_start();
+            do {
+                for (size_t i = 0; i < NR_PAGES; i++) {
+                    xbzrle_encode_buffer(old + i * PAGE_SIZE,
+                                         new + i * PAGE_SIZE, PAGE_SIZE,
+                                         dst, PAGE_SIZE);
+                }
+                total += PAGE_SIZE * NR_PAGES;
+            } while (g_test_timer_elapsed() < 0.5);
+
+            total /= MiB;
+            g_test_message("xbzrle_encode_buffer #%d: %2d%% dirty %8.0f MB/sec",
+                           accel_index, densities[d],
+                           total / g_test_timer_last());
+        }
+        accel_index++;
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(old);
+    g_free(new);
+    g_free(dst);
+}
+
+static void test_decode(const void *opaque)
+{
+    uint8_t *old = g_malloc(PAGE_SIZE * NR_PAGES);
+    uint8_t *new = g_malloc(PAGE_SIZE * NR_PAGES);
+    uint8_t *enc = g_malloc(PAGE_SIZE * NR_PAGES);
+    int enc_len[NR_PAGES];
+
+    for (size_t d = 0; d < ARRAY_SIZE(densities); d++) {
+        double total = 0.0;
+
+        fill_pages(old, new, densities[d]);
+        for (size_t i = 0; i < NR_PAGES; i++) {
+            enc_len[i] = xbzrle_encode_buffer(old + i * PAGE_SIZE,
+                                              new + i * PAGE_SIZE, PAGE_SIZE,
+                                              enc + i * PAGE_SIZE, PAGE_SIZE);
+        }
+
+        g_test_timer_start();
+        do {
+            for (size_t i = 0; i < NR_PAGES; i++) {
+                /* pages that did not compress are sent as is */
+                if (enc_len[i] > 0) {
+                    xbzrle_decode_buffer(enc + i * PAGE_SIZE, enc_len[i],
+                                         old + i * PAGE_SIZE, PAGE_SIZE);
+                }
+            }
+            total += PAGE_SIZE * NR_PAGES;
+        } while (g_test_timer_elapsed() < 0.5);
+
+        total /= MiB;
+        g_test_message("xbzrle_decode_buffer: %2d%% dirty %8.0f MB/sec",
+                       densities[d], total / g_test_timer_last());
+    }
+
+    g_free(old);
+    g_free(new);
+    g_free(enc);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/migration/xbzrle/decode/speed", NULL, test_decode);
+    g_test_add_data_func("/migration/xbzrle/encode/speed", NULL, test_encode);
+    return g_test_run();
+}
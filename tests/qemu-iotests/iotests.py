@@ -1265,6 +1265,27 @@ def check_equal_or_none(a, b):
         self.fail("Cannot find %s %s in result:\n%s" %
                   (node_name, file_name, result))
 
+    def get_blockstats(self, node_name, path='driver-specific'):
+        '''Return the value at the given path in the query-blockstats
+           entry of a node'''
+        result = self.vm.qmp('query-blockstats', query_nodes=True)
+        for entry in result['return']:
+            if entry.get('node-name') == node_name:
+                return self.dictpath(entry, path)
+        self.fail(f'node {node_name} not found in query-blockstats')
+
+    def assert_blockstats(self, node_name, before, path='driver-specific',
+                          **deltas):
+        '''Assert by how much the counters at the given path in the
+           query-blockstats entry of a node changed since @before, with
+           underscores in the counter names standing for dashes.  Returns
+           the new values.'''
+        after = self.get_blockstats(node_name, path)
+        for key, delta in deltas.items():
+            key = key.replace('_', '-')
+            self.assertEqual(after[key] - before[key], delta, key)
+        return after
+
     def assert_json_filename_equal(self, json_filename, reference):
         '''Asserts that the given filename is a json: filename and that its
            content is equal to the given reference object'''
@@ -51,6 +51,24 @@ static void test_multifd_postcopy_tcp_zstd(char *name, MigrateCommon *args)
 
     test_precopy_common(args);
 }
+
+static void *
+migrate_hook_start_precopy_tcp_multifd_adaptive(QTestState *from,
+                                                QTestState *to)
+{
+    return migrate_hook_start_precopy_tcp_multifd_common(from, to,
+                                                         "adaptive");
+}
+
+static void test_multifd_tcp_adaptive(char *name, MigrateCommon *args)
+{
+    args->listen_uri = "defer";
+    args->start_hook = migrate_hook_start_precopy_tcp_multifd_adaptive;
+
+    args->start.caps[MIGRATION_CAPABILITY_MULTIFD] = true;
+
+    test_precopy_common(args);
+}
 #endif /* CONFIG_ZSTD */
 
 #ifdef CONFIG_QATZIP
@@ -183,6 +201,8 @@ void migration_test_add_compression(MigrationTestEnv *env)
 #ifdef CONFIG_ZSTD
     migration_test_add("/migration/multifd/tcp/plain/zstd",
                        test_multifd_tcp_zstd);
+    migration_test_add("/migration/multifd/tcp/plain/adaptive",
+                       test_multifd_tcp_adaptive);
     if (env->has_uffd) {
         migration_test_add("/migration/multifd+postcopy/tcp/plain/zstd",
                            test_multifd_postcopy_tcp_zstd);
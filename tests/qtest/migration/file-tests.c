@@ -154,6 +154,118 @@ static void test_multifd_file_mapped_ram(char *name, MigrateCommon *args)
     test_file_common(args, true);
 }
 
+static void *migrate_hook_start_mapped_ram_page_store(QTestState *from,
+                                                     QTestState *to)
+{
+    g_autofree char *pool = g_strdup_printf("%s/pagestore", tmpfs);
+
+    migrate_set_parameter_str(from, "mapped-ram-page-store", pool);
+    migrate_set_parameter_str(to, "mapped-ram-page-store", pool);
+
+    return NULL;
+}
+
+static void migrate_hook_end_mapped_ram_page_store(QTestState *from,
+                                                   QTestState *to,
+                                                   void *opaque)
+{
+    g_autofree char *pool = g_strdup_printf("%s/pagestore", tmpfs);
+    g_autofree char *hashes = g_strdup_printf("%s/pagestore.hashes", tmpfs);
+
+    unlink(pool);
+    unlink(hashes);
+}
+
+static void test_precopy_file_mapped_ram_page_store(char *name,
+                                                    MigrateCommon *args)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+
+    args->connect_uri = uri;
+    args->listen_uri = "defer";
+    args->start_hook = migrate_hook_start_mapped_ram_page_store;
+    args->end_hook = migrate_hook_end_mapped_ram_page_store;
+
+    args->start.caps[MIGRATION_CAPABILITY_MAPPED_RAM] = true;
+
+    test_file_common(args, true);
+}
+
+static void test_precopy_file_page_store_no_mapped_ram(char *name,
+                                                       MigrateCommon *args)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+
+    args->connect_uri = uri;
+    args->listen_uri = "defer";
+    args->start_hook = migrate_hook_start_mapped_ram_page_store;
+    args->end_hook = migrate_hook_end_mapped_ram_page_store;
+    args->result = MIG_TEST_QMP_ERROR;
+
+    test_file_common(args, false);
+}
+
+static void test_multifd_file_mapped_ram_page_store(char *name,
+                                                    MigrateCommon *args)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+
+    args->connect_uri = uri;
+    args->listen_uri = "defer";
+    args->start_hook = migrate_hook_start_mapped_ram_page_store;
+    args->end_hook = migrate_hook_end_mapped_ram_page_store;
+
+    args->start.caps[MIGRATION_CAPABILITY_MULTIFD] = true;
+    args->start.caps[MIGRATION_CAPABILITY_MAPPED_RAM] = true;
+
+    test_file_common(args, true);
+}
+
+#ifdef __linux__
+static void *migrate_hook_start_mapped_ram_lazy_load(QTestState *from,
+                                                     QTestState *to)
+{
+    /* only the destination cares */
+    migrate_set_capability(to, "mapped-ram-lazy-load", true);
+
+    return NULL;
+}
+
+static void test_precopy_file_mapped_ram_lazy_load(char *name,
+                                                   MigrateCommon *args)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+
+    args->connect_uri = uri;
+    args->listen_uri = "defer";
+    args->start_hook = migrate_hook_start_mapped_ram_lazy_load;
+
+    args->start.caps[MIGRATION_CAPABILITY_MAPPED_RAM] = true;
+
+    test_file_common(args, true);
+}
+
+static void test_multifd_file_mapped_ram_lazy_load(char *name,
+                                                   MigrateCommon *args)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+
+    args->connect_uri = uri;
+    args->listen_uri = "defer";
+    args->start_hook = migrate_hook_start_mapped_ram_lazy_load;
+
+    args->start.caps[MIGRATION_CAPABILITY_MULTIFD] = true;
+    args->start.caps[MIGRATION_CAPABILITY_MAPPED_RAM] = true;
+
+    test_file_common(args, true);
+}
+#endif /* __linux__ */
+
 static void *migrate_hook_start_multifd_mapped_ram_dio(QTestState *from,
                                                        QTestState *to)
 {
@@ -272,6 +384,24 @@ static void test_multifd_file_mapped_ram_fdset_dio(char *name,
 }
 #endif /* !_WIN32 */
 
+/*
+ * The source RAM is a memfd that the target maps copy-on-write, so only
+ * the device state goes through the file.
+ */
+static void test_precopy_file_memfd_fork(char *name, MigrateCommon *args)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+
+    args->connect_uri = uri;
+    args->listen_uri = "defer";
+
+    args->start.mem_type = MEM_TYPE_MEMFD_FORK;
+    args->start.caps[MIGRATION_CAPABILITY_X_IGNORE_SHARED] = true;
+
+    test_file_common(args, true);
+}
+
 static void migration_test_add_file_smoke(MigrationTestEnv *env)
 {
     migration_test_add("/migration/precopy/file",
@@ -313,11 +443,21 @@ void migration_test_add_file(MigrationTestEnv *env)
 #endif
     migration_test_add("/migration/precopy/file/offset/bad",
                        test_precopy_file_offset_bad);
+    migration_test_add("/migration/precopy/file/memfd-fork",
+                       test_precopy_file_memfd_fork);
 
     migration_test_add("/migration/precopy/file/mapped-ram",
                        test_precopy_file_mapped_ram);
     migration_test_add("/migration/precopy/file/mapped-ram/live",
                        test_precopy_file_mapped_ram_live);
+    migration_test_add("/migration/precopy/file/mapped-ram/page-store",
+                       test_precopy_file_mapped_ram_page_store);
+    migration_test_add("/migration/precopy/file/page-store/no-mapped-ram",
+                       test_precopy_file_page_store_no_mapped_ram);
+#ifdef __linux__
+    migration_test_add("/migration/precopy/file/mapped-ram/lazy-load",
+                       test_precopy_file_mapped_ram_lazy_load);
+#endif
 
     migration_test_add("/migration/multifd/file/mapped-ram",
                        test_multifd_file_mapped_ram);
@@ -325,6 +465,12 @@ void migration_test_add_file(MigrationTestEnv *env)
                        test_precopy_file_mapped_ram_ignore_shared);
     migration_test_add("/migration/multifd/file/mapped-ram/live",
                        test_multifd_file_mapped_ram_live);
+    migration_test_add("/migration/multifd/file/mapped-ram/page-store",
+                       test_multifd_file_mapped_ram_page_store);
+#ifdef __linux__
+    migration_test_add("/migration/multifd/file/mapped-ram/lazy-load",
+                       test_multifd_file_mapped_ram_lazy_load);
+#endif
 
 #ifndef _WIN32
     migration_test_add("/migration/multifd/file/mapped-ram/fdset",
@@ -22,6 +22,7 @@
 #include "qobject/qjson.h"
 #include "qobject/qlist.h"
 #include "qemu/bswap.h"
+#include "qemu/memfd.h"
 #include "qemu/module.h"
 #include "qemu/option.h"
 #include "qemu/range.h"
@@ -263,8 +264,12 @@ static char *test_shmem_path(void)
 
 #define  MIG_MEM_ID  "mig.mem"
 
+/* memfd inherited by both QEMUs for MEM_TYPE_MEMFD_FORK */
+static int mem_fork_fd = -1;
+
 /* NOTE: caller is responsbile to free the string if returned */
-static char *migrate_mem_type_get_opts(MemType type, const char *memory_size)
+static char *migrate_mem_type_get_opts(MemType type, const char *memory_size,
+                                       bool target)
 {
     g_autofree char *shmem_path = NULL;
     g_autofree char *backend = NULL;
@@ -284,6 +289,11 @@ static char *migrate_mem_type_get_opts(MemType type, const char *memory_size)
     case MEM_TYPE_MEMFD:
         backend = g_strdup("-object memory-backend-memfd");
         break;
+    case MEM_TYPE_MEMFD_FORK:
+        backend = g_strdup_printf("-object memory-backend-memfd,fd=%d",
+                                  mem_fork_fd);
+        share = !target;
+        break;
     default:
         g_assert_not_reached();
         break;
@@ -304,6 +314,7 @@ int migrate_args(char **from, char **to, const char *uri, MigrateStart *args)
     gchar *cmd_target = NULL;
     const gchar *ignore_stderr;
     g_autofree char *mem_object = NULL;
+    g_autofree char *mem_object_target = NULL;
     const char *kvm_opts = NULL;
     const char *arch = qtest_get_arch();
     const char *memory_size;
@@ -311,6 +322,7 @@ int migrate_args(char **from, char **to, const char *uri, MigrateStart *args)
     g_autofree char *machine = NULL;
     const char *bootpath = bootfile_get();
     g_autofree char *memory_backend = NULL;
+    g_autofree char *memory_backend_target = NULL;
     const char *events;
 
     if (strcmp(arch, "i386") == 0 || strcmp(arch, "x86_64") == 0) {
@@ -367,9 +379,14 @@ int migrate_args(char **from, char **to, const char *uri, MigrateStart *args)
         ignore_stderr = "";
     }
 
-    mem_object = migrate_mem_type_get_opts(args->mem_type, memory_size);
+    mem_object = migrate_mem_type_get_opts(args->mem_type, memory_size,
+                                           false);
     memory_backend = g_strdup_printf("-machine memory-backend=%s %s",
                                      MIG_MEM_ID, mem_object);
+    mem_object_target = migrate_mem_type_get_opts(args->mem_type,
+                                                  memory_size, true);
+    memory_backend_target = g_strdup_printf("-machine memory-backend=%s %s",
+                                            MIG_MEM_ID, mem_object_target);
 
     if (args->use_dirty_ring) {
         kvm_opts = ",dirty-ring-size=4096";
@@ -415,7 +432,7 @@ int migrate_args(char **from, char **to, const char *uri, MigrateStart *args)
                                  "%s %s %s %s",
                                  kvm_opts ? kvm_opts : "",
                                  machine, machine_opts,
-                                 memory_backend, tmpfs, uri,
+                                 memory_backend_target, tmpfs, uri,
                                  events,
                                  arch_opts ? arch_opts : "",
                                  args->opts_target ? args->opts_target : "",
@@ -435,6 +452,18 @@ static bool migrate_mem_type_prepare(MemType type)
             return false;
         }
         break;
+    case MEM_TYPE_MEMFD_FORK:
+#ifdef CONFIG_LINUX
+        /* both QEMUs inherit it, QEMU sizes it */
+        mem_fork_fd = qemu_memfd_create("migration-test", 0, false, 0, 0,
+                                        NULL);
+        if (mem_fork_fd >= 0) {
+            qemu_clear_cloexec(mem_fork_fd);
+            break;
+        }
+#endif
+        g_test_skip("memfd is not supported");
+        return false;
     default:
         break;
     }
@@ -457,6 +486,11 @@ static void migrate_mem_type_cleanup(MemType type)
         shmem_path = test_shmem_path();
         unlink(shmem_path);
         break;
+    case MEM_TYPE_MEMFD_FORK:
+        /* QEMU has its own reference now */
+        close(mem_fork_fd);
+        mem_fork_fd = -1;
+        break;
     default:
         break;
     }
@@ -34,6 +34,11 @@ typedef enum {
      * but only anonymously allocated.
      */
     MEM_TYPE_MEMFD,
+    /*
+     * Use a memfd created by the test: shared mappings on the source,
+     * private (copy-on-write) mappings on the target.
+     */
+    MEM_TYPE_MEMFD_FORK,
     MEM_TYPE_NUM,
 } MemType;
 
@@ -95,6 +95,103 @@ static void test_precopy_unix_dirty_ring(char *name, MigrateCommon *args)
     test_precopy_common(args);
 }
 
+static void *migrate_hook_start_dirty_sync_threads(QTestState *from,
+                                                   QTestState *to)
+{
+    migrate_set_parameter_int(from, "dirty-sync-threads", 4);
+    return NULL;
+}
+
+static void test_precopy_unix_dirty_sync_threads(char *name,
+                                                 MigrateCommon *args)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+
+    args->listen_uri = uri;
+    args->connect_uri = uri;
+    /* the guest keeps dirtying memory, so that every sync finds pages */
+    args->live = true;
+    args->start_hook = migrate_hook_start_dirty_sync_threads;
+
+    test_precopy_common(args);
+}
+
+static void migrate_hook_end_predictive_switchover(QTestState *from,
+                                                   QTestState *to,
+                                                   void *opaque)
+{
+    QDict *rsp = migrate_query_not_failed(from);
+
+    /* the guest dirties memory all along, so the model had samples */
+    g_assert(qdict_haskey(rsp, "predicted-downtime"));
+    qobject_unref(rsp);
+}
+
+static void test_precopy_unix_predictive_switchover(char *name,
+                                                    MigrateCommon *args)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+
+    args->listen_uri = uri;
+    args->connect_uri = uri;
+    args->live = true;
+    args->start.caps[MIGRATION_CAPABILITY_PREDICTIVE_SWITCHOVER] = true;
+    args->end_hook = migrate_hook_end_predictive_switchover;
+
+    test_precopy_common(args);
+}
+
+/*
+ * The guest rewrites every page of its test memory all the time, so
+ * once the pages were resent a couple of times they must be held back.
+ * A 1ms downtime limit keeps the migration from converging meanwhile,
+ * and a high bandwidth makes the passes short enough for the pages to
+ * be found dirty again right after they were sent.
+ */
+static void test_precopy_unix_hot_page_deferral(char *name,
+                                                MigrateCommon *args)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    QTestState *from, *to;
+    int64_t deferred = 0;
+    int max_try_count = 60;
+
+    args->start.caps[MIGRATION_CAPABILITY_HOT_PAGE_DEFERRAL] = true;
+    if (migrate_start(&from, &to, uri, &args->start)) {
+        return;
+    }
+
+    migrate_ensure_non_converge(from);
+    migrate_set_parameter_int(from, "max-bandwidth", 1000 * 1000 * 1000);
+    migrate_prepare_for_dirty_mem(from);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate_qmp(from, to, uri, NULL, "{}");
+
+    while (--max_try_count) {
+        deferred = read_ram_property_int(from, "deferred-pages");
+        if (deferred) {
+            break;
+        }
+        g_assert_false(get_src()->stop_seen);
+        sleep(1);
+    }
+    g_assert_cmpint(deferred, >, 0);
+
+    /* Held back pages still go in the final round */
+    migrate_wait_for_dirty_mem(from, to);
+    migrate_ensure_converge(from);
+    wait_for_migration_complete(from);
+    wait_for_stop(from, get_src());
+
+    qtest_qmp_eventwait(to, "RESUME");
+    wait_for_serial("dest_serial");
+
+    migrate_end(from, to, true);
+}
+
 #ifdef CONFIG_RDMA
 
 #include <sys/resource.h>
@@ -1212,6 +1309,12 @@ void migration_test_add_precopy(MigrationTestEnv *env)
 
     migration_test_add("/migration/precopy/tcp/plain/switchover-ack",
                        test_precopy_tcp_switchover_ack);
+    migration_test_add("/migration/precopy/unix/dirty-sync-threads",
+                       test_precopy_unix_dirty_sync_threads);
+    migration_test_add("/migration/precopy/unix/predictive-switchover",
+                       test_precopy_unix_predictive_switchover);
+    migration_test_add("/migration/precopy/unix/hot-page-deferral",
+                       test_precopy_unix_hot_page_deferral);
 
 #ifndef _WIN32
     migration_test_add("/migration/precopy/fd/tcp",
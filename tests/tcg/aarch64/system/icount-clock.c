@@ -0,0 +1,84 @@
+/*
+ * Virtual clock determinism test for icount
+ *
+ * Prints the virtual counter after fixed amounts of work and the
+ * number of polls it takes for the virtual timer to fire.  Under
+ * icount both only depend on the instruction stream, so two runs
+ * must print exactly the same thing.
+ *
+ * Copyright (c) 2026 the Oro Operating System Project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <minilib.h>
+
+/* grabbed from Linux */
+#define __stringify_1(x...) #x
+#define __stringify(x...)   __stringify_1(x)
+
+#define read_sysreg(r) ({                                           \
+            uint64_t __val;                                         \
+            asm volatile("mrs %0, " __stringify(r) : "=r" (__val)); \
+            __val;                                                  \
+})
+
+#define write_sysreg(r, v) do {                     \
+        uint64_t __val = (uint64_t)(v);             \
+        asm volatile("msr " __stringify(r) ", %x0"  \
+                 : : "rZ" (__val));                 \
+} while (0)
+
+#define isb() asm volatile("isb" : : : "memory")
+
+#define CNTV_CTL_ENABLE  (1 << 0)
+#define CNTV_CTL_IMASK   (1 << 1)
+#define CNTV_CTL_ISTATUS (1 << 2)
+
+static void spin(unsigned long n)
+{
+    while (n--) {
+        asm volatile("" : : : "memory");
+    }
+}
+
+int main(void)
+{
+    uint64_t start, now;
+    unsigned long polls;
+    int i;
+
+    ml_printf("icount clock test\n");
+
+    start = read_sysreg(cntvct_el0);
+    for (i = 0; i < 8; i++) {
+        spin(1000ul << i);
+        isb();
+        now = read_sysreg(cntvct_el0);
+        ml_printf("spin %d: cntvct +%lu\n", i, now - start);
+    }
+
+    /*
+     * ISTATUS is only updated when the QEMU_CLOCK_VIRTUAL timer backing
+     * the counter fires, so the poll count shows exactly when the timer
+     * ran relative to the instruction stream.
+     */
+    for (i = 0; i < 8; i++) {
+        write_sysreg(cntv_ctl_el0, CNTV_CTL_ENABLE | CNTV_CTL_IMASK);
+        write_sysreg(cntv_tval_el0, 1000ul << i);
+        isb();
+
+        polls = 0;
+        while (!(read_sysreg(cntv_ctl_el0) & CNTV_CTL_ISTATUS)) {
+            polls++;
+        }
+        ml_printf("timer %d: fired after %lu polls\n", i, polls);
+
+        write_sysreg(cntv_ctl_el0, 0);
+        isb();
+    }
+
+    ml_printf("done\n");
+    return 0;
+}
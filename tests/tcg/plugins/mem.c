@@ -64,6 +64,14 @@ static bool do_inline, do_callback, do_print_accesses, do_region_summary;
 static bool do_haddr;
 static enum qemu_plugin_mem_rw rw = QEMU_PLUGIN_MEM_RW;
 
+/*
+ * With queue=true every access is also recorded through an event queue
+ * that never drops events, so its count must match the inline one.
+ */
+static bool do_queue;
+static struct qemu_plugin_event_queue *queue;
+static uint64_t queue_count;
+
 
 static GMutex lock;
 static GHashTable *regions;
@@ -81,6 +89,12 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
     g_autoptr(GString) out = g_string_new("");
 
+    if (do_queue) {
+        /* delivers the events that are still pending */
+        qemu_plugin_event_queue_free(queue);
+        g_assert(queue_count == qemu_plugin_u64_sum(mem_count));
+    }
+
     if (do_inline || do_callback) {
         g_string_printf(out, "mem accesses: %" PRIu64 "\n",
                         qemu_plugin_u64_sum(mem_count));
@@ -254,6 +268,14 @@ static void vcpu_mem(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
     }
 }
 
+/* only ever called from the consumer thread of the queue */
+static void vcpu_mem_batch(unsigned int cpu_index,
+                           const struct qemu_plugin_mem_event *events,
+                           size_t n_events, void *udata)
+{
+    queue_count += n_events;
+}
+
 static void print_access(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
                          uint64_t vaddr, void *udata)
 {
@@ -306,6 +328,9 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
                 QEMU_PLUGIN_INLINE_ADD_U64,
                 mem_count, 1);
         }
+        if (do_queue) {
+            qemu_plugin_register_vcpu_mem_batch_cb(insn, queue, rw, NULL);
+        }
         if (do_callback || do_region_summary) {
             qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem,
                                              QEMU_PLUGIN_CB_NO_REGS,
@@ -359,6 +384,11 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
                 fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
                 return -1;
             }
+        } else if (g_strcmp0(tokens[0], "queue") == 0) {
+            if (!qemu_plugin_bool_parse(tokens[0], tokens[1], &do_queue)) {
+                fprintf(stderr, "boolean argument parsing failed: %s\n", opt);
+                return -1;
+            }
         } else if (g_strcmp0(tokens[0], "print-accesses") == 0) {
             if (!qemu_plugin_bool_parse(tokens[0], tokens[1],
                                         &do_print_accesses)) {
@@ -383,6 +413,11 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
         return -1;
     }
 
+    if (do_queue && !do_inline) {
+        fprintf(stderr, "queue counting is checked against inline counting\n");
+        return -1;
+    }
+
     if (do_print_accesses) {
         g_autoptr(GString) out = g_string_new("");
         g_string_printf(out,
@@ -400,6 +435,11 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
     mem_count = qemu_plugin_scoreboard_u64_in_struct(
         counts, CPUCount, mem_count);
     io_count = qemu_plugin_scoreboard_u64_in_struct(counts, CPUCount, io_count);
+    if (do_queue) {
+        /* a small ring makes the vCPUs wait for the consumer now and then */
+        queue = qemu_plugin_event_queue_new(256, 64, QEMU_PLUGIN_BATCH_BLOCK,
+                                            1, vcpu_mem_batch, NULL);
+    }
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
     return 0;
@@ -0,0 +1,110 @@
+/*
+ * Self-modifying code in pages that mix code and data
+ *
+ * Writes to the lines of a code page that hold no code must leave the
+ * translated code alone.  Writes to lines that hold code must be seen
+ * by the next execution, including writes to the second line (or page)
+ * of a block that spans two, and so must code that is rewritten in
+ * place with other instructions at the same address.
+ *
+ * Copyright (c) 2026 the Oro Operating System Project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <stdint.h>
+#include <minilib.h>
+
+#define PAGE_SIZE 4096
+#define LINE_SIZE 64
+
+/* identity mapped, writable and executable */
+static uint8_t code[2 * PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+static int failures;
+
+typedef int (*code_fn)(void);
+
+static int run(int offset)
+{
+    return ((code_fn)&code[offset])();
+}
+
+static void check(const char *what, int offset, int expected)
+{
+    int value = run(offset);
+
+    if (value != expected) {
+        ml_printf("FAIL: %s: got %d, expected %d\n", what, value, expected);
+        failures++;
+    }
+}
+
+static void set_imm32(int offset, uint32_t imm)
+{
+    code[offset] = imm;
+    code[offset + 1] = imm >> 8;
+    code[offset + 2] = imm >> 16;
+    code[offset + 3] = imm >> 24;
+}
+
+/* nops, then mov $imm, %eax; ret.  Returns the offset of the imm32. */
+static int emit_mov_ret(int offset, int nops, uint32_t imm)
+{
+    while (nops--) {
+        code[offset++] = 0x90;
+    }
+    code[offset] = 0xb8;
+    set_imm32(offset + 1, imm);
+    code[offset + 5] = 0xc3;
+    return offset + 1;
+}
+
+int main(void)
+{
+    int imm, i;
+
+    ml_printf("SMC within mixed code and data pages\n");
+
+    /* data lines of a code page */
+    imm = emit_mov_ret(0, 0, 1);
+    check("initial code", 0, 1);
+    for (i = 0; i < 4096; i++) {
+        code[PAGE_SIZE / 2 + i % (PAGE_SIZE / 2)] = i;
+        if (i % 256 == 0) {
+            check("after a data write", 0, 1);
+        }
+    }
+
+    /* the same instruction with another immediate */
+    for (i = 2; i < 32; i++) {
+        set_imm32(imm, i);
+        check("rewritten immediate", 0, i);
+    }
+
+    /* other instructions at the same address: xor %eax,%eax; add $7,%eax */
+    code[0] = 0x31;
+    code[1] = 0xc0;
+    code[2] = 0x83;
+    code[3] = 0xc0;
+    code[4] = 0x07;
+    code[5] = 0xc3;
+    check("rewritten instruction", 0, 7);
+    emit_mov_ret(0, 0, 5);
+    check("restored instruction", 0, 5);
+
+    /* a block from line 2 into line 3, patched in line 3 only */
+    imm = emit_mov_ret(3 * LINE_SIZE - 3, 3, 0x11);
+    check("block across lines", 3 * LINE_SIZE - 3, 0x11);
+    set_imm32(imm, 0x22);
+    check("second line of a block", 3 * LINE_SIZE - 3, 0x22);
+
+    /* a block across pages, patched on the second page only */
+    imm = emit_mov_ret(PAGE_SIZE - 3, 3, 0x33);
+    check("block across pages", PAGE_SIZE - 3, 0x33);
+    set_imm32(imm, 0x44);
+    check("second page of a block", PAGE_SIZE - 3, 0x44);
+
+    ml_printf("%s\n", failures ? "FAIL" : "PASS");
+    return failures;
+}
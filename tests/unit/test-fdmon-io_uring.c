@@ -0,0 +1,311 @@
+/*
+ * io_uring fixed buffer and fixed file tests
+ *
+ * Fixed slots are looked up by address or fd number, which are reused
+ * after unregistration.  These tests check that a ring never resolves a
+ * reused address or fd to what used to be registered under it, and that
+ * a ring lets go of a file as soon as it is unregistered.
+ *
+ * Copyright (c) 2026 the Oro Operating System Project.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/aio.h"
+#include "qapi/error.h"
+#include "qemu/main-loop.h"
+#include "qemu/memalign.h"
+
+static AioContext *ctx;
+
+typedef struct {
+    CqeHandler cqe_handler;
+    bool write;
+    int fd;
+    void *buf;
+    size_t len;
+    off_t offset;
+
+    /* filled in by prep_sqe() and cqe_handler_cb() */
+    int file_index;
+    int buf_index;
+    int ret;
+    bool done;
+} TestReq;
+
+static void prep_sqe(struct io_uring_sqe *sqe, void *opaque)
+{
+    TestReq *req = opaque;
+
+    req->file_index = aio_fixed_file_index(req->fd);
+    req->buf_index = aio_fixed_buf_index(req->buf, req->len);
+
+    if (req->write) {
+        io_uring_prep_write(sqe, req->fd, req->buf, req->len, req->offset);
+    } else if (req->buf_index >= 0) {
+        io_uring_prep_read_fixed(sqe, req->fd, req->buf, req->len,
+                                 req->offset, req->buf_index);
+    } else {
+        io_uring_prep_read(sqe, req->fd, req->buf, req->len, req->offset);
+    }
+
+    if (req->file_index >= 0) {
+        sqe->fd = req->file_index;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+}
+
+static void cqe_handler_cb(CqeHandler *cqe_handler)
+{
+    TestReq *req = container_of(cqe_handler, TestReq, cqe_handler);
+
+    req->ret = cqe_handler->cqe.res;
+    req->done = true;
+}
+
+static void submit(TestReq *req)
+{
+    req->cqe_handler.cb = cqe_handler_cb;
+    aio_add_sqe(prep_sqe, req, &req->cqe_handler);
+    while (!req->done) {
+        aio_poll(ctx, true);
+    }
+}
+
+static TestReq do_read(int fd, void *buf, size_t len)
+{
+    TestReq req = {
+        .fd = fd,
+        .buf = buf,
+        .len = len,
+    };
+
+    submit(&req);
+    return req;
+}
+
+/* Returns a file of @len bytes of @c, opened read-only */
+static int open_file(int c, size_t len)
+{
+    g_autofree char *path = NULL;
+    g_autofree char *data = g_malloc(len);
+    int fd;
+
+    memset(data, c, len);
+    fd = g_file_open_tmp("test-fdmon-io_uring-XXXXXX", &path, NULL);
+    g_assert(fd >= 0);
+    g_assert(qemu_write_full(fd, data, len) == len);
+    close(fd);
+
+    fd = open(path, O_RDONLY);
+    g_assert(fd >= 0);
+    unlink(path);
+    return fd;
+}
+
+static bool has_fixed_tables(void)
+{
+    char buf[16];
+    TestReq req;
+    int fd, slot;
+
+    if (!aio_has_io_uring()) {
+        g_test_skip("io_uring is not available");
+        return false;
+    }
+
+    fd = open_file(0, sizeof(buf));
+    slot = aio_register_fixed_file(fd);
+    aio_register_fixed_buf(buf, sizeof(buf));
+    req = do_read(fd, buf, sizeof(buf));
+    aio_unregister_fixed_buf(buf, sizeof(buf));
+    aio_unregister_fixed_file(slot);
+    close(fd);
+
+    if (req.file_index < 0 || req.buf_index < 0) {
+        g_test_skip("io_uring has no fixed buffer and file tables");
+        return false;
+    }
+    return true;
+}
+
+static void test_file_reuse(void)
+{
+    char buf[4096];
+    TestReq req;
+    int fd_a, fd_b, slot;
+
+    if (!has_fixed_tables()) {
+        return;
+    }
+
+    fd_a = open_file(0xaa, sizeof(buf));
+    slot = aio_register_fixed_file(fd_a);
+    g_assert_cmpint(slot, >=, 0);
+    req = do_read(fd_a, buf, sizeof(buf));
+    g_assert_cmpint(req.file_index, >=, 0);
+    g_assert_cmpint(req.ret, ==, sizeof(buf));
+    g_assert_cmpint(buf[0], ==, (char)0xaa);
+
+    aio_unregister_fixed_file(slot);
+    req = do_read(fd_a, buf, sizeof(buf));
+    g_assert_cmpint(req.file_index, ==, -1);
+    close(fd_a);
+
+    /* A new file under the same fd number must not hit the old slot */
+    fd_b = open_file(0xbb, sizeof(buf));
+    g_assert_cmpint(fd_b, ==, fd_a);
+    slot = aio_register_fixed_file(fd_b);
+    g_assert_cmpint(slot, >=, 0);
+    req = do_read(fd_b, buf, sizeof(buf));
+    g_assert_cmpint(req.file_index, >=, 0);
+    g_assert_cmpint(req.ret, ==, sizeof(buf));
+    g_assert_cmpint(buf[0], ==, (char)0xbb);
+
+    aio_unregister_fixed_file(slot);
+    close(fd_b);
+}
+
+static void test_file_drop(void)
+{
+    char c = 'x';
+    TestReq req = {
+        .write = true,
+        .buf = &c,
+        .len = 1,
+        .offset = -1,
+    };
+    int fds[2], slot, i;
+    ssize_t ret;
+
+    if (!has_fixed_tables()) {
+        return;
+    }
+
+    g_assert(g_unix_open_pipe(fds, FD_CLOEXEC, NULL));
+    g_assert(g_unix_set_fd_nonblocking(fds[0], true, NULL));
+    req.fd = fds[1];
+    slot = aio_register_fixed_file(fds[1]);
+    submit(&req);
+    g_assert_cmpint(req.file_index, >=, 0);
+    g_assert_cmpint(req.ret, ==, 1);
+    g_assert_cmpint(read(fds[0], &c, 1), ==, 1);
+
+    /*
+     * Without running the AioContext, the ring must let go of the write
+     * end so that the read end sees EOF.  Older kernels put the file from
+     * a workqueue, hence the retries.
+     */
+    aio_unregister_fixed_file(slot);
+    close(fds[1]);
+    for (i = 0; i < 500; i++) {
+        ret = read(fds[0], &c, 1);
+        if (ret != -1 || errno != EAGAIN) {
+            break;
+        }
+        g_usleep(10 * 1000);
+    }
+    g_assert_cmpint(ret, ==, 0);
+    close(fds[0]);
+}
+
+static void test_buf_reuse(void)
+{
+    size_t len = qemu_real_host_page_size();
+    TestReq req;
+    void *p, *q;
+    int fd_a, fd_b;
+
+    if (!has_fixed_tables()) {
+        return;
+    }
+
+    fd_a = open_file(0xaa, len);
+    fd_b = open_file(0xbb, len);
+
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    g_assert(p != MAP_FAILED);
+    aio_register_fixed_buf(p, len);
+    req = do_read(fd_a, p, len);
+    g_assert_cmpint(req.buf_index, >=, 0);
+    g_assert_cmpint(req.ret, ==, len);
+    g_assert_cmpint(*(char *)p, ==, (char)0xaa);
+    aio_unregister_fixed_buf(p, len);
+
+    /* New memory at the same address must not hit the old pinned pages */
+    munmap(p, len);
+    q = mmap(p, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    g_assert(q == p);
+    aio_register_fixed_buf(q, len);
+    req = do_read(fd_b, q, len);
+    g_assert_cmpint(req.buf_index, >=, 0);
+    g_assert_cmpint(req.ret, ==, len);
+    g_assert_cmpint(*(char *)q, ==, (char)0xbb);
+    aio_unregister_fixed_buf(q, len);
+
+    munmap(q, len);
+    close(fd_a);
+    close(fd_b);
+}
+
+static void test_buf_lookup(void)
+{
+    size_t page = qemu_real_host_page_size();
+    TestReq req;
+    char *p;
+    int fd, first;
+
+    if (!has_fixed_tables()) {
+        return;
+    }
+
+    fd = open_file(0, page);
+    p = qemu_memalign(page, 3 * page);
+
+    /* two buffers with a gap, registered in descending address order */
+    aio_register_fixed_buf(p + 2 * page, page);
+    aio_register_fixed_buf(p, page);
+
+    req = do_read(fd, p, page);
+    g_assert_cmpint(req.buf_index, >=, 0);
+    first = req.buf_index;
+    req = do_read(fd, p + 2 * page + 512, 512);
+    g_assert_cmpint(req.buf_index, >=, 0);
+    g_assert_cmpint(req.buf_index, !=, first);
+    req = do_read(fd, p + page, 512);
+    g_assert_cmpint(req.buf_index, ==, -1);
+    req = do_read(fd, p + page - 512, 1024);
+    g_assert_cmpint(req.buf_index, ==, -1);
+
+    /* registrations nest */
+    aio_register_fixed_buf(p, page);
+    aio_unregister_fixed_buf(p, page);
+    req = do_read(fd, p, page);
+    g_assert_cmpint(req.buf_index, ==, first);
+    aio_unregister_fixed_buf(p, page);
+    req = do_read(fd, p, page);
+    g_assert_cmpint(req.buf_index, ==, -1);
+
+    aio_unregister_fixed_buf(p + 2 * page, page);
+    req = do_read(fd, p + 2 * page, page);
+    g_assert_cmpint(req.buf_index, ==, -1);
+
+    qemu_vfree(p);
+    close(fd);
+}
+
+int main(int argc, char **argv)
+{
+    qemu_init_main_loop(&error_fatal);
+    ctx = qemu_get_aio_context();
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/fdmon-io_uring/fixed-file/reuse", test_file_reuse);
+    g_test_add_func("/fdmon-io_uring/fixed-file/drop", test_file_drop);
+    g_test_add_func("/fdmon-io_uring/fixed-buf/reuse", test_buf_reuse);
+    g_test_add_func("/fdmon-io_uring/fixed-buf/lookup", test_buf_lookup);
+    return g_test_run();
+}
@@ -399,6 +399,28 @@ static void test_hbitmap_reset_all(TestHBitmapData *data,
     hbitmap_test_reset_all(data);
 }
 
+/* Each word of the 2nd-last level covers L2 bits of the last level,
+ * which are allocated on demand; exercise freeing and reallocating them.
+ */
+static void test_hbitmap_reset_sparse(TestHBitmapData *data,
+                                      const void *unused)
+{
+    hbitmap_test_init(data, L3 * 2, 0);
+    hbitmap_test_set(data, L2 - 1, 2);
+    hbitmap_test_set(data, L3, 1);
+    hbitmap_test_reset(data, L2, L2);
+    hbitmap_test_set(data, L2 + L1, 1);
+    hbitmap_test_reset(data, 0, L2);
+    hbitmap_test_reset(data, L2 + L1, 1);
+    hbitmap_test_set(data, L2 * 3 - 1, L2 + 2);
+    hbitmap_test_reset(data, L2 * 3, L2);
+    hbitmap_test_reset(data, L3, 1);
+    hbitmap_test_set(data, L3 * 2 - 1, 1);
+    hbitmap_test_reset(data, L2, L3 * 2 - L2);
+    g_assert(hbitmap_empty(data->hb));
+    hbitmap_test_set(data, L3 - L1, L1 * 2);
+}
+
 static void test_hbitmap_granularity(TestHBitmapData *data,
                                      const void *unused)
 {
@@ -1062,6 +1084,7 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/reset/empty", test_hbitmap_reset_empty);
     hbitmap_test_add("/hbitmap/reset/general", test_hbitmap_reset);
     hbitmap_test_add("/hbitmap/reset/all", test_hbitmap_reset_all);
+    hbitmap_test_add("/hbitmap/reset/sparse", test_hbitmap_reset_sparse);
     hbitmap_test_add("/hbitmap/granularity", test_hbitmap_granularity);
 
     hbitmap_test_add("/hbitmap/truncate/nop", test_hbitmap_truncate_nop);
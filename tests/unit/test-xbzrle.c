@@ -173,6 +173,72 @@ static void test_encode_decode(void)
     }
 }
 
+/*
+ * Every encoder must produce the same output as the plain C one, including
+ * when the destination is too small.
+ */
+static void test_encode_accel(void)
+{
+    enum { N = 200 };
+    uint8_t *old = g_malloc(XBZRLE_PAGE_SIZE * N);
+    uint8_t *new = g_malloc(XBZRLE_PAGE_SIZE * N);
+    uint8_t *expected = g_malloc(XBZRLE_PAGE_SIZE * N);
+    uint8_t *compressed = g_malloc(XBZRLE_PAGE_SIZE);
+    uint8_t *decoded = g_malloc(XBZRLE_PAGE_SIZE);
+    int expected_len[N], dlen[N];
+    bool first = true;
+    int i, j;
+
+    for (i = 0; i < N; i++) {
+        uint8_t *o = old + i * XBZRLE_PAGE_SIZE;
+        uint8_t *n = new + i * XBZRLE_PAGE_SIZE;
+        int density = g_test_rand_int_range(0, 101);
+
+        for (j = 0; j < XBZRLE_PAGE_SIZE; j++) {
+            o[j] = n[j] = g_test_rand_int();
+            if (g_test_rand_int_range(0, 100) < density) {
+                n[j] ^= g_test_rand_int_range(1, 256);
+            }
+        }
+        dlen[i] = g_test_rand_int_range(1, 3) == 1 ? XBZRLE_PAGE_SIZE :
+                  g_test_rand_int_range(2, XBZRLE_PAGE_SIZE);
+    }
+
+    do {
+        for (i = 0; i < N; i++) {
+            uint8_t *o = old + i * XBZRLE_PAGE_SIZE;
+            uint8_t *n = new + i * XBZRLE_PAGE_SIZE;
+            uint8_t *e = expected + i * XBZRLE_PAGE_SIZE;
+            int len = xbzrle_encode_buffer(o, n, XBZRLE_PAGE_SIZE,
+                                           compressed, dlen[i]);
+
+            if (first) {
+                expected_len[i] = len;
+                if (len > 0) {
+                    memcpy(e, compressed, len);
+                }
+            } else {
+                g_assert_cmpint(len, ==, expected_len[i]);
+                g_assert(len <= 0 || memcmp(e, compressed, len) == 0);
+            }
+
+            if (len >= 0) {
+                memcpy(decoded, o, XBZRLE_PAGE_SIZE);
+                g_assert_cmpint(xbzrle_decode_buffer(compressed, len, decoded,
+                                                     XBZRLE_PAGE_SIZE), >=, 0);
+                g_assert(memcmp(decoded, n, XBZRLE_PAGE_SIZE) == 0);
+            }
+        }
+        first = false;
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(old);
+    g_free(new);
+    g_free(expected);
+    g_free(compressed);
+    g_free(decoded);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -185,6 +251,8 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    /* must be last, it leaves the plain C encoder selected */
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
 
     return g_test_run();
 }
@@ -387,6 +387,14 @@ aio_ctx_finalize(GSource *source)
     }
 #endif
 
+#ifdef CONFIG_NVME_URING
+    if (ctx->nvme_uring) {
+        nvme_uring_detach_aio_context(ctx->nvme_uring, ctx);
+        nvme_uring_cleanup(ctx->nvme_uring);
+        ctx->nvme_uring = NULL;
+    }
+#endif
+
     assert(QSLIST_EMPTY(&ctx->scheduled_coroutines));
     qemu_bh_delete(ctx->co_schedule_bh);
 
@@ -462,6 +470,25 @@ LinuxAioState *aio_get_linux_aio(AioContext *ctx)
 }
 #endif
 
+#ifdef CONFIG_NVME_URING
+NvmeUringState *aio_setup_nvme_uring(AioContext *ctx, Error **errp)
+{
+    if (!ctx->nvme_uring) {
+        ctx->nvme_uring = nvme_uring_init(errp);
+        if (ctx->nvme_uring) {
+            nvme_uring_attach_aio_context(ctx->nvme_uring, ctx);
+        }
+    }
+    return ctx->nvme_uring;
+}
+
+NvmeUringState *aio_get_nvme_uring(AioContext *ctx)
+{
+    assert(ctx->nvme_uring);
+    return ctx->nvme_uring;
+}
+#endif
+
 void aio_notify(AioContext *ctx)
 {
     /*
@@ -600,6 +627,9 @@ AioContext *aio_context_new(Error **errp)
 #ifdef CONFIG_LINUX_AIO
     ctx->linux_aio = NULL;
 #endif
+#ifdef CONFIG_NVME_URING
+    ctx->nvme_uring = NULL;
+#endif
 
     ctx->thread_pool = NULL;
     qemu_rec_mutex_init(&ctx->lock);
@@ -41,12 +41,22 @@
  * fdmon_io_uring_wait().  Changes to AioHandlers are made by enqueuing them on
  * ctx->submit_list so that fdmon_io_uring_wait() can submit IORING_OP_POLL_ADD
  * and/or IORING_OP_POLL_REMOVE sqes for them.
+ *
+ * The ring is also used for disk I/O through aio_add_sqe().  Fixed buffers
+ * and fixed files for such requests are kept in process-wide tables, so
+ * that the same index means the same buffer or file in every ring.  Each
+ * AioContext fills its own ring's slots lazily, before it prepares an sqe,
+ * so that queued sqes are submitted before the slots they use change.
+ * Emptying a slot is done eagerly in every ring by the thread that
+ * unregisters it, because rings keep the memory and files of their slots
+ * alive and the caller is about to free them.
  */
 
 #include "qemu/osdep.h"
 #include <poll.h>
 #include "qapi/error.h"
 #include "qemu/defer-call.h"
+#include "qemu/lockable.h"
 #include "qemu/rcu_queue.h"
 #include "aio-posix.h"
 #include "trace.h"
@@ -54,6 +64,10 @@
 enum {
     FDMON_IO_URING_ENTRIES  = 128, /* sq/cq ring size */
 
+    /* fixed buffer and file table sizes */
+    FDMON_IO_URING_FIXED_BUFS  = 1024,
+    FDMON_IO_URING_FIXED_FILES = 256,
+
     /* AioHandler::flags */
     FDMON_IO_URING_PENDING            = (1 << 0),
     FDMON_IO_URING_ADD                = (1 << 1),
@@ -77,6 +91,397 @@ static inline int pfd_events_from_poll(int poll_events)
            (poll_events & POLLERR ? G_IO_ERR : 0);
 }
 
+/* largest fixed buffer accepted by the kernel */
+#define FDMON_IO_URING_FIXED_BUF_MAX (1 * GiB)
+
+/*
+ * A slot of the process-wide fixed buffer and file tables, and of each
+ * ring's copy of them.  @gen identifies what was put in the slot: it is
+ * taken from fixed.next_gen every time the slot is filled and is 0 while
+ * the slot is empty.  Rings compare generations rather than addresses or
+ * file descriptors, because after a slot is emptied the same address can
+ * be mapped to other memory and the same fd number can be another file.
+ */
+struct FdmonFixedBuf {
+    void *host;
+    size_t size;
+    uint64_t gen;
+};
+
+struct FdmonFixedFile {
+    int fd;
+    uint64_t gen;
+};
+
+/*
+ * Process-wide fixed buffer and file tables, and the AioContexts whose
+ * rings mirror them.  @generation is bumped on every change so that
+ * AioContexts notice they need to resync.
+ */
+static struct {
+    QemuMutex lock;
+    uint64_t generation;
+    uint64_t next_gen;
+    struct FdmonFixedBuf bufs[FDMON_IO_URING_FIXED_BUFS];
+    unsigned buf_refcnt[FDMON_IO_URING_FIXED_BUFS];
+    struct FdmonFixedFile files[FDMON_IO_URING_FIXED_FILES];
+    QLIST_HEAD(, AioContext) rings;
+} fixed;
+
+static void __attribute__((__constructor__)) fixed_init(void)
+{
+    int i;
+
+    qemu_mutex_init(&fixed.lock);
+    /* AioContexts start at 0 and sync on their first sqe */
+    fixed.generation = 1;
+    fixed.next_gen = 1;
+    for (i = 0; i < FDMON_IO_URING_FIXED_FILES; i++) {
+        fixed.files[i].fd = -1;
+    }
+    QLIST_INIT(&fixed.rings);
+}
+
+static void fixed_changed(void)
+{
+    qatomic_store_release(&fixed.generation, fixed.generation + 1);
+}
+
+/*
+ * Empty slot @i of every ring's fixed buffer table.  Filling slots is
+ * left to each ring's owner, but emptying cannot wait for it: a ring pins
+ * the pages of its fixed buffers and would keep reading and writing them
+ * after the caller unmapped the memory.  The kernel serializes the update
+ * against the owner's submissions.
+ *
+ * Called with fixed.lock held.
+ */
+static void fixed_buf_drop(int i)
+{
+    AioContext *ctx;
+    int ret;
+
+    QLIST_FOREACH(ctx, &fixed.rings, fixed_next) {
+        struct iovec iov = {};
+
+        if (!ctx->fixed_bufs || !ctx->fixed_bufs[i].gen) {
+            continue;
+        }
+        ret = io_uring_register_buffers_update_tag(&ctx->fdmon_io_uring, i,
+                                                   &iov, NULL, 1);
+        if (ret < 0) {
+            trace_fdmon_io_uring_fixed_update_failed(ctx, "buffers", i, ret);
+        }
+        qatomic_set(&ctx->fixed_bufs[i].gen, 0);
+    }
+}
+
+/*
+ * Same as fixed_buf_drop() for fixed files.  A ring holds a reference to
+ * the file in each of its slots, which would keep the file and its OFD
+ * locks alive after the caller closed the file descriptor.
+ *
+ * Called with fixed.lock held.
+ */
+static void fixed_file_drop(int i)
+{
+    AioContext *ctx;
+    int ret;
+
+    QLIST_FOREACH(ctx, &fixed.rings, fixed_next) {
+        int fd = -1;
+
+        if (!ctx->fixed_files || !ctx->fixed_files[i].gen) {
+            continue;
+        }
+        ret = io_uring_register_files_update(&ctx->fdmon_io_uring, i, &fd, 1);
+        if (ret < 0) {
+            trace_fdmon_io_uring_fixed_update_failed(ctx, "files", i, ret);
+        }
+        qatomic_set(&ctx->fixed_files[i].gen, 0);
+    }
+}
+
+static void fixed_buf_ref(void *host, size_t size)
+{
+    int i, free_slot = -1;
+
+    for (i = 0; i < FDMON_IO_URING_FIXED_BUFS; i++) {
+        if (fixed.buf_refcnt[i] && fixed.bufs[i].host == host &&
+            fixed.bufs[i].size == size) {
+            fixed.buf_refcnt[i]++;
+            return;
+        }
+        if (free_slot < 0 && !fixed.buf_refcnt[i]) {
+            free_slot = i;
+        }
+    }
+
+    if (free_slot < 0) {
+        trace_fdmon_io_uring_fixed_buf_full(host, size);
+        return;
+    }
+    fixed.bufs[free_slot] = (struct FdmonFixedBuf) {
+        .host = host,
+        .size = size,
+        .gen = fixed.next_gen++,
+    };
+    fixed.buf_refcnt[free_slot] = 1;
+}
+
+static void fixed_buf_unref(void *host, size_t size)
+{
+    int i;
+
+    for (i = 0; i < FDMON_IO_URING_FIXED_BUFS; i++) {
+        if (fixed.buf_refcnt[i] && fixed.bufs[i].host == host &&
+            fixed.bufs[i].size == size) {
+            if (!--fixed.buf_refcnt[i]) {
+                fixed.bufs[i] = (struct FdmonFixedBuf) {};
+                fixed_buf_drop(i);
+            }
+            return;
+        }
+    }
+}
+
+void aio_register_fixed_buf(void *host, size_t size)
+{
+    size_t done, chunk;
+
+    QEMU_LOCK_GUARD(&fixed.lock);
+    for (done = 0; done < size; done += chunk) {
+        chunk = MIN(size - done, FDMON_IO_URING_FIXED_BUF_MAX);
+        fixed_buf_ref(host + done, chunk);
+    }
+    fixed_changed();
+}
+
+void aio_unregister_fixed_buf(void *host, size_t size)
+{
+    size_t done, chunk;
+
+    QEMU_LOCK_GUARD(&fixed.lock);
+    for (done = 0; done < size; done += chunk) {
+        chunk = MIN(size - done, FDMON_IO_URING_FIXED_BUF_MAX);
+        fixed_buf_unref(host + done, chunk);
+    }
+    fixed_changed();
+}
+
+int aio_register_fixed_file(int fd)
+{
+    int i;
+
+    QEMU_LOCK_GUARD(&fixed.lock);
+    for (i = 0; i < FDMON_IO_URING_FIXED_FILES; i++) {
+        if (!fixed.files[i].gen) {
+            fixed.files[i] = (struct FdmonFixedFile) {
+                .fd = fd,
+                .gen = fixed.next_gen++,
+            };
+            fixed_changed();
+            return i;
+        }
+    }
+
+    trace_fdmon_io_uring_fixed_file_full(fd);
+    return -1;
+}
+
+void aio_unregister_fixed_file(int slot)
+{
+    if (slot < 0) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&fixed.lock);
+    assert(slot < FDMON_IO_URING_FIXED_FILES && fixed.files[slot].gen);
+    fixed.files[slot] = (struct FdmonFixedFile) { .fd = -1 };
+    fixed_file_drop(slot);
+    fixed_changed();
+}
+
+/*
+ * Binary search ctx->fixed_buf_sorted, which lists the slots filled at the
+ * last sync by address, for the last buffer starting at or before @base.
+ * Slots emptied since then have their generation cleared by
+ * fixed_buf_drop() and are skipped.
+ */
+int aio_fixed_buf_index(const void *base, size_t len)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    struct FdmonFixedBuf *buf;
+    int lo = 0, hi = ctx->nr_fixed_buf_sorted;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (ctx->fixed_bufs[ctx->fixed_buf_sorted[mid]].host <= base) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return -1;
+    }
+
+    buf = &ctx->fixed_bufs[ctx->fixed_buf_sorted[lo - 1]];
+    if (base + len <= buf->host + buf->size && qatomic_read(&buf->gen)) {
+        return ctx->fixed_buf_sorted[lo - 1];
+    }
+    return -1;
+}
+
+int aio_fixed_file_index(int fd)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    int i;
+
+    for (i = 0; i < ctx->nr_fixed_files; i++) {
+        if (ctx->fixed_files[i].fd == fd &&
+            qatomic_read(&ctx->fixed_files[i].gen)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+#ifdef HAVE_IO_URING_REGISTER_BUFFERS_SPARSE
+/* Create empty fixed buffer and file tables in the ring, if supported */
+static void fdmon_io_uring_setup_fixed(AioContext *ctx)
+{
+    struct io_uring *ring = &ctx->fdmon_io_uring;
+    int i, ret;
+
+    ret = io_uring_register_buffers_sparse(ring, FDMON_IO_URING_FIXED_BUFS);
+    if (ret == 0) {
+        ctx->fixed_bufs = g_new0(struct FdmonFixedBuf,
+                                 FDMON_IO_URING_FIXED_BUFS);
+        ctx->fixed_buf_sorted = g_new(int, FDMON_IO_URING_FIXED_BUFS);
+    } else {
+        trace_fdmon_io_uring_fixed_update_failed(ctx, "buffers", -1, ret);
+    }
+
+    ret = io_uring_register_files_sparse(ring, FDMON_IO_URING_FIXED_FILES);
+    if (ret == 0) {
+        ctx->fixed_files = g_new0(struct FdmonFixedFile,
+                                  FDMON_IO_URING_FIXED_FILES);
+        for (i = 0; i < FDMON_IO_URING_FIXED_FILES; i++) {
+            ctx->fixed_files[i].fd = -1;
+        }
+    } else {
+        trace_fdmon_io_uring_fixed_update_failed(ctx, "files", -1, ret);
+    }
+
+    if (ctx->fixed_bufs || ctx->fixed_files) {
+        QEMU_LOCK_GUARD(&fixed.lock);
+        QLIST_INSERT_HEAD(&fixed.rings, ctx, fixed_next);
+    }
+}
+#endif
+
+/* Rebuild ctx->fixed_buf_sorted from the filled slots of ctx->fixed_bufs */
+static void fdmon_io_uring_sort_fixed_bufs(AioContext *ctx)
+{
+    int i, j, n = 0;
+
+    for (i = 0; i < FDMON_IO_URING_FIXED_BUFS; i++) {
+        void *host = ctx->fixed_bufs[i].host;
+
+        if (!ctx->fixed_bufs[i].gen) {
+            continue;
+        }
+
+        /* insertion sort, the table is small and changes rarely */
+        for (j = n; j > 0 &&
+             ctx->fixed_bufs[ctx->fixed_buf_sorted[j - 1]].host > host; j--) {
+            ctx->fixed_buf_sorted[j] = ctx->fixed_buf_sorted[j - 1];
+        }
+        ctx->fixed_buf_sorted[j] = i;
+        n++;
+    }
+    ctx->nr_fixed_buf_sorted = n;
+}
+
+/*
+ * Bring the ring's fixed buffer and file tables up to date with the
+ * process-wide ones.  Slots the kernel refuses to update are left empty
+ * in ctx->fixed_bufs/ctx->fixed_files so they are never used.
+ */
+static void fdmon_io_uring_sync_fixed(AioContext *ctx)
+{
+    struct io_uring *ring = &ctx->fdmon_io_uring;
+    uint64_t generation = qatomic_load_acquire(&fixed.generation);
+    int i, ret;
+
+    if (likely(generation == ctx->fixed_generation)) {
+        return;
+    }
+    ctx->fixed_generation = generation;
+
+    /*
+     * Queued sqes may refer to slots that are about to change, let the
+     * kernel resolve them first.
+     */
+    if (io_uring_sq_ready(ring)) {
+        while (io_uring_submit(ring) == -EINTR) {
+            /* Keep trying if syscall was interrupted */
+        }
+    }
+
+    QEMU_LOCK_GUARD(&fixed.lock);
+
+    for (i = 0; ctx->fixed_bufs && i < FDMON_IO_URING_FIXED_BUFS; i++) {
+        struct FdmonFixedBuf *buf = &fixed.bufs[i];
+        struct iovec iov = {
+            .iov_base = buf->host,
+            .iov_len = buf->size,
+        };
+
+        if (buf->gen == ctx->fixed_bufs[i].gen) {
+            continue;
+        }
+
+        ret = io_uring_register_buffers_update_tag(ring, i, &iov, NULL, 1);
+        if (ret < 0) {
+            /* most likely RLIMIT_MEMLOCK, try to at least empty the slot */
+            trace_fdmon_io_uring_fixed_update_failed(ctx, "buffers", i, ret);
+            iov = (struct iovec) {};
+            io_uring_register_buffers_update_tag(ring, i, &iov, NULL, 1);
+            ctx->fixed_bufs[i] = (struct FdmonFixedBuf) {};
+            continue;
+        }
+        ctx->fixed_bufs[i] = *buf;
+    }
+    if (ctx->fixed_bufs) {
+        fdmon_io_uring_sort_fixed_bufs(ctx);
+    }
+
+    for (i = 0; ctx->fixed_files && i < FDMON_IO_URING_FIXED_FILES; i++) {
+        struct FdmonFixedFile *file = &fixed.files[i];
+        int fd = file->fd;
+
+        if (file->gen == ctx->fixed_files[i].gen) {
+            continue;
+        }
+
+        ret = io_uring_register_files_update(ring, i, &fd, 1);
+        if (ret < 0) {
+            trace_fdmon_io_uring_fixed_update_failed(ctx, "files", i, ret);
+            fd = -1;
+            io_uring_register_files_update(ring, i, &fd, 1);
+            ctx->fixed_files[i] = (struct FdmonFixedFile) { .fd = -1 };
+            continue;
+        }
+        ctx->fixed_files[i] = *file;
+        if (file->gen) {
+            ctx->nr_fixed_files = MAX(ctx->nr_fixed_files, i + 1);
+        }
+    }
+}
+
 /*
  * Returns an sqe for submitting a request. Only called from the AioContext
  * thread.
@@ -174,8 +579,12 @@ static void fdmon_io_uring_add_sqe(AioContext *ctx,
         void (*prep_sqe)(struct io_uring_sqe *sqe, void *opaque),
         void *opaque, CqeHandler *cqe_handler)
 {
-    struct io_uring_sqe *sqe = get_sqe(ctx);
+    struct io_uring_sqe *sqe;
+
+    /* prep_sqe() may look up fixed buffers and files */
+    fdmon_io_uring_sync_fixed(ctx);
 
+    sqe = get_sqe(ctx);
     prep_sqe(sqe, opaque);
     io_uring_sqe_set_data(sqe, cqe_handler);
 
@@ -466,6 +875,9 @@ bool fdmon_io_uring_setup(AioContext *ctx, Error **errp)
 
     QSLIST_INIT(&ctx->submit_list);
     QSIMPLEQ_INIT(&ctx->cqe_handler_ready_list);
+#ifdef HAVE_IO_URING_REGISTER_BUFFERS_SPARSE
+    fdmon_io_uring_setup_fixed(ctx);
+#endif
     ctx->fdmon_ops = &fdmon_io_uring_ops;
     ctx->io_uring_fd_tag = g_source_add_unix_fd(&ctx->source,
             ctx->fdmon_io_uring.ring_fd, G_IO_IN);
@@ -480,7 +892,19 @@ void fdmon_io_uring_destroy(AioContext *ctx)
         return;
     }
 
+    if (QLIST_IS_INSERTED(ctx, fixed_next)) {
+        QEMU_LOCK_GUARD(&fixed.lock);
+        QLIST_SAFE_REMOVE(ctx, fixed_next);
+    }
     io_uring_queue_exit(&ctx->fdmon_io_uring);
+    g_free(ctx->fixed_bufs);
+    ctx->fixed_bufs = NULL;
+    g_free(ctx->fixed_buf_sorted);
+    ctx->fixed_buf_sorted = NULL;
+    ctx->nr_fixed_buf_sorted = 0;
+    g_free(ctx->fixed_files);
+    ctx->fixed_files = NULL;
+    ctx->nr_fixed_files = 0;
 
     /* Move handlers due to be removed onto the deleted list */
     while ((node = QSLIST_FIRST_RCU(&ctx->submit_list))) {
@@ -50,8 +50,18 @@
  * extremely sparse, this is also O(m + m/W + m/W^2 + ...), so the amortized
  * cost of advancing from one bit to the next is usually constant (worst case
  * O(logB n) as in the non-amortized complexity).
+ *
+ * The last level is W times larger than all the others together, and for
+ * dirty bitmaps it is mostly zero.  It is therefore split in chunks of W
+ * words, i.e. exactly the words covered by one word of the 2nd-last level.
+ * A chunk is only allocated when a bit is set in it and is freed again as
+ * soon as the 2nd-last level says that it became zero, so the memory used
+ * by the last level is proportional to the dirty part of the bitmap.
  */
 
+#define HBITMAP_LAST_LEVEL      (HBITMAP_LEVELS - 1)
+#define HBITMAP_CHUNK_WORDS     BITS_PER_LONG
+
 struct HBitmap {
     /*
      * Size of the bitmap, as requested in hbitmap_alloc or in hbitmap_truncate.
@@ -93,14 +103,79 @@ struct HBitmap {
      * actual bitmap.
      *
      * Note that all bitmaps have the same number of levels.  Even a 1-bit
-     * bitmap will still allocate HBITMAP_LEVELS arrays.
+     * bitmap will still allocate HBITMAP_LEVELS arrays.  The last level is
+     * not stored here but in @chunks.
      */
     unsigned long *levels[HBITMAP_LEVELS];
 
-    /* The length of each levels[] array. */
+    /* The length of each levels[] array, in words. */
     uint64_t sizes[HBITMAP_LEVELS];
+
+    /* The last level, sizes[HBITMAP_LAST_LEVEL - 1] chunks of
+     * HBITMAP_CHUNK_WORDS words each.  NULL chunks are all zero.
+     */
+    unsigned long **chunks;
 };
 
+/* Return word @pos of @level. */
+static inline unsigned long hb_word(const HBitmap *hb, int level, uint64_t pos)
+{
+    const unsigned long *chunk;
+
+    if (level != HBITMAP_LAST_LEVEL) {
+        return hb->levels[level][pos];
+    }
+    chunk = hb->chunks[pos >> BITS_PER_LEVEL];
+    return chunk ? chunk[pos & (HBITMAP_CHUNK_WORDS - 1)] : 0;
+}
+
+/* Return a pointer to word @pos of @level.  If the word is in a chunk
+ * that is not allocated, the chunk is allocated if @alloc is true,
+ * otherwise NULL is returned.
+ */
+static unsigned long *hb_word_ptr(HBitmap *hb, int level, uint64_t pos,
+                                  bool alloc)
+{
+    unsigned long **chunk;
+
+    if (level != HBITMAP_LAST_LEVEL) {
+        return &hb->levels[level][pos];
+    }
+    chunk = &hb->chunks[pos >> BITS_PER_LEVEL];
+    if (!*chunk) {
+        if (!alloc) {
+            return NULL;
+        }
+        *chunk = g_new0(unsigned long, HBITMAP_CHUNK_WORDS);
+    }
+    return &(*chunk)[pos & (HBITMAP_CHUNK_WORDS - 1)];
+}
+
+static void hb_free_chunks(HBitmap *hb, uint64_t first, uint64_t last)
+{
+    uint64_t i;
+
+    for (i = first; i <= last; i++) {
+        g_free(hb->chunks[i]);
+        hb->chunks[i] = NULL;
+    }
+}
+
+/* Free the chunks holding words @pos to @lastpos of the last level that
+ * became zero.  Relies on the 2nd-last level being up to date.
+ */
+static void hb_trim_chunks(HBitmap *hb, uint64_t pos, uint64_t lastpos)
+{
+    const unsigned long *upper = hb->levels[HBITMAP_LAST_LEVEL - 1];
+    uint64_t i;
+
+    for (i = pos >> BITS_PER_LEVEL; i <= lastpos >> BITS_PER_LEVEL; i++) {
+        if (hb->chunks[i] && !upper[i]) {
+            hb_free_chunks(hb, i, i);
+        }
+    }
+}
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -136,7 +211,7 @@ static unsigned long hbitmap_iter_skip_words(HBitmapIter *hbi)
         hbi->cur[i] = cur & (cur - 1);
 
         /* Set up next level for iteration.  */
-        cur = hb->levels[i + 1][pos];
+        cur = hb_word(hb, i + 1, pos);
     }
 
     hbi->pos = pos;
@@ -149,7 +224,7 @@ static unsigned long hbitmap_iter_skip_words(HBitmapIter *hbi)
 int64_t hbitmap_iter_next(HBitmapIter *hbi)
 {
     unsigned long cur = hbi->cur[HBITMAP_LEVELS - 1] &
-            hbi->hb->levels[HBITMAP_LEVELS - 1][hbi->pos];
+            hb_word(hbi->hb, HBITMAP_LAST_LEVEL, hbi->pos);
     int64_t item;
 
     if (cur == 0) {
@@ -182,7 +257,7 @@ void hbitmap_iter_init(HBitmapIter *hbi, const HBitmap *hb, uint64_t first)
         pos >>= BITS_PER_LEVEL;
 
         /* Drop bits representing items before first.  */
-        hbi->cur[i] = hb->levels[i][pos] & ~((1UL << bit) - 1);
+        hbi->cur[i] = hb_word(hb, i, pos) & ~((1UL << bit) - 1);
 
         /* We have already added level i+1, so the lowest set bit has
          * been processed.  Clear it.
@@ -220,8 +295,7 @@ int64_t hbitmap_next_dirty(const HBitmap *hb, int64_t start, int64_t count)
 int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
 {
     size_t pos = (start >> hb->granularity) >> BITS_PER_LEVEL;
-    unsigned long *last_lev = hb->levels[HBITMAP_LEVELS - 1];
-    unsigned long cur = last_lev[pos];
+    unsigned long cur = hb_word(hb, HBITMAP_LAST_LEVEL, pos);
     unsigned start_bit_offset;
     uint64_t end_bit, sz;
     int64_t res;
@@ -247,13 +321,14 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
     if (cur == (unsigned long)-1) {
         do {
             pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
+        } while (pos < sz &&
+                 hb_word(hb, HBITMAP_LAST_LEVEL, pos) == (unsigned long)-1);
 
         if (pos >= sz) {
             return -1;
         }
 
-        cur = last_lev[pos];
+        cur = hb_word(hb, HBITMAP_LAST_LEVEL, pos);
     }
 
     res = (pos << BITS_PER_LEVEL) + ctol(cur);
@@ -434,23 +509,26 @@ static bool hb_set_between(HBitmap *hb, int level, uint64_t start,
     size_t pos = start >> BITS_PER_LEVEL;
     size_t lastpos = last >> BITS_PER_LEVEL;
     bool changed = false;
+    unsigned long *elem;
     size_t i;
 
     i = pos;
     if (i < lastpos) {
         uint64_t next = (start | (BITS_PER_LONG - 1)) + 1;
-        changed |= hb_set_elem(&hb->levels[level][i], start, next - 1);
+        changed |= hb_set_elem(hb_word_ptr(hb, level, i, true),
+                               start, next - 1);
         for (;;) {
             start = next;
             next += BITS_PER_LONG;
             if (++i == lastpos) {
                 break;
             }
-            changed |= (hb->levels[level][i] == 0);
-            hb->levels[level][i] = ~0UL;
+            elem = hb_word_ptr(hb, level, i, true);
+            changed |= (*elem == 0);
+            *elem = ~0UL;
         }
     }
-    changed |= hb_set_elem(&hb->levels[level][i], start, last);
+    changed |= hb_set_elem(hb_word_ptr(hb, level, i, true), start, last);
 
     /* If there was any change in this layer, we may have to update
      * the one above.
@@ -487,7 +565,8 @@ void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count)
 }
 
 /* Resetting works the other way round: propagate up if the new
- * value is zero.
+ * value is zero.  A NULL @elem is a word of an unallocated chunk, which
+ * is zero already.
  */
 static inline bool hb_reset_elem(unsigned long *elem, uint64_t start, uint64_t last)
 {
@@ -497,6 +576,10 @@ static inline bool hb_reset_elem(unsigned long *elem, uint64_t start, uint64_t l
     assert((last >> BITS_PER_LEVEL) == (start >> BITS_PER_LEVEL));
     assert(start <= last);
 
+    if (!elem) {
+        return false;
+    }
+
     mask = 2UL << (last & (BITS_PER_LONG - 1));
     mask -= 1UL << (start & (BITS_PER_LONG - 1));
     blanked = *elem != 0 && ((*elem & ~mask) == 0);
@@ -512,6 +595,7 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
     size_t pos = start >> BITS_PER_LEVEL;
     size_t lastpos = last >> BITS_PER_LEVEL;
     bool changed = false;
+    unsigned long *elem;
     size_t i;
 
     i = pos;
@@ -523,7 +607,8 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
          * unless the lower-level word became entirely zero.  So, remove pos
          * from the upper-level range if bits remain set.
          */
-        if (hb_reset_elem(&hb->levels[level][i], start, next - 1)) {
+        if (hb_reset_elem(hb_word_ptr(hb, level, i, false),
+                          start, next - 1)) {
             changed = true;
         } else {
             pos++;
@@ -535,13 +620,16 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
             if (++i == lastpos) {
                 break;
             }
-            changed |= (hb->levels[level][i] != 0);
-            hb->levels[level][i] = 0UL;
+            elem = hb_word_ptr(hb, level, i, false);
+            if (elem) {
+                changed |= (*elem != 0);
+                *elem = 0UL;
+            }
         }
     }
 
     /* Same as above, this time for lastpos.  */
-    if (hb_reset_elem(&hb->levels[level][i], start, last)) {
+    if (hb_reset_elem(hb_word_ptr(hb, level, i, false), start, last)) {
         changed = true;
     } else {
         lastpos--;
@@ -577,9 +665,11 @@ void hbitmap_reset(HBitmap *hb, uint64_t start, uint64_t count)
     assert(last < hb->size);
 
     hb->count -= hb_count_between(hb, first, last);
-    if (hb_reset_between(hb, HBITMAP_LEVELS - 1, first, last) &&
-        hb->meta) {
-        hbitmap_set(hb->meta, start, count);
+    if (hb_reset_between(hb, HBITMAP_LEVELS - 1, first, last)) {
+        hb_trim_chunks(hb, first >> BITS_PER_LEVEL, last >> BITS_PER_LEVEL);
+        if (hb->meta) {
+            hbitmap_set(hb->meta, start, count);
+        }
     }
 }
 
@@ -588,7 +678,8 @@ void hbitmap_reset_all(HBitmap *hb)
     unsigned int i;
 
     /* Same as hbitmap_alloc() except for memset() instead of malloc() */
-    for (i = HBITMAP_LEVELS; --i >= 1; ) {
+    hb_free_chunks(hb, 0, hb->sizes[HBITMAP_LAST_LEVEL - 1] - 1);
+    for (i = HBITMAP_LAST_LEVEL; --i >= 1; ) {
         memset(hb->levels[i], 0, hb->sizes[i] * sizeof(unsigned long));
     }
 
@@ -621,7 +712,7 @@ bool hbitmap_get(const HBitmap *hb, uint64_t item)
     unsigned long bit = 1UL << (pos & (BITS_PER_LONG - 1));
     assert(pos < hb->size);
 
-    return (hb->levels[HBITMAP_LEVELS - 1][pos >> BITS_PER_LEVEL] & bit) != 0;
+    return (hb_word(hb, HBITMAP_LAST_LEVEL, pos >> BITS_PER_LEVEL) & bit) != 0;
 }
 
 uint64_t hbitmap_serialization_align(const HBitmap *hb)
@@ -638,7 +729,7 @@ uint64_t hbitmap_serialization_align(const HBitmap *hb)
  */
 static void serialization_chunk(const HBitmap *hb,
                                 uint64_t start, uint64_t count,
-                                unsigned long **first_el, uint64_t *el_count)
+                                uint64_t *first_el, uint64_t *el_count)
 {
     uint64_t last = start + count - 1;
     uint64_t gran = hbitmap_serialization_align(hb);
@@ -652,20 +743,44 @@ static void serialization_chunk(const HBitmap *hb,
     start = (start >> hb->granularity) >> BITS_PER_LEVEL;
     last = (last >> hb->granularity) >> BITS_PER_LEVEL;
 
-    *first_el = &hb->levels[HBITMAP_LEVELS - 1][start];
+    *first_el = start;
     *el_count = last - start + 1;
 }
 
+/* Set @count words of the last level, starting at @pos, to @val.  Only
+ * meant for deserialization, the upper levels are not updated.
+ */
+static void hb_fill_words(HBitmap *hb, uint64_t pos, uint64_t count,
+                          unsigned long val)
+{
+    while (count) {
+        uint64_t off = pos & (HBITMAP_CHUNK_WORDS - 1);
+        uint64_t n = MIN(count, HBITMAP_CHUNK_WORDS - off);
+        unsigned long *cur;
+        uint64_t i;
+
+        if (!val && n == HBITMAP_CHUNK_WORDS) {
+            hb_free_chunks(hb, pos >> BITS_PER_LEVEL, pos >> BITS_PER_LEVEL);
+        } else {
+            cur = hb_word_ptr(hb, HBITMAP_LAST_LEVEL, pos, val != 0);
+            for (i = 0; cur && i < n; i++) {
+                cur[i] = val;
+            }
+        }
+        pos += n;
+        count -= n;
+    }
+}
+
 uint64_t hbitmap_serialization_size(const HBitmap *hb,
                                     uint64_t start, uint64_t count)
 {
-    uint64_t el_count;
-    unsigned long *cur;
+    uint64_t first, el_count;
 
     if (!count) {
         return 0;
     }
-    serialization_chunk(hb, start, count, &cur, &el_count);
+    serialization_chunk(hb, start, count, &first, &el_count);
 
     return el_count * sizeof(unsigned long);
 }
@@ -673,22 +788,19 @@ uint64_t hbitmap_serialization_size(const HBitmap *hb,
 void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
                             uint64_t start, uint64_t count)
 {
-    uint64_t el_count;
-    unsigned long *cur, *end;
+    uint64_t i, first, el_count;
 
     if (!count) {
         return;
     }
-    serialization_chunk(hb, start, count, &cur, &el_count);
-    end = cur + el_count;
+    serialization_chunk(hb, start, count, &first, &el_count);
 
-    while (cur != end) {
-        unsigned long el =
-            (BITS_PER_LONG == 32 ? cpu_to_le32(*cur) : cpu_to_le64(*cur));
+    for (i = first; i < first + el_count; i++) {
+        unsigned long el = hb_word(hb, HBITMAP_LAST_LEVEL, i);
 
+        el = (BITS_PER_LONG == 32 ? cpu_to_le32(el) : cpu_to_le64(el));
         memcpy(buf, &el, sizeof(el));
         buf += sizeof(el);
-        cur++;
     }
 }
 
@@ -696,26 +808,24 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
                               uint64_t start, uint64_t count,
                               bool finish)
 {
-    uint64_t el_count;
-    unsigned long *cur, *end;
+    uint64_t i, first, el_count;
+    unsigned long el, *cur;
 
     if (!count) {
         return;
     }
-    serialization_chunk(hb, start, count, &cur, &el_count);
-    end = cur + el_count;
+    serialization_chunk(hb, start, count, &first, &el_count);
 
-    while (cur != end) {
-        memcpy(cur, buf, sizeof(*cur));
+    for (i = first; i < first + el_count; i++) {
+        memcpy(&el, buf, sizeof(el));
+        el = (BITS_PER_LONG == 32 ? le32_to_cpu(el) : le64_to_cpu(el));
 
-        if (BITS_PER_LONG == 32) {
-            le32_to_cpus((uint32_t *)cur);
-        } else {
-            le64_to_cpus((uint64_t *)cur);
+        /* Only allocate chunks for words that have bits set */
+        cur = hb_word_ptr(hb, HBITMAP_LAST_LEVEL, i, el != 0);
+        if (cur) {
+            *cur = el;
         }
-
-        buf += sizeof(unsigned long);
-        cur++;
+        buf += sizeof(el);
     }
     if (finish) {
         hbitmap_deserialize_finish(hb);
@@ -725,15 +835,14 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
 void hbitmap_deserialize_zeroes(HBitmap *hb, uint64_t start, uint64_t count,
                                 bool finish)
 {
-    uint64_t el_count;
-    unsigned long *first;
+    uint64_t first, el_count;
 
     if (!count) {
         return;
     }
     serialization_chunk(hb, start, count, &first, &el_count);
 
-    memset(first, 0, el_count * sizeof(unsigned long));
+    hb_fill_words(hb, first, el_count, 0);
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -742,15 +851,14 @@ void hbitmap_deserialize_zeroes(HBitmap *hb, uint64_t start, uint64_t count,
 void hbitmap_deserialize_ones(HBitmap *hb, uint64_t start, uint64_t count,
                               bool finish)
 {
-    uint64_t el_count;
-    unsigned long *first;
+    uint64_t first, el_count;
 
     if (!count) {
         return;
     }
     serialization_chunk(hb, start, count, &first, &el_count);
 
-    memset(first, 0xff, el_count * sizeof(unsigned long));
+    hb_fill_words(hb, first, el_count, ~0UL);
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -770,13 +878,21 @@ void hbitmap_deserialize_finish(HBitmap *bitmap)
         memset(bitmap->levels[lev], 0, size * sizeof(unsigned long));
 
         for (i = 0; i < prev_size; ++i) {
-            if (bitmap->levels[lev + 1][i]) {
+            if (lev + 1 == HBITMAP_LAST_LEVEL &&
+                !bitmap->chunks[i >> BITS_PER_LEVEL]) {
+                /* Skip the whole chunk */
+                i |= HBITMAP_CHUNK_WORDS - 1;
+                continue;
+            }
+            if (hb_word(bitmap, lev + 1, i)) {
                 bitmap->levels[lev][i >> BITS_PER_LEVEL] |=
                     1UL << (i & (BITS_PER_LONG - 1));
             }
         }
     }
 
+    /* Drop the chunks that were deserialized as all zeroes */
+    hb_trim_chunks(bitmap, 0, bitmap->sizes[HBITMAP_LAST_LEVEL] - 1);
     bitmap->levels[0][0] |= 1UL << (BITS_PER_LONG - 1);
     bitmap->count = hb_count_between(bitmap, 0, bitmap->size - 1);
 }
@@ -785,6 +901,8 @@ void hbitmap_free(HBitmap *hb)
 {
     unsigned i;
     assert(!hb->meta);
+    hb_free_chunks(hb, 0, hb->sizes[HBITMAP_LAST_LEVEL - 1] - 1);
+    g_free(hb->chunks);
     for (i = HBITMAP_LEVELS; i-- > 0; ) {
         g_free(hb->levels[i]);
     }
@@ -808,8 +926,11 @@ HBitmap *hbitmap_alloc(uint64_t size, int granularity)
     for (i = HBITMAP_LEVELS; i-- > 0; ) {
         size = MAX((size + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
         hb->sizes[i] = size;
-        hb->levels[i] = g_new0(unsigned long, size);
+        if (i != HBITMAP_LAST_LEVEL) {
+            hb->levels[i] = g_new0(unsigned long, size);
+        }
     }
+    hb->chunks = g_new0(unsigned long *, hb->sizes[HBITMAP_LAST_LEVEL - 1]);
 
     /* We necessarily have free bits in level 0 due to the definition
      * of HBITMAP_LEVELS, so use one for a sentinel.  This speeds up
@@ -825,7 +946,7 @@ void hbitmap_truncate(HBitmap *hb, uint64_t size)
     bool shrink;
     unsigned i;
     uint64_t num_elements = size;
-    uint64_t old;
+    uint64_t old, old_chunks;
 
     assert(size <= INT64_MAX);
     hb->orig_size = size;
@@ -855,6 +976,7 @@ void hbitmap_truncate(HBitmap *hb, uint64_t size)
     }
 
     hb->size = size;
+    old_chunks = hb->sizes[HBITMAP_LAST_LEVEL - 1];
     for (i = HBITMAP_LEVELS; i-- > 0; ) {
         size = MAX(BITS_TO_LONGS(size), 1);
         if (hb->sizes[i] == size) {
@@ -862,12 +984,28 @@ void hbitmap_truncate(HBitmap *hb, uint64_t size)
         }
         old = hb->sizes[i];
         hb->sizes[i] = size;
+        if (i == HBITMAP_LAST_LEVEL) {
+            /* Chunks are always allocated whole, see below */
+            continue;
+        }
         hb->levels[i] = g_renew(unsigned long, hb->levels[i], size);
         if (!shrink) {
             memset(&hb->levels[i][old], 0x00,
                    (size - old) * sizeof(*hb->levels[i]));
         }
     }
+
+    size = hb->sizes[HBITMAP_LAST_LEVEL - 1];
+    if (size != old_chunks) {
+        if (shrink) {
+            hb_free_chunks(hb, size, old_chunks - 1);
+        }
+        hb->chunks = g_renew(unsigned long *, hb->chunks, size);
+        if (!shrink) {
+            memset(&hb->chunks[old_chunks], 0,
+                   (size - old_chunks) * sizeof(*hb->chunks));
+        }
+    }
     if (hb->meta) {
         hbitmap_truncate(hb->meta, hb->size << hb->granularity);
     }
@@ -929,12 +1067,27 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
         return;
     }
 
-    /* This merge is O(size), as BITS_PER_LONG and HBITMAP_LEVELS are constant.
-     * It may be possible to improve running times for sparsely populated maps
-     * by using hbitmap_iter_next, but this is suboptimal for dense maps.
+    /* This merge is O(size / BITS_PER_LONG) for the upper levels.  In the
+     * last level, only the chunks that are allocated in @a or @b are
+     * visited.
      */
     assert(a->size == b->size);
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
+    for (j = 0; j < a->sizes[HBITMAP_LAST_LEVEL - 1]; j++) {
+        const unsigned long *ca = a->chunks[j], *cb = b->chunks[j];
+        unsigned long *dst;
+        unsigned k;
+
+        if (!ca && !cb) {
+            hb_free_chunks(result, j, j);
+            continue;
+        }
+        dst = hb_word_ptr(result, HBITMAP_LAST_LEVEL,
+                          j * HBITMAP_CHUNK_WORDS, true);
+        for (k = 0; k < HBITMAP_CHUNK_WORDS; k++) {
+            dst[k] = (ca ? ca[k] : 0) | (cb ? cb[k] : 0);
+        }
+    }
+    for (i = HBITMAP_LAST_LEVEL - 1; i >= 0; i--) {
         for (j = 0; j < a->sizes[i]; j++) {
             result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
         }
@@ -946,10 +1099,24 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
 
 char *hbitmap_sha256(const HBitmap *bitmap, Error **errp)
 {
-    size_t size = bitmap->sizes[HBITMAP_LEVELS - 1] * sizeof(unsigned long);
-    char *data = (char *)bitmap->levels[HBITMAP_LEVELS - 1];
+    static const unsigned long zero_chunk[HBITMAP_CHUNK_WORDS];
+    uint64_t nb_chunks = bitmap->sizes[HBITMAP_LAST_LEVEL - 1];
+    uint64_t size = bitmap->sizes[HBITMAP_LAST_LEVEL] * sizeof(unsigned long);
+    g_autofree struct iovec *iov = g_new(struct iovec, nb_chunks);
     char *hash = NULL;
-    qcrypto_hash_digest(QCRYPTO_HASH_ALGO_SHA256, data, size, &hash, errp);
+    uint64_t i;
+
+    /* Hash the last level as if it was stored contiguously */
+    for (i = 0; i < nb_chunks; i++) {
+        const unsigned long *chunk = bitmap->chunks[i];
+
+        iov[i].iov_base = (void *)(chunk ? chunk : zero_chunk);
+        iov[i].iov_len = MIN(size, sizeof(zero_chunk));
+        size -= iov[i].iov_len;
+    }
+    assert(size == 0);
+    qcrypto_hash_digestv(QCRYPTO_HASH_ALGO_SHA256, iov, nb_chunks,
+                         &hash, errp);
 
     return hash;
 }
@@ -240,7 +240,8 @@ int uffd_change_protection(int uffd_fd, void *addr, uint64_t length,
  * Copy range of source pages to the destination to resolve
  * missing page fault somewhere in the destination range.
  *
- * Returns 0 on success, -errno in case of an error
+ * Returns 0 on success, -errno in case of an error; -EEXIST, when part
+ * of the range is already populated, is not reported
  *
  * @uffd_fd: UFFD file descriptor
  * @dst_addr: destination base address
@@ -260,9 +261,12 @@ int uffd_copy_page(int uffd_fd, void *dst_addr, void *src_addr,
 
     if (ioctl(uffd_fd, UFFDIO_COPY, &uffd_copy)) {
         int e = errno;
-        error_report("uffd_copy_page() failed: dst_addr=%p src_addr=%p length=%" PRIu64
-                " mode=%" PRIx64 " errno=%i", dst_addr, src_addr,
-                length, (uint64_t) uffd_copy.mode, e);
+        /* EEXIST only means that someone else resolved the fault first */
+        if (e != EEXIST) {
+            error_report("uffd_copy_page() failed: dst_addr=%p src_addr=%p "
+                    "length=%" PRIu64 " mode=%" PRIx64 " errno=%i", dst_addr,
+                    src_addr, length, (uint64_t) uffd_copy.mode, e);
+        }
         return -e;
     }
 
@@ -274,7 +278,7 @@ int uffd_copy_page(int uffd_fd, void *dst_addr, void *src_addr,
  *
  * Fill range pages with zeroes to resolve missing page fault within the range.
  *
- * Returns 0 on success, -errno in case of an error
+ * Returns 0 on success, -errno in case of an error; -EEXIST is not reported
  *
  * @uffd_fd: UFFD file descriptor
  * @addr: base address
@@ -291,9 +295,11 @@ int uffd_zero_page(int uffd_fd, void *addr, uint64_t length, bool dont_wake)
 
     if (ioctl(uffd_fd, UFFDIO_ZEROPAGE, &uffd_zeropage)) {
         int e = errno;
-        error_report("uffd_zero_page() failed: addr=%p length=%" PRIu64
-                " mode=%" PRIx64 " errno=%i", addr, length,
-                (uint64_t) uffd_zeropage.mode, e);
+        if (e != EEXIST) {
+            error_report("uffd_zero_page() failed: addr=%p length=%" PRIu64
+                    " mode=%" PRIx64 " errno=%i", addr, length,
+                    (uint64_t) uffd_zeropage.mode, e);
+        }
         return -e;
     }
 